@@ -0,0 +1,525 @@
+/*
+ * bench.c
+ *
+ * Micro-benchmarks of the object, pack and checkout hot paths, run
+ * against synthetic repositories in a temporary directory:
+ *
+ *   small  many small source-like files
+ *   huge   a few large, partly compressible blobs
+ *   chain  one file through many small edits (deep delta chains)
+ *
+ * Each stage is timed with the monotonic clock and reported as one
+ * JSON object — objects/sec, MB/sec and the peak RSS so far — in a
+ * single JSON document on stdout, so runs can be stored and compared:
+ *
+ *   ./bench [--scale=<n>] [--threads=<n>] [--keep] > bench.json
+ *
+ * The data is generated from a fixed seed, so every run of one build
+ * does the same work.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/commands/commands.h"
+#include "../src/constants.h"
+#include "../src/objects/loose_store.h"
+#include "../src/objects/object.h"
+#include "../src/pack/delta.h"
+#include "../src/pack/pack_objects.h"
+#include "../src/pack/packfile.h"
+#include "../src/pack/packstore.h"
+#include "../src/utils/compression/compression.h"
+#include "../src/utils/scratch/scratch.h"
+#include "../src/utils/string/string.h"
+
+/* Data set sizes at --scale=1 */
+#define BENCH_SMALL_FILES 4000
+#define BENCH_SMALL_MIN 256
+#define BENCH_SMALL_MAX 8192
+#define BENCH_HUGE_BLOBS 2
+#define BENCH_HUGE_SIZE (16UL * 1024 * 1024)
+#define BENCH_CHAIN_REVISIONS 400
+#define BENCH_CHAIN_SIZE (64 * 1024)
+
+/* One synthetic data set: a list of blob bodies. */
+typedef struct {
+    const char *name;
+    unsigned char **bodies;
+    size_t *sizes;
+    ObjectId *oids;          /* filled by the loose write stage */
+    size_t count;
+    size_t bytes;
+} Dataset;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+/* xorshift64*: fast, and the same sequence on every platform */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static const char *const words[] = {
+    "static", "int", "return", "const", "char", "size_t", "if", "for", "while",
+    "struct", "void", "unsigned", "result", "goto", "cleanup", "free", "malloc",
+    "object", "delta", "pack", "base", "offset", "len", "data", "=", "==", "{",
+    "}", "(", ")", ";", "->", "0", "1", "NULL", "//", "*", "&", "+", "-",
+};
+
+/* Fills buf with source-like text: random words, spaces and newlines. */
+static void fill_text(unsigned char *buf, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        uint64_t r = rng_next();
+        const char *w = words[r % (sizeof(words) / sizeof(words[0]))];
+        size_t wlen = strlen(w);
+        for (size_t i = 0; i < wlen && pos < len; i++) buf[pos++] = (unsigned char)w[i];
+        if (pos < len) buf[pos++] = (r >> 32) % 8 == 0 ? '\n' : ' ';
+    }
+}
+
+/* Fills buf with alternating 4 KiB runs of text and random bytes. */
+static void fill_mixed(unsigned char *buf, size_t len) {
+    for (size_t pos = 0; pos < len; pos += 4096) {
+        size_t chunk = len - pos < 4096 ? len - pos : 4096;
+        if ((pos / 4096) % 2 == 0) {
+            fill_text(buf + pos, chunk);
+        } else {
+            for (size_t i = 0; i < chunk; i++) buf[pos + i] = (unsigned char)rng_next();
+        }
+    }
+}
+
+static int dataset_alloc(Dataset *ds, const char *name, size_t count) {
+    ds->name = name;
+    ds->count = count;
+    ds->bytes = 0;
+    ds->bodies = calloc(count, sizeof(unsigned char *));
+    ds->sizes = calloc(count, sizeof(size_t));
+    ds->oids = calloc(count, sizeof(ObjectId));
+    if (ds->bodies == NULL || ds->sizes == NULL || ds->oids == NULL) {
+        GIT_ERR("bench: malloc failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int dataset_add(Dataset *ds, size_t i, size_t size) {
+    ds->bodies[i] = malloc(size > 0 ? size : 1);
+    if (ds->bodies[i] == NULL) {
+        GIT_ERR("bench: malloc failed\n");
+        return 1;
+    }
+    ds->sizes[i] = size;
+    ds->bytes += size;
+    return 0;
+}
+
+static void dataset_free(Dataset *ds) {
+    for (size_t i = 0; ds->bodies != NULL && i < ds->count; i++) free(ds->bodies[i]);
+    free(ds->bodies);
+    free(ds->sizes);
+    free(ds->oids);
+}
+
+static int make_small(Dataset *ds, int scale) {
+    if (dataset_alloc(ds, "small", (size_t)BENCH_SMALL_FILES * (size_t)scale) != 0) return 1;
+    for (size_t i = 0; i < ds->count; i++) {
+        size_t size = BENCH_SMALL_MIN + rng_next() % (BENCH_SMALL_MAX - BENCH_SMALL_MIN);
+        if (dataset_add(ds, i, size) != 0) return 1;
+        fill_text(ds->bodies[i], size);
+    }
+    return 0;
+}
+
+static int make_huge(Dataset *ds, int scale) {
+    if (dataset_alloc(ds, "huge", (size_t)BENCH_HUGE_BLOBS * (size_t)scale) != 0) return 1;
+    for (size_t i = 0; i < ds->count; i++) {
+        if (dataset_add(ds, i, BENCH_HUGE_SIZE) != 0) return 1;
+        fill_mixed(ds->bodies[i], BENCH_HUGE_SIZE);
+    }
+    return 0;
+}
+
+/* Each revision is the previous one with a few short runs rewritten. */
+static int make_chain(Dataset *ds, int scale) {
+    if (dataset_alloc(ds, "chain", (size_t)BENCH_CHAIN_REVISIONS * (size_t)scale) != 0) return 1;
+    for (size_t i = 0; i < ds->count; i++) {
+        if (dataset_add(ds, i, BENCH_CHAIN_SIZE) != 0) return 1;
+        if (i == 0) {
+            fill_text(ds->bodies[0], BENCH_CHAIN_SIZE);
+            continue;
+        }
+        memcpy(ds->bodies[i], ds->bodies[i - 1], BENCH_CHAIN_SIZE);
+        for (int edit = 0; edit < 4; edit++) {
+            size_t at = rng_next() % (BENCH_CHAIN_SIZE - 64);
+            fill_text(ds->bodies[i] + at, 8 + rng_next() % 56);
+        }
+    }
+    return 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return usage.ru_maxrss;  /* KiB on Linux */
+}
+
+static int results_printed = 0;
+
+/* Prints one result object of the "results" array. */
+static void report(const char *stage, const char *dataset, size_t objects, size_t bytes,
+                   double seconds) {
+    if (seconds <= 0) seconds = 1e-9;
+    printf("%s\n    {\"stage\": \"%s\", \"dataset\": \"%s\", \"objects\": %zu, \"bytes\": %zu, "
+           "\"seconds\": %.6f, \"objects_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+           "\"peak_rss_kb\": %ld}",
+           results_printed++ ? "," : "", stage, dataset, objects, bytes, seconds,
+           (double)objects / seconds, (double)bytes / (1024.0 * 1024.0) / seconds,
+           peak_rss_kb());
+}
+
+/* Creates dir as an empty repository and makes it the current one. */
+static int enter_repo(const char *dir) {
+    if (mkdir(dir, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) {
+        GIT_ERR("bench: cannot create %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (chdir(dir) != 0 ||
+        (mkdir(GIT_ROOT_DIR, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) ||
+        (mkdir(GIT_REFS_DIR, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) ||
+        (mkdir(GIT_OBJECTS_DIR, DIRECTORY_PERMISSION) == -1 && errno != EEXIST)) {
+        GIT_ERR("bench: cannot set up repository %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    packstore_reset();
+    loose_store_reopen();
+    return 0;
+}
+
+static int bench_hash(const Dataset *ds) {
+    double start = now_seconds();
+    for (size_t i = 0; i < ds->count; i++) {
+        ObjectId oid;
+        if (object_hash("blob", ds->bodies[i], ds->sizes[i], &oid) != 0) return 1;
+    }
+    report("hash", ds->name, ds->count, ds->bytes, now_seconds() - start);
+    return 0;
+}
+
+/* Times compress_data(), then decompress_exact() on its output. */
+static int bench_compress_inflate(const Dataset *ds) {
+    unsigned char **compressed = calloc(ds->count, sizeof(unsigned char *));
+    unsigned long *compressed_len = calloc(ds->count, sizeof(unsigned long));
+    int result = 1;
+    if (compressed == NULL || compressed_len == NULL) {
+        GIT_ERR("bench: malloc failed\n");
+        goto cleanup;
+    }
+
+    double start = now_seconds();
+    for (size_t i = 0; i < ds->count; i++) {
+        compressed[i] = compress_data(ds->bodies[i], ds->sizes[i], &compressed_len[i]);
+        if (compressed[i] == NULL) goto cleanup;
+    }
+    report("compress", ds->name, ds->count, ds->bytes, now_seconds() - start);
+
+    start = now_seconds();
+    for (size_t i = 0; i < ds->count; i++) {
+        unsigned char *body = decompress_exact(compressed[i], compressed_len[i], ds->sizes[i], NULL);
+        if (body == NULL) goto cleanup;
+        free(body);
+    }
+    report("inflate", ds->name, ds->count, ds->bytes, now_seconds() - start);
+    result = 0;
+
+cleanup:
+    for (size_t i = 0; compressed != NULL && i < ds->count; i++) free(compressed[i]);
+    free(compressed);
+    free(compressed_len);
+    return result;
+}
+
+/*
+ * Times create_delta() between consecutive revisions, then replays the
+ * whole chain with apply_delta_into() and checks it ends at the last
+ * revision.
+ */
+static int bench_delta(const Dataset *ds) {
+    unsigned char **deltas = calloc(ds->count, sizeof(unsigned char *));
+    size_t *delta_len = calloc(ds->count, sizeof(size_t));
+    ScratchBuf bufs[2] = {0};
+    int result = 1;
+    if (deltas == NULL || delta_len == NULL) {
+        GIT_ERR("bench: malloc failed\n");
+        goto cleanup;
+    }
+
+    double start = now_seconds();
+    for (size_t i = 1; i < ds->count; i++) {
+        DeltaIndex *index = delta_index_new(ds->bodies[i - 1], ds->sizes[i - 1]);
+        if (index == NULL) goto cleanup;
+        deltas[i] = create_delta(index, ds->bodies[i], ds->sizes[i], ds->sizes[i], &delta_len[i]);
+        delta_index_free(index);
+        if (deltas[i] == NULL) {
+            GIT_ERR("bench: revision %zu has no delta\n", i);
+            goto cleanup;
+        }
+    }
+    report("delta-create", ds->name, ds->count - 1, ds->bytes - ds->sizes[0], now_seconds() - start);
+
+    start = now_seconds();
+    const unsigned char *current = ds->bodies[0];
+    size_t current_len = ds->sizes[0];
+    for (size_t i = 1; i < ds->count; i++) {
+        ScratchBuf *out = &bufs[i % 2];
+        if (apply_delta_into(current, current_len, deltas[i], delta_len[i], out, &current_len) != 0) {
+            goto cleanup;
+        }
+        current = out->data;
+    }
+    report("delta-apply", ds->name, ds->count - 1, ds->bytes - ds->sizes[0], now_seconds() - start);
+    if (current_len != ds->sizes[ds->count - 1] ||
+        memcmp(current, ds->bodies[ds->count - 1], current_len) != 0) {
+        GIT_ERR("bench: delta chain does not rebuild the last revision\n");
+        goto cleanup;
+    }
+    result = 0;
+
+cleanup:
+    for (size_t i = 0; deltas != NULL && i < ds->count; i++) free(deltas[i]);
+    free(deltas);
+    free(delta_len);
+    scratch_free(&bufs[0]);
+    scratch_free(&bufs[1]);
+    return result;
+}
+
+static int bench_write_loose(Dataset *ds) {
+    double start = now_seconds();
+    for (size_t i = 0; i < ds->count; i++) {
+        if (object_write_body("blob", ds->bodies[i], ds->sizes[i], &ds->oids[i]) != 0) return 1;
+    }
+    report("write-loose", ds->name, ds->count, ds->bytes, now_seconds() - start);
+    return 0;
+}
+
+/* Writes a flat tree naming every blob of ds; returns its id in *tree. */
+static int write_flat_tree(const Dataset *ds, ObjectId *tree) {
+    /* "100644 f0000000\0" + 20-byte id per entry; zero-padded names sort */
+    size_t entry_len = 7 + 8 + 1 + OID_RAW_SIZE;
+    unsigned char *body = malloc(ds->count * entry_len + 1);
+    if (body == NULL) {
+        GIT_ERR("bench: malloc failed\n");
+        return 1;
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < ds->count; i++) {
+        pos += (size_t)sprintf((char *)body + pos, "100644 f%07zu", i) + 1;
+        memcpy(body + pos, ds->oids[i].hash, OID_RAW_SIZE);
+        pos += OID_RAW_SIZE;
+    }
+    int result = object_write_body("tree", body, pos, tree);
+    free(body);
+    return result;
+}
+
+/* Packs every object written so far, as gc does. */
+static int bench_pack_write(Dataset *sets, size_t set_count, unsigned char *checksum) {
+    size_t count = 0, bytes = 0;
+    for (size_t s = 0; s < set_count; s++) {
+        count += sets[s].count;
+        bytes += sets[s].bytes;
+    }
+    PackObject *objects = malloc(count * sizeof(PackObject));
+    if (objects == NULL) {
+        GIT_ERR("bench: malloc failed\n");
+        return 1;
+    }
+    size_t n = 0;
+    for (size_t s = 0; s < set_count; s++) {
+        for (size_t i = 0; i < sets[s].count; i++) {
+            /* Name the chain's revisions alike, so they are tried against each other */
+            char name[32];
+            snprintf(name, sizeof(name), "%s%zu", sets[s].name, strcmp(sets[s].name, "chain") ? i : 0);
+            objects[n].oid = sets[s].oids[i];
+            objects[n].type = OBJ_BLOB;
+            objects[n].size = sets[s].sizes[i];
+            objects[n].name_hash = pack_name_hash(name);
+            n++;
+        }
+    }
+    PackObjectsOptions opts = { PACK_WINDOW_DEFAULT, PACK_DEPTH_DEFAULT };
+    double start = now_seconds();
+    int result = pack_objects(objects, count, &opts, checksum);
+    if (result == 0) report("pack-write", "all", count, bytes, now_seconds() - start);
+    free(objects);
+    return result;
+}
+
+/*
+ * Maps the pack written by bench_pack_write() and times indexing it
+ * (index-pack) and exploding it into loose objects (unpack) — once on
+ * the calling thread and once through the object writer pool — each in
+ * a fresh repository under the current directory's parent.
+ */
+static int bench_pack_parse(const char *repo, const unsigned char *checksum, size_t objects,
+                            int threads) {
+    char hex[OID_HEX_SIZE + 1], path[GIT_PATH_MAX];
+    hex_encode(checksum, OID_RAW_SIZE, hex);
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s/pack-%s.pack", repo, GIT_PACK_DIR, hex) >= sizeof(path)) {
+        GIT_ERR("bench: path too long: %s\n", repo);
+        return 1;
+    }
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        GIT_ERR("bench: cannot open %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    size_t len = (size_t)st.st_size;
+    unsigned char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        GIT_ERR("bench: cannot map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int result = 1;
+    unsigned char check[OID_RAW_SIZE];
+    if (chdir("..") != 0 || enter_repo("index") != 0) goto cleanup;
+    double start = now_seconds();
+    if (packfile_index_buffer(map, len, threads, check) != 0) goto cleanup;
+    report("pack-index", "all", objects, len, now_seconds() - start);
+
+    if (chdir("..") != 0 || enter_repo("unpack") != 0) goto cleanup;
+    start = now_seconds();
+    if (packfile_parse(map, len, 1) != 0) goto cleanup;
+    report("pack-unpack", "all", objects, len, now_seconds() - start);
+
+    if (chdir("..") != 0 || enter_repo("unpack-parallel") != 0) goto cleanup;
+    start = now_seconds();
+    if (packfile_parse(map, len, threads) != 0) goto cleanup;
+    report("pack-unpack-parallel", "all", objects, len, now_seconds() - start);
+    result = 0;
+
+cleanup:
+    munmap(map, len);
+    return result;
+}
+
+static int bench_checkout(const Dataset *ds, int threads) {
+    ObjectId tree;
+    if (write_flat_tree(ds, &tree) != 0) return 1;
+    if (mkdir("checkout", DIRECTORY_PERMISSION) == -1) {
+        GIT_ERR("bench: cannot create checkout directory: %s\n", strerror(errno));
+        return 1;
+    }
+    double start = now_seconds();
+    if (checkout_tree(&tree, "checkout", threads) != 0) return 1;
+    report("checkout", ds->name, ds->count, ds->bytes, now_seconds() - start);
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+/* Parses "--<name>=<n>" with n in [min, max]; 0, or 1 if it is bad. */
+static int parse_int(const char *arg, size_t prefix_len, long min, long max, int *value) {
+    char *end;
+    long n = strtol(arg + prefix_len, &end, 10);
+    if (end == arg + prefix_len || *end != '\0' || n < min || n > max) {
+        GIT_ERR("bench: invalid value %s\n", arg);
+        return 1;
+    }
+    *value = (int)n;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int scale = 1, threads = 0, keep = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--scale=", 8) == 0) {
+            if (parse_int(argv[i], 8, 1, 1000, &scale) != 0) return 1;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            if (parse_int(argv[i], 10, 0, 1024, &threads) != 0) return 1;
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            keep = 1;
+        } else {
+            GIT_ERR("usage: bench [--scale=<n>] [--threads=<n>] [--keep]\n");
+            return 1;
+        }
+    }
+
+    const char *tmp = getenv("TMPDIR");
+    char root[GIT_PATH_MAX], repo[sizeof(root) + sizeof("/objects")];
+    if ((size_t)snprintf(root, sizeof(root), "%s/git-bench-XXXXXX",
+                         tmp != NULL && *tmp != '\0' ? tmp : "/tmp") >= sizeof(root)) {
+        GIT_ERR("bench: TMPDIR is too long\n");
+        return 1;
+    }
+    if (mkdtemp(root) == NULL) {
+        GIT_ERR("bench: cannot create a temporary directory: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(repo, sizeof(repo), "%s/objects", root);
+
+    Dataset sets[3] = {0};
+    Dataset *small = &sets[0], *huge = &sets[1], *chain = &sets[2];
+    int result = 1;
+    if (make_small(small, scale) != 0 || make_huge(huge, scale) != 0 ||
+        make_chain(chain, scale) != 0) {
+        goto cleanup;
+    }
+
+    printf("{\n  \"scale\": %d,\n  \"threads\": %d,\n  \"results\": [", scale, threads);
+    for (size_t s = 0; s < 3; s++) {
+        if (bench_hash(&sets[s]) != 0 || bench_compress_inflate(&sets[s]) != 0) goto finish;
+    }
+    if (bench_delta(chain) != 0) goto finish;
+
+    if (chdir(root) != 0 || enter_repo("objects") != 0) goto finish;
+    for (size_t s = 0; s < 3; s++) {
+        if (bench_write_loose(&sets[s]) != 0) goto finish;
+    }
+    if (bench_checkout(small, threads) != 0) goto finish;
+    unsigned char checksum[OID_RAW_SIZE];
+    if (bench_pack_write(sets, 3, checksum) != 0) goto finish;
+    size_t objects = small->count + huge->count + chain->count;
+    if (bench_pack_parse(repo, checksum, objects, threads) != 0) goto finish;
+    result = 0;
+
+finish:
+    printf("\n  ],\n  \"peak_rss_kb\": %ld,\n  \"ok\": %s\n}\n", peak_rss_kb(),
+           result == 0 ? "true" : "false");
+cleanup:
+    for (size_t s = 0; s < 3; s++) dataset_free(&sets[s]);
+    if (chdir("/") == 0 && !keep) nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (keep) GIT_ERR("bench: kept %s\n", root);
+    return result;
+}
@@ -1,20 +1,107 @@
 /*
  * cat_file.c
  *
- * Implements the "git cat-file -p" command — reads a git object
- * from the store and prints its content to stdout.
+ * Implements the "git cat-file -p|-t|-s" command — reads a git object
+ * from the store and prints its content, type or size to stdout.
+ * -t and -s only read the object header, never the body.
+ *
+ * --batch and --batch-check answer any number of object names read
+ * from stdin in one process, so the open pack maps and the delta base
+ * cache serve every request after the first.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "../constants.h"
 #include "../objects/object.h"
+#include "../objects/promisor.h"
+#include "../pack/packfile.h"
+#include "commands.h"
+
+int cat_file(const char *flag, const char *sha1) {
+    ObjectId oid;
+    if (oid_parse(sha1, &oid) != 0) return 1;
+
+    if (strcmp(flag, "-t") == 0 || strcmp(flag, "-s") == 0) {
+        int type;
+        size_t size;
+        if (object_read_header(&oid, &type, &size) != 0) return 1;
+        if (flag[1] == 't') printf("%s\n", packfile_type_name(type));
+        else printf("%zu\n", size);
+        return 0;
+    }
+    if (strcmp(flag, "-p") != 0) {
+        GIT_ERR("Unknown flag %s for cat-file\n", flag);
+        return 1;
+    }
 
-int cat_file(const char *sha1) {
     GitObject obj;
-    if (object_read(sha1, &obj) != 0) return 1;
+    if (object_read(&oid, &obj) != 0) return 1;
 
-    printf("%.*s", (int)obj.body_size, obj.body);
+    /* Blobs may hold NUL bytes: write the body as bytes, not as a string */
+    size_t written = fwrite(obj.body, 1, obj.body_size, stdout);
     free(obj.raw);
+    if (written != obj.body_size || fflush(stdout) != 0) {
+        GIT_ERR("cat-file: error writing to stdout\n");
+        return 1;
+    }
     return 0;
 }
+
+/*
+ * Answers one --batch / --batch-check line: "<sha> <type> <size>",
+ * then for --batch the body and a newline; "<name> missing" for names
+ * that are malformed or not in the store.
+ */
+static int batch_one(const char *name, int contents) {
+    ObjectId oid;
+    int found = strlen(name) == OID_HEX_SIZE && oid_from_hex(name, &oid) == 0;
+    /* A partial clone may still fetch an object it does not have */
+    if (found && !object_exists(&oid) && !promisor_enabled()) found = 0;
+
+    int type = 0;
+    size_t size = 0;
+    GitObject obj = {0};
+    if (found && contents) {
+        found = object_read(&oid, &obj) == 0;
+        if (found) {
+            const char *space = memchr(obj.raw, ' ', (size_t)(obj.body - obj.raw));
+            type = space != NULL ? packfile_type_code((const char *)obj.raw,
+                                                      (size_t)(space - (const char *)obj.raw)) : -1;
+            size = obj.body_size;
+        }
+    } else if (found) {
+        found = object_read_header(&oid, &type, &size) == 0;
+    }
+    if (!found || type < 0) {
+        free(obj.raw);
+        return printf("%s missing\n", name) < 0;
+    }
+
+    int failed = printf("%s %s %zu\n", name, packfile_type_name(type), size) < 0;
+    if (!failed && contents) {
+        failed = fwrite(obj.body, 1, obj.body_size, stdout) != obj.body_size ||
+                 putchar('\n') == EOF;
+    }
+    free(obj.raw);
+    return failed;
+}
+
+int cat_file_batch(int contents, int buffer) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    int result = 0;
+    while (result == 0 && (len = getline(&line, &capacity, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        result = batch_one(line, contents);
+        /* Unless told otherwise, answer each request before reading the next */
+        if (result == 0 && !buffer && fflush(stdout) != 0) result = 1;
+    }
+    if (result == 0 && fflush(stdout) != 0) result = 1;
+    if (result != 0) GIT_ERR("cat-file: error writing to stdout\n");
+    free(line);
+    return result;
+}
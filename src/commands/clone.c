@@ -6,28 +6,56 @@
  *
  * Pipeline:
  *   1. Create target directory and init .git/
- *   2. GET refs → extract HEAD SHA
- *   3. POST upload-pack with "want" request → get packfile response
- *   4. Strip side-band framing → raw packfile
- *   5. Parse packfile → write all objects to .git/objects/
- *   6. Read HEAD commit → tree → recursively checkout working directory
+ *   2. Discover HEAD. With protocol v2 (asked for, used when the server
+ *      agrees): GET the capabilities, then ls-refs for just HEAD and its
+ *      symref target. Otherwise: GET the full v0 ref advertisement and
+ *      take the first line. Steps 2 and 3 share one HTTP session.
+ *   3. POST upload-pack with a want request (v2 fetch, or v0 "want";
+ *      asking for ofs-delta, for smaller packs), streaming the response:
+ *        curl chunk → side-band demux → pack parser → .git/objects/pack/
+ *      The pack is kept verbatim and indexed (like git's index-pack)
+ *      while the download runs; the response is never held in memory
+ *      as a whole and no object is recompressed
+ *   4. Read HEAD commit → tree → checkout: walk the trees and create
+ *      directories, then write the files from a thread pool
+ *   5. Record every checked-out file in .git/index
+ *   6. Point HEAD at the remote's default branch, when v2 named it
+ *   7. Write the commit-graph (not for --depth), so that history
+ *      walks read it instead of inflating commits
+ *
+ * --depth asks the server to cut history ("deepen"); the boundary
+ * commits it reports are recorded in .git/shallow. --filter leaves
+ * blobs out: the remote is then recorded as a promisor, and step 4
+ * fetches the blobs the checkout needs in one batch (see promisor.h).
+ *
+ * A v2 server may offload history to static files (see offload.h):
+ * bundles listed by bundle-uri are installed before step 3, whose
+ * fetch then sends their tips as "have"s, and packs named in the
+ * fetch's packfile-uris section are downloaded right after it.
  */
 
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../constants.h"
 #include "commands.h"
+#include "../index/index.h"
 #include "../objects/object.h"
-#include "../utils/string/string.h"
+#include "../objects/promisor.h"
 #include "../utils/file/file.h"
 #include "../net/http.h"
+#include "../objects/commit_graph.h"
+#include "../net/offload.h"
 #include "../net/pktline.h"
 #include "../pack/packfile.h"
+#include "../pack/packstore.h"
+#include "../utils/thread/thread_pool.h"
+#include "../utils/trace/trace.h"
 
 /*
  * Extracts the tree SHA from a commit object body.
@@ -40,43 +68,90 @@
  *
  * The tree SHA is always the first line, characters 5-44.
  */
-static int get_tree_sha(const char *commit_sha, char *tree_sha_out) {
+static int get_tree_sha(const ObjectId *commit, ObjectId *tree_out) {
     GitObject obj;
-    if (object_read(commit_sha, &obj) != 0) return 1;
+    if (object_read(commit, &obj) != 0) return 1;
 
-    /* Verify the body starts with "tree " */
-    if (obj.body_size < 45 || memcmp(obj.body, "tree ", 5) != 0) {
-        GIT_ERR("clone: malformed commit object %s\n", commit_sha);
+    /* Verify the body starts with "tree <hex>" */
+    if (obj.body_size < 45 || memcmp(obj.body, "tree ", 5) != 0 ||
+        oid_from_hex((const char *)obj.body + 5, tree_out) != 0) {
+        char hex[OID_HEX_SIZE + 1];
+        GIT_ERR("clone: malformed commit object %s\n", oid_to_hex(commit, hex));
         free(obj.raw);
         return 1;
     }
 
-    memcpy(tree_sha_out, obj.body + 5, 40);
-    tree_sha_out[40] = '\0';
     free(obj.raw);
     return 0;
 }
 
+/* One file to materialize, found while planning the checkout. */
+typedef struct {
+    char *path;
+    ObjectId oid;
+    uint32_t mode;  /* tree entry mode, e.g. 0100644 */
+    struct stat st; /* set by the worker once the file is written */
+    int failed;     /* set by the worker; reported after the pool drains */
+} CheckoutFile;
+
+/* Files discovered by the planning walk, in tree order. */
+typedef struct {
+    CheckoutFile *files;
+    size_t count;
+    size_t capacity;
+} CheckoutPlan;
+
+static int plan_add_file(CheckoutPlan *plan, const char *path, uint32_t mode,
+                         const unsigned char *sha_bin) {
+    if (plan->count == plan->capacity) {
+        size_t new_capacity = plan->capacity == 0 ? 256 : plan->capacity * 2;
+        CheckoutFile *grown = realloc(plan->files, new_capacity * sizeof(CheckoutFile));
+        if (grown == NULL) {
+            GIT_ERR("clone: malloc failed for checkout plan\n");
+            return 1;
+        }
+        plan->files = grown;
+        plan->capacity = new_capacity;
+    }
+
+    CheckoutFile *f = &plan->files[plan->count];
+    f->path = strdup(path);
+    if (f->path == NULL) {
+        GIT_ERR("clone: malloc failed for checkout plan\n");
+        return 1;
+    }
+    memcpy(f->oid.hash, sha_bin, OID_RAW_SIZE);
+    f->mode = mode;
+    f->failed = 0;
+    plan->count++;
+    return 0;
+}
+
+static void plan_free(CheckoutPlan *plan) {
+    for (size_t i = 0; i < plan->count; i++) free(plan->files[i].path);
+    free(plan->files);
+}
+
 /*
- * Recursively checks out a tree object into a directory.
- *
- * Walks the tree's binary entries. For each entry:
- *   - Mode "40000" (directory): create subdirectory, recurse
- *   - Other modes (files): read the blob and write it to disk
+ * Planning phase: recursively walks a tree object, creating every
+ * directory and queuing every file. Only trees are read here; blobs
+ * are left for the parallel phase.
  *
  * Tree entry format: <mode> <name>\0<20-byte binary SHA>
  */
-static int checkout_tree(const char *tree_sha, const char *dir) {
+static int plan_tree(const ObjectId *tree, const char *dir, CheckoutPlan *plan) {
     GitObject obj;
-    if (object_read(tree_sha, &obj) != 0) return 1;
+    if (object_read(tree, &obj) != 0) return 1;
 
+    int result = 1;
+    char hex[OID_HEX_SIZE + 1];
     unsigned char *pos = obj.body;
     unsigned char *end = obj.body + obj.body_size;
 
     while (pos < end) {
         /* Parse mode */
         unsigned char *space = memchr(pos, ' ', (size_t)(end - pos));
-        if (space == NULL) { free(obj.raw); return 1; }
+        if (space == NULL || space - pos >= 16) goto malformed;
         char mode[16];
         size_t mode_len = (size_t)(space - pos);
         memcpy(mode, pos, mode_len);
@@ -85,75 +160,424 @@ static int checkout_tree(const char *tree_sha, const char *dir) {
         /* Parse name */
         unsigned char *name_start = space + 1;
         unsigned char *name_end = memchr(name_start, '\0', (size_t)(end - name_start));
-        if (name_end == NULL) { free(obj.raw); return 1; }
+        if (name_end == NULL) goto malformed;
         size_t name_len = (size_t)(name_end - name_start);
-        if (name_len >= GIT_PATH_MAX - 1) {
-            GIT_ERR("clone: entry name too long (%zu bytes)\n", name_len);
-            free(obj.raw);
-            return 1;
-        }
-        char name[GIT_PATH_MAX];
-        memcpy(name, name_start, name_len);
-        name[name_len] = '\0';
 
         /* 20-byte binary SHA follows the NUL */
-        if (name_end + 1 + 20 > end) { free(obj.raw); return 1; }
+        if (name_end + 1 + OID_RAW_SIZE > end) goto malformed;
         unsigned char *sha_bin = name_end + 1;
-        char *sha_hex = hex_to_string(sha_bin, 20);
-        if (sha_hex == NULL) { free(obj.raw); return 1; }
 
         /* Build full path: dir/name */
         char path[GIT_PATH_MAX];
-        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        int path_len = snprintf(path, sizeof(path), "%s/%.*s", dir, (int)name_len, name_start);
+        if (path_len < 0 || (size_t)path_len >= sizeof(path)) {
+            GIT_ERR("clone: path too long under %s\n", dir);
+            goto cleanup;
+        }
 
         if (strcmp(mode, "40000") == 0) {
             /* Directory entry: create dir and recurse into subtree */
             if (mkdir(path, DIRECTORY_PERMISSION) == -1) {
                 GIT_ERR("clone: failed to create directory %s\n", path);
-                free(sha_hex);
-                free(obj.raw);
-                return 1;
-            }
-            if (checkout_tree(sha_hex, path) != 0) {
-                free(sha_hex);
-                free(obj.raw);
-                return 1;
-            }
-        } else {
-            /* File entry: read blob and write to disk */
-            GitObject blob;
-            if (object_read(sha_hex, &blob) != 0) {
-                free(sha_hex);
-                free(obj.raw);
-                return 1;
-            }
-            if (write_file(path, (const char *)blob.body,
-                           blob.body_size, "wb") != 0) {
-                GIT_ERR("clone: failed to write file %s\n", path);
-                free(blob.raw);
-                free(sha_hex);
-                free(obj.raw);
-                return 1;
+                goto cleanup;
             }
-            free(blob.raw);
+            ObjectId subtree;
+            memcpy(subtree.hash, sha_bin, OID_RAW_SIZE);
+            if (plan_tree(&subtree, path, plan) != 0) goto cleanup;
+        } else if (plan_add_file(plan, path, (uint32_t)strtoul(mode, NULL, 8), sha_bin) != 0) {
+            goto cleanup;
         }
 
-        free(sha_hex);
-        pos = sha_bin + 20;
+        pos = sha_bin + OID_RAW_SIZE;
     }
+    result = 0;
+    goto cleanup;
 
+malformed:
+    GIT_ERR("clone: malformed tree object %s\n", oid_to_hex(tree, hex));
+cleanup:
     free(obj.raw);
+    return result;
+}
+
+/* Creates a symlink whose target is the blob's content, as git does. */
+static int checkout_symlink(const char *path, const GitObject *blob) {
+    char *target = strndup((const char *)blob->body, blob->body_size);
+    if (target == NULL) {
+        GIT_ERR("clone: malloc failed for link target\n");
+        return 1;
+    }
+    int failed = symlink(target, path) != 0;
+    if (failed) GIT_ERR("clone: cannot create symlink %s: %s\n", path, strerror(errno));
+    free(target);
+    return failed;
+}
+
+/*
+ * Worker task: materializes one tree entry at its planned path with
+ * the type its mode asks for, so the work tree matches the index:
+ * 100755 files are made executable (wherever they are readable),
+ * 120000 becomes a symlink and a 160000 submodule an empty directory.
+ */
+static void checkout_file_task(void *arg) {
+    CheckoutFile *f = arg;
+    if (f->mode == 0160000) {
+        /* The submodule's commit is not in this repository */
+        if (mkdir(f->path, DIRECTORY_PERMISSION) != 0 || lstat(f->path, &f->st) != 0) f->failed = 1;
+        return;
+    }
+    GitObject blob;
+    if (object_read(&f->oid, &blob) != 0) {
+        f->failed = 1;
+        return;
+    }
+    if (f->mode == 0120000) {
+        if (checkout_symlink(f->path, &blob) != 0) f->failed = 1;
+    } else if (write_file(f->path, (const char *)blob.body, blob.body_size, "wb") != 0) {
+        f->failed = 1;
+    } else if (f->mode == 0100755) {
+        struct stat st;
+        /* Executable wherever the umask left it readable */
+        if (stat(f->path, &st) != 0 ||
+            chmod(f->path, (st.st_mode & 07777) | (st.st_mode & 0444) >> 2) != 0) {
+            f->failed = 1;
+        }
+    }
+    if (!f->failed && lstat(f->path, &f->st) != 0) f->failed = 1;
+    free(blob.raw);
+}
+
+/* Writes .git/index from the checked-out files and their stat data. */
+static int write_checkout_index(const CheckoutPlan *plan) {
+    GitIndex index = {0};
+    int result = 1;
+    for (size_t i = 0; i < plan->count; i++) {
+        const CheckoutFile *f = &plan->files[i];
+        /* Index paths are relative to the work tree: "./a/b" is "a/b" */
+        const char *path = strncmp(f->path, "./", 2) == 0 ? f->path + 2 : f->path;
+        if (index_add(&index, path, f->mode, &f->oid, &f->st) != 0) goto cleanup;
+    }
+    if (index_write(&index) != 0) goto cleanup;
+    result = 0;
+
+cleanup:
+    index_free(&index);
+    return result;
+}
+
+int checkout_tree(const ObjectId *tree, const char *dir, int threads) {
+    CheckoutPlan plan = {0};
+    int result = 1;
+
+    uint64_t start = trace_now();
+    if (plan_tree(tree, dir, &plan) != 0) goto cleanup;
+    trace_span("checkout.plan", start);
+
+    /* Partial clone: one request for every blob left out, not one per file */
+    if (promisor_enabled() && plan.count > 0) {
+        ObjectId *wanted = malloc(plan.count * sizeof(ObjectId));
+        if (wanted == NULL) {
+            GIT_ERR("clone: malloc failed\n");
+            goto cleanup;
+        }
+        size_t wanted_count = 0;
+        for (size_t i = 0; i < plan.count; i++) {
+            /* A submodule entry names a commit of another repository */
+            if (plan.files[i].mode != 0160000) wanted[wanted_count++] = plan.files[i].oid;
+        }
+        int failed = wanted_count > 0 && promisor_fetch(wanted, wanted_count);
+        free(wanted);
+        if (failed) goto cleanup;
+    }
+
+    start = trace_now();
+    if (threads <= 0) threads = thread_pool_default_threads();
+    if ((size_t)threads > plan.count) threads = plan.count > 0 ? (int)plan.count : 1;
+    ThreadPool *pool = thread_pool_new(threads);
+    if (pool == NULL) goto cleanup;
+
+    size_t failures = 0;
+    for (size_t i = 0; i < plan.count; i++) {
+        if (thread_pool_submit(pool, checkout_file_task, &plan.files[i]) != 0) {
+            plan.files[i].failed = 1;
+        }
+    }
+    thread_pool_free(pool);
+
+    for (size_t i = 0; i < plan.count; i++) {
+        if (!plan.files[i].failed) continue;
+        GIT_ERR("clone: failed to check out %s\n", plan.files[i].path);
+        failures++;
+    }
+    if (failures > 0) {
+        GIT_ERR("clone: %zu of %zu files could not be checked out\n", failures, plan.count);
+        goto cleanup;
+    }
+    trace_span("checkout.files", start);
+    start = trace_now();
+    if (write_checkout_index(&plan) != 0) goto cleanup;
+    trace_span("checkout.index", start);
+    result = 0;
+
+cleanup:
+    plan_free(&plan);
+    return result;
+}
+
+/* What the remote's HEAD is, and how to ask for it. */
+typedef struct {
+    char sha[OID_HEX_SIZE + 1];
+    char target[256];       /* symref target, e.g. "refs/heads/main"; "" if unknown */
+    int v2;                 /* server speaks protocol v2 */
+    int ofs_delta;          /* v0: server offered ofs-delta */
+    int side_band;          /* v0: server offered side-band-64k */
+    int shallow;            /* server accepts "deepen" */
+    int filter;             /* server accepts "filter" */
+    int bundle_uri;         /* v2: server lists bundles with "bundle-uri" */
+    int packfile_uris;      /* v2: fetch may name packs to download */
+    int sideband_all;       /* v2: fetch can frame every packet */
+} RemoteHead;
+
+/*
+ * Finds the remote HEAD. Asks for protocol v2 first, so that only the
+ * HEAD ref crosses the wire; a v0 server answers with its full ref
+ * advertisement instead, whose first line is HEAD.
+ */
+static int discover_head(HttpSession *http, RemoteHead *head) {
+    HttpResponse resp = {0};
+    char *request = NULL;
+    int result = 1;
+    *head = (RemoteHead){0};
+
+    http_session_set_protocol(http, 2);
+    if (http_get_refs(http, &resp) != 0) goto cleanup;
+
+    head->v2 = pktline_is_v2(resp.data, resp.size);
+    if (!head->v2) {
+        if (pktline_parse_head(resp.data, resp.size, head->sha) != 0) goto cleanup;
+        head->ofs_delta = pktline_has_capability(resp.data, resp.size, "ofs-delta");
+        head->side_band = pktline_has_capability(resp.data, resp.size, "side-band-64k");
+        head->shallow = pktline_has_capability(resp.data, resp.size, "shallow");
+        head->filter = pktline_has_capability(resp.data, resp.size, "filter");
+        result = 0;
+        goto cleanup;
+    }
+    if (!pktline_v2_has_capability(resp.data, resp.size, "ls-refs") ||
+        !pktline_v2_has_capability(resp.data, resp.size, "fetch")) {
+        GIT_ERR("clone: server does not offer ls-refs and fetch\n");
+        goto cleanup;
+    }
+    head->shallow = pktline_v2_has_feature(resp.data, resp.size, "fetch", "shallow");
+    head->filter = pktline_v2_has_feature(resp.data, resp.size, "fetch", "filter");
+    head->bundle_uri = pktline_v2_has_capability(resp.data, resp.size, "bundle-uri");
+    head->packfile_uris = pktline_v2_has_feature(resp.data, resp.size, "fetch", "packfile-uris");
+    head->sideband_all = pktline_v2_has_feature(resp.data, resp.size, "fetch", "sideband-all");
+    http_response_free(&resp);
+
+    const char *prefixes[] = { "HEAD" };
+    size_t request_len;
+    if (pktline_build_ls_refs(prefixes, 1, &request, &request_len) != 0) goto cleanup;
+    if (http_post_command(http, request, request_len, &resp) != 0) goto cleanup;
+    if (pktline_parse_ls_refs(resp.data, resp.size, "HEAD", head->sha,
+                              head->target, sizeof(head->target)) != 0) goto cleanup;
+    result = 0;
+
+cleanup:
+    free(request);
+    http_response_free(&resp);
+    return result;
+}
+
+/*
+ * Makes .git/HEAD a symref to the remote's default branch and creates
+ * that branch at the cloned commit. Targets outside refs/heads/ (or
+ * that could escape .git) are ignored and HEAD is left as init wrote it.
+ */
+static int write_head_ref(const char *target, const char *sha) {
+    if (strncmp(target, "refs/heads/", 11) != 0 || target[11] == '\0' ||
+        strstr(target, "..") != NULL || strstr(target, "//") != NULL ||
+        target[strlen(target) - 1] == '/') {
+        return 0;
+    }
+
+    char path[GIT_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", GIT_ROOT_DIR, target);
+    /* Branch names may contain slashes: create each directory on the way */
+    for (char *slash = strchr(path + strlen(GIT_REFS_DIR) + 1, '/'); slash != NULL;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int failed = mkdir(path, DIRECTORY_PERMISSION) != 0 && errno != EEXIST;
+        *slash = '/';
+        if (failed) {
+            GIT_ERR("clone: cannot create %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    }
+
+    char line[GIT_PATH_MAX];
+    int len = snprintf(line, sizeof(line), "%s\n", sha);
+    if (write_file(path, line, (size_t)len, "wb") != 0) return 1;
+    len = snprintf(line, sizeof(line), "ref: %s\n", target);
+    return write_file(".git/HEAD", line, (size_t)len, "wb");
+}
+
+/* Accepts "blob:none" and "blob:limit=<n>[kmg]". */
+static int valid_filter(const char *spec) {
+    if (strcmp(spec, "blob:none") == 0) return 1;
+    if (strncmp(spec, "blob:limit=", 11) != 0) return 0;
+    const char *p = spec + 11;
+    if (*p < '0' || *p > '9') return 0;
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == 'k' || *p == 'm' || *p == 'g') p++;
+    return *p == '\0';
+}
+
+/*
+ * Writes .git/config with the origin remote. A filtered clone also
+ * names origin as its promisor, in the form git uses, so both this
+ * implementation and git know where missing objects come from.
+ */
+static int write_clone_config(const char *url, const char *filter) {
+    char config[GIT_PATH_MAX * 2];
+    int len = snprintf(config, sizeof(config),
+                       "[core]\n"
+                       "\trepositoryformatversion = %d\n"
+                       "\tbare = false\n"
+                       "[remote \"" PROMISOR_REMOTE "\"]\n"
+                       "\turl = %s\n"
+                       "\tfetch = +refs/heads/*:refs/remotes/" PROMISOR_REMOTE "/*\n",
+                       filter != NULL ? 1 : 0, url);
+    if (filter != NULL && len > 0 && (size_t)len < sizeof(config)) {
+        len += snprintf(config + len, sizeof(config) - (size_t)len,
+                        "\tpromisor = true\n"
+                        "\tpartialclonefilter = %s\n"
+                        "[extensions]\n"
+                        "\tpartialclone = " PROMISOR_REMOTE "\n",
+                        filter);
+    }
+    if (len < 0 || (size_t)len >= sizeof(config)) {
+        GIT_ERR("clone: URL too long\n");
+        return 1;
+    }
+    return write_file(GIT_CONFIG_FILE, config, (size_t)len, "wb");
+}
+
+/* Boundary commits of a shallow clone, as reported by the server. */
+typedef struct {
+    char *data;             /* "<hex>\n" lines, the .git/shallow format */
+    size_t len;
+    size_t capacity;
+} ShallowList;
+
+/* Collects a "shallow <sha>" line. */
+static int add_shallow(ShallowList *list, const char *line) {
+    if (list->len + OID_HEX_SIZE + 1 > list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 64 * (OID_HEX_SIZE + 1) : list->capacity * 2;
+        char *grown = realloc(list->data, new_capacity);
+        if (grown == NULL) {
+            GIT_ERR("clone: malloc failed\n");
+            return 1;
+        }
+        list->data = grown;
+        list->capacity = new_capacity;
+    }
+    memcpy(list->data + list->len, line + 8, OID_HEX_SIZE);
+    list->data[list->len + OID_HEX_SIZE] = '\n';
+    list->len += OID_HEX_SIZE + 1;
+    return 0;
+}
+
+/* A pack the server wants downloaded rather than sent inline. */
+typedef struct {
+    char hash[OID_HEX_SIZE + 1];
+    char *uri;              /* heap-allocated */
+} PackUri;
+
+/* What the text packets of a fetch response told us. */
+typedef struct {
+    ShallowList shallow;
+    PackUri *uris;
+    size_t uri_count;
+    int in_uris;            /* inside the v2 "packfile-uris" section */
+} FetchResponse;
+
+/* Collects a "<hash> <uri>" line of the packfile-uris section. */
+static int add_pack_uri(FetchResponse *response, const char *line, size_t len) {
+    if (len <= OID_HEX_SIZE + 1 || line[OID_HEX_SIZE] != ' ') {
+        GIT_ERR("clone: malformed packfile-uris line\n");
+        return 1;
+    }
+    PackUri *grown = realloc(response->uris, (response->uri_count + 1) * sizeof(PackUri));
+    if (grown == NULL) {
+        GIT_ERR("clone: malloc failed\n");
+        return 1;
+    }
+    response->uris = grown;
+    PackUri *entry = &response->uris[response->uri_count];
+    memcpy(entry->hash, line, OID_HEX_SIZE);
+    entry->hash[OID_HEX_SIZE] = '\0';
+    entry->uri = strndup(line + OID_HEX_SIZE + 1, len - OID_HEX_SIZE - 1);
+    if (entry->uri == NULL) {
+        GIT_ERR("clone: malloc failed\n");
+        return 1;
+    }
+    response->uri_count++;
+    return 0;
+}
+
+/*
+ * Demux line handler: collects "shallow <sha>" lines and the packs of
+ * a "packfile-uris" section; v2 section headers switch sections.
+ */
+static int response_line(const char *line, size_t len, void *ctx) {
+    FetchResponse *response = ctx;
+    if (len == 13 && memcmp(line, "packfile-uris", 13) == 0) {
+        response->in_uris = 1;
+        return 0;
+    }
+    if ((len == 8 && memcmp(line, "packfile", 8) == 0) ||
+        (len == 12 && memcmp(line, "shallow-info", 12) == 0)) {
+        response->in_uris = 0;
+        return 0;
+    }
+    if (response->in_uris) return add_pack_uri(response, line, len);
+    if (len == 8 + OID_HEX_SIZE && memcmp(line, "shallow ", 8) == 0) {
+        return add_shallow(&response->shallow, line);
+    }
     return 0;
 }
 
-int clone_repo(const char *url, const char *dir) {
+static void fetch_response_free(FetchResponse *response) {
+    free(response->shallow.data);
+    for (size_t i = 0; i < response->uri_count; i++) free(response->uris[i].uri);
+    free(response->uris);
+}
+
+/* HTTP sink: feeds response bytes into the side-band demultiplexer. */
+static int demux_sink(const unsigned char *data, size_t len, void *ctx) {
+    return pktline_demux_feed((PktlineDemux *)ctx, data, len);
+}
+
+/* Demux sink: feeds raw packfile bytes into the pack parser. */
+static int pack_sink(const unsigned char *data, size_t len, void *ctx) {
+    return packfile_stream_feed((PackStream *)ctx, data, len);
+}
+
+int clone_repo(const char *url, const char *dir, int depth, const char *filter, int threads) {
     int result = 1;
+    FetchResponse response = {0};
+    ObjectId *bundle_tips = NULL;
+    size_t bundle_tip_count = 0;
     char *want_body = NULL;
-    unsigned char *pack_data = NULL;
-    HttpResponse refs_resp = {0};
-    HttpResponse pack_resp = {0};
+    PackStream *pack = NULL;
+    HttpSession *http = NULL;
     int changed_dir = 0;
 
+    if (filter != NULL && !valid_filter(filter)) {
+        GIT_ERR("clone: unsupported filter '%s' (expected blob:none or blob:limit=<n>)\n", filter);
+        return 1;
+    }
+
     /* Step 1: Create target directory and init .git/ inside it */
     if (mkdir(dir, DIRECTORY_PERMISSION) == -1) {
         GIT_ERR("clone: failed to create directory %s\n", dir);
@@ -176,45 +600,127 @@ int clone_repo(const char *url, const char *dir) {
     if (init_git() != 0) goto cleanup;
 
     /* Step 2: Discover refs — get HEAD SHA */
-    if (http_get_refs(url, &refs_resp) != 0) goto cleanup;
+    http = http_session_new(url);
+    if (http == NULL) goto cleanup;
+    RemoteHead remote = {0};
+    uint64_t start = trace_now();
+    if (discover_head(http, &remote) != 0) goto cleanup;
+    trace_span("clone.discover", start);
+
+    /* Step 3: Build "want" request and stream the packfile into the store */
+    if (depth > 0 && !remote.shallow) {
+        GIT_ERR("clone: server does not support shallow clients\n");
+        goto cleanup;
+    }
+    if (filter != NULL && !remote.filter) {
+        GIT_ERR("clone: warning: filtering not recognized by server, ignoring\n");
+        filter = NULL;
+    }
+    /* Missing objects are fetched with protocol v2 only */
+    if (filter != NULL && !remote.v2) {
+        GIT_ERR("clone: warning: filtering needs protocol v2, ignoring\n");
+        filter = NULL;
+    }
+    if (write_clone_config(url, filter) != 0) goto cleanup;
 
-    char head_sha[41];
-    if (pktline_parse_head(refs_resp.data, refs_resp.size, head_sha) != 0) goto cleanup;
-    http_response_free(&refs_resp);
-    refs_resp = (HttpResponse){0};
+    /* Most of the history may be downloadable as static bundles; the
+     * fetch then only has to cover what they miss */
+    if (remote.bundle_uri && depth == 0 && filter == NULL) {
+        start = trace_now();
+        if (offload_fetch_bundles(http, threads, &bundle_tips, &bundle_tip_count) != 0) goto cleanup;
+        trace_span("clone.bundles", start);
+    }
 
-    /* Step 3: Build "want" request and fetch the packfile */
+    PktlineFetchOptions opts = { depth, filter, bundle_tips, bundle_tip_count, NULL, 0 };
+    ObjectId head;
+    if (oid_from_hex(remote.sha, &head) != 0) {
+        GIT_ERR("clone: malformed HEAD %s\n", remote.sha);
+        goto cleanup;
+    }
     size_t want_len;
-    if (pktline_build_want(head_sha, &want_body, &want_len) != 0) goto cleanup;
+    /* Progress is only worth sending when someone is watching it */
+    int progress = isatty(STDERR_FILENO);
+    if (remote.v2) {
+        /* v2 fetch is always side-band framed; ofs-delta is always allowed */
+        const char *args[4];
+        size_t arg_count = 0;
+        char uri_arg[32];
+        args[arg_count++] = "ofs-delta";
+        /* git's upload-pack only sends packfile-uris under sideband-all */
+        if (remote.packfile_uris && remote.sideband_all) {
+            snprintf(uri_arg, sizeof(uri_arg), "packfile-uris %s", offload_uri_protocols(http));
+            args[arg_count++] = "sideband-all";
+            args[arg_count++] = uri_arg;
+        }
+        if (!progress) args[arg_count++] = "no-progress";
+        if (pktline_build_fetch(&head, 1, args, arg_count, &opts, &want_body, &want_len) != 0)
+            goto cleanup;
+    } else {
+        char caps[64] = "";
+        if (remote.ofs_delta) strcat(caps, " ofs-delta");
+        if (remote.side_band) strcat(caps, progress ? " side-band-64k" : " side-band-64k no-progress");
+        if (depth > 0) strcat(caps, " shallow");
+        if (filter != NULL) strcat(caps, " filter");
+        if (pktline_build_want(&head, 1, caps[0] != '\0' ? caps + 1 : NULL, &opts, 1,
+                               &want_body, &want_len) != 0) goto cleanup;
+    }
+
+    pack = packfile_stream_new(PACK_MODE_INDEX);
+    if (pack == NULL) goto cleanup;
+    packfile_stream_set_threads(pack, threads);
+    PktlineDemux demux;
+    pktline_demux_init(&demux, pack_sink, pack);
+    pktline_demux_set_line_handler(&demux, response_line, &response);
+    if (remote.v2 && remote.packfile_uris && remote.sideband_all) pktline_demux_set_sideband_all(&demux);
+    PktlineMessageLog messages = {0};
+    pktline_demux_set_message_handler(&demux, pktline_print_message, &messages);
 
-    if (http_post_pack(url, want_body, want_len, &pack_resp) != 0) goto cleanup;
+    /* Download, side-band demux and pack parse overlap: see the counters */
+    start = trace_now();
+    if (http_post_pack(http, want_body, want_len, demux_sink, &demux) != 0) goto cleanup;
+    if (pktline_demux_finish(&demux) != 0) goto cleanup;
+    trace_span("clone.fetch", start);
+    /* Offloaded packs go in before the inline one is finished */
+    start = trace_now();
+    for (size_t i = 0; i < response.uri_count; i++) {
+        if (offload_fetch_pack(http, response.uris[i].hash, response.uris[i].uri, threads) != 0)
+            goto cleanup;
+    }
+    if (response.uri_count > 0) trace_span("clone.offload", start);
+    start = trace_now();
+    if (packfile_stream_finish(pack) != 0) goto cleanup;
+    trace_span("clone.finish_pack", start);
+    packstore_reprepare();
+    if (filter != NULL && promisor_mark_pack(packfile_stream_checksum(pack)) != 0) goto cleanup;
+    if (response.shallow.len > 0 &&
+        write_file(GIT_SHALLOW_FILE, response.shallow.data, response.shallow.len, "wb") != 0)
+        goto cleanup;
+    http_session_free(http);
+    http = NULL;
     free(want_body);
     want_body = NULL;
+    packfile_stream_free(pack);
+    pack = NULL;
 
-    /* Step 4: Extract raw packfile from response */
-    size_t pack_len;
-    if (pktline_strip_sideband(pack_resp.data, pack_resp.size,
-                               &pack_data, &pack_len) != 0) goto cleanup;
-    http_response_free(&pack_resp);
-    pack_resp = (HttpResponse){0};
-
-    /* Step 5: Parse packfile — writes all objects to .git/objects/ */
-    if (packfile_parse(pack_data, pack_len) != 0) goto cleanup;
-    free(pack_data);
-    pack_data = NULL;
+    /* Step 4: Checkout — commit → tree → working directory */
+    ObjectId tree;
+    start = trace_now();
+    if (get_tree_sha(&head, &tree) != 0) goto cleanup;
+    if (checkout_tree(&tree, ".", threads) != 0) goto cleanup;
+    if (write_head_ref(remote.target, remote.sha) != 0) goto cleanup;
+    trace_span("clone.checkout", start);
 
-    /* Step 6: Checkout — commit → tree → working directory */
-    char tree_sha[41];
-    if (get_tree_sha(head_sha, tree_sha) != 0) goto cleanup;
-    if (checkout_tree(tree_sha, ".") != 0) goto cleanup;
+    /* Step 7: only an optimization — the clone is complete without it */
+    if (commit_graph_write(&head, 1) != 0) GIT_ERR("clone: warning: commit-graph not written\n");
 
     result = 0;
 
 cleanup:
     free(want_body);
-    free(pack_data);
-    http_response_free(&refs_resp);
-    http_response_free(&pack_resp);
+    free(bundle_tips);
+    fetch_response_free(&response);
+    packfile_stream_free(pack);
+    http_session_free(http);
     if (changed_dir) {
         if (chdir(original_dir) != 0) {
             GIT_ERR("clone: chdir back to %s failed\n", original_dir);
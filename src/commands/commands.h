@@ -9,18 +9,36 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include "../objects/object_id.h"
+
 /* Initializes a new git repository by creating .git/, .git/refs/,
  * .git/objects/, and writing the default HEAD reference. */
 int init_git(void);
 
 /*
- * Reads and prints the content of a git blob object.
+ * Prints a git object's content (-p), type (-t) or size (-s).
  *
+ * @param flag  "-p", "-t" or "-s".
  * @param sha1  40-character hex SHA-1 hash identifying the object.
- *              Resolved to .git/objects/<first 2 chars>/<remaining 38>.
+ *              Looked up in the packs, then in .git/objects/<2>/<38>.
  * @return      0 on success, 1 on failure.
  */
-int cat_file(const char *sha1);
+int cat_file(const char *flag, const char *sha1);
+
+/*
+ * Prints the objects named on stdin, one 40-hex name per line, as
+ * "<sha> <type> <size>\n" followed (with contents) by the body and a
+ * newline — git's cat-file --batch / --batch-check output. Names that
+ * are not in the store print "<name> missing".
+ *
+ * stdout should be fully buffered: each answer is flushed as a whole
+ * after it is complete, or only at the end with buffer set.
+ *
+ * @param contents  1 for --batch (bodies too), 0 for --batch-check.
+ * @param buffer    1 for --buffer: no flush between answers.
+ * @return          0 on success, 1 if stdout could not be written.
+ */
+int cat_file_batch(int contents, int buffer);
 
 /*
  * Creates a git blob object from a file and writes it to the object store.
@@ -54,9 +72,13 @@ int ls_tree(const char *sha1);
  * resulting tree object to .git/objects/.
  * Prints the 40-character hex hash to stdout.
  *
- * @return  0 on success, 1 on failure.
+ * Blobs are hashed and written concurrently; the result is the same
+ * for any thread count.
+ *
+ * @param threads  Blob worker count (0 = one per CPU).
+ * @return         0 on success, 1 on failure.
  */
-int write_tree(void);
+int write_tree(int threads);
 
 /*
  * Creates a commit object linking a tree to its parent commit.
@@ -79,10 +101,98 @@ int commit_tree(const char *tree_sha, const char *parent_sha, const char *messag
  * from the remote, and checks out the HEAD commit's tree into the
  * working directory.
  *
- * @param url  Repository URL (e.g. "https://github.com/user/repo/").
- * @param dir  Target directory to clone into.
- * @return     0 on success, 1 on failure.
+ * A depth > 0 fetches only that many commits of history (a shallow
+ * clone). A filter ("blob:none", "blob:limit=<n>[kmg]") leaves blobs
+ * out of the pack; the remote is recorded as a promisor and missing
+ * blobs are fetched on demand, starting with those the checkout needs.
+ *
+ * @param url      Repository URL (e.g. "https://github.com/user/repo/").
+ * @param dir      Target directory to clone into.
+ * @param depth    Commits of history to fetch; 0 for all.
+ * @param filter   Object filter spec, or NULL for a full clone.
+ * @param threads  Delta resolution and checkout threads (0 = one per CPU).
+ * @return         0 on success, 1 on failure.
+ */
+int clone_repo(const char *url, const char *dir, int depth, const char *filter, int threads);
+
+/*
+ * Checks out a tree object into a directory (clone's last step).
+ *
+ * Phase 1 (serial) walks the trees and creates all directories, so
+ * that phase 2 never races on a parent. Phase 2 hands every file to a
+ * thread pool that reads the blob and writes it out, with the type
+ * its mode asks for (executable file, symlink, or an empty directory
+ * for a submodule). A failing file does not stop the others; all
+ * failures are reported at the end.
+ * Once every file is in place, .git/index records them all.
+ *
+ * @param tree     Root tree to check out.
+ * @param dir      Existing directory to populate.
+ * @param threads  Worker count (0 = one per CPU).
+ * @return         0 on success, 1 on failure.
+ */
+int checkout_tree(const ObjectId *tree, const char *dir, int threads);
+
+/*
+ * Fetches new history from the origin remote (remote.origin.url).
+ *
+ * Negotiates with multi_ack_detailed over protocol v0 so that the
+ * server sends only the objects missing here, as a thin pack that is
+ * completed against local objects. Then updates
+ * refs/remotes/origin/<branch> for every remote branch and writes
+ * FETCH_HEAD.
+ *
+ * @param threads  Delta resolution threads (0 = one per CPU).
+ * @return         0 on success, 1 on failure.
+ */
+int fetch_origin(int threads);
+
+/*
+ * Stores a packfile read from stdin without unpacking it.
+ *
+ * The pack is written verbatim to .git/objects/pack/pack-<checksum>.pack
+ * and a v2 index (fanout, sorted SHAs, CRC32s, offsets) is generated
+ * next to it. Prints "pack\t<checksum>" to stdout.
+ *
+ * @param threads  Delta resolution threads (0 = one per CPU).
+ * @return         0 on success, 1 on failure.
+ */
+int index_pack(int threads);
+
+/*
+ * Packs all loose objects into one new pack and deletes them.
+ *
+ * Objects are deltified against each other with a sliding window:
+ * each is tried against the window previous objects of its type (in
+ * type / name / size order), and chains are kept to depth deltas.
+ * Loose objects already in a pack are just deleted.
+ *
+ * @param window  Delta search window (0 = no deltas).
+ * @param depth   Longest delta chain.
+ * @return        0 on success, 1 on failure.
+ */
+int gc(int window, int depth);
+
+/* How rev_list() prints each commit. */
+typedef enum {
+    REV_LIST_OIDS,      /* rev-list: one ID per line */
+    REV_LIST_MEDIUM,    /* log: ID, Merge:, Author:, Date:, indented message */
+    REV_LIST_ONELINE,   /* log --oneline: abbreviated ID and subject */
+} RevListFormat;
+
+/*
+ * Lists the commits reachable from revs, newest committer date first,
+ * as git rev-list and git log order them by default.
+ *
+ * Commits in the commit-graph are walked without reading them from
+ * the object store (log still reads the ones it prints).
+ *
+ * @param revs       Revisions: IDs, ref names, HEAD; tags are peeled.
+ * @param rev_count  Number of revs.
+ * @param max_count  Stop after this many commits (-1 = no limit).
+ * @param format     Output format.
+ * @return           0 on success, 1 on failure.
  */
-int clone_repo(const char *url, const char *dir);
+int rev_list(char **revs, size_t rev_count, long max_count, RevListFormat format);
 
 #endif /* COMMANDS_H */
@@ -57,11 +57,12 @@ int commit_tree(const char *tree_sha, const char *parent_sha, const char *messag
         "committer Dev <dev@example.com> %ld +0000\n\n%s\n",
         tree_sha, parent_sha, (long)now, (long)now, message);
 
-    char *sha_hex = object_write(commit_data, total_size);
+    ObjectId oid;
+    int failed = object_write(commit_data, total_size, &oid);
     free(commit_data);
-    if (sha_hex == NULL) return 1;
+    if (failed) return 1;
 
-    printf("%s\n", sha_hex);
-    free(sha_hex);
+    char hex[OID_HEX_SIZE + 1];
+    printf("%s\n", oid_to_hex(&oid, hex));
     return 0;
 }
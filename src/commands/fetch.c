@@ -0,0 +1,731 @@
+/*
+ * fetch.c
+ *
+ * Implements the "git fetch" command — brings the origin remote's
+ * branches up to date, transferring only the objects we are missing.
+ *
+ * Pipeline:
+ *   1. GET the v0 ref advertisement. Every advertised branch whose
+ *      commit is not in the object store becomes a "want".
+ *   2. Negotiate (multi_ack_detailed): the commits reachable from our
+ *      refs are walked newest first and offered as "have" lines, in
+ *      rounds of growing size. The server answers each round with
+ *      "ACK <sha> common" for commits it shares, "ACK <sha> ready"
+ *      once it can build a pack, and a closing NAK. HTTP is stateless,
+ *      so every round repeats the wants and the acknowledged commits;
+ *      ancestors of an acknowledged commit are never offered.
+ *   3. Send "done" and stream the pack into .git/objects/pack/. The
+ *      pack is thin — its deltas may be based on objects we already
+ *      have — and is completed from the object store as it is indexed.
+ *   4. Point refs/remotes/origin/<branch> at the fetched commits and
+ *      record them in FETCH_HEAD.
+ *   5. Rewrite the commit-graph to take in the new commits.
+ *
+ * The negotiation walk takes dates and parents from the commit-graph
+ * for the commits it has, and inflates only those fetched since.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "commands.h"
+#include "../objects/commit_graph.h"
+#include "../objects/object.h"
+#include "../objects/promisor.h"
+#include "../utils/config/config.h"
+#include "../utils/file/file.h"
+#include "../utils/trace/trace.h"
+#include "../net/http.h"
+#include "../net/pktline.h"
+#include "../pack/packfile.h"
+#include "../pack/packstore.h"
+#include "../refs/refs.h"
+
+/* Haves in the first negotiation round; each round doubles it ... */
+#define FETCH_FIRST_ROUND 16
+/* ... up to this many */
+#define FETCH_MAX_ROUND 1024
+/* Once something is common, give up after this many unacknowledged haves */
+#define FETCH_MAX_IN_VAIN 256
+
+/* Walk flags */
+#define WALK_QUEUED   1u    /* pushed onto the date queue */
+#define WALK_PARSED   2u    /* date and parents read */
+#define WALK_COMMON   4u    /* the server has it, so it has the ancestors too */
+
+/* One commit of the negotiation walk. */
+typedef struct {
+    ObjectId oid;
+    unsigned long long date;    /* committer time */
+    size_t *parents;            /* node indices; heap-allocated */
+    size_t parent_count;
+    unsigned int flags;
+} WalkNode;
+
+/*
+ * The commits reachable from our refs, discovered lazily: a node's
+ * parents are read when the node is queued, and the queue hands out
+ * the newest commit first, as git's negotiator does.
+ */
+typedef struct {
+    WalkNode *nodes;
+    size_t count;
+    size_t capacity;
+    size_t *table;              /* open addressing, node index + 1; 0 = empty */
+    size_t table_size;          /* power of two */
+    size_t *queue;              /* binary max-heap of node indices by date */
+    size_t queue_len;
+    size_t queue_capacity;
+    const ObjectId *shallows;   /* boundary commits, whose parents are absent */
+    size_t shallow_count;
+    const CommitGraph *graph;   /* dates and parents without inflating; may be NULL */
+} CommitWalk;
+
+static size_t walk_slot(const CommitWalk *walk, const ObjectId *oid) {
+    size_t mask = walk->table_size - 1;
+    size_t i = ((size_t)oid->hash[0] << 24 | (size_t)oid->hash[1] << 16 |
+                (size_t)oid->hash[2] << 8 | oid->hash[3]) & mask;
+    while (walk->table[i] != 0 && !oid_equal(&walk->nodes[walk->table[i] - 1].oid, oid)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Index of oid's node, or SIZE_MAX if the walk has not met it. */
+static size_t walk_find(const CommitWalk *walk, const ObjectId *oid) {
+    if (walk->table_size == 0) return SIZE_MAX;
+    size_t slot = walk->table[walk_slot(walk, oid)];
+    return slot == 0 ? SIZE_MAX : slot - 1;
+}
+
+/* Index of oid's node, added if new; SIZE_MAX on allocation failure. */
+static size_t walk_node(CommitWalk *walk, const ObjectId *oid) {
+    size_t found = walk_find(walk, oid);
+    if (found != SIZE_MAX) return found;
+
+    if ((walk->count + 1) * 2 > walk->table_size) {
+        size_t new_size = walk->table_size == 0 ? 1024 : walk->table_size * 2;
+        size_t *table = calloc(new_size, sizeof(size_t));
+        if (table == NULL) goto oom;
+        free(walk->table);
+        walk->table = table;
+        walk->table_size = new_size;
+        for (size_t i = 0; i < walk->count; i++) {
+            walk->table[walk_slot(walk, &walk->nodes[i].oid)] = i + 1;
+        }
+    }
+    if (walk->count == walk->capacity) {
+        size_t new_capacity = walk->capacity == 0 ? 512 : walk->capacity * 2;
+        WalkNode *grown = realloc(walk->nodes, new_capacity * sizeof(WalkNode));
+        if (grown == NULL) goto oom;
+        walk->nodes = grown;
+        walk->capacity = new_capacity;
+    }
+    WalkNode *node = &walk->nodes[walk->count];
+    memset(node, 0, sizeof(*node));
+    node->oid = *oid;
+    walk->table[walk_slot(walk, oid)] = walk->count + 1;
+    return walk->count++;
+
+oom:
+    GIT_ERR("fetch: malloc failed for commit walk\n");
+    return SIZE_MAX;
+}
+
+static int is_shallow(const CommitWalk *walk, const ObjectId *oid) {
+    for (size_t i = 0; i < walk->shallow_count; i++) {
+        if (oid_equal(&walk->shallows[i], oid)) return 1;
+    }
+    return 0;
+}
+
+/* walk_parse() for a commit of the commit-graph: no inflating. */
+static int walk_parse_graph(CommitWalk *walk, size_t index, uint32_t pos) {
+    size_t parent_count = 0;
+    while (!is_shallow(walk, &walk->nodes[index].oid) &&
+           commit_graph_parent(walk->graph, pos, parent_count) != COMMIT_GRAPH_NONE) {
+        parent_count++;
+    }
+    size_t *parents = parent_count > 0 ? malloc(parent_count * sizeof(size_t)) : NULL;
+    if (parent_count > 0 && parents == NULL) {
+        GIT_ERR("fetch: malloc failed for commit walk\n");
+        return 1;
+    }
+    for (size_t i = 0; i < parent_count; i++) {
+        ObjectId parent;
+        commit_graph_oid(walk->graph, commit_graph_parent(walk->graph, pos, i), &parent);
+        parents[i] = walk_node(walk, &parent);
+        if (parents[i] == SIZE_MAX) {
+            free(parents);
+            return 1;
+        }
+    }
+
+    WalkNode *node = &walk->nodes[index];
+    node->parents = parents;
+    node->parent_count = parent_count;
+    node->date = commit_graph_date(walk->graph, pos);
+    node->flags |= WALK_PARSED;
+    return 0;
+}
+
+/*
+ * Reads a commit's committer time and parents. Parents that are not
+ * in the object store (beyond a shallow boundary) are left out.
+ */
+static int walk_parse(CommitWalk *walk, size_t index) {
+    ObjectId oid = walk->nodes[index].oid;
+    uint32_t pos = walk->graph != NULL ? commit_graph_find(walk->graph, &oid) : COMMIT_GRAPH_NONE;
+    if (pos != COMMIT_GRAPH_NONE) return walk_parse_graph(walk, index, pos);
+    GitObject obj;
+    if (object_read(&oid, &obj) != 0) return 1;
+    int result = 1;
+    size_t *parents = NULL;
+    size_t parent_count = 0;
+    unsigned long long date = 0;
+
+    const char *p = (const char *)obj.body;
+    const char *end = p + obj.body_size;
+    int shallow = is_shallow(walk, &oid);
+    /* Headers end at the first empty line */
+    while (p < end && *p != '\n') {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == NULL) eol = end;
+        ObjectId parent;
+        if (!shallow && eol - p == 7 + OID_HEX_SIZE && memcmp(p, "parent ", 7) == 0 &&
+            oid_from_hex(p + 7, &parent) == 0 && object_exists(&parent)) {
+            size_t *grown = realloc(parents, (parent_count + 1) * sizeof(size_t));
+            if (grown == NULL) {
+                GIT_ERR("fetch: malloc failed for commit walk\n");
+                goto cleanup;
+            }
+            parents = grown;
+            size_t parent_index = walk_node(walk, &parent);
+            if (parent_index == SIZE_MAX) goto cleanup;
+            parents[parent_count++] = parent_index;
+        } else if (eol - p > 10 && memcmp(p, "committer ", 10) == 0) {
+            /* "committer <name> <<email>> <time> <tz>" */
+            const char *gt = p;
+            for (const char *q = p; q < eol; q++) {
+                if (*q == '>') gt = q;
+            }
+            date = strtoull(gt + 1, NULL, 10);
+        }
+        p = eol + 1;
+    }
+
+    WalkNode *node = &walk->nodes[index];
+    node->parents = parents;
+    node->parent_count = parent_count;
+    node->date = date;
+    node->flags |= WALK_PARSED;
+    parents = NULL;
+    result = 0;
+
+cleanup:
+    free(parents);
+    free(obj.raw);
+    return result;
+}
+
+static int walk_newer(const CommitWalk *walk, size_t a, size_t b) {
+    return walk->nodes[a].date > walk->nodes[b].date;
+}
+
+/* Parses a commit and queues it, once. */
+static int walk_push(CommitWalk *walk, size_t index) {
+    if (walk->nodes[index].flags & WALK_QUEUED) return 0;
+    if (!(walk->nodes[index].flags & WALK_PARSED) && walk_parse(walk, index) != 0) return 1;
+    if (walk->queue_len == walk->queue_capacity) {
+        size_t new_capacity = walk->queue_capacity == 0 ? 256 : walk->queue_capacity * 2;
+        size_t *grown = realloc(walk->queue, new_capacity * sizeof(size_t));
+        if (grown == NULL) {
+            GIT_ERR("fetch: malloc failed for commit walk\n");
+            return 1;
+        }
+        walk->queue = grown;
+        walk->queue_capacity = new_capacity;
+    }
+    walk->nodes[index].flags |= WALK_QUEUED;
+
+    size_t i = walk->queue_len++;
+    while (i > 0 && walk_newer(walk, index, walk->queue[(i - 1) / 2])) {
+        walk->queue[i] = walk->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    walk->queue[i] = index;
+    return 0;
+}
+
+/* Takes the newest queued commit; SIZE_MAX once the walk is done. */
+static size_t walk_pop(CommitWalk *walk) {
+    if (walk->queue_len == 0) return SIZE_MAX;
+    size_t top = walk->queue[0];
+    size_t last = walk->queue[--walk->queue_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= walk->queue_len) break;
+        if (child + 1 < walk->queue_len && walk_newer(walk, walk->queue[child + 1], walk->queue[child])) {
+            child++;
+        }
+        if (!walk_newer(walk, walk->queue[child], last)) break;
+        walk->queue[i] = walk->queue[child];
+        i = child;
+    }
+    walk->queue[i] = last;
+    return top;
+}
+
+/*
+ * Marks a commit and every ancestor the walk has parsed as common.
+ * Ancestors not parsed yet pick the flag up when they are queued.
+ */
+static int walk_mark_common(CommitWalk *walk, size_t index) {
+    size_t *stack = malloc(sizeof(size_t) * 64);
+    size_t len = 0, capacity = 64;
+    if (stack == NULL) {
+        GIT_ERR("fetch: malloc failed for commit walk\n");
+        return 1;
+    }
+    walk->nodes[index].flags |= WALK_COMMON;
+    stack[len++] = index;
+    while (len > 0) {
+        WalkNode *node = &walk->nodes[stack[--len]];
+        for (size_t i = 0; i < node->parent_count; i++) {
+            WalkNode *parent = &walk->nodes[node->parents[i]];
+            if (parent->flags & WALK_COMMON) continue;
+            parent->flags |= WALK_COMMON;
+            if (len == capacity) {
+                size_t *grown = realloc(stack, capacity * 2 * sizeof(size_t));
+                if (grown == NULL) {
+                    GIT_ERR("fetch: malloc failed for commit walk\n");
+                    free(stack);
+                    return 1;
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[len++] = node->parents[i];
+        }
+    }
+    free(stack);
+    return 0;
+}
+
+static void walk_free(CommitWalk *walk) {
+    for (size_t i = 0; i < walk->count; i++) free(walk->nodes[i].parents);
+    free(walk->nodes);
+    free(walk->table);
+    free(walk->queue);
+}
+
+/* Queues a local ref's target if it is a commit we have. */
+static int walk_add_tip(CommitWalk *walk, const ObjectId *oid) {
+    int type;
+    size_t size;
+    if (!object_exists(oid) || object_read_header(oid, &type, &size) != 0 || type != OBJ_COMMIT) {
+        return 0;
+    }
+    size_t index = walk_node(walk, oid);
+    return index == SIZE_MAX ? 1 : walk_push(walk, index);
+}
+
+/* refs_for_each() callback: queues every ref's commit. */
+static int walk_add_ref(const char *name, const ObjectId *oid, void *ctx) {
+    (void)name;
+    return walk_add_tip(ctx, oid);
+}
+
+/* Accepts branch names that stay inside refs/remotes/origin/. */
+static int valid_branch(const char *name) {
+    return name[0] != '\0' && name[0] != '/' && strstr(name, "..") == NULL &&
+           strstr(name, "//") == NULL && name[strlen(name) - 1] != '/';
+}
+
+/* One branch of the remote, under refs/heads/. */
+typedef struct {
+    char name[256];             /* without "refs/heads/" */
+    ObjectId oid;
+} RemoteBranch;
+
+typedef struct {
+    RemoteBranch *branches;
+    size_t count;
+} RemoteBranches;
+
+/* pktline_for_each_ref() callback: keeps the remote's branches. */
+static int collect_branch(const ObjectId *oid, const char *name, size_t name_len, void *ctx) {
+    RemoteBranches *remote = ctx;
+    if (name_len <= 11 || memcmp(name, "refs/heads/", 11) != 0) return 0;
+    name += 11;
+    name_len -= 11;
+    if (name_len >= sizeof(remote->branches[0].name)) return 0;
+
+    RemoteBranch *grown = realloc(remote->branches, (remote->count + 1) * sizeof(RemoteBranch));
+    if (grown == NULL) {
+        GIT_ERR("fetch: malloc failed\n");
+        return 1;
+    }
+    remote->branches = grown;
+    RemoteBranch *branch = &remote->branches[remote->count];
+    memcpy(branch->name, name, name_len);
+    branch->name[name_len] = '\0';
+    if (!valid_branch(branch->name)) return 0;
+    branch->oid = *oid;
+    remote->count++;
+    return 0;
+}
+
+/* What the server said about our haves. */
+typedef struct {
+    CommitWalk *walk;
+    ObjectId *commons;          /* acknowledged haves, resent every round */
+    size_t common_count;
+    size_t common_capacity;
+    int new_common;             /* this reply acknowledged something new */
+    int ready;                  /* the server can make a pack now */
+} Negotiation;
+
+/* Line handler: "ACK <sha> common|ready|continue", "ACK <sha>", "NAK". */
+static int negotiation_line(const char *line, size_t len, void *ctx) {
+    Negotiation *neg = ctx;
+    ObjectId oid;
+    if (len < 4 + OID_HEX_SIZE || memcmp(line, "ACK ", 4) != 0 || oid_from_hex(line + 4, &oid) != 0) {
+        return 0;
+    }
+    const char *status = line + 4 + OID_HEX_SIZE;
+    size_t status_len = len - (4 + OID_HEX_SIZE);
+    if (status_len == 6 && memcmp(status, " ready", 6) == 0) neg->ready = 1;
+
+    size_t index = walk_find(neg->walk, &oid);
+    if (index == SIZE_MAX || (neg->walk->nodes[index].flags & WALK_COMMON)) return 0;
+    if (walk_mark_common(neg->walk, index) != 0) return 1;
+    if (neg->common_count == neg->common_capacity) {
+        size_t new_capacity = neg->common_capacity == 0 ? 64 : neg->common_capacity * 2;
+        ObjectId *grown = realloc(neg->commons, new_capacity * sizeof(ObjectId));
+        if (grown == NULL) {
+            GIT_ERR("fetch: malloc failed\n");
+            return 1;
+        }
+        neg->commons = grown;
+        neg->common_capacity = new_capacity;
+    }
+    neg->commons[neg->common_count++] = oid;
+    neg->new_common = 1;
+    return 0;
+}
+
+/* Demux sink of a negotiation round, whose reply carries no pack. */
+static int reject_pack(const unsigned char *data, size_t len, void *ctx) {
+    (void)data; (void)len; (void)ctx;
+    GIT_ERR("fetch: unexpected pack data during negotiation\n");
+    return 1;
+}
+
+/* Demux sink: feeds raw packfile bytes into the pack parser. */
+static int pack_sink(const unsigned char *data, size_t len, void *ctx) {
+    return packfile_stream_feed((PackStream *)ctx, data, len);
+}
+
+/* HTTP sink: feeds response bytes into the side-band demultiplexer. */
+static int demux_sink(const unsigned char *data, size_t len, void *ctx) {
+    return pktline_demux_feed((PktlineDemux *)ctx, data, len);
+}
+
+/*
+ * POSTs one upload-pack request, sending ACK/NAK lines to the
+ * negotiation and pack data (if any) to sink.
+ */
+static int post_request(HttpSession *http, const char *body, size_t body_len,
+                        Negotiation *neg, PktlineSink sink, void *sink_ctx) {
+    PktlineDemux demux;
+    pktline_demux_init(&demux, sink, sink_ctx);
+    pktline_demux_set_line_handler(&demux, negotiation_line, neg);
+    PktlineMessageLog messages = {0};
+    pktline_demux_set_message_handler(&demux, pktline_print_message, &messages);
+    if (http_post_pack(http, body, body_len, demux_sink, &demux) != 0) return 1;
+    return pktline_demux_finish(&demux);
+}
+
+/*
+ * Runs negotiation rounds until the server is ready, our history runs
+ * out, or too many haves in a row went unacknowledged. Afterwards
+ * neg->commons holds what the final request should repeat.
+ */
+static int negotiate(HttpSession *http, const ObjectId *wants, size_t want_count,
+                     const char *caps, PktlineFetchOptions *opts, Negotiation *neg) {
+    CommitWalk *walk = neg->walk;
+    ObjectId *haves = NULL;
+    char *body = NULL;
+    size_t round = FETCH_FIRST_ROUND;
+    size_t in_vain = 0;
+    int result = 1;
+
+    while (!neg->ready) {
+        ObjectId *grown = realloc(haves, (neg->common_count + round) * sizeof(ObjectId));
+        if (grown == NULL) {
+            GIT_ERR("fetch: malloc failed\n");
+            goto cleanup;
+        }
+        haves = grown;
+        memcpy(haves, neg->commons, neg->common_count * sizeof(ObjectId));
+        size_t count = neg->common_count;
+
+        /* Newest commits first; common ones are walked through, not sent */
+        size_t index;
+        while (count < neg->common_count + round && (index = walk_pop(walk)) != SIZE_MAX) {
+            WalkNode node = walk->nodes[index];
+            for (size_t i = 0; i < node.parent_count; i++) {
+                if (node.flags & WALK_COMMON) walk->nodes[node.parents[i]].flags |= WALK_COMMON;
+                if (walk_push(walk, node.parents[i]) != 0) goto cleanup;
+            }
+            if (!(node.flags & WALK_COMMON)) haves[count++] = node.oid;
+        }
+        size_t sent = count - neg->common_count;
+        if (sent == 0) break;
+
+        opts->haves = haves;
+        opts->have_count = count;
+        size_t body_len;
+        if (pktline_build_want(wants, want_count, caps, opts, 0, &body, &body_len) != 0) goto cleanup;
+        neg->new_common = 0;
+        if (post_request(http, body, body_len, neg, reject_pack, NULL) != 0) goto cleanup;
+        free(body);
+        body = NULL;
+
+        in_vain = neg->new_common ? 0 : in_vain + sent;
+        if (neg->common_count > 0 && in_vain >= FETCH_MAX_IN_VAIN) break;
+        if (round < FETCH_MAX_ROUND) round *= 2;
+    }
+    result = 0;
+
+cleanup:
+    opts->haves = NULL;
+    opts->have_count = 0;
+    free(haves);
+    free(body);
+    return result;
+}
+
+/* Writes .git/refs/remotes/origin/<name>, creating directories on the way. */
+static int write_remote_ref(const char *name, const ObjectId *oid) {
+    char path[GIT_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/remotes/" PROMISOR_REMOTE "/%s", GIT_REFS_DIR, name);
+    for (char *slash = strchr(path + strlen(GIT_REFS_DIR) + 1, '/'); slash != NULL;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int failed = mkdir(path, DIRECTORY_PERMISSION) != 0 && errno != EEXIST;
+        *slash = '/';
+        if (failed) {
+            GIT_ERR("fetch: cannot create %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    }
+    char hex[OID_HEX_SIZE + 1], line[OID_HEX_SIZE + 2];
+    int len = snprintf(line, sizeof(line), "%s\n", oid_to_hex(oid, hex));
+    return write_file(path, line, (size_t)len, "wb");
+}
+
+/* Reads .git/refs/remotes/origin/<name>; 1 if there is no such ref. */
+static int read_remote_ref(const char *name, ObjectId *oid) {
+    char path[GIT_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/remotes/" PROMISOR_REMOTE "/%s", GIT_REFS_DIR, name);
+    if (access(path, F_OK) != 0) return 1;
+    long size;
+    char *content = read_file(path, &size);
+    int result = content == NULL || size < OID_HEX_SIZE || oid_from_hex(content, oid) != 0;
+    free(content);
+    return result;
+}
+
+/*
+ * Updates the remote-tracking refs, reporting each change the way
+ * git does, and writes FETCH_HEAD. The branch HEAD is on is marked
+ * for merge; the others are not.
+ */
+static int update_refs(const char *url, const RemoteBranches *remote) {
+    char head[GIT_PATH_MAX] = "";
+    if (access(GIT_ROOT_DIR "/HEAD", F_OK) == 0) {
+        long size;
+        char *content = read_file(GIT_ROOT_DIR "/HEAD", &size);
+        if (content != NULL && size > 16 && strncmp(content, "ref: refs/heads/", 16) == 0) {
+            snprintf(head, sizeof(head), "%.*s", (int)strcspn(content + 16, "\n"), content + 16);
+        }
+        free(content);
+    }
+
+    FILE *fetch_head = fopen(GIT_ROOT_DIR "/FETCH_HEAD", "wb");
+    if (fetch_head == NULL) {
+        GIT_ERR("fetch: cannot write FETCH_HEAD: %s\n", strerror(errno));
+        return 1;
+    }
+    int reported = 0;
+    for (size_t i = 0; i < remote->count; i++) {
+        const RemoteBranch *branch = &remote->branches[i];
+        char hex[OID_HEX_SIZE + 1];
+        fprintf(fetch_head, "%s\t%s\tbranch '%s' of %s\n", oid_to_hex(&branch->oid, hex),
+                strcmp(branch->name, head) == 0 ? "" : "not-for-merge", branch->name, url);
+
+        ObjectId old;
+        int is_new = read_remote_ref(branch->name, &old) != 0;
+        if (!is_new && oid_equal(&old, &branch->oid)) continue;
+        if (write_remote_ref(branch->name, &branch->oid) != 0) {
+            fclose(fetch_head);
+            return 1;
+        }
+        if (!reported++) GIT_ERR("From %s\n", url);
+        if (is_new) {
+            GIT_ERR(" * [new branch]      %s -> " PROMISOR_REMOTE "/%s\n", branch->name, branch->name);
+        } else {
+            char old_hex[OID_HEX_SIZE + 1];
+            oid_to_hex(&old, old_hex);
+            GIT_ERR("   %.7s..%.7s  %s -> " PROMISOR_REMOTE "/%s\n", old_hex, hex,
+                    branch->name, branch->name);
+        }
+    }
+    if (fclose(fetch_head) != 0) {
+        GIT_ERR("fetch: cannot write FETCH_HEAD: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int fetch_origin(int threads) {
+    char url[GIT_PATH_MAX];
+    if (config_get("remote." PROMISOR_REMOTE ".url", url, sizeof(url)) != 0) {
+        GIT_ERR("fetch: no url configured for remote '" PROMISOR_REMOTE "'\n");
+        return 1;
+    }
+
+    int result = 1;
+    HttpSession *http = NULL;
+    HttpResponse refs = {0};
+    RemoteBranches remote = {0};
+    ObjectId *wants = NULL;
+    ObjectId *shallows = NULL;
+    size_t shallow_count = 0;
+    CommitWalk walk = {0};
+    CommitGraph *graph = NULL;
+    Negotiation neg = { &walk, NULL, 0, 0, 0, 0 };
+    char *body = NULL;
+    PackStream *pack = NULL;
+
+    /* Step 1: the remote's branches; those we lack are the wants */
+    http = http_session_new(url);
+    if (http == NULL) goto cleanup;
+    uint64_t start = trace_now();
+    if (http_get_refs(http, &refs) != 0) goto cleanup;
+    trace_span("fetch.discover", start);
+    if (pktline_is_v2(refs.data, refs.size)) {
+        GIT_ERR("fetch: server answered with protocol v2 unasked\n");
+        goto cleanup;
+    }
+    if (pktline_for_each_ref(refs.data, refs.size, collect_branch, &remote) != 0) goto cleanup;
+
+    wants = malloc((remote.count + 1) * sizeof(ObjectId));
+    if (wants == NULL) {
+        GIT_ERR("fetch: malloc failed\n");
+        goto cleanup;
+    }
+    size_t want_count = 0;
+    for (size_t i = 0; i < remote.count; i++) {
+        int duplicate = 0;
+        for (size_t j = 0; j < want_count; j++) duplicate |= oid_equal(&wants[j], &remote.branches[i].oid);
+        if (!duplicate && !object_exists(&remote.branches[i].oid)) wants[want_count++] = remote.branches[i].oid;
+    }
+
+    if (want_count > 0) {
+        char caps[128] = "";
+        int multi_ack = pktline_has_capability(refs.data, refs.size, "multi_ack_detailed");
+        if (multi_ack) strcat(caps, " multi_ack_detailed");
+        if (pktline_has_capability(refs.data, refs.size, "side-band-64k")) {
+            strcat(caps, isatty(STDERR_FILENO) ? " side-band-64k" : " side-band-64k no-progress");
+        }
+        if (pktline_has_capability(refs.data, refs.size, "ofs-delta")) strcat(caps, " ofs-delta");
+        if (pktline_has_capability(refs.data, refs.size, "thin-pack")) strcat(caps, " thin-pack");
+
+        if (refs_read_shallow(&shallows, &shallow_count) != 0) goto cleanup;
+        if (shallow_count > 0) {
+            if (!pktline_has_capability(refs.data, refs.size, "shallow")) {
+                GIT_ERR("fetch: server does not support shallow clients\n");
+                goto cleanup;
+            }
+            strcat(caps, " shallow");
+        }
+        /* A partial clone keeps its filter, or the pack brings every blob */
+        char filter[256];
+        int filtered = config_get_bool("remote." PROMISOR_REMOTE ".promisor") &&
+                       config_get("remote." PROMISOR_REMOTE ".partialclonefilter", filter, sizeof(filter)) == 0 &&
+                       pktline_has_capability(refs.data, refs.size, "filter");
+        if (filtered) strcat(caps, " filter");
+        PktlineFetchOptions opts = { 0, filtered ? filter : NULL, NULL, 0, shallows, shallow_count };
+
+        /* Step 2: offer what we have */
+        start = trace_now();
+        walk.shallows = shallows;
+        walk.shallow_count = shallow_count;
+        walk.graph = graph = commit_graph_open();
+        if (refs_for_each(walk_add_ref, &walk) != 0) goto cleanup;
+        if (multi_ack) {
+            if (negotiate(http, wants, want_count, caps + 1, &opts, &neg) != 0) goto cleanup;
+        } else {
+            /* Without multi_ack_detailed, offer just our tips along with "done" */
+            neg.commons = malloc((walk.queue_len + 1) * sizeof(ObjectId));
+            if (neg.commons == NULL) {
+                GIT_ERR("fetch: malloc failed\n");
+                goto cleanup;
+            }
+            for (size_t i = 0; i < walk.queue_len; i++) neg.commons[i] = walk.nodes[walk.queue[i]].oid;
+            neg.common_count = walk.queue_len;
+        }
+        trace_span("fetch.negotiate", start);
+
+        /* Step 3: "done", and the (thin) pack */
+        opts.haves = neg.commons;
+        opts.have_count = neg.common_count;
+        size_t body_len;
+        if (pktline_build_want(wants, want_count, caps + 1, &opts, 1, &body, &body_len) != 0) goto cleanup;
+        pack = packfile_stream_new(PACK_MODE_INDEX);
+        if (pack == NULL) goto cleanup;
+        packfile_stream_set_threads(pack, threads);
+        start = trace_now();
+        if (post_request(http, body, body_len, &neg, pack_sink, pack) != 0) goto cleanup;
+        trace_span("fetch.pack", start);
+        start = trace_now();
+        if (packfile_stream_finish(pack) != 0) goto cleanup;
+        trace_span("fetch.finish_pack", start);
+        packstore_reprepare();
+        if (filtered && promisor_mark_pack(packfile_stream_checksum(pack)) != 0) goto cleanup;
+    }
+
+    /* Step 4: remote-tracking refs and FETCH_HEAD */
+    start = trace_now();
+    result = update_refs(url, &remote);
+    if (result == 0) trace_span("fetch.update_refs", start);
+
+    /* Step 5: only an optimization — the fetch is complete without it */
+    if (result == 0 && commit_graph_write(NULL, 0) != 0) {
+        GIT_ERR("fetch: warning: commit-graph not written\n");
+    }
+
+cleanup:
+    packfile_stream_free(pack);
+    free(body);
+    free(neg.commons);
+    walk_free(&walk);
+    commit_graph_close(graph);
+    free(shallows);
+    free(wants);
+    free(remote.branches);
+    http_response_free(&refs);
+    http_session_free(http);
+    return result;
+}
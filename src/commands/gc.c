@@ -0,0 +1,188 @@
+/*
+ * gc.c
+ *
+ * Implements the "git gc" command — packs every loose object into one
+ * new pack (with deltas, see pack_objects.c) and deletes the loose
+ * files. Loose objects that some pack already holds are just deleted.
+ *
+ * git hashes each object's full path for the delta search order; here
+ * the trees among the loose objects supply the entry names of the
+ * blobs and trees they list, which is what the hash weighs most.
+ */
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../objects/object.h"
+#include "../pack/pack_objects.h"
+#include "../pack/packfile.h"
+#include "../pack/packstore.h"
+#include "../utils/file/file.h"
+#include "../utils/trace/trace.h"
+#include "commands.h"
+
+/* A loose object and what is to become of it. */
+typedef struct {
+    PackObject obj;
+    int packed;      /* some pack already has it: delete only */
+} LooseObject;
+
+typedef struct {
+    LooseObject *items;
+    size_t count;
+    size_t capacity;
+} LooseList;
+
+static int add_loose(LooseList *list, const ObjectId *oid) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        LooseObject *grown = realloc(list->items, capacity * sizeof(LooseObject));
+        if (grown == NULL) {
+            GIT_ERR("gc: malloc failed\n");
+            return 1;
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    LooseObject *item = &list->items[list->count++];
+    memset(item, 0, sizeof(*item));
+    item->obj.oid = *oid;
+    return 0;
+}
+
+/* Collects the names of .git/objects/<xx>/<38 hex>. */
+static int list_loose(LooseList *list) {
+    for (int fanout = 0; fanout < 256; fanout++) {
+        char dir_path[GIT_PATH_MAX];
+        snprintf(dir_path, sizeof(dir_path), "%s/%02x", GIT_OBJECTS_DIR, fanout);
+        DIR *dir = opendir(dir_path);
+        if (dir == NULL) continue;
+
+        struct dirent *dentry;
+        int result = 0;
+        while (result == 0 && (dentry = readdir(dir)) != NULL) {
+            if (strlen(dentry->d_name) != OID_HEX_SIZE - 2) continue;
+            char hex[OID_HEX_SIZE + 1];
+            snprintf(hex, 3, "%02x", fanout);
+            memcpy(hex + 2, dentry->d_name, OID_HEX_SIZE - 2 + 1);
+            ObjectId oid;
+            if (oid_from_hex(hex, &oid) != 0) continue;  /* temporary file */
+            result = add_loose(list, &oid);
+        }
+        closedir(dir);
+        if (result != 0) return 1;
+    }
+    return 0;
+}
+
+static int compare_loose(const void *a, const void *b) {
+    return oid_cmp(&((const LooseObject *)a)->obj.oid, &((const LooseObject *)b)->obj.oid);
+}
+
+/* Names the loose objects a loose tree lists, for their name hashes. */
+static int hash_tree_names(LooseList *list, const ObjectId *tree) {
+    GitObject obj;
+    if (object_read(tree, &obj) != 0) return 1;
+
+    const unsigned char *pos = obj.body;
+    const unsigned char *end = obj.body + obj.body_size;
+    while (pos < end) {
+        const unsigned char *space = memchr(pos, ' ', (size_t)(end - pos));
+        if (space == NULL) break;
+        const unsigned char *name = space + 1;
+        const unsigned char *name_end = memchr(name, '\0', (size_t)(end - name));
+        if (name_end == NULL || name_end + 1 + OID_RAW_SIZE > end) break;
+
+        LooseObject key;
+        memcpy(key.obj.oid.hash, name_end + 1, OID_RAW_SIZE);
+        LooseObject *entry = bsearch(&key, list->items, list->count, sizeof(LooseObject),
+                                     compare_loose);
+        if (entry != NULL && entry->obj.name_hash == 0) {
+            entry->obj.name_hash = pack_name_hash((const char *)name);
+        }
+        pos = name_end + 1 + OID_RAW_SIZE;
+    }
+    free(obj.raw);
+    return 0;
+}
+
+/* Deletes the loose files (and the fan-out directories left empty). */
+static void prune_loose(const LooseList *list) {
+    char hex[OID_HEX_SIZE + 1];
+    for (size_t i = 0; i < list->count; i++) {
+        char dir_path[GIT_PATH_MAX], file_path[GIT_PATH_MAX];
+        const ObjectId *oid = &list->items[i].obj.oid;
+        if (object_path(oid, dir_path, sizeof(dir_path), file_path, sizeof(file_path)) != 0) continue;
+        if (unlink(file_path) != 0 && errno != ENOENT) {
+            GIT_ERR("gc: warning: cannot remove loose object %s: %s\n",
+                    oid_to_hex(oid, hex), strerror(errno));
+        }
+    }
+    for (int fanout = 0; fanout < 256; fanout++) {
+        char dir_path[GIT_PATH_MAX];
+        snprintf(dir_path, sizeof(dir_path), "%s/%02x", GIT_OBJECTS_DIR, fanout);
+        rmdir(dir_path);  /* fails harmlessly unless empty */
+    }
+}
+
+int gc(int window, int depth) {
+    LooseList list = {0};
+    PackObject *objects = NULL;
+    int result = 1;
+    uint64_t start = trace_now();
+    if (list_loose(&list) != 0) goto cleanup;
+    if (list.count == 0) {
+        result = 0;
+        goto cleanup;
+    }
+    qsort(list.items, list.count, sizeof(LooseObject), compare_loose);
+
+    size_t to_pack = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        LooseObject *item = &list.items[i];
+        item->packed = packstore_contains(&item->obj.oid);
+        if (item->packed) continue;
+        if (object_read_header(&item->obj.oid, &item->obj.type, &item->obj.size) != 0) goto cleanup;
+        to_pack++;
+    }
+    for (size_t i = 0; i < list.count; i++) {
+        LooseObject *item = &list.items[i];
+        if (!item->packed && item->obj.type == OBJ_TREE &&
+            hash_tree_names(&list, &item->obj.oid) != 0) {
+            goto cleanup;
+        }
+    }
+    trace_span("gc.enumerate", start);
+
+    start = trace_now();
+    if (to_pack > 0) {
+        objects = malloc(to_pack * sizeof(PackObject));
+        if (objects == NULL) {
+            GIT_ERR("gc: malloc failed\n");
+            goto cleanup;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < list.count; i++) {
+            if (!list.items[i].packed) objects[n++] = list.items[i].obj;
+        }
+        PackObjectsOptions opts = { window, depth };
+        unsigned char checksum[OID_RAW_SIZE];
+        if (pack_objects(objects, to_pack, &opts, checksum) != 0) goto cleanup;
+    }
+    trace_span("gc.pack", start);
+    start = trace_now();
+    prune_loose(&list);
+    trace_span("gc.prune", start);
+    result = 0;
+
+cleanup:
+    free(objects);
+    free(list.items);
+    return result;
+}
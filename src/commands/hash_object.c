@@ -6,15 +6,14 @@
  */
 
 #include <stdio.h>
-#include <stdlib.h>
 
 #include "../objects/object.h"
 
 int hash_object(const char *path) {
-    char *sha_hex = create_blob(path);
-    if (sha_hex == NULL) return 1;
+    ObjectId oid;
+    if (create_blob(path, &oid) != 0) return 1;
 
-    printf("%s\n", sha_hex);
-    free(sha_hex);
+    char hex[OID_HEX_SIZE + 1];
+    printf("%s\n", oid_to_hex(&oid, hex));
     return 0;
 }
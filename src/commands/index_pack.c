@@ -0,0 +1,42 @@
+/*
+ * index_pack.c
+ *
+ * Implements the "git index-pack --stdin" command — stores a packfile
+ * read from stdin under .git/objects/pack/ and generates its .idx,
+ * without exploding it into loose objects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../constants.h"
+#include "../objects/object_id.h"
+#include "../pack/packfile.h"
+#include "../utils/string/string.h"
+
+int index_pack(int threads) {
+    PackStream *ps = packfile_stream_new(PACK_MODE_INDEX);
+    if (ps == NULL) return 1;
+    packfile_stream_set_threads(ps, threads);
+
+    int result = 1;
+    unsigned char buf[FILE_BUFFER_SIZE * 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+        if (packfile_stream_feed(ps, buf, n) != 0) goto cleanup;
+    }
+    if (ferror(stdin)) {
+        GIT_ERR("index-pack: error reading stdin\n");
+        goto cleanup;
+    }
+    if (packfile_stream_finish(ps) != 0) goto cleanup;
+
+    char hex[OID_HEX_SIZE + 1];
+    hex_encode(packfile_stream_checksum(ps), OID_RAW_SIZE, hex);
+    printf("pack\t%s\n", hex);
+    result = 0;
+
+cleanup:
+    packfile_stream_free(ps);
+    return result;
+}
@@ -12,8 +12,11 @@
 #include "../objects/object.h"
 
 int ls_tree(const char *sha1) {
+    ObjectId oid;
+    if (oid_parse(sha1, &oid) != 0) return 1;
+
     GitObject obj;
-    if (object_read(sha1, &obj) != 0) return 1;
+    if (object_read(&oid, &obj) != 0) return 1;
 
     unsigned char *pos = obj.body;
     unsigned char *end = obj.body + obj.body_size;
@@ -0,0 +1,417 @@
+/*
+ * rev_list.c
+ *
+ * Implements "git rev-list" and "git log" — lists the commits
+ * reachable from the given revisions, newest committer date first
+ * (ties in the order the commits were reached), like git's default
+ * walk order.
+ *
+ * Commits in the commit-graph are walked through its mapped arrays:
+ * dates and parents are fixed-offset reads, and "seen" is one bit per
+ * graph position, so rev-list inflates no commit there. Commits made
+ * since the graph was written are read from the object store. log
+ * reads each commit it prints, for the author and message.
+ *
+ * In a shallow clone the walk stops at the commits in .git/shallow,
+ * whose parents were never fetched, as git does.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../constants.h"
+#include "../objects/commit_graph.h"
+#include "../objects/object.h"
+#include "../pack/packfile.h"
+#include "../refs/refs.h"
+#include "commands.h"
+
+/* Annotated tags pointing at tags deeper than this are not followed */
+#define TAG_PEEL_MAX 8
+/* Abbreviated IDs in log output (git's default minimum) */
+#define ABBREV_LEN 7
+
+/* A commit waiting in the date queue. */
+typedef struct {
+    ObjectId oid;
+    uint64_t date;
+    uint64_t seq;           /* arrival order, breaks date ties */
+    uint32_t graph_pos;     /* COMMIT_GRAPH_NONE if read from the object store */
+    ObjectId *parents;      /* object store commits only; heap-allocated */
+    size_t parent_count;
+} QueuedCommit;
+
+typedef struct {
+    CommitGraph *graph;     /* NULL without a commit-graph */
+    unsigned char *seen_pos; /* bit per graph position */
+    ObjectId *seen;         /* other commits: open addressing; all-zero = empty */
+    size_t seen_count;
+    size_t seen_size;       /* power of two */
+    QueuedCommit *queue;    /* binary heap, newest on top */
+    size_t queue_len;
+    size_t queue_capacity;
+    uint64_t next_seq;
+    ObjectId *shallows;     /* .git/shallow; heap-allocated */
+    size_t shallow_count;
+} RevWalk;
+
+static int is_empty_oid(const ObjectId *oid) {
+    static const ObjectId zero;
+    return oid_equal(oid, &zero);
+}
+
+static size_t seen_slot(const RevWalk *walk, const ObjectId *oid) {
+    size_t mask = walk->seen_size - 1;
+    size_t i = ((size_t)oid->hash[0] << 24 | (size_t)oid->hash[1] << 16 |
+                (size_t)oid->hash[2] << 8 | oid->hash[3]) & mask;
+    while (!is_empty_oid(&walk->seen[i]) && !oid_equal(&walk->seen[i], oid)) i = (i + 1) & mask;
+    return i;
+}
+
+/* Records a commit outside the graph. Returns 1 if new, 0 if seen, -1 on failure. */
+static int mark_seen(RevWalk *walk, const ObjectId *oid) {
+    if (walk->seen_size > 0 && oid_equal(&walk->seen[seen_slot(walk, oid)], oid)) return 0;
+    if ((walk->seen_count + 1) * 2 > walk->seen_size) {
+        size_t new_size = walk->seen_size == 0 ? 256 : walk->seen_size * 2;
+        ObjectId *old = walk->seen;
+        size_t old_size = walk->seen_size;
+        walk->seen = calloc(new_size, sizeof(ObjectId));
+        if (walk->seen == NULL) {
+            GIT_ERR("rev-list: malloc failed\n");
+            walk->seen = old;
+            return -1;
+        }
+        walk->seen_size = new_size;
+        for (size_t i = 0; i < old_size; i++) {
+            if (!is_empty_oid(&old[i])) walk->seen[seen_slot(walk, &old[i])] = old[i];
+        }
+        free(old);
+    }
+    walk->seen[seen_slot(walk, oid)] = *oid;
+    walk->seen_count++;
+    return 1;
+}
+
+static int newer(const QueuedCommit *a, const QueuedCommit *b) {
+    return a->date > b->date || (a->date == b->date && a->seq < b->seq);
+}
+
+static int queue_push(RevWalk *walk, QueuedCommit *commit) {
+    if (walk->queue_len == walk->queue_capacity) {
+        size_t new_capacity = walk->queue_capacity == 0 ? 256 : walk->queue_capacity * 2;
+        QueuedCommit *grown = realloc(walk->queue, new_capacity * sizeof(QueuedCommit));
+        if (grown == NULL) {
+            GIT_ERR("rev-list: malloc failed\n");
+            free(commit->parents);
+            return 1;
+        }
+        walk->queue = grown;
+        walk->queue_capacity = new_capacity;
+    }
+    commit->seq = walk->next_seq++;
+    size_t i = walk->queue_len++;
+    while (i > 0 && newer(commit, &walk->queue[(i - 1) / 2])) {
+        walk->queue[i] = walk->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    walk->queue[i] = *commit;
+    return 0;
+}
+
+/* Takes the newest queued commit; 1 once the queue is empty. */
+static int queue_pop(RevWalk *walk, QueuedCommit *out) {
+    if (walk->queue_len == 0) return 1;
+    *out = walk->queue[0];
+    QueuedCommit last = walk->queue[--walk->queue_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= walk->queue_len) break;
+        if (child + 1 < walk->queue_len && newer(&walk->queue[child + 1], &walk->queue[child])) child++;
+        if (!newer(&walk->queue[child], &last)) break;
+        walk->queue[i] = walk->queue[child];
+        i = child;
+    }
+    if (walk->queue_len > 0) walk->queue[i] = last;
+    return 0;
+}
+
+/* Reads a commit outside the graph: parents and committer time. */
+static int read_commit(const ObjectId *oid, QueuedCommit *out) {
+    char hex[OID_HEX_SIZE + 1];
+    GitObject obj;
+    if (object_read(oid, &obj) != 0) return 1;
+    if (memcmp(obj.raw, "commit ", 7) != 0) {
+        GIT_ERR("rev-list: %s is not a commit\n", oid_to_hex(oid, hex));
+        free(obj.raw);
+        return 1;
+    }
+
+    const char *p = (const char *)obj.body;
+    const char *end = p + obj.body_size;
+    /* Headers end at the first empty line */
+    while (p < end && *p != '\n') {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == NULL) eol = end;
+        ObjectId parent;
+        if (eol - p == 7 + OID_HEX_SIZE && memcmp(p, "parent ", 7) == 0 &&
+            oid_from_hex(p + 7, &parent) == 0) {
+            ObjectId *grown = realloc(out->parents, (out->parent_count + 1) * sizeof(ObjectId));
+            if (grown == NULL) {
+                GIT_ERR("rev-list: malloc failed\n");
+                free(obj.raw);
+                return 1;
+            }
+            out->parents = grown;
+            out->parents[out->parent_count++] = parent;
+        } else if (eol - p > 10 && memcmp(p, "committer ", 10) == 0) {
+            /* "committer <name> <<email>> <time> <tz>" */
+            const char *gt = p;
+            for (const char *q = p; q < eol; q++) {
+                if (*q == '>') gt = q;
+            }
+            out->date = strtoull(gt + 1, NULL, 10);
+        }
+        p = eol + 1;
+    }
+    free(obj.raw);
+    return 0;
+}
+
+/* Queues a commit of the graph, once. */
+static int push_graph(RevWalk *walk, uint32_t pos) {
+    unsigned char bit = (unsigned char)(1u << (pos & 7));
+    if (walk->seen_pos[pos >> 3] & bit) return 0;
+    walk->seen_pos[pos >> 3] |= bit;
+    QueuedCommit commit = { .graph_pos = pos, .date = commit_graph_date(walk->graph, pos) };
+    commit_graph_oid(walk->graph, pos, &commit.oid);
+    return queue_push(walk, &commit);
+}
+
+/* Queues a commit, once; from the graph when it has it. */
+static int push_commit(RevWalk *walk, const ObjectId *oid) {
+    uint32_t pos = walk->graph != NULL ? commit_graph_find(walk->graph, oid) : COMMIT_GRAPH_NONE;
+    if (pos != COMMIT_GRAPH_NONE) return push_graph(walk, pos);
+
+    int is_new = mark_seen(walk, oid);
+    if (is_new <= 0) return is_new < 0;
+    QueuedCommit commit = { .oid = *oid, .graph_pos = COMMIT_GRAPH_NONE };
+    if (read_commit(oid, &commit) != 0) {
+        free(commit.parents);
+        return 1;
+    }
+    for (size_t i = 0; i < walk->shallow_count; i++) {
+        if (oid_equal(oid, &walk->shallows[i])) {
+            /* A shallow boundary: its parents are not here */
+            free(commit.parents);
+            commit.parents = NULL;
+            commit.parent_count = 0;
+            break;
+        }
+    }
+    return queue_push(walk, &commit);
+}
+
+static int push_parents(RevWalk *walk, const QueuedCommit *commit) {
+    if (commit->graph_pos == COMMIT_GRAPH_NONE) {
+        for (size_t i = 0; i < commit->parent_count; i++) {
+            if (push_commit(walk, &commit->parents[i]) != 0) return 1;
+        }
+        return 0;
+    }
+    for (size_t n = 0; ; n++) {
+        uint32_t parent = commit_graph_parent(walk->graph, commit->graph_pos, n);
+        if (parent == COMMIT_GRAPH_NONE) return 0;
+        if (push_graph(walk, parent) != 0) return 1;
+    }
+}
+
+/* Resolves a revision to a commit, peeling annotated tags. */
+static int resolve_commit(const char *rev, ObjectId *oid_out) {
+    if (refs_resolve(rev, oid_out) != 0) {
+        GIT_ERR("fatal: bad revision '%s'\n", rev);
+        return 1;
+    }
+    for (int depth = 0; depth < TAG_PEEL_MAX; depth++) {
+        int type;
+        size_t size;
+        if (object_read_header(oid_out, &type, &size) != 0) return 1;
+        if (type == OBJ_COMMIT) return 0;
+        if (type != OBJ_TAG) break;
+
+        /* A tag starts with "object <sha>\n" */
+        GitObject obj;
+        if (object_read(oid_out, &obj) != 0) return 1;
+        int peeled = obj.body_size > 7 + OID_HEX_SIZE && memcmp(obj.body, "object ", 7) == 0 &&
+                     oid_from_hex((const char *)obj.body + 7, oid_out) == 0;
+        free(obj.raw);
+        if (!peeled) break;
+    }
+    GIT_ERR("fatal: '%s' does not name a commit\n", rev);
+    return 1;
+}
+
+/* Finds a header line ("author ...") of a commit body; NULL if absent. */
+static const char *find_header(const char *body, const char *end, const char *name, size_t *len) {
+    size_t name_len = strlen(name);
+    for (const char *p = body; p < end && *p != '\n'; ) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == NULL) eol = end;
+        if ((size_t)(eol - p) > name_len && memcmp(p, name, name_len) == 0 && p[name_len] == ' ') {
+            *len = (size_t)(eol - p) - name_len - 1;
+            return p + name_len + 1;
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+/*
+ * Prints "Author: <name> <<email>>" and "Date:   <date>" from an
+ * "author" value, the date in its own time zone as git's default
+ * format shows it: "Tue Nov 14 22:18:20 2023 +0000".
+ */
+static void print_author(const char *author, size_t len) {
+    const char *gt = NULL;
+    for (const char *q = author; q < author + len; q++) {
+        if (*q == '>') gt = q;
+    }
+    if (gt == NULL) {
+        printf("Author: %.*s\n", (int)len, author);
+        return;
+    }
+    printf("Author: %.*s\n", (int)(gt + 1 - author), author);
+
+    char *tz_end;
+    long long when = strtoll(gt + 1, &tz_end, 10);
+    long tz = strtol(tz_end, NULL, 10);
+    long offset = (tz / 100) * 3600 + (tz % 100) * 60;
+    time_t local = (time_t)(when + offset);
+    struct tm tm;
+    char date[64];
+    if (gmtime_r(&local, &tm) == NULL ||
+        strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Y", &tm) == 0) {
+        printf("Date:   %.*s\n", (int)(author + len - gt - 2), gt + 2);
+        return;
+    }
+    /* %e pads the day with a space; git does not */
+    const char *day = date + 8;
+    printf("Date:   %.8s%s %+05ld\n", date, *day == ' ' ? day + 1 : day, tz);
+}
+
+/* Prints one commit in log's medium format, or as --oneline. */
+static int print_log_entry(const CommitGraph *graph, const QueuedCommit *commit, int oneline,
+                           int first) {
+    GitObject obj;
+    if (object_read(&commit->oid, &obj) != 0) return 1;
+    const char *body = (const char *)obj.body;
+    const char *end = body + obj.body_size;
+    char hex[OID_HEX_SIZE + 1];
+    oid_to_hex(&commit->oid, hex);
+
+    /* The message follows the first empty line */
+    const char *message = end;
+    for (const char *p = body; p < end; ) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == NULL) break;
+        if (eol == p) {
+            message = eol + 1;
+            break;
+        }
+        p = eol + 1;
+    }
+    /* Leading and trailing blank lines are not shown */
+    while (message < end && *message == '\n') message++;
+    const char *message_end = end;
+    while (message_end > message && message_end[-1] == '\n') message_end--;
+
+    if (oneline) {
+        /* The subject is the first paragraph, its lines joined by spaces */
+        printf("%.*s ", ABBREV_LEN, hex);
+        for (const char *p = message; p < message_end; ) {
+            const char *eol = memchr(p, '\n', (size_t)(message_end - p));
+            if (eol == NULL) eol = message_end;
+            if (eol == p) break;
+            printf("%s%.*s", p == message ? "" : " ", (int)(eol - p), p);
+            p = eol + 1;
+        }
+        putchar('\n');
+        free(obj.raw);
+        return 0;
+    }
+
+    printf("%scommit %s\n", first ? "" : "\n", hex);
+    /* Only merges show their parents */
+    if (commit->parent_count > 1 ||
+        (commit->graph_pos != COMMIT_GRAPH_NONE && commit_graph_parent(graph, commit->graph_pos, 1) != COMMIT_GRAPH_NONE)) {
+        printf("Merge:");
+        for (const char *p = body; p < end && *p != '\n'; ) {
+            const char *eol = memchr(p, '\n', (size_t)(end - p));
+            if (eol == NULL) eol = end;
+            if (eol - p == 7 + OID_HEX_SIZE && memcmp(p, "parent ", 7) == 0) {
+                printf(" %.*s", ABBREV_LEN, p + 7);
+            }
+            p = eol + 1;
+        }
+        putchar('\n');
+    }
+    size_t author_len;
+    const char *author = find_header(body, end, "author", &author_len);
+    if (author != NULL) print_author(author, author_len);
+    putchar('\n');
+    for (const char *p = message; p < message_end; ) {
+        const char *eol = memchr(p, '\n', (size_t)(message_end - p));
+        if (eol == NULL) eol = message_end;
+        printf("    %.*s\n", (int)(eol - p), p);
+        p = eol + 1;
+    }
+    free(obj.raw);
+    return 0;
+}
+
+int rev_list(char **revs, size_t rev_count, long max_count, RevListFormat format) {
+    RevWalk walk = {0};
+    int result = 1;
+    if (refs_read_shallow(&walk.shallows, &walk.shallow_count) != 0) goto cleanup;
+    walk.graph = commit_graph_open();
+    if (walk.graph != NULL) {
+        walk.seen_pos = calloc((size_t)commit_graph_count(walk.graph) / 8 + 1, 1);
+        if (walk.seen_pos == NULL) {
+            GIT_ERR("rev-list: malloc failed\n");
+            goto cleanup;
+        }
+    }
+
+    for (size_t i = 0; i < rev_count; i++) {
+        ObjectId oid;
+        if (resolve_commit(revs[i], &oid) != 0 || push_commit(&walk, &oid) != 0) goto cleanup;
+    }
+
+    QueuedCommit commit;
+    for (long shown = 0; (max_count < 0 || shown < max_count) && queue_pop(&walk, &commit) == 0; shown++) {
+        char hex[OID_HEX_SIZE + 1];
+        int failed = push_parents(&walk, &commit) != 0 ||
+                     (format == REV_LIST_OIDS ? printf("%s\n", oid_to_hex(&commit.oid, hex)) < 0
+                                              : print_log_entry(walk.graph, &commit, format == REV_LIST_ONELINE,
+                                                                shown == 0) != 0);
+        free(commit.parents);
+        if (failed) goto cleanup;
+    }
+    if (fflush(stdout) != 0) {
+        GIT_ERR("rev-list: error writing to stdout\n");
+        goto cleanup;
+    }
+    result = 0;
+
+cleanup:
+    for (size_t i = 0; i < walk.queue_len; i++) free(walk.queue[i].parents);
+    free(walk.queue);
+    free(walk.seen);
+    free(walk.seen_pos);
+    free(walk.shallows);
+    commit_graph_close(walk.graph);
+    return result;
+}
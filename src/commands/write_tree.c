@@ -4,6 +4,25 @@
  * Implements the "git write-tree" command — recursively scans the
  * working directory, creates blob/tree objects, and prints the
  * root tree's SHA-1 hash to stdout.
+ *
+ * Two phases:
+ *   1. Scan: walk the directories (each readdir handle is closed
+ *      before descending) and hand every file to a thread pool that
+ *      hashes and writes its blob while the scan continues. A file
+ *      whose stat data matches its .git/index entry reuses the ID
+ *      recorded there and is not read at all.
+ *   2. Assemble: once the pool drains, build the tree objects
+ *      bottom-up, sorting each directory exactly as the serial
+ *      version did, so the root SHA does not depend on thread count.
+ *      A directory whose files all match their index entries is the
+ *      index's version of it; if the cache tree has a valid node for
+ *      it, the recorded tree ID is used instead of rebuilding.
+ *
+ * The index is only a cache here: write-tree never adds, removes or
+ * changes what it tracks. Afterwards it is rewritten if a hashed file
+ * turned out unchanged (fresh stat data, so the next run can skip it)
+ * or a tree was built; the cache tree written back keeps describing
+ * the index, not the work tree.
  */
 
 #include <dirent.h>
@@ -15,41 +34,86 @@
 #include <string.h>
 
 #include "../constants.h"
+#include "../index/index.h"
 #include "../objects/object.h"
-#include "../utils/string/string.h"
+#include "../utils/thread/thread_pool.h"
+
+struct TreeDir;
 
 /* Holds one parsed directory entry before we pack it into binary tree format. */
 typedef struct {
     char mode[7];       /* "100644" or "40000" + null */
     char *name;         /* heap-allocated filename (caller frees via cleanup) */
-    char sha_hex[41];   /* 40-char hex SHA + null */
+    ObjectId oid;       /* blob or subtree ID, filled in by the scan/assemble */
+    char *path;         /* files: full path, read by the blob worker */
+    struct stat st;     /* files: stat data, recorded in the index */
+    const IndexEntry *ie; /* files: the path's index entry, or NULL if untracked */
+    int cached;         /* files: oid taken from the index, not hashed */
+    int failed;         /* files: set by the blob worker */
+    struct TreeDir *subdir; /* directories: scanned contents */
 } TreeEntry;
 
+/* Index lookups during the scan and assembly, and what they saved. */
+typedef struct {
+    const GitIndex *index;
+    size_t trees_built; /* directories whose tree object had to be written */
+} ScanCache;
+
+/* One scanned directory; entries are final once the scan moves on. */
+typedef struct TreeDir {
+    TreeEntry *entries;
+    size_t entry_count;
+} TreeDir;
+
 /* Lexicographic comparator for qsort — git requires sorted tree entries. */
 static int compare_tree_entries(const void *a, const void *b) {
     return strcmp(((const TreeEntry *)a)->name, ((const TreeEntry *)b)->name);
 }
 
+static void free_tree_dir(TreeDir *tree) {
+    if (tree == NULL) return;
+    for (size_t i = 0; i < tree->entry_count; i++) {
+        free(tree->entries[i].name);
+        free(tree->entries[i].path);
+        free_tree_dir(tree->entries[i].subdir);
+    }
+    free(tree->entries);
+    free(tree);
+}
+
+/* Index paths are relative to the work tree: "./a/b" is "a/b". */
+static const char *work_tree_path(const char *path) {
+    return strncmp(path, "./", 2) == 0 ? path + 2 : path;
+}
+
+/* Pool task: hash and store one file's blob. */
+static void blob_task(void *arg) {
+    TreeEntry *te = arg;
+    if (create_blob(te->path, &te->oid) != 0) te->failed = 1;
+}
+
 /*
- * Recursively builds tree objects from a directory's contents.
- * For files: creates a blob via create_blob.
- * For subdirectories: recurses to build a child tree first.
- * Entries are sorted alphabetically — git requires this for
- * deterministic hashing (same directory = same tree SHA).
+ * Scan phase: records a directory's files and subdirectories.
+ * Files are queued on the pool as soon as the directory has been
+ * read (their entries no longer move); subdirectories are scanned
+ * after the readdir handle is closed. Files the index vouches for
+ * are not queued.
  *
- * Returns heap-allocated 40-char hex hash (caller must free), or NULL.
+ * Returns a heap-allocated TreeDir (free with free_tree_dir), or NULL.
  */
-static char *write_tree_recursive(const char *dir_path) {
+static TreeDir *scan_dir(const char *dir_path, ThreadPool *pool, ScanCache *cache) {
     DIR *dir = opendir(dir_path);
     if (dir == NULL) {
         GIT_ERR("Error opening directory %s: %s\n", dir_path, strerror(errno));
         return NULL;
     }
 
-    TreeEntry *entries = NULL;
-    size_t entry_count = 0;
+    TreeDir *tree = calloc(1, sizeof(TreeDir));
     size_t entry_capacity = 0;
-    char *result_sha = NULL;
+    if (tree == NULL) {
+        GIT_ERR("Error allocating memory for tree entries\n");
+        goto fail;
+    }
 
     struct dirent *dentry;
     while ((dentry = readdir(dir)) != NULL) {
@@ -65,53 +129,138 @@ static char *write_tree_recursive(const char *dir_path) {
         struct stat st;
         if (stat(full_path, &st) == -1) {
             GIT_ERR("Error stat %s: %s\n", full_path, strerror(errno));
-            goto cleanup;
+            goto fail;
         }
+        /* Skip symlinks, pipes, sockets, etc. */
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) continue;
 
         /* Grow entries array using doubling strategy to amortize realloc cost */
-        if (entry_count >= entry_capacity) {
+        if (tree->entry_count >= entry_capacity) {
             entry_capacity = entry_capacity == 0 ? 8 : entry_capacity * 2;
-            TreeEntry *new_entries = realloc(entries, entry_capacity * sizeof(TreeEntry));
+            TreeEntry *new_entries = realloc(tree->entries, entry_capacity * sizeof(TreeEntry));
             if (new_entries == NULL) {
                 GIT_ERR("Error allocating memory for tree entries\n");
-                goto cleanup;
+                goto fail;
             }
-            entries = new_entries;
+            tree->entries = new_entries;
         }
 
-        TreeEntry *te = &entries[entry_count];
+        TreeEntry *te = &tree->entries[tree->entry_count];
+        memset(te, 0, sizeof(*te));
         te->name = strdup(dentry->d_name);
-        if (te->name == NULL) {
+        te->path = strdup(full_path);
+        tree->entry_count++;
+        if (te->name == NULL || te->path == NULL) {
             GIT_ERR("Error duplicating entry name\n");
-            goto cleanup;
+            goto fail;
         }
+        strcpy(te->mode, S_ISDIR(st.st_mode) ? "40000" : "100644");
+        if (S_ISDIR(st.st_mode)) continue;
 
-        char *sha = NULL;
-        if (S_ISREG(st.st_mode)) {
-            strcpy(te->mode, "100644");
-            sha = create_blob(full_path);
-        } else if (S_ISDIR(st.st_mode)) {
-            strcpy(te->mode, "40000");
-            sha = write_tree_recursive(full_path);
-        } else {
-            /* Skip symlinks, pipes, sockets, etc. */
-            free(te->name);
-            continue;
+        te->st = st;
+        te->ie = index_find(cache->index, work_tree_path(full_path));
+        if (te->ie != NULL && index_entry_matches(te->ie, &st)) {
+            te->oid = te->ie->oid;
+            te->cached = 1;
         }
+    }
+
+    closedir(dir);
+    dir = NULL;
 
-        if (sha == NULL) {
-            free(te->name);
+    for (size_t i = 0; i < tree->entry_count; i++) {
+        TreeEntry *te = &tree->entries[i];
+        if (strcmp(te->mode, "40000") == 0 || te->cached) continue;
+        if (thread_pool_submit(pool, blob_task, te) != 0) te->failed = 1;
+    }
+    for (size_t i = 0; i < tree->entry_count; i++) {
+        TreeEntry *te = &tree->entries[i];
+        if (strcmp(te->mode, "40000") != 0) continue;
+        te->subdir = scan_dir(te->path, pool, cache);
+        if (te->subdir == NULL) goto fail;
+    }
+    return tree;
+
+fail:
+    if (dir != NULL) closedir(dir);
+    /* Queued blob tasks still point into this tree */
+    thread_pool_wait(pool);
+    free_tree_dir(tree);
+    return NULL;
+}
+
+/*
+ * Assemble phase: builds the tree object for a scanned directory,
+ * children first. Entries are sorted alphabetically — git requires
+ * this for deterministic hashing (same directory = same tree SHA).
+ *
+ * The directory is "clean" when every file below it is tracked as
+ * 100644 with the ID just found, and the index has no other entries
+ * below it (nothing deleted, no symlink or gitlink the scan skipped):
+ * the tree we would write is then the index's. A clean directory
+ * with a valid cache tree node reuses the recorded tree ID. The fresh
+ * node describes the index either way: the built tree when clean,
+ * otherwise whatever the loaded node said (the index is unchanged).
+ *
+ * @param dir        Work-tree-relative path of the directory; "" for the root.
+ * @param cached     This directory's node in the loaded cache tree, or NULL.
+ * @param fresh      Node to fill in for the cache tree written back.
+ * @param oid_out    Output: the tree's ID.
+ * @param files_out  Output: regular files at or below this directory.
+ * @param clean      Output: 1 if the tree is the index's version of it.
+ * @return           0 on success, 1 on failure.
+ */
+static int write_tree_dir(TreeDir *tree, const char *dir, const CacheTree *cached,
+                          CacheTree *fresh, ScanCache *cache, ObjectId *oid_out,
+                          size_t *files_out, int *clean) {
+    TreeEntry *entries = tree->entries;
+    size_t entry_count = tree->entry_count;
+    int result = 1;
+    size_t files = 0;
+    int all_match = 1;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        TreeEntry *te = &entries[i];
+        if (te->subdir == NULL) {
+            if (te->failed) goto cleanup;
+            files++;
+            if (te->ie == NULL || te->ie->mode != 0100644 || !oid_equal(&te->oid, &te->ie->oid))
+                all_match = 0;
+            continue;
+        }
+        CacheTree *child = cache_tree_new(te->name);
+        if (child == NULL) goto cleanup;
+        if (cache_tree_add_child(fresh, child) != 0) {
+            cache_tree_free(child);
             goto cleanup;
         }
-        memcpy(te->sha_hex, sha, 40);
-        te->sha_hex[40] = '\0';
-        free(sha);
-
-        entry_count++;
+        const CacheTree *child_cached = cached != NULL
+            ? cache_tree_find(cached, te->name, strlen(te->name)) : NULL;
+        const char *child_dir = work_tree_path(te->path);
+        size_t child_files;
+        int child_clean;
+        if (write_tree_dir(te->subdir, child_dir, child_cached, child, cache, &te->oid,
+                           &child_files, &child_clean) != 0)
+            goto cleanup;
+        files += child_files;
+        all_match &= child_clean;
     }
+    *files_out = files;
+    /* Git's trees have no empty directories, so an empty one is never the index's */
+    *clean = all_match && files > 0 && index_count_under(cache->index, dir) == files;
 
-    closedir(dir);
-    dir = NULL;
+    int cached_valid = cached != NULL && cached->entry_count >= 0;
+    if (*clean && cached_valid && (size_t)cached->entry_count == files) {
+        *oid_out = cached->oid;
+        fresh->entry_count = cached->entry_count;
+        fresh->oid = cached->oid;
+        return 0;
+    }
+    if (!*clean && cached_valid) {
+        fresh->entry_count = cached->entry_count;
+        fresh->oid = cached->oid;
+    }
+    cache->trees_built++;
 
     /* Git requires tree entries sorted by name for deterministic hashing */
     if (entry_count > 1) {
@@ -121,7 +270,7 @@ static char *write_tree_recursive(const char *dir_path) {
     /* Calculate body size: each entry is mode + space + name + null + 20 SHA bytes */
     size_t body_size = 0;
     for (size_t i = 0; i < entry_count; i++) {
-        body_size += strlen(entries[i].mode) + 1 + strlen(entries[i].name) + 1 + 20;
+        body_size += strlen(entries[i].mode) + 1 + strlen(entries[i].name) + 1 + OID_RAW_SIZE;
     }
 
     /* Build "tree <body_size>\0<packed entries>" */
@@ -155,35 +304,85 @@ static char *write_tree_recursive(const char *dir_path) {
         write_pos += name_len;
         *write_pos++ = '\0';
 
-        /* Convert 40-char hex SHA to 20 raw bytes for binary tree format */
-        size_t sha_byte_len;
-        unsigned char *sha_bytes = hex_string_to_bytes(entries[i].sha_hex, &sha_byte_len);
-        if (sha_bytes == NULL) {
-            free(tree_data);
-            goto cleanup;
-        }
-        memcpy(write_pos, sha_bytes, 20);
-        write_pos += 20;
-        free(sha_bytes);
+        memcpy(write_pos, entries[i].oid.hash, OID_RAW_SIZE);
+        write_pos += OID_RAW_SIZE;
     }
 
-    result_sha = object_write(tree_data, total_size);
+    result = object_write(tree_data, total_size, oid_out);
     free(tree_data);
+    if (result == 0 && *clean) {
+        fresh->entry_count = (int)files;
+        fresh->oid = *oid_out;
+    }
 
 cleanup:
-    if (dir != NULL) closedir(dir);
-    for (size_t i = 0; i < entry_count; i++) {
-        free(entries[i].name);
+    return result;
+}
+
+/*
+ * Records fresh stat data for every tracked file that was hashed and
+ * found to still have its entry's ID. Untracked files, modified files
+ * and entries the scan never saw are left exactly as they were.
+ *
+ * @return  The number of entries refreshed.
+ */
+static size_t refresh_stat_data(const TreeDir *tree, GitIndex *index) {
+    size_t refreshed = 0;
+    for (size_t i = 0; i < tree->entry_count; i++) {
+        const TreeEntry *te = &tree->entries[i];
+        if (te->subdir != NULL) {
+            refreshed += refresh_stat_data(te->subdir, index);
+        } else if (te->ie != NULL && !te->cached && oid_equal(&te->oid, &te->ie->oid)) {
+            index_entry_set_stat(&index->entries[te->ie - index->entries], &te->st);
+            refreshed++;
+        }
     }
-    free(entries);
-    return result_sha;
+    return refreshed;
 }
 
-int write_tree(void) {
-    char *sha_hex = write_tree_recursive(".");
-    if (sha_hex == NULL) return 1;
+int write_tree(int threads) {
+    GitIndex index = {0};
+    if (index_load(&index) != 0) {
+        GIT_ERR("write-tree: warning: ignoring unreadable %s\n", GIT_INDEX_FILE);
+    }
+
+    ThreadPool *pool = thread_pool_new(threads);
+    if (pool == NULL) {
+        index_free(&index);
+        return 1;
+    }
+
+    ScanCache cache = { &index, 0 };
+    TreeDir *root = scan_dir(".", pool, &cache);
+    thread_pool_free(pool); /* every blob is written once this returns */
+    if (root == NULL) {
+        index_free(&index);
+        return 1;
+    }
+
+    ObjectId oid;
+    size_t files;
+    int clean;
+    CacheTree *fresh_tree = cache_tree_new("");
+    int failed = fresh_tree == NULL ||
+                 write_tree_dir(root, "", index.cache_tree, fresh_tree, &cache, &oid,
+                                &files, &clean) != 0;
+    /* Rewrite only when stat data went stale or a tree was rebuilt; never create an index */
+    if (!failed && index.count > 0 &&
+        (refresh_stat_data(root, &index) > 0 || cache.trees_built > 0)) {
+        cache_tree_free(index.cache_tree);
+        index.cache_tree = fresh_tree;
+        fresh_tree = NULL;
+        /* A failure only costs speed */
+        if (index_write(&index) != 0)
+            GIT_ERR("write-tree: warning: could not update %s\n", GIT_INDEX_FILE);
+    }
+    cache_tree_free(fresh_tree);
+    free_tree_dir(root);
+    index_free(&index);
+    if (failed) return 1;
 
-    printf("%s\n", sha_hex);
-    free(sha_hex);
+    char hex[OID_HEX_SIZE + 1];
+    printf("%s\n", oid_to_hex(&oid, hex));
     return 0;
 }
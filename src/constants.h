@@ -15,6 +15,10 @@
 #define GIT_ROOT_DIR ".git"
 #define GIT_REFS_DIR ".git/refs"
 #define GIT_OBJECTS_DIR ".git/objects"
+#define GIT_PACK_DIR ".git/objects/pack"
+#define GIT_INDEX_FILE ".git/index"
+#define GIT_CONFIG_FILE ".git/config"
+#define GIT_SHALLOW_FILE ".git/shallow"
 
 /* Buffer and path limits */
 #ifndef PATH_MAX
@@ -0,0 +1,180 @@
+/*
+ * cache_tree.c
+ *
+ * TREE extension format, one record per directory in pre-order:
+ *
+ *   <name>\0<entry_count> <subtree_count>\n[<20-byte tree ID>]
+ *
+ * followed by that many subtree records. The ID is present only when
+ * entry_count is not -1 (invalid).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "cache_tree.h"
+
+CacheTree *cache_tree_new(const char *name) {
+    CacheTree *node = calloc(1, sizeof(CacheTree));
+    if (node != NULL) node->name = strdup(name);
+    if (node == NULL || node->name == NULL) {
+        GIT_ERR("cache-tree: malloc failed\n");
+        free(node);
+        return NULL;
+    }
+    node->entry_count = -1;
+    return node;
+}
+
+int cache_tree_add_child(CacheTree *parent, CacheTree *child) {
+    if (parent->child_count == parent->child_capacity) {
+        size_t new_capacity = parent->child_capacity == 0 ? 4 : parent->child_capacity * 2;
+        CacheTree **grown = realloc(parent->children, new_capacity * sizeof(CacheTree *));
+        if (grown == NULL) {
+            GIT_ERR("cache-tree: malloc failed\n");
+            return 1;
+        }
+        parent->children = grown;
+        parent->child_capacity = new_capacity;
+    }
+    parent->children[parent->child_count++] = child;
+    return 0;
+}
+
+/* git's subtree order: shorter names first, then bytewise */
+static int compare_name(const char *a, size_t a_len, const char *b, size_t b_len) {
+    if (a_len != b_len) return a_len < b_len ? -1 : 1;
+    return memcmp(a, b, a_len);
+}
+
+static int compare_children(const void *a, const void *b) {
+    const CacheTree *x = *(CacheTree *const *)a;
+    const CacheTree *y = *(CacheTree *const *)b;
+    return compare_name(x->name, strlen(x->name), y->name, strlen(y->name));
+}
+
+CacheTree *cache_tree_find(const CacheTree *node, const char *name, size_t len) {
+    size_t lo = 0, hi = node->child_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const CacheTree *child = node->children[mid];
+        int cmp = compare_name(child->name, strlen(child->name), name, len);
+        if (cmp == 0) return node->children[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+/* Parses one record and its subtrees; advances *pos. */
+static CacheTree *parse_node(const unsigned char *data, size_t len, size_t *pos, int depth) {
+    if (depth > 1024) return NULL;
+    const unsigned char *nul = memchr(data + *pos, '\0', len - *pos);
+    if (nul == NULL) return NULL;
+    CacheTree *node = cache_tree_new((const char *)data + *pos);
+    if (node == NULL) return NULL;
+    *pos = (size_t)(nul - data) + 1;
+
+    /* "<entry_count> <subtree_count>\n" */
+    const unsigned char *nl = memchr(data + *pos, '\n', len - *pos);
+    char counts[32];
+    size_t counts_len = nl != NULL ? (size_t)(nl - (data + *pos)) : 0;
+    if (nl == NULL || counts_len >= sizeof(counts)) goto fail;
+    memcpy(counts, data + *pos, counts_len);
+    counts[counts_len] = '\0';
+    int entry_count, subtree_count;
+    if (sscanf(counts, "%d %d", &entry_count, &subtree_count) != 2 || subtree_count < 0) goto fail;
+    *pos += counts_len + 1;
+
+    node->entry_count = entry_count < 0 ? -1 : entry_count;
+    if (node->entry_count >= 0) {
+        if (len - *pos < OID_RAW_SIZE) goto fail;
+        memcpy(node->oid.hash, data + *pos, OID_RAW_SIZE);
+        *pos += OID_RAW_SIZE;
+    }
+
+    for (int i = 0; i < subtree_count; i++) {
+        CacheTree *child = parse_node(data, len, pos, depth + 1);
+        if (child == NULL) goto fail;
+        if (cache_tree_add_child(node, child) != 0) {
+            cache_tree_free(child);
+            goto fail;
+        }
+    }
+    /* Lookups binary-search; git writes this order, but do not rely on it */
+    if (node->child_count > 1) {
+        qsort(node->children, node->child_count, sizeof(CacheTree *), compare_children);
+    }
+    return node;
+
+fail:
+    cache_tree_free(node);
+    return NULL;
+}
+
+CacheTree *cache_tree_parse(const unsigned char *data, size_t len) {
+    size_t pos = 0;
+    CacheTree *root = parse_node(data, len, &pos, 0);
+    if (root == NULL) GIT_ERR("cache-tree: malformed TREE extension\n");
+    return root;
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+} Buffer;
+
+static int buffer_put(Buffer *b, const void *data, size_t len) {
+    if (b->len + len > b->capacity) {
+        size_t new_capacity = b->capacity == 0 ? 4096 : b->capacity;
+        while (new_capacity < b->len + len) new_capacity *= 2;
+        unsigned char *grown = realloc(b->data, new_capacity);
+        if (grown == NULL) return 1;
+        b->data = grown;
+        b->capacity = new_capacity;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static int serialize_node(CacheTree *node, Buffer *b) {
+    if (node->child_count > 1) {
+        qsort(node->children, node->child_count, sizeof(CacheTree *), compare_children);
+    }
+    char counts[32];
+    int counts_len = snprintf(counts, sizeof(counts), "%d %zu\n",
+                              node->entry_count, node->child_count);
+    if (buffer_put(b, node->name, strlen(node->name) + 1) != 0 ||
+        buffer_put(b, counts, (size_t)counts_len) != 0 ||
+        (node->entry_count >= 0 && buffer_put(b, node->oid.hash, OID_RAW_SIZE) != 0)) {
+        return 1;
+    }
+    for (size_t i = 0; i < node->child_count; i++) {
+        if (serialize_node(node->children[i], b) != 0) return 1;
+    }
+    return 0;
+}
+
+int cache_tree_serialize(CacheTree *root, unsigned char **out, size_t *len) {
+    Buffer b = {0};
+    if (serialize_node(root, &b) != 0) {
+        GIT_ERR("cache-tree: malloc failed\n");
+        free(b.data);
+        return 1;
+    }
+    *out = b.data;
+    *len = b.len;
+    return 0;
+}
+
+void cache_tree_free(CacheTree *node) {
+    if (node == NULL) return;
+    for (size_t i = 0; i < node->child_count; i++) cache_tree_free(node->children[i]);
+    free(node->children);
+    free(node->name);
+    free(node);
+}
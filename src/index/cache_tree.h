@@ -0,0 +1,71 @@
+/*
+ * cache_tree.h
+ *
+ * The cache tree: the tree object ID of every directory the index
+ * covers, stored in the index as its "TREE" extension. A directory
+ * whose node is still valid does not need its tree object rebuilt.
+ *
+ * A node describes the index's version of its directory, never the
+ * work tree's: only a change to the index can invalidate it.
+ */
+
+#ifndef CACHE_TREE_H
+#define CACHE_TREE_H
+
+#include <stddef.h>
+
+#include "../objects/object_id.h"
+
+typedef struct CacheTree {
+    char *name;                 /* path component; "" for the root */
+    int entry_count;            /* index entries below this directory; -1 = invalid */
+    ObjectId oid;               /* tree ID, meaningful only while valid */
+    struct CacheTree **children;
+    size_t child_count;
+    size_t child_capacity;
+} CacheTree;
+
+/*
+ * Creates an invalid node with no children.
+ *
+ * @param name  Path component (copied); "" for the root.
+ * @return      Heap-allocated node (free with cache_tree_free()), or NULL.
+ */
+CacheTree *cache_tree_new(const char *name);
+
+/*
+ * Attaches child under parent, which takes ownership of it.
+ *
+ * @return  0 on success, 1 on allocation failure (child not attached).
+ */
+int cache_tree_add_child(CacheTree *parent, CacheTree *child);
+
+/*
+ * Finds a direct child by name (len bytes, not NUL-terminated).
+ * Only valid on trees from cache_tree_parse(), whose children are sorted.
+ *
+ * @return  The child, or NULL.
+ */
+CacheTree *cache_tree_find(const CacheTree *node, const char *name, size_t len);
+
+/*
+ * Parses the body of a TREE extension.
+ *
+ * @return  Heap-allocated root node, or NULL if malformed.
+ */
+CacheTree *cache_tree_parse(const unsigned char *data, size_t len);
+
+/*
+ * Serializes a tree into TREE extension format, sorting children into
+ * git's order (shorter names first, then bytewise) on the way.
+ *
+ * @param out  Output: heap-allocated extension body (caller frees).
+ * @param len  Output: byte count of *out.
+ * @return     0 on success, 1 on allocation failure.
+ */
+int cache_tree_serialize(CacheTree *root, unsigned char **out, size_t *len);
+
+/* Frees a node and everything below it. Safe to call with NULL. */
+void cache_tree_free(CacheTree *node);
+
+#endif /* CACHE_TREE_H */
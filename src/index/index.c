@@ -0,0 +1,356 @@
+/*
+ * index.c
+ *
+ * Reader and writer for the version 2 index format:
+ *
+ *   "DIRC" | version (2) | entry count                 (big-endian u32s)
+ *   entries, sorted by path:
+ *     ctime s/ns, mtime s/ns, dev, ino, mode, uid, gid, size  (u32 each)
+ *     20-byte object ID | u16 flags (name length, stage)
+ *     path, NUL-padded so each entry is a multiple of 8 bytes
+ *   extensions: 4-byte signature | u32 size | data
+ *     "TREE" (the cache tree) is read and written; others are skipped
+ *   SHA-1 of everything above
+ *
+ * Version 3 indexes (extended flags) are read too; version 4 (prefix
+ * compressed paths) is reported as unsupported.
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../constants.h"
+#include "../utils/file/file.h"
+#include "../utils/hash/hash.h"
+#include "cache_tree.h"
+#include "index.h"
+
+#define INDEX_SIGNATURE "DIRC"
+#define INDEX_VERSION 2
+#define CACHE_TREE_SIGNATURE "TREE"
+
+/* Fixed part of an on-disk entry, up to the path */
+#define ENTRY_FIXED_SIZE 62
+#define FLAG_EXTENDED 0x4000
+#define FLAG_STAGE_MASK 0x3000
+#define FLAG_NAME_MASK 0x0fff
+
+static uint32_t get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const IndexEntry *)a)->path, ((const IndexEntry *)b)->path);
+}
+
+static int grow_entries(GitIndex *index) {
+    if (index->count < index->capacity) return 0;
+    size_t new_capacity = index->capacity == 0 ? 64 : index->capacity * 2;
+    IndexEntry *grown = realloc(index->entries, new_capacity * sizeof(IndexEntry));
+    if (grown == NULL) {
+        GIT_ERR("index: malloc failed for entries\n");
+        return 1;
+    }
+    index->entries = grown;
+    index->capacity = new_capacity;
+    return 0;
+}
+
+/* Parses the entries of a loaded index; returns 0, or 1 if malformed. */
+static int parse_entries(GitIndex *index, const unsigned char *data, size_t len) {
+    if (len < 12 + OID_RAW_SIZE || memcmp(data, INDEX_SIGNATURE, 4) != 0) {
+        GIT_ERR("index: bad signature\n");
+        return 1;
+    }
+    uint32_t version = get_u32(data + 4);
+    if (version != 2 && version != 3) {
+        GIT_ERR("index: unsupported version %u\n", version);
+        return 1;
+    }
+
+    unsigned char check[OID_RAW_SIZE];
+    HashPart body = { data, len - OID_RAW_SIZE };
+    if (hash_parts(HASH_SHA1, &body, 1, check) != 0 ||
+        memcmp(check, data + len - OID_RAW_SIZE, OID_RAW_SIZE) != 0) {
+        GIT_ERR("index: checksum mismatch\n");
+        return 1;
+    }
+
+    uint32_t count = get_u32(data + 8);
+    size_t end = len - OID_RAW_SIZE;
+    size_t pos = 12;
+    for (uint32_t i = 0; i < count; i++) {
+        if (pos + ENTRY_FIXED_SIZE > end) goto truncated;
+        const unsigned char *e = data + pos;
+        uint16_t flags = (uint16_t)((e[60] << 8) | e[61]);
+        size_t name_pos = pos + ENTRY_FIXED_SIZE + ((flags & FLAG_EXTENDED) ? 2 : 0);
+        if (name_pos > end) goto truncated;
+
+        const unsigned char *nul = memchr(data + name_pos, '\0', end - name_pos);
+        if (nul == NULL) goto truncated;
+        size_t name_len = (size_t)(nul - (data + name_pos));
+        /* Entries are NUL-padded to a multiple of 8, with at least one NUL */
+        size_t entry_len = (name_pos - pos + name_len + 8) & ~(size_t)7;
+        if (pos + entry_len > end) goto truncated;
+
+        /* Unmerged stages are not tracked here */
+        if ((flags & FLAG_STAGE_MASK) == 0) {
+            if (grow_entries(index) != 0) return 1;
+            IndexEntry *ie = &index->entries[index->count];
+            ie->ctime_sec = get_u32(e);
+            ie->ctime_nsec = get_u32(e + 4);
+            ie->mtime_sec = get_u32(e + 8);
+            ie->mtime_nsec = get_u32(e + 12);
+            ie->dev = get_u32(e + 16);
+            ie->ino = get_u32(e + 20);
+            ie->mode = get_u32(e + 24);
+            ie->uid = get_u32(e + 28);
+            ie->gid = get_u32(e + 32);
+            ie->size = get_u32(e + 36);
+            memcpy(ie->oid.hash, e + 40, OID_RAW_SIZE);
+            ie->path = strndup((const char *)data + name_pos, name_len);
+            if (ie->path == NULL) {
+                GIT_ERR("index: malloc failed for path\n");
+                return 1;
+            }
+            index->count++;
+        }
+        pos += entry_len;
+    }
+
+    while (end - pos >= 8) {
+        const unsigned char *ext = data + pos;
+        uint32_t ext_len = get_u32(ext + 4);
+        if (ext_len > end - pos - 8) goto truncated;
+        /* A damaged cache tree costs only speed: drop it and carry on */
+        if (memcmp(ext, CACHE_TREE_SIGNATURE, 4) == 0 && index->cache_tree == NULL) {
+            index->cache_tree = cache_tree_parse(ext + 8, ext_len);
+        }
+        pos += 8 + ext_len;
+    }
+    return 0;
+
+truncated:
+    GIT_ERR("index: truncated entry\n");
+    return 1;
+}
+
+int index_load(GitIndex *index) {
+    struct stat st;
+    if (stat(GIT_INDEX_FILE, &st) != 0 && errno == ENOENT) return 0;
+
+    long size;
+    unsigned char *data = (unsigned char *)read_file(GIT_INDEX_FILE, &size);
+    if (data == NULL) return 1;
+
+    int failed = parse_entries(index, data, (size_t)size);
+    free(data);
+    if (failed) {
+        index_free(index);
+        return 1;
+    }
+    /* Written by git in path order; be tolerant of anything else */
+    for (size_t i = 1; i < index->count; i++) {
+        if (strcmp(index->entries[i - 1].path, index->entries[i].path) >= 0) {
+            qsort(index->entries, index->count, sizeof(IndexEntry), compare_entries);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Writer that checksums everything it emits, like the .idx writer. */
+typedef struct {
+    FILE *fp;
+    HashCtx *hash;
+    int failed;
+} IndexWriter;
+
+static void index_put(IndexWriter *w, const void *data, size_t len) {
+    if (w->failed) return;
+    if (fwrite(data, 1, len, w->fp) != len) {
+        w->failed = 1;
+        return;
+    }
+    hash_update(w->hash, data, len);
+}
+
+static void put_entry(IndexWriter *w, const IndexEntry *e, time_t now) {
+    unsigned char fixed[ENTRY_FIXED_SIZE];
+    /* Racily clean: a change later in this second would keep the same stat */
+    uint32_t size = (time_t)e->mtime_sec >= now ? 0 : e->size;
+    uint32_t fields[10] = {
+        e->ctime_sec, e->ctime_nsec, e->mtime_sec, e->mtime_nsec,
+        e->dev, e->ino, e->mode, e->uid, e->gid, size,
+    };
+    for (int i = 0; i < 10; i++) put_u32(fixed + 4 * i, fields[i]);
+    memcpy(fixed + 40, e->oid.hash, OID_RAW_SIZE);
+
+    size_t name_len = strlen(e->path);
+    uint16_t flags = name_len < FLAG_NAME_MASK ? (uint16_t)name_len : FLAG_NAME_MASK;
+    fixed[60] = (unsigned char)(flags >> 8);
+    fixed[61] = (unsigned char)flags;
+
+    static const unsigned char padding[8] = {0};
+    size_t entry_len = (ENTRY_FIXED_SIZE + name_len + 8) & ~(size_t)7;
+    index_put(w, fixed, sizeof(fixed));
+    index_put(w, e->path, name_len);
+    index_put(w, padding, entry_len - ENTRY_FIXED_SIZE - name_len);
+}
+
+int index_write(GitIndex *index) {
+    if (index->count > UINT32_MAX) {
+        GIT_ERR("index: too many entries (%zu)\n", index->count);
+        return 1;
+    }
+    if (index->count > 1) {
+        qsort(index->entries, index->count, sizeof(IndexEntry), compare_entries);
+    }
+
+    const char *lock_path = GIT_INDEX_FILE ".lock";
+    int fd = open(lock_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        GIT_ERR("index: cannot create %s: %s\n", lock_path, strerror(errno));
+        return 1;
+    }
+    IndexWriter w = { fdopen(fd, "wb"), hash_ctx_new(HASH_SHA1), 0 };
+    if (w.fp == NULL || w.hash == NULL) {
+        GIT_ERR("index: cannot write %s\n", lock_path);
+        if (w.fp != NULL) fclose(w.fp);
+        else close(fd);
+        hash_ctx_free(w.hash);
+        unlink(lock_path);
+        return 1;
+    }
+
+    unsigned char header[12];
+    memcpy(header, INDEX_SIGNATURE, 4);
+    put_u32(header + 4, INDEX_VERSION);
+    put_u32(header + 8, (uint32_t)index->count);
+    index_put(&w, header, sizeof(header));
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < index->count; i++) put_entry(&w, &index->entries[i], now);
+
+    if (index->cache_tree != NULL) {
+        unsigned char *ext = NULL;
+        size_t ext_len = 0;
+        if (cache_tree_serialize(index->cache_tree, &ext, &ext_len) != 0 || ext_len > UINT32_MAX) {
+            w.failed = 1;
+        } else {
+            unsigned char ext_header[8];
+            memcpy(ext_header, CACHE_TREE_SIGNATURE, 4);
+            put_u32(ext_header + 4, (uint32_t)ext_len);
+            index_put(&w, ext_header, sizeof(ext_header));
+            index_put(&w, ext, ext_len);
+        }
+        free(ext);
+    }
+
+    unsigned char checksum[OID_RAW_SIZE];
+    hash_final(w.hash, checksum);
+    if (!w.failed && fwrite(checksum, 1, sizeof(checksum), w.fp) != sizeof(checksum)) w.failed = 1;
+    hash_ctx_free(w.hash);
+    if (fclose(w.fp) != 0) w.failed = 1;
+
+    if (w.failed || rename(lock_path, GIT_INDEX_FILE) != 0) {
+        GIT_ERR("index: error writing %s\n", GIT_INDEX_FILE);
+        unlink(lock_path);
+        return 1;
+    }
+    return 0;
+}
+
+int index_add(GitIndex *index, const char *path, uint32_t mode,
+              const ObjectId *oid, const struct stat *st) {
+    if (grow_entries(index) != 0) return 1;
+    IndexEntry *e = &index->entries[index->count];
+    e->path = strdup(path);
+    if (e->path == NULL) {
+        GIT_ERR("index: malloc failed for path\n");
+        return 1;
+    }
+    index_entry_set_stat(e, st);
+    e->mode = mode;
+    e->oid = *oid;
+    index->count++;
+    return 0;
+}
+
+void index_entry_set_stat(IndexEntry *entry, const struct stat *st) {
+    entry->ctime_sec = (uint32_t)st->st_ctim.tv_sec;
+    entry->ctime_nsec = (uint32_t)st->st_ctim.tv_nsec;
+    entry->mtime_sec = (uint32_t)st->st_mtim.tv_sec;
+    entry->mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    entry->dev = (uint32_t)st->st_dev;
+    entry->ino = (uint32_t)st->st_ino;
+    entry->uid = (uint32_t)st->st_uid;
+    entry->gid = (uint32_t)st->st_gid;
+    entry->size = (uint32_t)st->st_size;
+}
+
+const IndexEntry *index_find(const GitIndex *index, const char *path) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(index->entries[mid].path, path);
+        if (cmp == 0) return &index->entries[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+/* Position of the first entry whose path sorts at or after key. */
+static size_t lower_bound(const GitIndex *index, const char *key) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(index->entries[mid].path, key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t index_count_under(const GitIndex *index, const char *dir) {
+    if (dir[0] == '\0') return index->count;
+    /* Paths under "dir/" sort between "dir/" and "dir0" ('0' follows '/') */
+    char key[GIT_PATH_MAX];
+    int len = snprintf(key, sizeof(key), "%s/", dir);
+    if (len < 0 || (size_t)len >= sizeof(key)) return 0;
+    size_t first = lower_bound(index, key);
+    key[len - 1] = '0';
+    return lower_bound(index, key) - first;
+}
+
+int index_entry_matches(const IndexEntry *entry, const struct stat *st) {
+    return entry->mtime_sec == (uint32_t)st->st_mtim.tv_sec &&
+           entry->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec &&
+           entry->ctime_sec == (uint32_t)st->st_ctim.tv_sec &&
+           entry->ctime_nsec == (uint32_t)st->st_ctim.tv_nsec &&
+           entry->ino == (uint32_t)st->st_ino &&
+           entry->dev == (uint32_t)st->st_dev &&
+           entry->size == (uint32_t)st->st_size;
+}
+
+void index_free(GitIndex *index) {
+    for (size_t i = 0; i < index->count; i++) free(index->entries[i].path);
+    free(index->entries);
+    cache_tree_free(index->cache_tree);
+    *index = (GitIndex){0};
+}
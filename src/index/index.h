@@ -0,0 +1,117 @@
+/*
+ * index.h
+ *
+ * The index (.git/index, "dircache"): one entry per tracked file with
+ * its mode, object ID and the stat data seen when the ID was last
+ * computed. Written in git's version 2 format, so git can read it.
+ *
+ * Here it serves as a stat cache: checkout records every file it
+ * writes, and write-tree reuses an entry's ID whenever the file's
+ * stat data still matches instead of hashing the file again. Only
+ * checkout decides what the index tracks; write-tree just refreshes
+ * the stat data of entries whose content it found unchanged.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <sys/stat.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../objects/object_id.h"
+#include "cache_tree.h"
+
+/* One file, with its stat data truncated to 32 bits as on disk. */
+typedef struct {
+    uint32_t ctime_sec, ctime_nsec;
+    uint32_t mtime_sec, mtime_nsec;
+    uint32_t dev, ino;
+    uint32_t mode;              /* 0100644, 0100755, 0120000 or 0160000 */
+    uint32_t uid, gid;
+    uint32_t size;
+    ObjectId oid;
+    char *path;                 /* heap-allocated, relative to the work tree */
+} IndexEntry;
+
+/* An in-memory index; zero-initialize before index_load(). */
+typedef struct {
+    IndexEntry *entries;        /* sorted by path once loaded or written */
+    size_t count;
+    size_t capacity;
+    CacheTree *cache_tree;      /* TREE extension, or NULL; owned by the index */
+} GitIndex;
+
+/*
+ * Reads .git/index.
+ *
+ * A missing index is not an error: *index is left empty. The cache
+ * tree is loaded if present (a malformed one is dropped); other
+ * extensions are skipped.
+ *
+ * @param index  Zero-initialized index to populate.
+ * @return       0 on success, 1 if the file is corrupt or unsupported
+ *               (*index is left empty).
+ */
+int index_load(GitIndex *index);
+
+/*
+ * Writes the index to .git/index via .git/index.lock and a rename.
+ *
+ * Entries are sorted by path first. An entry modified in the same
+ * second as the write is stored with size 0 ("smudged"), so a later
+ * edit within that second cannot hide behind matching stat data.
+ * index->cache_tree, if set, is written as the TREE extension.
+ *
+ * @return  0 on success, 1 on failure (.git/index is left unchanged).
+ */
+int index_write(GitIndex *index);
+
+/*
+ * Appends an entry. Call index_write() (or keep adding in path order)
+ * before looking entries up.
+ *
+ * @param path  Work-tree-relative path (copied).
+ * @param mode  Git file mode, e.g. 0100644.
+ * @param oid   Blob ID for the file's content.
+ * @param st    Stat data of the file the ID was computed from.
+ * @return      0 on success, 1 on allocation failure.
+ */
+int index_add(GitIndex *index, const char *path, uint32_t mode,
+              const ObjectId *oid, const struct stat *st);
+
+/*
+ * Finds the entry for a path by binary search.
+ *
+ * @return  The entry, or NULL if the path is not in the index.
+ */
+const IndexEntry *index_find(const GitIndex *index, const char *path);
+
+/*
+ * Counts the entries below a directory by binary search.
+ *
+ * @param dir  Work-tree-relative directory ("a/b"); "" is the root.
+ * @return     The number of entries whose path starts with "dir/".
+ */
+size_t index_count_under(const GitIndex *index, const char *dir);
+
+/*
+ * Records fresh stat data for an entry, e.g. after its file was hashed
+ * again and found unchanged. Mode and ID are left alone.
+ */
+void index_entry_set_stat(IndexEntry *entry, const struct stat *st);
+
+/*
+ * Checks whether a file still matches the stat data recorded in its
+ * entry, i.e. whether the entry's object ID can be trusted without
+ * reading the file.
+ *
+ * @return  1 if the stat data matches, 0 otherwise.
+ */
+int index_entry_matches(const IndexEntry *entry, const struct stat *st);
+
+/* Frees all entries; the index can be reused afterwards. */
+void index_free(GitIndex *index);
+
+#endif /* INDEX_H */
@@ -7,21 +7,71 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "commands/commands.h"
+#include "objects/commit_graph.h"
+#include "objects/loose_store.h"
+#include "pack/pack_objects.h"
+#include "utils/trace/trace.h"
 
 /* Wrappers adapt the generic (argc, argv) dispatch signature
  * to each command's specific parameters. CLI parsing stays here
  * so the command implementations stay clean and testable. */
 
+/*
+ * Parses one "--threads=<n>" argument into *threads.
+ * Returns 0, or 1 on a bad value or any other option.
+ */
+static int parse_thread_arg(const char *arg, int *threads) {
+    if (strncmp(arg, "--threads=", 10) != 0) {
+        fprintf(stderr, "Unknown option %s\n", arg);
+        return 1;
+    }
+    char *end;
+    long n = strtol(arg + 10, &end, 10);
+    if (end == arg + 10 || *end != '\0' || n < 0 || n > 1024) {
+        fprintf(stderr, "Invalid thread count %s\n", arg + 10);
+        return 1;
+    }
+    *threads = (int)n;
+    return 0;
+}
+
+/*
+ * Scans argv[first..] for "--threads=<n>".
+ * Leaves *threads untouched when absent. Returns 0, or 1 on a bad value
+ * or an unknown option.
+ */
+static int parse_threads(int argc, char **argv, int first, int *threads) {
+    for (int i = first; i < argc; i++) {
+        if (parse_thread_arg(argv[i], threads) != 0) return 1;
+    }
+    return 0;
+}
+
 static int cmd_init(int argc, char **argv) {
     (void)argc; (void)argv;
     return init_git();
 }
 
 static int cmd_cat_file(int argc, char **argv) {
-    (void)argc;
-    return cat_file(argv[3]);
+    if (strcmp(argv[2], "--batch") == 0 || strcmp(argv[2], "--batch-check") == 0) {
+        int buffer = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--buffer") != 0) {
+                fprintf(stderr, "Unknown option %s\n", argv[i]);
+                return 1;
+            }
+            buffer = 1;
+        }
+        return cat_file_batch(argv[2][7] == '\0', buffer);
+    }
+    if (argc < 4) {
+        fprintf(stderr, "Usage: ./your_program.sh cat-file (-p|-t|-s) <sha1>\n");
+        return 1;
+    }
+    return cat_file(argv[2], argv[3]);
 }
 
 static int cmd_hash_object(int argc, char **argv) {
@@ -35,8 +85,9 @@ static int cmd_ls_tree(int argc, char **argv) {
 }
 
 static int cmd_write_tree(int argc, char **argv) {
-    (void)argc; (void)argv;
-    return write_tree();
+    int threads = 0;
+    if (parse_threads(argc, argv, 2, &threads) != 0) return 1;
+    return write_tree(threads);
 }
 
 static int cmd_commit_tree(int argc, char **argv) {
@@ -45,8 +96,112 @@ static int cmd_commit_tree(int argc, char **argv) {
 }
 
 static int cmd_clone(int argc, char **argv) {
+    int threads = 0, depth = 0;
+    const char *filter = NULL;
+    for (int i = 4; i < argc; i++) {
+        if (strncmp(argv[i], "--depth=", 8) == 0) {
+            char *end;
+            long n = strtol(argv[i] + 8, &end, 10);
+            if (end == argv[i] + 8 || *end != '\0' || n < 1 || n > 0x7fffffff) {
+                fprintf(stderr, "Invalid depth %s\n", argv[i] + 8);
+                return 1;
+            }
+            depth = (int)n;
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else if (parse_thread_arg(argv[i], &threads) != 0) {
+            return 1;
+        }
+    }
+    return clone_repo(argv[2], argv[3], depth, filter, threads);
+}
+
+static int cmd_fetch(int argc, char **argv) {
+    int threads = 0;
+    if (parse_threads(argc, argv, 2, &threads) != 0) return 1;
+    return fetch_origin(threads);
+}
+
+static int cmd_index_pack(int argc, char **argv) {
+    int threads = 0;
+    if (parse_threads(argc, argv, 3, &threads) != 0) return 1;
+    return index_pack(threads);
+}
+
+/* Parses the value of "--<name>=<n>" into *value; 0, or 1 if it is bad. */
+static int parse_count(const char *arg, size_t prefix_len, long max, int *value) {
+    char *end;
+    long n = strtol(arg + prefix_len, &end, 10);
+    if (end == arg + prefix_len || *end != '\0' || n < 0 || n > max) {
+        fprintf(stderr, "Invalid value %s\n", arg);
+        return 1;
+    }
+    *value = (int)n;
+    return 0;
+}
+
+static int cmd_gc(int argc, char **argv) {
+    int window = PACK_WINDOW_DEFAULT, depth = PACK_DEPTH_DEFAULT;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--window=", 9) == 0) {
+            if (parse_count(argv[i], 9, 1024, &window) != 0) return 1;
+        } else if (strncmp(argv[i], "--depth=", 8) == 0) {
+            if (parse_count(argv[i], 8, 4095, &depth) != 0) return 1;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    return gc(window, depth);
+}
+
+/*
+ * Parses rev-list / log arguments: --max-count=<n> or -n <n>, and
+ * (for log) --oneline; the rest are revisions. log defaults to HEAD.
+ */
+static int cmd_rev_walk(int argc, char **argv, int is_log) {
+    char *head[] = { "HEAD" };
+    char **revs = argv + 2;
+    size_t rev_count = 0;
+    int max_count = -1;
+    RevListFormat format = is_log ? REV_LIST_MEDIUM : REV_LIST_OIDS;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--max-count=", 12) == 0) {
+            if (parse_count(argv[i], 12, 0x7fffffff, &max_count) != 0) return 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], 0, 0x7fffffff, &max_count) != 0) return 1;
+        } else if (is_log && strcmp(argv[i], "--oneline") == 0) {
+            format = REV_LIST_ONELINE;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        } else {
+            revs[rev_count++] = argv[i];  /* compacts the revisions in place */
+        }
+    }
+    if (rev_count == 0) {
+        if (!is_log) {
+            fprintf(stderr, "Usage: ./your_program.sh rev-list [--max-count=<n>] <commit>...\n");
+            return 1;
+        }
+        revs = head;
+        rev_count = 1;
+    }
+    return rev_list(revs, rev_count, max_count, format);
+}
+
+static int cmd_rev_list(int argc, char **argv) {
+    return cmd_rev_walk(argc, argv, 0);
+}
+
+static int cmd_log(int argc, char **argv) {
+    return cmd_rev_walk(argc, argv, 1);
+}
+
+static int cmd_commit_graph(int argc, char **argv) {
     (void)argc;
-    return clone_repo(argv[2], argv[3]);
+    (void)argv;
+    return commit_graph_write(NULL, 0);
 }
 
 typedef struct {
@@ -59,19 +214,36 @@ typedef struct {
 
 static const Command commands[] = {
     { "init",        2, NULL,          NULL,                            cmd_init },
-    { "cat-file",    4, "-p",          "cat-file -p <sha1>",           cmd_cat_file },
+    { "cat-file",    3, NULL,          "cat-file (-p|-t|-s) <sha1> | (--batch|--batch-check) [--buffer]", cmd_cat_file },
     { "hash-object", 4, "-w",          "hash-object -w <file>",        cmd_hash_object },
     { "ls-tree",     4, "--name-only", "ls-tree --name-only <sha1>",   cmd_ls_tree },
-    { "write-tree",  2, NULL,          NULL,                            cmd_write_tree },
+    { "write-tree",  2, NULL,          "write-tree [--threads=<n>]",   cmd_write_tree },
     { "commit-tree", 7, NULL,          "commit-tree <tree> -p <parent> -m <msg>", cmd_commit_tree },
-    { "clone",       4, NULL,          "clone <url> <dir>",             cmd_clone },
+    { "clone",       4, NULL,          "clone <url> <dir> [--depth=<n>] [--filter=<spec>] [--threads=<n>]", cmd_clone },
+    { "fetch",       2, NULL,          "fetch [--threads=<n>]",        cmd_fetch },
+    { "index-pack",  3, "--stdin",     "index-pack --stdin [--threads=<n>]", cmd_index_pack },
+    { "gc",          2, NULL,          "gc [--window=<n>] [--depth=<n>]", cmd_gc },
+    { "rev-list",    3, NULL,          "rev-list [--max-count=<n>] <commit>...", cmd_rev_list },
+    { "log",         2, NULL,          "log [--oneline] [--max-count=<n>] [<commit>...]", cmd_log },
+    { "commit-graph", 3, "write",      "commit-graph write",            cmd_commit_graph },
 };
 
 static const size_t num_commands = sizeof(commands) / sizeof(commands[0]);
 
+/*
+ * Whether the command streams bulk output on stdout (cat-file --batch,
+ * rev-list, log), where unbuffered stdout would cost a write() per line.
+ */
+static int bulk_stdout(int argc, char **argv) {
+    if (argc >= 2 && (strcmp(argv[1], "rev-list") == 0 || strcmp(argv[1], "log") == 0)) return 1;
+    return argc >= 3 && strcmp(argv[1], "cat-file") == 0 && strncmp(argv[2], "--batch", 7) == 0;
+}
+
 int main(const int argc, char *argv[]) {
-    /* Disable output buffering so CodeCrafters test runner sees output immediately */
-    setbuf(stdout, NULL);
+    /* Disable output buffering so CodeCrafters test runner sees output immediately;
+     * bulk output is fully buffered and flushed by the command instead */
+    if (bulk_stdout(argc, argv)) setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+    else setbuf(stdout, NULL);
     setbuf(stderr, NULL);
 
     if (argc < 2) {
@@ -92,7 +264,14 @@ int main(const int argc, char *argv[]) {
             fprintf(stderr, "Unknown flag %s for %s\n", argv[2], commands[i].name);
             return 1;
         }
-        return commands[i].handler(argc, argv);
+        /* The whole command is one span; GIT_TRACE_PERF is read before any chdir */
+        uint64_t start = trace_now();
+        int status = commands[i].handler(argc, argv);
+        /* One sync barrier for every object the command wrote (core.fsyncMethod=batch) */
+        if (loose_store_flush() != 0) status = 1;
+        trace_span(commands[i].name, start);
+        trace_finish(commands[i].name, status);
+        return status;
     }
 
     fprintf(stderr, "Unknown command %s\n", command);
@@ -3,92 +3,229 @@
  *
  * HTTP client using libcurl for git's smart HTTP protocol.
  * Two operations: GET refs (discover what the server has) and
- * POST upload-pack (request a packfile of objects).
+ * POST upload-pack (request a packfile of objects). Every response
+ * is streamed to a sink; the refs sink simply collects the body.
+ *
+ * A session owns one easy handle, reset between requests so its
+ * connection cache survives, plus a curl share holding the DNS, TLS
+ * session and connection caches, so any handle added later for the
+ * same remote reuses them too.
+ *
+ * http_download() is the exception to one-handle-per-session: a large
+ * file on a server that takes byte ranges is split across several
+ * handles driven by one curl multi handle, all sharing those caches.
  */
 
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <curl/curl.h>
 
 #include "../constants.h"
+#include "../utils/trace/trace.h"
 #include "http.h"
 
+/* Files at least this large are downloaded as parallel range requests */
+#define HTTP_RANGE_MIN_SIZE (8 * 1024 * 1024)
+/* Range requests per download */
+#define HTTP_RANGE_PARTS 4
+
+struct HttpSession {
+    char *url;
+    int protocol;               /* wire protocol version to request; 0 = server default */
+    CURL *curl;
+    CURLSH *share;
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+};
+
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+static int curl_init_failed;
+
+/* curl_global_init is not thread-safe on older libcurl; run it once. */
+static void init_curl(void) {
+    curl_init_failed = curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK;
+}
+
+/* The share may be used from several threads; one mutex per data kind. */
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    HttpSession *session = userptr;
+    pthread_mutex_lock(&session->locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    HttpSession *session = userptr;
+    pthread_mutex_unlock(&session->locks[data]);
+}
+
+HttpSession *http_session_new(const char *url) {
+    pthread_once(&curl_once, init_curl);
+    if (curl_init_failed) {
+        GIT_ERR("curl_global_init failed\n");
+        return NULL;
+    }
+
+    HttpSession *session = calloc(1, sizeof(HttpSession));
+    if (session == NULL) {
+        GIT_ERR("http: malloc failed\n");
+        return NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) pthread_mutex_init(&session->locks[i], NULL);
+
+    session->url = strdup(url);
+    session->curl = curl_easy_init();
+    session->share = curl_share_init();
+    if (session->url == NULL || session->curl == NULL || session->share == NULL) {
+        GIT_ERR("http: cannot create session\n");
+        http_session_free(session);
+        return NULL;
+    }
+
+    curl_share_setopt(session->share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(session->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(session->share, CURLSHOPT_USERDATA, session);
+    curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    /* Shared connection caches need libcurl 7.57; older ones keep a per-handle cache */
+    curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    return session;
+}
+
+void http_session_free(HttpSession *session) {
+    if (session == NULL) return;
+    /* The handle must let go of the share before the share can go */
+    if (session->curl != NULL) curl_easy_cleanup(session->curl);
+    if (session->share != NULL) curl_share_cleanup(session->share);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) pthread_mutex_destroy(&session->locks[i]);
+    free(session->url);
+    free(session);
+}
+
+const char *http_session_url(const HttpSession *session) {
+    return session->url;
+}
+
+void http_session_set_protocol(HttpSession *session, int version) {
+    session->protocol = version;
+}
+
 /*
- * libcurl callback — called repeatedly as data arrives from the server.
- *
- * libcurl doesn't give us the whole response at once. It calls this
- * function multiple times with chunks of data (e.g., 16KB at a time).
- * We grow our buffer with realloc and append each chunk.
- *
- * Parameters (set by libcurl, not us):
- *   chunk     — pointer to the incoming data
- *   elem_size — always 1 (size of each element)
- *   count     — number of elements (= number of bytes)
- *   userdata  — our HttpResponse pointer (passed via CURLOPT_WRITEDATA)
- *
- * Must return the number of bytes handled. Returning less than
- * count signals an error and aborts the transfer.
+ * Builds the headers every request of the session sends: the
+ * Git-Protocol request, if any, and the body's Content-Type.
+ * Returns the list (the caller frees it), or NULL if there is none.
  */
-static size_t write_callback(void *chunk, size_t elem_size, size_t count, void *userdata) {
-    size_t chunk_size = elem_size * count;
-    HttpResponse *resp = (HttpResponse *)userdata;
-
-    /* Grow the buffer to fit the new chunk.
-     * +1 for a null terminator we add for convenience (so the data
-     * can be used as a C string for text responses like refs). */
-    char *new_data = realloc(resp->data, resp->size + chunk_size + 1);
-    if (new_data == NULL) {
-        GIT_ERR("realloc failed in HTTP callback\n");
-        return 0;
+static struct curl_slist *request_headers(const HttpSession *session, const char *content_type) {
+    struct curl_slist *headers = NULL;
+    if (session->protocol > 0) {
+        char line[48];
+        snprintf(line, sizeof(line), "Git-Protocol: version=%d", session->protocol);
+        headers = curl_slist_append(headers, line);
+    }
+    if (content_type != NULL) {
+        char line[128];
+        snprintf(line, sizeof(line), "Content-Type: %s", content_type);
+        struct curl_slist *appended = curl_slist_append(headers, line);
+        if (appended != NULL) headers = appended;
     }
+    return headers;
+}
 
-    resp->data = new_data;
-    memcpy(resp->data + resp->size, chunk, chunk_size);
-    resp->size += chunk_size;
-    resp->data[resp->size] = '\0';
+/* Bridges libcurl's write callback to a caller-supplied HttpSink. */
+typedef struct {
+    HttpSink sink;
+    void *ctx;
+} StreamTarget;
 
+/*
+ * libcurl callback — forwards each chunk straight to the sink
+ * without copying. A sink failure returns 0, which makes libcurl
+ * abort the transfer with CURLE_WRITE_ERROR.
+ */
+static size_t stream_callback(void *chunk, size_t elem_size, size_t count, void *userdata) {
+    size_t chunk_size = elem_size * count;
+    StreamTarget *target = (StreamTarget *)userdata;
+
+    trace_count(TRACE_BYTES_RECEIVED, chunk_size);
+    if (target->sink((const unsigned char *)chunk, chunk_size, target->ctx) != 0) {
+        return 0;
+    }
     return chunk_size;
 }
 
 /*
- * Shared setup for both GET and POST requests.
- * Returns a configured CURL handle, or NULL on failure.
+ * Sink that collects a body into an HttpResponse. The buffer doubles
+ * as it fills and keeps a NUL after the data, so text responses like
+ * refs can be used as C strings.
  */
-static CURL *setup_curl(const char *url, HttpResponse *resp) {
-    CURL *curl = curl_easy_init();
-    if (curl == NULL) {
-        GIT_ERR("curl_easy_init failed\n");
-        return NULL;
+static int response_sink(const unsigned char *data, size_t len, void *ctx) {
+    HttpResponse *resp = ctx;
+    if (resp->size + len + 1 > resp->capacity) {
+        size_t new_capacity = resp->capacity == 0 ? 16 * 1024 : resp->capacity;
+        while (new_capacity < resp->size + len + 1) new_capacity *= 2;
+        char *grown = realloc(resp->data, new_capacity);
+        if (grown == NULL) {
+            GIT_ERR("realloc failed in HTTP callback\n");
+            return 1;
+        }
+        resp->data = grown;
+        resp->capacity = new_capacity;
     }
+    if (len > 0) memcpy(resp->data + resp->size, data, len);
+    resp->size += len;
+    resp->data[resp->size] = '\0';
+    return 0;
+}
 
+/* Sets the options every request of a session uses on a fresh handle. */
+static void configure_handle(HttpSession *session, CURL *curl, const char *url, StreamTarget *target) {
+    curl_easy_setopt(curl, CURLOPT_SHARE, session->share);
     curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, target);
     /* Follow HTTP redirects (GitHub sometimes redirects) */
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
     /* User-Agent header — some servers reject requests without one */
     curl_easy_setopt(curl, CURLOPT_USERAGENT, "git/codecrafters");
-
-    return curl;
+    /* HTTP/2 over TLS when the server offers it; HTTP/1.1 otherwise.
+     * A libcurl built without HTTP/2 rejects this and keeps 1.1. */
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    /* "" = advertise every encoding this libcurl can decode */
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    /* Error pages must not reach the sink as if they were protocol data */
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
 }
 
 /*
- * Runs a curl request and checks for errors.
- * Cleans up the curl handle before returning.
+ * Prepares the session's handle for a new request. curl_easy_reset
+ * clears the previous request's options but keeps its live
+ * connections, so the next request can reuse them.
  */
-static int perform_and_cleanup(CURL *curl) {
+static CURL *setup_curl(HttpSession *session, const char *url, StreamTarget *target) {
+    CURL *curl = session->curl;
+    curl_easy_reset(curl);
+    configure_handle(session, curl, url, target);
+    return curl;
+}
+
+/* Runs a prepared request and checks for errors; the handle stays open. */
+static int perform(CURL *curl) {
     CURLcode res = curl_easy_perform(curl);
     if (res != CURLE_OK) {
         GIT_ERR("HTTP request failed: %s\n", curl_easy_strerror(res));
-        curl_easy_cleanup(curl);
         return 1;
     }
 
     long http_code;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    curl_easy_cleanup(curl);
-
     if (http_code != 200) {
         GIT_ERR("HTTP error: %ld\n", http_code);
         return 1;
@@ -97,31 +234,48 @@ static int perform_and_cleanup(CURL *curl) {
     return 0;
 }
 
-int http_get_refs(const char *url, HttpResponse *resp) {
-    resp->data = NULL;
-    resp->size = 0;
+/* Runs a prepared request with the given headers, then detaches and frees them. */
+static int perform_with_headers(CURL *curl, struct curl_slist *headers) {
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    int result = perform(curl);
+    /* The handle outlives this request; do not leave it pointing at freed headers */
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(headers);
+    return result;
+}
+
+int http_get_stream(HttpSession *session, const char *url, HttpSink sink, void *ctx) {
+    StreamTarget target = { sink, ctx };
+    CURL *curl = setup_curl(session, url, &target);
+    return perform_with_headers(curl, request_headers(session, NULL));
+}
+
+int http_get_refs(HttpSession *session, HttpResponse *resp) {
+    *resp = (HttpResponse){0};
 
     /* Build the refs discovery URL:
      * <repo_url>.git/info/refs?service=git-upload-pack */
     char full_url[GIT_PATH_MAX];
-    snprintf(full_url, sizeof(full_url), "%s.git/info/refs?service=git-upload-pack", url);
-
-    CURL *curl = setup_curl(full_url, resp);
-    if (curl == NULL) return 1;
+    snprintf(full_url, sizeof(full_url), "%s.git/info/refs?service=git-upload-pack", session->url);
 
-    return perform_and_cleanup(curl);
+    if (http_get_stream(session, full_url, response_sink, resp) != 0) {
+        http_response_free(resp);
+        return 1;
+    }
+    /* An empty body still hands the caller a valid C string */
+    if (resp->data == NULL && response_sink(NULL, 0, resp) != 0) return 1;
+    return 0;
 }
 
-int http_post_pack(const char *url, const char *body, size_t body_len, HttpResponse *resp) {
-    resp->data = NULL;
-    resp->size = 0;
-
+int http_post_pack(HttpSession *session, const char *body, size_t body_len,
+                   HttpSink sink, void *ctx) {
+    /* Every upload-pack request — v0 wants, v2 ls-refs and fetch — is a POST here */
     /* Build the upload-pack URL: <repo_url>.git/git-upload-pack */
     char full_url[GIT_PATH_MAX];
-    snprintf(full_url, sizeof(full_url), "%s.git/git-upload-pack", url);
+    snprintf(full_url, sizeof(full_url), "%s.git/git-upload-pack", session->url);
 
-    CURL *curl = setup_curl(full_url, resp);
-    if (curl == NULL) return 1;
+    StreamTarget target = { sink, ctx };
+    CURL *curl = setup_curl(session, full_url, &target);
 
     /* Set POST method with the request body */
     curl_easy_setopt(curl, CURLOPT_POST, 1L);
@@ -132,17 +286,177 @@ int http_post_pack(const char *url, const char *body, size_t body_len, HttpRespo
     curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
 
     /* Git protocol requires this specific Content-Type */
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/x-git-upload-pack-request");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    return perform_with_headers(curl, request_headers(session, "application/x-git-upload-pack-request"));
+}
 
-    int result = perform_and_cleanup(curl);
-    curl_slist_free_all(headers);
+int http_post_command(HttpSession *session, const char *body, size_t body_len, HttpResponse *resp) {
+    *resp = (HttpResponse){0};
+    if (http_post_pack(session, body, body_len, response_sink, resp) != 0) {
+        http_response_free(resp);
+        return 1;
+    }
+    if (resp->data == NULL && response_sink(NULL, 0, resp) != 0) return 1;
+    return 0;
+}
+
+/* Sink for downloads: one byte range of the output file. */
+typedef struct {
+    int fd;
+    off_t offset;          /* where the next byte goes */
+    off_t end;             /* one past the range's last byte; -1 = unbounded */
+} FileRange;
+
+static int file_sink(const unsigned char *data, size_t len, void *ctx) {
+    FileRange *range = ctx;
+    if (range->end >= 0 && (off_t)len > range->end - range->offset) {
+        GIT_ERR("http: server sent more than the requested range\n");
+        return 1;
+    }
+    while (len > 0) {
+        ssize_t n = pwrite(range->fd, data, len, range->offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            GIT_ERR("http: write failed: %s\n", strerror(errno));
+            return 1;
+        }
+        data += n;
+        len -= (size_t)n;
+        range->offset += n;
+    }
+    return 0;
+}
+
+/* Header callback for the probe: notes "Accept-Ranges: bytes". */
+static size_t ranges_header(char *line, size_t elem_size, size_t count, void *userdata) {
+    size_t len = elem_size * count;
+    const char name[] = "accept-ranges:";
+    if (len >= sizeof(name) - 1 && strncasecmp(line, name, sizeof(name) - 1) == 0) {
+        const char *value = line + sizeof(name) - 1;
+        const char *end = line + len;
+        while (value < end && *value == ' ') value++;
+        if (end - value >= 5 && strncasecmp(value, "bytes", 5) == 0) *(int *)userdata = 1;
+    }
+    return len;
+}
+
+/*
+ * HEAD request for a download's size and whether it may be fetched
+ * in ranges. Sets *size to -1 when the server does not say.
+ * Returns 0 on success, 1 if the probe failed.
+ */
+static int probe_download(HttpSession *session, const char *url, curl_off_t *size, int *ranges) {
+    CURL *curl = setup_curl(session, url, NULL);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, ranges_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, ranges);
+    *ranges = 0;
+    *size = -1;
+    if (perform(curl) != 0) return 1;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, size);
+    return 0;
+}
+
+/*
+ * Fetches [0, size) of url as HTTP_RANGE_PARTS range requests running
+ * side by side on one multi handle; each part writes its own slice.
+ */
+static int download_ranges(HttpSession *session, const char *url, int fd, off_t size) {
+    CURLM *multi = curl_multi_init();
+    CURL *parts[HTTP_RANGE_PARTS] = {0};
+    StreamTarget targets[HTTP_RANGE_PARTS];
+    FileRange ranges[HTTP_RANGE_PARTS];
+    int result = 1;
+    if (multi == NULL) {
+        GIT_ERR("http: cannot create multi handle\n");
+        return 1;
+    }
+
+    off_t part_size = (size + HTTP_RANGE_PARTS - 1) / HTTP_RANGE_PARTS;
+    for (int i = 0; i < HTTP_RANGE_PARTS; i++) {
+        off_t start = part_size * i;
+        off_t end = start + part_size < size ? start + part_size : size;
+        ranges[i] = (FileRange){ fd, start, end };
+        targets[i] = (StreamTarget){ file_sink, &ranges[i] };
+
+        parts[i] = curl_easy_init();
+        if (parts[i] == NULL) {
+            GIT_ERR("http: cannot create handle\n");
+            goto cleanup;
+        }
+        configure_handle(session, parts[i], url, &targets[i]);
+        /* Decoding would make the ranges refer to the encoded body */
+        curl_easy_setopt(parts[i], CURLOPT_ACCEPT_ENCODING, NULL);
+        char spec[64];
+        snprintf(spec, sizeof(spec), "%lld-%lld", (long long)start, (long long)end - 1);
+        curl_easy_setopt(parts[i], CURLOPT_RANGE, spec);
+        curl_multi_add_handle(multi, parts[i]);
+    }
+
+    int running;
+    do {
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        if (mc == CURLM_OK && running > 0) mc = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        if (mc != CURLM_OK) {
+            GIT_ERR("http: %s\n", curl_multi_strerror(mc));
+            goto cleanup;
+        }
+    } while (running > 0);
+
+    CURLMsg *msg;
+    int pending;
+    while ((msg = curl_multi_info_read(multi, &pending)) != NULL) {
+        if (msg->msg == CURLMSG_DONE && msg->data.result != CURLE_OK) {
+            GIT_ERR("HTTP request failed: %s\n", curl_easy_strerror(msg->data.result));
+            goto cleanup;
+        }
+    }
+    for (int i = 0; i < HTTP_RANGE_PARTS; i++) {
+        long http_code;
+        curl_easy_getinfo(parts[i], CURLINFO_RESPONSE_CODE, &http_code);
+        /* A 200 would mean the server ignored the range */
+        if (http_code != 206 || ranges[i].offset != ranges[i].end) {
+            GIT_ERR("http: range request %d of %s failed (HTTP %ld)\n", i, url, http_code);
+            goto cleanup;
+        }
+    }
+    result = 0;
+
+cleanup:
+    for (int i = 0; i < HTTP_RANGE_PARTS; i++) {
+        if (parts[i] == NULL) continue;
+        curl_multi_remove_handle(multi, parts[i]);
+        curl_easy_cleanup(parts[i]);
+    }
+    curl_multi_cleanup(multi);
     return result;
 }
 
+int http_download(HttpSession *session, const char *url, int fd, off_t *size_out) {
+    curl_off_t size;
+    int ranges;
+    if (probe_download(session, url, &size, &ranges) == 0 && ranges && size >= HTTP_RANGE_MIN_SIZE) {
+        if (ftruncate(fd, (off_t)size) != 0) {
+            GIT_ERR("http: cannot size download file: %s\n", strerror(errno));
+            return 1;
+        }
+        if (download_ranges(session, url, fd, (off_t)size) != 0) return 1;
+        *size_out = (off_t)size;
+        return 0;
+    }
+
+    /* Small, unsized or not range-capable: one plain GET */
+    FileRange range = { fd, 0, -1 };
+    StreamTarget target = { file_sink, &range };
+    CURL *curl = setup_curl(session, url, &target);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, NULL);
+    if (perform(curl) != 0) return 1;
+    *size_out = range.offset;
+    return 0;
+}
+
 void http_response_free(HttpResponse *resp) {
     free(resp->data);
     resp->data = NULL;
     resp->size = 0;
+    resp->capacity = 0;
 }
@@ -3,44 +3,129 @@
  *
  * HTTP client for git's smart HTTP protocol.
  * Uses libcurl to handle HTTPS, TLS, and transfer encoding.
+ *
+ * All requests for one remote go through an HttpSession, which keeps
+ * a single curl handle alive between them: the refs GET and the
+ * upload-pack POST share one connection (HTTP/2 where the server
+ * offers it) instead of each paying for DNS, TCP and TLS setup.
  */
 
 #ifndef HTTP_H
 #define HTTP_H
 
 #include <stddef.h>
+#include <sys/types.h>
+
+/* A connection to one remote repository; opaque. */
+typedef struct HttpSession HttpSession;
 
-/* Holds an HTTP response body accumulated from libcurl callbacks. */
+/* Holds an HTTP response body accumulated by http_get_refs(). */
 typedef struct {
-    char *data;      /* heap-allocated response body (caller must free) */
-    size_t size;     /* byte count of data */
+    char *data;      /* heap-allocated, NUL-terminated response body (caller must free) */
+    size_t size;     /* byte count of data, excluding the NUL */
+    size_t capacity; /* allocated bytes */
 } HttpResponse;
 
+/*
+ * Receives response body bytes as they arrive from the server.
+ * Returning non-zero aborts the transfer.
+ */
+typedef int (*HttpSink)(const unsigned char *data, size_t len, void *ctx);
+
+/*
+ * Opens a session for a repository. No connection is made until the
+ * first request.
+ *
+ * @param url  Repository URL (e.g. "https://github.com/user/repo"), copied.
+ * @return     Heap-allocated session (free with http_session_free()), or NULL.
+ */
+HttpSession *http_session_new(const char *url);
+
+/* Returns the repository URL the session was opened for. */
+const char *http_session_url(const HttpSession *session);
+
+/*
+ * Asks the server to speak a given wire protocol version: every later
+ * request carries "Git-Protocol: version=<n>". Servers that do not
+ * know the version ignore the header and answer in version 0.
+ *
+ * @param session  Session to configure.
+ * @param version  Protocol version, e.g. 2.
+ */
+void http_session_set_protocol(HttpSession *session, int version);
+
 /*
  * Fetches the refs list from a git smart HTTP server.
  *
  * Sends: GET <url>/info/refs?service=git-upload-pack
- * The response contains pkt-line formatted ref advertisements.
+ * The response contains pkt-line formatted ref advertisements, or
+ * with protocol version 2, the server's capability advertisement.
  *
- * @param url   Repository URL (e.g. "https://github.com/user/repo")
- * @param resp  Output: populated with the response body on success.
- * @return      0 on success, 1 on failure.
+ * @param session  Session for the repository.
+ * @param resp     Output: populated with the response body on success.
+ * @return         0 on success, 1 on failure.
  */
-int http_get_refs(const char *url, HttpResponse *resp);
+int http_get_refs(HttpSession *session, HttpResponse *resp);
 
 /*
- * Sends a git-upload-pack request to fetch a packfile.
+ * Sends a git-upload-pack request and streams the response to a sink.
  *
  * Sends: POST <url>/git-upload-pack with the given body.
- * The response contains a packfile (after pkt-line framing).
+ * The response (pkt-line framed packfile) is never buffered here —
+ * each chunk is handed to sink as soon as libcurl delivers it, so
+ * network transfer overlaps with whatever the sink does.
  *
- * @param url       Repository URL.
+ * @param session   Session for the repository.
  * @param body      Request body (pkt-line formatted "want" lines).
  * @param body_len  Byte count of body.
+ * @param sink      Called for every chunk of the response body.
+ * @param ctx       Passed through to sink.
+ * @return          0 on success, 1 on failure (including sink errors).
+ */
+int http_post_pack(HttpSession *session, const char *body, size_t body_len,
+                   HttpSink sink, void *ctx);
+
+/*
+ * Sends a protocol v2 command (e.g. ls-refs) and collects the whole
+ * response, for commands whose answer is small.
+ *
+ * @param session   Session for the repository.
+ * @param body      pkt-line encoded command request.
+ * @param body_len  Byte count of body.
  * @param resp      Output: populated with the response body on success.
  * @return          0 on success, 1 on failure.
  */
-int http_post_pack(const char *url, const char *body, size_t body_len, HttpResponse *resp);
+int http_post_command(HttpSession *session, const char *body, size_t body_len, HttpResponse *resp);
+
+/*
+ * Streams the body of an arbitrary GET through the session's
+ * connection cache, e.g. for a URL the server advertised.
+ *
+ * @param session  Session whose connections and caches to reuse.
+ * @param url      Absolute URL to fetch.
+ * @param sink     Called for every chunk of the response body.
+ * @param ctx      Passed through to sink.
+ * @return         0 on success, 1 on failure (including sink errors).
+ */
+int http_get_stream(HttpSession *session, const char *url, HttpSink sink, void *ctx);
+
+/*
+ * Downloads a static file (a bundle or pack offered by the server)
+ * into fd. A HEAD request first asks for its size: files of at least
+ * 8 MiB on servers that accept byte ranges are fetched as parallel
+ * range requests, each writing its own slice of the file; anything
+ * else comes down as one GET. All requests reuse the session's caches.
+ *
+ * @param session   Session whose connections and caches to reuse.
+ * @param url       Absolute URL to fetch.
+ * @param fd        Empty file opened for writing; written with pwrite().
+ * @param size_out  Output: the file's size once downloaded.
+ * @return          0 on success, 1 on failure.
+ */
+int http_download(HttpSession *session, const char *url, int fd, off_t *size_out);
+
+/* Closes the session's connections and frees it. Safe to call with NULL. */
+void http_session_free(HttpSession *session);
 
 /*
  * Frees the data inside an HttpResponse.
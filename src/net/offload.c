@@ -0,0 +1,323 @@
+/*
+ * offload.c
+ *
+ * Every offloaded file goes the same way: downloaded (in parallel
+ * ranges when large) into an unlinked temporary file next to the
+ * packs, mmap'd, and indexed like a fetched pack. Bundles first have
+ * their header checked, and are retried until their prerequisites are
+ * in — a bundle list need not be in dependency order.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../constants.h"
+#include "../pack/bundle.h"
+#include "../pack/packfile.h"
+#include "../pack/packstore.h"
+#include "../utils/string/string.h"
+#include "../utils/trace/trace.h"
+#include "offload.h"
+#include "pktline.h"
+
+/* Bundles beyond this many in one list are ignored */
+#define OFFLOAD_MAX_BUNDLES 64
+
+const char *offload_uri_protocols(const HttpSession *session) {
+    return strncmp(http_session_url(session), "http://", 7) == 0 ? "http,https" : "https";
+}
+
+/* Checks a URI against the protocols offload_uri_protocols() offers. */
+static int uri_allowed(const HttpSession *session, const char *uri) {
+    if (strncmp(uri, "https://", 8) == 0) return 1;
+    if (strncmp(uri, "http://", 7) == 0 && strncmp(http_session_url(session), "http://", 7) == 0) {
+        return 1;
+    }
+    GIT_ERR("offload: warning: not following %s\n", uri);
+    return 0;
+}
+
+/*
+ * Downloads uri into a temporary file under .git/objects/pack/. The
+ * file is unlinked at once, so closing *fd_out is all the cleanup
+ * there is. Returns 0 on success, 1 on failure.
+ */
+static int download_temp(HttpSession *session, const char *uri, int *fd_out, off_t *size) {
+    if (mkdir(GIT_PACK_DIR, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) {
+        GIT_ERR("offload: cannot create %s: %s\n", GIT_PACK_DIR, strerror(errno));
+        return 1;
+    }
+    char path[GIT_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/tmp_download_XXXXXX", GIT_PACK_DIR);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        GIT_ERR("offload: cannot create temporary file: %s\n", strerror(errno));
+        return 1;
+    }
+    unlink(path);
+
+    if (http_download(session, uri, fd, size) != 0 || *size == 0) {
+        if (*size == 0) GIT_ERR("offload: %s is empty\n", uri);
+        close(fd);
+        return 1;
+    }
+    *fd_out = fd;
+    return 0;
+}
+
+/* Maps a downloaded file read-only. Returns NULL on failure. */
+static const unsigned char *map_download(int fd, off_t size) {
+    void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        GIT_ERR("offload: mmap failed: %s\n", strerror(errno));
+        return NULL;
+    }
+    return map;
+}
+
+int offload_fetch_pack(HttpSession *session, const char *hash, const char *uri, int threads) {
+    ObjectId expected;
+    if (strlen(hash) != OID_HEX_SIZE || oid_from_hex(hash, &expected) != 0) {
+        GIT_ERR("offload: malformed pack hash '%s'\n", hash);
+        return 1;
+    }
+    if (!uri_allowed(session, uri)) return 1;
+
+    int fd;
+    off_t size;
+    uint64_t start = trace_now();
+    if (download_temp(session, uri, &fd, &size) != 0) return 1;
+    trace_span("offload.download", start);
+    int result = 1;
+    const unsigned char *map = map_download(fd, size);
+    if (map == NULL) goto cleanup;
+
+    unsigned char checksum[OID_RAW_SIZE];
+    if (packfile_index_buffer(map, (size_t)size, threads, checksum) != 0) goto cleanup;
+    if (memcmp(checksum, expected.hash, OID_RAW_SIZE) != 0) {
+        char got[OID_HEX_SIZE + 1];
+        hex_encode(checksum, OID_RAW_SIZE, got);
+        GIT_ERR("offload: %s is pack %s, expected %s\n", uri, got, hash);
+        goto cleanup;
+    }
+    packstore_reprepare();
+    result = 0;
+
+cleanup:
+    if (map != NULL) munmap((void *)map, (size_t)size);
+    close(fd);
+    return result;
+}
+
+/* One "bundle.<id>.*" group of a bundle list. */
+typedef struct {
+    char id[64];
+    char *uri;                  /* heap-allocated; NULL until listed */
+    unsigned long long token;   /* creationToken; 0 if none */
+    int fd;                     /* downloaded file, or -1 */
+    off_t size;
+} BundleEntry;
+
+/* A bundle list, as the "key=value" lines of a bundle-uri reply. */
+typedef struct {
+    BundleEntry entries[OFFLOAD_MAX_BUNDLES];
+    size_t count;
+    int version;
+    int mode_any;               /* "bundle.mode=any": one bundle is enough */
+} BundleList;
+
+static BundleEntry *find_entry(BundleList *list, const char *id, size_t id_len) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (strlen(list->entries[i].id) == id_len && memcmp(list->entries[i].id, id, id_len) == 0) {
+            return &list->entries[i];
+        }
+    }
+    if (list->count == OFFLOAD_MAX_BUNDLES || id_len >= sizeof(list->entries[0].id)) return NULL;
+    BundleEntry *entry = &list->entries[list->count++];
+    memcpy(entry->id, id, id_len);
+    entry->id[id_len] = '\0';
+    entry->fd = -1;
+    return entry;
+}
+
+/* pktline_for_each_line() callback: one "bundle.<key>=<value>" line. */
+static int bundle_list_line(const char *line, size_t len, void *ctx) {
+    BundleList *list = ctx;
+    const char *eq = memchr(line, '=', len);
+    if (eq == NULL || len < 7 || strncasecmp(line, "bundle.", 7) != 0) return 0;
+
+    char value[GIT_PATH_MAX];
+    size_t value_len = len - (size_t)(eq + 1 - line);
+    if (value_len >= sizeof(value)) return 0;
+    memcpy(value, eq + 1, value_len);
+    value[value_len] = '\0';
+
+    const char *key = line + 7;
+    size_t key_len = (size_t)(eq - key);
+    if (key_len == 7 && strncasecmp(key, "version", 7) == 0) {
+        list->version = atoi(value);
+        return 0;
+    }
+    if (key_len == 4 && strncasecmp(key, "mode", 4) == 0) {
+        list->mode_any = strcmp(value, "any") == 0;
+        return 0;
+    }
+
+    /* "<id>.<name>": the id is everything up to the last dot */
+    const char *dot = NULL;
+    for (const char *p = key; p < eq; p++) {
+        if (*p == '.') dot = p;
+    }
+    if (dot == NULL) return 0;
+    BundleEntry *entry = find_entry(list, key, (size_t)(dot - key));
+    if (entry == NULL) return 0;
+    const char *name = dot + 1;
+    size_t name_len = (size_t)(eq - name);
+    if (name_len == 3 && strncasecmp(name, "uri", 3) == 0) {
+        char *uri = strdup(value);
+        if (uri == NULL) {
+            GIT_ERR("offload: malloc failed\n");
+            return 1;
+        }
+        free(entry->uri);
+        entry->uri = uri;
+    } else if (name_len == 13 && strncasecmp(name, "creationtoken", 13) == 0) {
+        entry->token = strtoull(value, NULL, 10);
+    }
+    return 0;
+}
+
+/* Oldest first: a later bundle is usually built on the earlier ones */
+static int compare_token(const void *a, const void *b) {
+    const BundleEntry *x = a, *y = b;
+    return x->token < y->token ? -1 : x->token > y->token;
+}
+
+/* Asks the server for its bundle list. */
+static int request_list(HttpSession *session, BundleList *list) {
+    char *request = NULL;
+    size_t request_len;
+    HttpResponse resp = {0};
+    int result = 1;
+    if (pktline_build_bundle_uri(&request, &request_len) != 0) goto cleanup;
+    if (http_post_command(session, request, request_len, &resp) != 0) goto cleanup;
+    result = pktline_for_each_line(resp.data, resp.size, bundle_list_line, list);
+
+cleanup:
+    free(request);
+    http_response_free(&resp);
+    return result;
+}
+
+/* Appends a bundle's tips to the caller's list; takes ownership of add. */
+static int append_tips(ObjectId **tips, size_t *count, ObjectId *add, size_t add_count) {
+    if (add_count == 0) {
+        free(add);
+        return 0;
+    }
+    ObjectId *grown = realloc(*tips, (*count + add_count) * sizeof(ObjectId));
+    if (grown == NULL) {
+        GIT_ERR("offload: malloc failed\n");
+        free(add);
+        return 1;
+    }
+    memcpy(grown + *count, add, add_count * sizeof(ObjectId));
+    *tips = grown;
+    *count += add_count;
+    free(add);
+    return 0;
+}
+
+/*
+ * Unbundles the downloaded entries, repeating while that makes
+ * progress, since one bundle may supply another's prerequisites.
+ */
+static int install_bundles(BundleList *list, int threads, ObjectId **tips, size_t *tip_count) {
+    int progress = 1;
+    while (progress) {
+        progress = 0;
+        for (size_t i = 0; i < list->count; i++) {
+            BundleEntry *entry = &list->entries[i];
+            if (entry->fd < 0) continue;
+
+            const unsigned char *map = map_download(entry->fd, entry->size);
+            ObjectId *found = NULL;
+            size_t found_count = 0;
+            int r = map == NULL ? 1 : bundle_unbundle(map, (size_t)entry->size, threads,
+                                                      &found, &found_count);
+            if (map != NULL) munmap((void *)map, (size_t)entry->size);
+            if (r < 0) continue;
+
+            close(entry->fd);
+            entry->fd = -1;
+            if (r > 0) {
+                GIT_ERR("offload: warning: skipping bundle %s\n", entry->uri);
+                continue;
+            }
+            packstore_reprepare();
+            if (append_tips(tips, tip_count, found, found_count) != 0) return 1;
+            if (list->mode_any) return 0;
+            progress = 1;
+        }
+    }
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->entries[i].fd >= 0) {
+            GIT_ERR("offload: warning: prerequisites of bundle %s are missing\n", list->entries[i].uri);
+        }
+    }
+    return 0;
+}
+
+int offload_fetch_bundles(HttpSession *session, int threads, ObjectId **tips, size_t *tip_count) {
+    *tips = NULL;
+    *tip_count = 0;
+    BundleList *list = calloc(1, sizeof(BundleList));
+    if (list == NULL) {
+        GIT_ERR("offload: malloc failed\n");
+        return 1;
+    }
+
+    /* Bundles are advisory: without a list, the fetch covers everything */
+    int result = 0;
+    if (request_list(session, list) != 0) {
+        GIT_ERR("offload: warning: cannot read the bundle list\n");
+        goto cleanup;
+    }
+    if (list->count > 0 && list->version != 1) {
+        GIT_ERR("offload: warning: unsupported bundle list version %d\n", list->version);
+        goto cleanup;
+    }
+
+    qsort(list->entries, list->count, sizeof(BundleEntry), compare_token);
+    uint64_t start = trace_now();
+    for (size_t i = 0; i < list->count; i++) {
+        BundleEntry *entry = &list->entries[i];
+        if (entry->uri == NULL || !uri_allowed(session, entry->uri)) continue;
+        if (download_temp(session, entry->uri, &entry->fd, &entry->size) != 0) {
+            GIT_ERR("offload: warning: cannot download bundle %s\n", entry->uri);
+            entry->fd = -1;
+        }
+    }
+    trace_span("offload.download", start);
+    result = install_bundles(list, threads, tips, tip_count);
+
+cleanup:
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->entries[i].fd >= 0) close(list->entries[i].fd);
+        free(list->entries[i].uri);
+    }
+    free(list);
+    if (result != 0) {
+        free(*tips);
+        *tips = NULL;
+        *tip_count = 0;
+    }
+    return result;
+}
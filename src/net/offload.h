@@ -0,0 +1,58 @@
+/*
+ * offload.h
+ *
+ * Fetching history from static files instead of upload-pack: the
+ * bundles a server lists with the v2 "bundle-uri" command, and the
+ * packs it names in the "packfile-uris" section of a fetch response.
+ * Both are typically served by a CDN, so the git server only has to
+ * produce what the static files do not cover.
+ *
+ * Only absolute URIs are followed, and only over https — or http too
+ * when the remote itself is plain http, which loses nothing. Every
+ * object is still hashed while it is indexed.
+ */
+
+#ifndef OFFLOAD_H
+#define OFFLOAD_H
+
+#include <stddef.h>
+
+#include "../objects/object_id.h"
+#include "http.h"
+
+/*
+ * Returns the protocols to offer in a "packfile-uris" fetch argument
+ * for this remote: "https", or "http,https" for an http remote.
+ */
+const char *offload_uri_protocols(const HttpSession *session);
+
+/*
+ * Asks the server for its bundle list and installs the bundles it
+ * names, oldest creationToken first. A list that cannot be read, or a
+ * bundle that cannot be fetched or whose prerequisites never show up,
+ * is skipped with a warning; whatever the bundles miss is left to the
+ * fetch that follows.
+ *
+ * @param session    v2 session to the remote (must offer bundle-uri).
+ * @param threads    Delta resolution workers; 0 = every online CPU.
+ * @param tips       Output: heap-allocated ref tips of the installed
+ *                   bundles (caller frees), to send as "have" lines.
+ * @param tip_count  Output: number of tips.
+ * @return           0 on success (even if no bundle was usable),
+ *                   1 on allocation failure.
+ */
+int offload_fetch_bundles(HttpSession *session, int threads, ObjectId **tips, size_t *tip_count);
+
+/*
+ * Downloads one pack named in a "packfile-uris" response line and
+ * installs it with its .idx.
+ *
+ * @param session  Session whose connections and caches to reuse.
+ * @param hash     40-hex checksum the server promised for the pack.
+ * @param uri      Where to download it from.
+ * @param threads  Delta resolution workers; 0 = every online CPU.
+ * @return         0 on success, 1 on failure or checksum mismatch.
+ */
+int offload_fetch_pack(HttpSession *session, const char *hash, const char *uri, int threads);
+
+#endif /* OFFLOAD_H */
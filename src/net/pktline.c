@@ -1,15 +1,23 @@
 /*
  * pktline.c
  *
- * Git pkt-line wire format: parse ref advertisements and
- * build "want" requests for the smart HTTP protocol.
+ * Git pkt-line wire format: parse ref advertisements, build "want"
+ * requests, and demultiplex the upload-pack response stream for the
+ * smart HTTP protocol; plus the protocol v2 capability, ls-refs and
+ * fetch messages.
+ *
+ * Every reader here — buffered advertisements as well as the streamed
+ * upload-pack response — goes through one incremental iterator
+ * (PktlineIter), which hands out views into the caller's bytes.
  */
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../constants.h"
+#include "../utils/trace/trace.h"
 #include "pktline.h"
 
 /*
@@ -32,7 +40,115 @@ static int hex4_to_int(const char *hex) {
     return value;
 }
 
-int pktline_parse_head(const char *data, size_t data_len, char *sha_out) {
+void pktline_iter_init(PktlineIter *it) {
+    memset(it, 0, sizeof(*it));
+}
+
+void pktline_iter_feed(PktlineIter *it, const void *data, size_t len) {
+    it->in = data;
+    it->in_len = len;
+    it->in_pos = 0;
+}
+
+int pktline_iter_at_boundary(const PktlineIter *it) {
+    return !it->in_packet && it->len_have == 0;
+}
+
+PktlineKind pktline_iter_next(PktlineIter *it, PktlineEvent *ev) {
+    memset(ev, 0, sizeof(*ev));
+    size_t avail = it->in_len - it->in_pos;
+
+    if (it->raw) {
+        if (avail == 0) return ev->kind = PKTLINE_NEED_MORE;
+        ev->data = it->in + it->in_pos;
+        ev->len = avail;
+        it->in_pos = it->in_len;
+        return ev->kind = PKTLINE_RAW;
+    }
+
+    if (!it->in_packet) {
+        /* Accumulate the 4-byte length prefix (it may straddle feeds) */
+        size_t need = 4 - it->len_have;
+        size_t take = avail < need ? avail : need;
+        memcpy(it->len_buf + it->len_have, it->in + it->in_pos, take);
+        it->len_have += take;
+        it->in_pos += take;
+        if (it->len_have < 4) return ev->kind = PKTLINE_NEED_MORE;
+        it->len_have = 0;
+
+        /* Server sent the packfile without side-band framing */
+        if (memcmp(it->len_buf, "PACK", 4) == 0) {
+            it->raw = 1;
+            ev->data = it->len_buf;
+            ev->len = 4;
+            return ev->kind = PKTLINE_RAW;
+        }
+
+        int pkt_len = hex4_to_int((const char *)it->len_buf);
+        if (pkt_len < 0 || pkt_len == 3) return ev->kind = PKTLINE_ERROR;
+        if (pkt_len == 0) return ev->kind = PKTLINE_FLUSH;
+        if (pkt_len == 1) return ev->kind = PKTLINE_DELIM;
+        if (pkt_len == 2) return ev->kind = PKTLINE_RESPONSE_END;
+
+        it->in_packet = 1;
+        it->started = 0;
+        it->remaining = (size_t)pkt_len - 4;
+        avail = it->in_len - it->in_pos;
+    }
+
+    if (avail == 0 && it->remaining > 0) return ev->kind = PKTLINE_NEED_MORE;
+    size_t take = avail < it->remaining ? avail : it->remaining;
+    ev->data = it->in + it->in_pos;
+    ev->len = take;
+    ev->first = !it->started;
+    it->started = 1;
+    it->in_pos += take;
+    it->remaining -= take;
+    ev->last = it->remaining == 0;
+    if (ev->last) it->in_packet = 0;
+    return ev->kind = PKTLINE_DATA;
+}
+
+/* Starts iterating over a fully buffered response. */
+static void reader_init(PktlineIter *it, const char *data, size_t data_len) {
+    pktline_iter_init(it);
+    pktline_iter_feed(it, data, data_len);
+}
+
+/*
+ * Steps to the next packet of a buffered response. With the whole
+ * response fed at once, a data packet always arrives as one view.
+ * Sets *payload / *payload_len for data packets (text packets lose
+ * their trailing LF) and returns the packet kind; PKTLINE_NEED_MORE
+ * means the data ended cleanly, PKTLINE_ERROR that it is malformed.
+ */
+static PktlineKind read_packet(PktlineIter *it, const char **payload, size_t *payload_len) {
+    PktlineEvent ev;
+    PktlineKind kind = pktline_iter_next(it, &ev);
+    if (kind == PKTLINE_NEED_MORE && !pktline_iter_at_boundary(it)) return PKTLINE_ERROR;
+    if (kind == PKTLINE_RAW) return PKTLINE_ERROR;
+    if (kind != PKTLINE_DATA) return kind;
+
+    *payload = (const char *)ev.data;
+    *payload_len = ev.len;
+    if (*payload_len > 0 && (*payload)[*payload_len - 1] == '\n') (*payload_len)--;
+    return kind;
+}
+
+/* Matches "name" or "name=..." at the start of a payload of word_len bytes. */
+static int word_matches(const char *word, size_t word_len, const char *name) {
+    size_t name_len = strlen(name);
+    return word_len >= name_len && memcmp(word, name, name_len) == 0 &&
+           (word_len == name_len || word[name_len] == '=');
+}
+
+/*
+ * Finds the first ref line of a v0 advertisement.
+ * Sets *payload / *payload_len to the line without its length prefix.
+ * Returns 0 on success, 1 on failure.
+ */
+static int first_ref_line(const char *data, size_t data_len,
+                          const char **payload, size_t *payload_len) {
     /*
      * Walk through pkt-lines, skipping the service announcement header.
      *
@@ -43,161 +159,560 @@ int pktline_parse_head(const char *data, size_t data_len, char *sha_out) {
      *   00XXsha1 refs/heads/master\n      ← other refs
      *   0000                              ← flush (end of refs)
      *
-     * We want the SHA from the first ref line after the first flush.
+     * We want the first ref line after the first flush.
      */
-    size_t pos = 0;
+    PktlineIter it;
+    reader_init(&it, data, data_len);
     int seen_flush = 0;
+    PktlineKind kind;
 
-    while (pos + 4 <= data_len) {
-        int pkt_len = hex4_to_int(data + pos);
-        if (pkt_len < 0) {
-            GIT_ERR("pktline: invalid hex length at offset %zu\n", pos);
+    while ((kind = read_packet(&it, payload, payload_len)) != PKTLINE_NEED_MORE) {
+        if (kind == PKTLINE_ERROR) {
+            GIT_ERR("pktline: malformed refs response\n");
             return 1;
         }
+        if (kind == PKTLINE_FLUSH) seen_flush = 1;
+        else if (kind == PKTLINE_DATA && seen_flush) return 0;
+    }
+
+    GIT_ERR("pktline: HEAD SHA not found in refs response\n");
+    return 1;
+}
+
+int pktline_parse_head(const char *data, size_t data_len, char *sha_out) {
+    /* The first ref line starts with the 40-char hex SHA of HEAD */
+    const char *payload;
+    size_t payload_len;
+    if (first_ref_line(data, data_len, &payload, &payload_len) != 0) return 1;
+
+    if (payload_len < 40) {
+        GIT_ERR("pktline: ref line too short (%zu bytes)\n", payload_len);
+        return 1;
+    }
+
+    memcpy(sha_out, payload, 40);
+    sha_out[40] = '\0';
+    return 0;
+}
 
-        /* Flush packet */
-        if (pkt_len == 0) {
-            seen_flush = 1;
-            pos += 4;
-            continue;
+int pktline_has_capability(const char *data, size_t data_len, const char *name) {
+    const char *payload;
+    size_t payload_len;
+    if (first_ref_line(data, data_len, &payload, &payload_len) != 0) return 0;
+
+    /* Capabilities follow the NUL: space-separated "name" or "name=value" */
+    const char *caps = memchr(payload, '\0', payload_len);
+    if (caps == NULL) return 0;
+    caps++;
+    const char *end = payload + payload_len;
+
+    while (caps < end) {
+        const char *word_end = caps;
+        while (word_end < end && *word_end != ' ' && *word_end != '\n') word_end++;
+        if (word_matches(caps, (size_t)(word_end - caps), name)) return 1;
+        caps = word_end + 1;
+    }
+    return 0;
+}
+
+int pktline_for_each_ref(const char *data, size_t data_len, PktlineRefFn fn, void *ctx) {
+    PktlineIter it;
+    reader_init(&it, data, data_len);
+    const char *payload;
+    size_t payload_len;
+    PktlineKind kind;
+
+    /* Skip the "# service=" header up to its flush */
+    while ((kind = read_packet(&it, &payload, &payload_len)) == PKTLINE_DATA) {}
+    if (kind != PKTLINE_FLUSH) {
+        GIT_ERR("pktline: malformed refs response\n");
+        return 1;
+    }
+    while ((kind = read_packet(&it, &payload, &payload_len)) == PKTLINE_DATA) {
+        /* "<sha> <name>", the first line with "\0<capabilities>" after it */
+        const char *nul = memchr(payload, '\0', payload_len);
+        if (nul != NULL) payload_len = (size_t)(nul - payload);
+        ObjectId oid;
+        if (payload_len < OID_HEX_SIZE + 2 || payload[OID_HEX_SIZE] != ' ' ||
+            oid_from_hex(payload, &oid) != 0) {
+            GIT_ERR("pktline: malformed ref line\n");
+            return 1;
         }
+        const char *name = payload + OID_HEX_SIZE + 1;
+        if (fn(&oid, name, payload_len - (OID_HEX_SIZE + 1), ctx) != 0) return 1;
+    }
+    if (kind != PKTLINE_FLUSH) {
+        GIT_ERR("pktline: malformed refs response\n");
+        return 1;
+    }
+    return 0;
+}
 
-        /* Sanity: length must cover at least the 4-byte prefix */
-        if (pkt_len < 4 || pos + (size_t)pkt_len > data_len) {
-            GIT_ERR("pktline: bad packet length %d at offset %zu\n", pkt_len, pos);
+/*
+ * Starts reading a v2 advertisement, positioned just past its
+ * "version 2" packet. Returns 0 on success, 1 if this is not v2.
+ */
+static int skip_v2_version(PktlineIter *it, const char *data, size_t data_len) {
+    const char *payload = NULL;
+    size_t payload_len = 0;
+    reader_init(it, data, data_len);
+    PktlineKind kind = read_packet(it, &payload, &payload_len);
+    /* Some servers keep the v0 "# service=" header and its flush */
+    if (kind == PKTLINE_DATA && payload_len >= 1 && payload[0] == '#') {
+        if (read_packet(it, &payload, &payload_len) != PKTLINE_FLUSH) return 1;
+        kind = read_packet(it, &payload, &payload_len);
+    }
+    if (kind != PKTLINE_DATA || payload_len != 9 || memcmp(payload, "version 2", 9) != 0) return 1;
+    return 0;
+}
+
+int pktline_is_v2(const char *data, size_t data_len) {
+    PktlineIter it;
+    return skip_v2_version(&it, data, data_len) == 0;
+}
+
+/* Finds a v2 capability packet by name; returns its payload, or NULL. */
+static const char *find_v2_capability(const char *data, size_t data_len, const char *name,
+                                      size_t *payload_len) {
+    PktlineIter it;
+    if (skip_v2_version(&it, data, data_len) != 0) return NULL;
+
+    /* One capability per packet until the flush */
+    const char *payload;
+    while (read_packet(&it, &payload, payload_len) == PKTLINE_DATA) {
+        if (word_matches(payload, *payload_len, name)) return payload;
+    }
+    return NULL;
+}
+
+int pktline_v2_has_capability(const char *data, size_t data_len, const char *name) {
+    size_t payload_len;
+    return find_v2_capability(data, data_len, name, &payload_len) != NULL;
+}
+
+int pktline_v2_has_feature(const char *data, size_t data_len, const char *name,
+                           const char *feature) {
+    size_t payload_len;
+    const char *payload = find_v2_capability(data, data_len, name, &payload_len);
+    size_t name_len = strlen(name);
+    if (payload == NULL || payload_len <= name_len) return 0;
+
+    /* "name=feature feature ..." */
+    const char *word = payload + name_len + 1;
+    const char *end = payload + payload_len;
+    size_t feature_len = strlen(feature);
+    while (word < end) {
+        const char *word_end = memchr(word, ' ', (size_t)(end - word));
+        if (word_end == NULL) word_end = end;
+        if ((size_t)(word_end - word) == feature_len && memcmp(word, feature, feature_len) == 0) {
             return 1;
         }
+        word = word_end + 1;
+    }
+    return 0;
+}
 
-        /*
-         * After the first flush, the next packet's payload starts with
-         * the 40-char hex SHA of HEAD. The payload starts at pos+4.
-         */
-        if (seen_flush) {
-            const char *payload = data + pos + 4;
-            int payload_len = pkt_len - 4;
-
-            if (payload_len < 40) {
-                GIT_ERR("pktline: ref line too short (%d bytes)\n", payload_len);
-                return 1;
-            }
+void pktline_buf_line(PktlineBuf *buf, const char *fmt, ...) {
+    if (buf->failed) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int payload_len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (payload_len < 0 || payload_len > 0xFFFF - 4) {
+        GIT_ERR("pktline: packet too long\n");
+        buf->failed = 1;
+        return;
+    }
 
-            memcpy(sha_out, payload, 40);
-            sha_out[40] = '\0';
-            return 0;
+    size_t pkt_len = 4 + (size_t)payload_len;
+    /* +1: vsnprintf always writes a NUL, which the next packet overwrites */
+    if (buf->len + pkt_len + 1 > buf->capacity) {
+        size_t new_capacity = buf->capacity == 0 ? 256 : buf->capacity;
+        while (new_capacity < buf->len + pkt_len + 1) new_capacity *= 2;
+        char *grown = realloc(buf->data, new_capacity);
+        if (grown == NULL) {
+            GIT_ERR("pktline: malloc failed\n");
+            buf->failed = 1;
+            return;
         }
+        buf->data = grown;
+        buf->capacity = new_capacity;
+    }
+
+    char prefix[5];
+    snprintf(prefix, sizeof(prefix), "%04zx", pkt_len);
+    memcpy(buf->data + buf->len, prefix, 4);
+    va_start(ap, fmt);
+    vsnprintf(buf->data + buf->len + 4, (size_t)payload_len + 1, fmt, ap);
+    va_end(ap);
+    buf->len += pkt_len;
+}
 
-        pos += (size_t)pkt_len;
+/* Appends one of the 4-byte special packets. */
+static void buf_special(PktlineBuf *buf, const char *pkt) {
+    if (buf->failed) return;
+    if (buf->len + 5 > buf->capacity) {
+        size_t new_capacity = buf->capacity == 0 ? 256 : buf->capacity * 2;
+        char *grown = realloc(buf->data, new_capacity);
+        if (grown == NULL) {
+            GIT_ERR("pktline: malloc failed\n");
+            buf->failed = 1;
+            return;
+        }
+        buf->data = grown;
+        buf->capacity = new_capacity;
     }
+    memcpy(buf->data + buf->len, pkt, 4);
+    buf->len += 4;
+    buf->data[buf->len] = '\0';
+}
 
-    GIT_ERR("pktline: HEAD SHA not found in refs response\n");
+void pktline_buf_flush(PktlineBuf *buf) {
+    buf_special(buf, "0000");
+}
+
+void pktline_buf_delim(PktlineBuf *buf) {
+    buf_special(buf, "0001");
+}
+
+/* Hands a finished request to the caller, or frees it on failure. */
+static int buf_finish(PktlineBuf *buf, char **out_body, size_t *out_len) {
+    if (buf->failed) {
+        free(buf->data);
+        return 1;
+    }
+    *out_body = buf->data;
+    *out_len = buf->len;
+    return 0;
+}
+
+int pktline_build_ls_refs(const char *const *prefixes, size_t prefix_count,
+                          char **out_body, size_t *out_len) {
+    PktlineBuf buf = {0};
+    pktline_buf_line(&buf, "command=ls-refs\n");
+    pktline_buf_delim(&buf);
+    pktline_buf_line(&buf, "symrefs\n");
+    for (size_t i = 0; i < prefix_count; i++) {
+        pktline_buf_line(&buf, "ref-prefix %s\n", prefixes[i]);
+    }
+    pktline_buf_flush(&buf);
+    return buf_finish(&buf, out_body, out_len);
+}
+
+int pktline_build_bundle_uri(char **out_body, size_t *out_len) {
+    PktlineBuf buf = {0};
+    pktline_buf_line(&buf, "command=bundle-uri\n");
+    pktline_buf_delim(&buf);
+    pktline_buf_flush(&buf);
+    return buf_finish(&buf, out_body, out_len);
+}
+
+int pktline_for_each_line(const char *data, size_t data_len, PktlineLineFn fn, void *ctx) {
+    PktlineIter it;
+    reader_init(&it, data, data_len);
+    const char *payload;
+    size_t payload_len;
+    PktlineKind kind;
+
+    while ((kind = read_packet(&it, &payload, &payload_len)) == PKTLINE_DATA) {
+        if (fn(payload, payload_len, ctx) != 0) return 1;
+    }
+    if (kind != PKTLINE_FLUSH && kind != PKTLINE_RESPONSE_END) {
+        GIT_ERR("pktline: malformed response\n");
+        return 1;
+    }
+    return 0;
+}
+
+int pktline_parse_ls_refs(const char *data, size_t data_len, const char *name,
+                          char *sha_out, char *target_out, size_t target_size) {
+    PktlineIter it;
+    reader_init(&it, data, data_len);
+    size_t name_len = strlen(name);
+    const char *payload;
+    size_t payload_len;
+    PktlineKind kind;
+
+    while ((kind = read_packet(&it, &payload, &payload_len)) == PKTLINE_DATA) {
+        /* "<sha> <name>" then optional space-separated attributes */
+        if (payload_len < 41 || payload[40] != ' ') {
+            GIT_ERR("pktline: malformed ls-refs line\n");
+            return 1;
+        }
+        const char *ref = payload + 41;
+        const char *end = payload + payload_len;
+        const char *ref_end = memchr(ref, ' ', (size_t)(end - ref));
+        if (ref_end == NULL) ref_end = end;
+        if ((size_t)(ref_end - ref) != name_len || memcmp(ref, name, name_len) != 0) continue;
+
+        memcpy(sha_out, payload, 40);
+        sha_out[40] = '\0';
+        target_out[0] = '\0';
+
+        static const char symref_attr[] = "symref-target:";
+        const char *attr = ref_end;
+        while (attr < end) {
+            attr++;
+            const char *attr_end = memchr(attr, ' ', (size_t)(end - attr));
+            if (attr_end == NULL) attr_end = end;
+            size_t attr_len = (size_t)(attr_end - attr);
+            size_t prefix_len = sizeof(symref_attr) - 1;
+            if (attr_len > prefix_len && memcmp(attr, symref_attr, prefix_len) == 0) {
+                size_t target_len = attr_len - prefix_len;
+                if (target_len >= target_size) {
+                    GIT_ERR("pktline: symref target too long\n");
+                    return 1;
+                }
+                memcpy(target_out, attr + prefix_len, target_len);
+                target_out[target_len] = '\0';
+            }
+            attr = attr_end;
+        }
+        return 0;
+    }
+
+    if (kind == PKTLINE_ERROR) GIT_ERR("pktline: malformed ls-refs response\n");
+    else GIT_ERR("pktline: server did not list %s\n", name);
     return 1;
 }
 
-int pktline_build_want(const char *sha, char **out_body, size_t *out_len) {
+/* Appends the shallow/deepen/filter lines shared by v0 and v2 requests. */
+static void put_fetch_options(PktlineBuf *buf, const PktlineFetchOptions *opts) {
+    if (opts == NULL) return;
+    for (size_t i = 0; i < opts->shallow_count; i++) {
+        char hex[OID_HEX_SIZE + 1];
+        pktline_buf_line(buf, "shallow %s\n", oid_to_hex(&opts->shallows[i], hex));
+    }
+    if (opts->depth > 0) pktline_buf_line(buf, "deepen %d\n", opts->depth);
+    if (opts->filter != NULL) pktline_buf_line(buf, "filter %s\n", opts->filter);
+}
+
+static void put_haves(PktlineBuf *buf, const PktlineFetchOptions *opts) {
+    if (opts == NULL) return;
+    for (size_t i = 0; i < opts->have_count; i++) {
+        char hex[OID_HEX_SIZE + 1];
+        pktline_buf_line(buf, "have %s\n", oid_to_hex(&opts->haves[i], hex));
+    }
+}
+
+int pktline_build_fetch(const ObjectId *wants, size_t want_count,
+                        const char *const *args, size_t arg_count,
+                        const PktlineFetchOptions *opts, char **out_body, size_t *out_len) {
+    PktlineBuf buf = {0};
+    pktline_buf_line(&buf, "command=fetch\n");
+    pktline_buf_delim(&buf);
+    for (size_t i = 0; i < want_count; i++) {
+        char hex[OID_HEX_SIZE + 1];
+        pktline_buf_line(&buf, "want %s\n", oid_to_hex(&wants[i], hex));
+    }
+    for (size_t i = 0; i < arg_count; i++) {
+        pktline_buf_line(&buf, "%s\n", args[i]);
+    }
+    put_fetch_options(&buf, opts);
+    put_haves(&buf, opts);
+    pktline_buf_line(&buf, "done\n");
+    pktline_buf_flush(&buf);
+    return buf_finish(&buf, out_body, out_len);
+}
+
+int pktline_build_want(const ObjectId *wants, size_t want_count, const char *capabilities,
+                       const PktlineFetchOptions *opts, int done,
+                       char **out_body, size_t *out_len) {
     /*
      * Build the request body that tells the server which objects we want.
-     * No capabilities requested — keeps the exchange simple.
+     * Capabilities, if any, ride on the first want line.
      *
      * Format:
-     *   "0032want <40-char SHA>\n"  ← 0x32 = 50 bytes total
-     *   "0000"                      ← flush
-     *   "0009done\n"               ← 0x09 = 9 bytes total
-     *
-     * Total: 50 + 4 + 9 = 63 bytes.
+     *   "XXXXwant <40-char SHA>[ caps]\n"  ← 0x32 = 50 bytes without caps
+     *   "0032want <40-char SHA>\n"        ← (one per further want)
+     *   "XXXXdeepen <n>\n", "XXXXfilter <spec>\n"   (optional)
+     *   "0000"                             ← flush
+     *   "0032have <40-char SHA>\n"        ← (optional, any number)
+     *   "0009done\n" or "0000"            ← last request, or a round
      */
-    const size_t total = 50 + 4 + 9;
-    char *body = malloc(total + 1);
-    if (body == NULL) {
-        GIT_ERR("pktline: malloc failed\n");
+    if (want_count == 0) {
+        GIT_ERR("pktline: want request without wants\n");
         return 1;
     }
+    int has_caps = capabilities != NULL && capabilities[0] != '\0';
+    PktlineBuf buf = {0};
+    for (size_t i = 0; i < want_count; i++) {
+        char hex[OID_HEX_SIZE + 1];
+        oid_to_hex(&wants[i], hex);
+        if (i == 0 && has_caps) pktline_buf_line(&buf, "want %s %s\n", hex, capabilities);
+        else pktline_buf_line(&buf, "want %s\n", hex);
+    }
+    put_fetch_options(&buf, opts);
+    pktline_buf_flush(&buf);
+    put_haves(&buf, opts);
+    if (done) pktline_buf_line(&buf, "done\n");
+    else pktline_buf_flush(&buf);
+    return buf_finish(&buf, out_body, out_len);
+}
 
-    snprintf(body, total + 1, "0032want %.40s\n00000009done\n", sha);
+void pktline_demux_init(PktlineDemux *demux, PktlineSink sink, void *ctx) {
+    memset(demux, 0, sizeof(*demux));
+    pktline_iter_init(&demux->iter);
+    demux->sink = sink;
+    demux->ctx = ctx;
+    demux->channel = -1;
+}
 
-    *out_body = body;
-    *out_len = total;
-    return 0;
+void pktline_demux_set_line_handler(PktlineDemux *demux, PktlineLineFn on_line, void *ctx) {
+    demux->on_line = on_line;
+    demux->line_ctx = ctx;
 }
 
-int pktline_strip_sideband(const char *data, size_t data_len,
-                           unsigned char **pack_out, size_t *pack_len) {
-    /*
-     * Extract the raw packfile from an upload-pack response.
-     *
-     * Strategy 1: Walk pkt-line packets and extract channel 1 data.
-     *   Flush packets ("0000") between NAK and the side-band data
-     *   are skipped (not treated as terminators).
-     *
-     * Strategy 2 (fallback): If no side-band data is found, scan
-     *   for the "PACK" magic directly — handles servers that send
-     *   the packfile as raw bytes after NAK.
-     */
-    unsigned char *out = NULL;
-    size_t out_size = 0;
-    size_t pos = 0;
+void pktline_demux_set_message_handler(PktlineDemux *demux, PktlineMessageFn on_message, void *ctx) {
+    demux->on_message = on_message;
+    demux->message_ctx = ctx;
+}
 
-    while (pos + 4 <= data_len) {
-        int pkt_len = hex4_to_int(data + pos);
+void pktline_demux_set_sideband_all(PktlineDemux *demux) {
+    demux->sideband_all = 1;
+}
 
-        /* Not valid pkt-line data — stop scanning */
-        if (pkt_len < 0) break;
+/* Side-band frames start with channel 1, 2 or 3; anything else is text */
+static int is_text_packet(int channel) {
+    return channel < 1 || channel > 3;
+}
 
-        /* Flush packet — skip it and keep looking.
-         * There may be a flush between NAK and the side-band data. */
-        if (pkt_len == 0) {
-            pos += 4;
-            continue;
-        }
+/* Hands a complete text packet to the line handler; "ERR" lines are fatal. */
+static int handle_line(PktlineDemux *demux, const char *line, size_t len) {
+    if (len > 0 && line[len - 1] == '\n') len--;
+    /* With sideband-all, channel 1 carries pack data only from here on */
+    if (len == 8 && memcmp(line, "packfile", 8) == 0) demux->in_pack = 1;
+    if (len >= 4 && memcmp(line, "ERR ", 4) == 0) {
+        GIT_ERR("remote error: %.*s\n", (int)(len - 4), line + 4);
+        return 1;
+    }
+    if (demux->on_line == NULL) return 0;
+    return demux->on_line(line, len, demux->line_ctx);
+}
 
-        if (pkt_len < 4 || pos + (size_t)pkt_len > data_len) break;
+/* Hands packfile bytes to the sink, timing it apart from the demux. */
+static int forward(PktlineDemux *demux, const unsigned char *data, size_t len) {
+    uint64_t start = trace_now();
+    int result = demux->sink(data, len, demux->ctx);
+    if (start != 0) demux->sink_ns += trace_now() - start;
+    return result;
+}
 
-        /* Payload starts after the 4-byte hex prefix.
-         * The first byte of payload is the channel indicator. */
-        if (pkt_len > 5 && (unsigned char)data[pos + 4] == 1) {
-            /* Channel 1: packfile data — skip the channel byte */
-            const char *chunk = data + pos + 5;
-            size_t chunk_len = (size_t)pkt_len - 5;
+/* Routes one view of a data packet by the packet's channel. */
+static int demux_data(PktlineDemux *demux, const PktlineEvent *ev) {
+    const unsigned char *data = ev->data;
+    size_t len = ev->len;
 
-            unsigned char *grown = realloc(out, out_size + chunk_len);
-            if (grown == NULL) {
-                GIT_ERR("pktline: realloc failed\n");
-                free(out);
-                return 1;
-            }
-            out = grown;
-            memcpy(out + out_size, chunk, chunk_len);
-            out_size += chunk_len;
+    if (ev->first) {
+        demux->channel = len > 0 ? data[0] : 0;
+        if (!is_text_packet(demux->channel)) {
+            data++;
+            len--;
         }
-        /* Channel 2 (progress) and channel 3 (error) are silently skipped.
-         * Non-sideband lines like NAK are also skipped. */
-
-        pos += (size_t)pkt_len;
+        demux->line_len = 0;
     }
 
-    if (out_size > 0) {
-        *pack_out = out;
-        *pack_len = out_size;
-        return 0;
+    /* sideband-all frames v2 section text on channel 1 as well */
+    int channel = demux->channel;
+    if (channel == 1 && demux->sideband_all && !demux->in_pack) channel = 0;
+
+    switch (channel) {
+    case 1:
+        if (len > 0 && forward(demux, data, len) != 0) return 1;
+        break;
+    case 2:
+    case 3:
+        if (demux->on_message != NULL && len > 0 &&
+            demux->on_message(demux->channel, (const char *)data, len, demux->message_ctx) != 0) {
+            return 1;
+        }
+        /* The server stops after a channel-3 message */
+        if (demux->channel == 3 && ev->last) {
+            if (demux->on_message == NULL) GIT_ERR("remote error (no details)\n");
+            demux->remote_error = 1;
+            return 1;
+        }
+        break;
+    default:
+        /* A text packet in one view needs no copy */
+        if (ev->first && ev->last) return handle_line(demux, (const char *)data, len);
+        /* Otherwise assemble it; over-long lines are marked by line_len past the buffer */
+        if (demux->line_len + len <= sizeof(demux->line)) {
+            memcpy(demux->line + demux->line_len, data, len);
+            demux->line_len += len;
+        } else {
+            demux->line_len = sizeof(demux->line) + 1;
+        }
+        if (ev->last && demux->line_len <= sizeof(demux->line)) {
+            return handle_line(demux, demux->line, demux->line_len);
+        }
+        break;
     }
-    free(out);
-
-    /* Fallback: server sent raw PACK bytes (no side-band framing).
-     * Scan for the "PACK" magic and copy everything from there. */
-    for (size_t i = 0; i + 4 <= data_len; i++) {
-        if (memcmp(data + i, "PACK", 4) == 0) {
-            size_t raw_len = data_len - i;
-            unsigned char *raw = malloc(raw_len);
-            if (raw == NULL) {
-                GIT_ERR("pktline: malloc failed\n");
-                return 1;
-            }
-            memcpy(raw, data + i, raw_len);
-            *pack_out = raw;
-            *pack_len = raw_len;
+    return 0;
+}
+
+/* pktline_demux_feed() itself, less the timing. */
+static int demux_feed(PktlineDemux *demux, const unsigned char *data, size_t len) {
+    /*
+     * The response is a sequence of pkt-lines (NAK, side-band packets,
+     * flushes). Channel 1 carries packfile data, forwarded straight
+     * from the caller's buffer; channels 2 (progress) and 3 (error)
+     * go to the message handler, other lines to the line handler.
+     */
+    pktline_iter_feed(&demux->iter, data, len);
+
+    for (;;) {
+        PktlineEvent ev;
+        switch (pktline_iter_next(&demux->iter, &ev)) {
+        case PKTLINE_NEED_MORE:
             return 0;
+        case PKTLINE_FLUSH:
+        case PKTLINE_DELIM:
+        case PKTLINE_RESPONSE_END:
+            /* There may be a flush between NAK and the data, and v2
+             * sections are separated by delimiters */
+            break;
+        case PKTLINE_RAW:
+            if (forward(demux, ev.data, ev.len) != 0) return 1;
+            break;
+        case PKTLINE_DATA:
+            if (demux_data(demux, &ev) != 0) return 1;
+            break;
+        case PKTLINE_ERROR:
+            GIT_ERR("pktline: invalid packet length in upload-pack response\n");
+            return 1;
         }
     }
+}
 
-    GIT_ERR("pktline: no packfile data found in response\n");
-    return 1;
+int pktline_demux_feed(PktlineDemux *demux, const unsigned char *data, size_t len) {
+    uint64_t start = trace_now();
+    demux->sink_ns = 0;
+    int result = demux_feed(demux, data, len);
+    if (start != 0) trace_count(TRACE_SIDEBAND_NS, trace_now() - start - demux->sink_ns);
+    return result;
+}
+
+int pktline_demux_finish(const PktlineDemux *demux) {
+    if (!pktline_iter_at_boundary(&demux->iter)) {
+        GIT_ERR("pktline: upload-pack response truncated mid-packet\n");
+        return 1;
+    }
+    return 0;
+}
+
+int pktline_print_message(int channel, const char *data, size_t len, void *ctx) {
+    PktlineMessageLog *log = ctx;
+    const char *end = data + len;
+    while (data < end) {
+        if (!log->mid_line) fputs(channel == 3 ? "remote error: " : "remote: ", stderr);
+        /* Progress meters redraw their line with CR */
+        const char *brk = data;
+        while (brk < end && *brk != '\n' && *brk != '\r') brk++;
+        if (brk < end) brk++;
+        fwrite(data, 1, (size_t)(brk - data), stderr);
+        log->mid_line = brk[-1] != '\n' && brk[-1] != '\r';
+        data = brk;
+    }
+    return 0;
 }
@@ -6,13 +6,223 @@
  * Every line in git's smart HTTP protocol is prefixed with a
  * 4-character hex length (e.g. "003e"). The length includes the
  * 4 prefix bytes themselves. "0000" is a flush packet — a separator
- * between logical groups.
+ * between logical groups. Protocol v2 adds "0001" (delimiter,
+ * between a command's capabilities and its arguments) and "0002"
+ * (response end).
+ *
+ * Protocol v2 exchange used by clone:
+ *   GET info/refs          → capability advertisement ("version 2", ...)
+ *   POST command=ls-refs   → only the refs matching our ref-prefixes
+ *   POST command=fetch     → "packfile" section, side-band framed
  */
 
 #ifndef PKTLINE_H
 #define PKTLINE_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "../objects/object_id.h"
+
+/* What pktline_iter_next() found. */
+typedef enum {
+    PKTLINE_NEED_MORE,    /* input exhausted; feed more bytes */
+    PKTLINE_DATA,         /* (part of) a data packet's payload */
+    PKTLINE_FLUSH,        /* "0000" */
+    PKTLINE_DELIM,        /* "0001" (v2) */
+    PKTLINE_RESPONSE_END, /* "0002" (v2) */
+    PKTLINE_RAW,          /* unframed bytes after a bare "PACK" magic */
+    PKTLINE_ERROR         /* invalid length prefix */
+} PktlineKind;
+
+/*
+ * One step of the iterator. For PKTLINE_DATA and PKTLINE_RAW, data
+ * points into the bytes last fed (or, for the first RAW view, the
+ * iterator's own copy of the "PACK" magic) and stays valid until the
+ * next feed. A data packet split across feeds arrives as several
+ * views; first / last mark its first and final view.
+ */
+typedef struct {
+    PktlineKind kind;
+    const unsigned char *data;
+    size_t len;
+    int first;
+    int last;
+} PktlineEvent;
+
+/*
+ * Incremental pkt-line iterator. Payloads are never copied: only a
+ * length prefix split across feeds is carried over, in len_buf.
+ * A "PACK" magic where a length prefix is expected switches it to
+ * raw mode, in which the rest of the input is passed through as is.
+ */
+typedef struct {
+    const unsigned char *in; /* current feed */
+    size_t in_len;
+    size_t in_pos;
+    unsigned char len_buf[4]; /* length prefix, possibly split across feeds */
+    size_t len_have;          /* bytes of len_buf filled so far */
+    size_t remaining;         /* payload bytes left in the current packet */
+    int in_packet;            /* 1 while inside a data packet */
+    int started;              /* 1 once the current packet produced a view */
+    int raw;                  /* 1 once the input switched to raw PACK bytes */
+} PktlineIter;
+
+/* Resets an iterator to the start of a stream. */
+void pktline_iter_init(PktlineIter *it);
+
+/*
+ * Hands the iterator its next slice of input. The previous slice
+ * must have been drained (pktline_iter_next returned NEED_MORE).
+ */
+void pktline_iter_feed(PktlineIter *it, const void *data, size_t len);
+
+/*
+ * Advances to the next packet, or the next view of the current one.
+ *
+ * @param it  Iterator state.
+ * @param ev  Output: what was found (see PktlineEvent).
+ * @return    ev->kind.
+ */
+PktlineKind pktline_iter_next(PktlineIter *it, PktlineEvent *ev);
+
+/* Returns 1 if the input so far ended exactly between packets. */
+int pktline_iter_at_boundary(const PktlineIter *it);
+
+/*
+ * Growable buffer for building pkt-line requests. Zero-initialize;
+ * errors are sticky in failed, so a request can be built without
+ * checking each call. The caller owns and frees data.
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+    int failed;
+} PktlineBuf;
+
+/*
+ * Appends one data packet: printf-formatted payload behind its
+ * 4-hex-digit length.
+ */
+void pktline_buf_line(PktlineBuf *buf, const char *fmt, ...);
+
+/* Appends a flush packet ("0000"). */
+void pktline_buf_flush(PktlineBuf *buf);
+
+/* Appends a delimiter packet ("0001"). */
+void pktline_buf_delim(PktlineBuf *buf);
+
+/*
+ * Checks whether a refs discovery response is a protocol v2
+ * capability advertisement ("version 2" as its first packet, after
+ * an optional "# service=" header).
+ *
+ * @return  1 for v2, 0 for anything else (i.e. a v0 ref advertisement).
+ */
+int pktline_is_v2(const char *data, size_t data_len);
+
+/*
+ * Checks whether a v2 capability advertisement lists a capability
+ * ("ls-refs", or "fetch=shallow filter" matched by name).
+ *
+ * @return  1 if advertised, 0 otherwise.
+ */
+int pktline_v2_has_capability(const char *data, size_t data_len, const char *name);
+
+/*
+ * Checks whether a v2 capability lists a feature in its value, e.g.
+ * "filter" in "fetch=shallow filter".
+ *
+ * @return  1 if listed, 0 otherwise.
+ */
+int pktline_v2_has_feature(const char *data, size_t data_len, const char *name,
+                           const char *feature);
+
+/* Optional narrowing of what a fetch transfers. */
+typedef struct {
+    int depth;              /* > 0: only this many commits of history ("deepen") */
+    const char *filter;     /* object filter, e.g. "blob:none"; NULL for none */
+    const ObjectId *haves;  /* commits we already have, sent as "have" lines */
+    size_t have_count;
+    const ObjectId *shallows; /* our shallow boundary, sent as "shallow" lines */
+    size_t shallow_count;
+} PktlineFetchOptions;
+
+/*
+ * Builds a v2 ls-refs request asking for symref targets and only the
+ * refs starting with one of the given prefixes.
+ *
+ * @param prefixes      Ref prefixes, e.g. "HEAD", "refs/heads/".
+ * @param prefix_count  Number of prefixes; 0 lists every ref.
+ * @param out_body      Output: heap-allocated request body (caller frees).
+ * @param out_len       Output: byte count of the request body.
+ * @return              0 on success, 1 on failure.
+ */
+int pktline_build_ls_refs(const char *const *prefixes, size_t prefix_count,
+                          char **out_body, size_t *out_len);
+
+/*
+ * Looks a ref up in an ls-refs response. Lines look like
+ *   <40-hex SHA> <name>[ symref-target:<target>][ peeled:<SHA>]
+ *
+ * @param data         ls-refs response body.
+ * @param data_len     Byte count of data.
+ * @param name         Ref to find, e.g. "HEAD".
+ * @param sha_out      Output buffer — at least 41 bytes (40 hex + NUL).
+ * @param target_out   Output: the symref target, or "" if the ref is
+ *                     not a symref.
+ * @param target_size  Size of target_out.
+ * @return             0 if found, 1 if absent or malformed.
+ */
+int pktline_parse_ls_refs(const char *data, size_t data_len, const char *name,
+                          char *sha_out, char *target_out, size_t target_size);
+
+/*
+ * Builds a v2 fetch request:
+ *   command=fetch, delimiter, "want <sha>" per object, each argument,
+ *   "deepen <n>" / "filter <spec>" from opts, "done", flush
+ *
+ * @param wants       Objects to request.
+ * @param want_count  Number of wants.
+ * @param args        Extra fetch arguments, one per packet (e.g. "ofs-delta").
+ * @param arg_count   Number of args.
+ * @param opts        Depth and filter, or NULL for a full fetch.
+ * @param out_body    Output: heap-allocated request body (caller frees).
+ * @param out_len    Output: byte count of the request body.
+ * @return           0 on success, 1 on failure.
+ */
+int pktline_build_fetch(const ObjectId *wants, size_t want_count,
+                        const char *const *args, size_t arg_count,
+                        const PktlineFetchOptions *opts, char **out_body, size_t *out_len);
+
+/*
+ * Builds a v2 bundle-uri request, which asks the server where its
+ * pre-made bundles can be downloaded from.
+ *
+ * @param out_body  Output: heap-allocated request body (caller frees).
+ * @param out_len   Output: byte count of the request body.
+ * @return          0 on success, 1 on failure.
+ */
+int pktline_build_bundle_uri(char **out_body, size_t *out_len);
+
+/*
+ * Receives one data packet of a buffered response, without its
+ * trailing LF. Returning non-zero stops the walk.
+ */
+typedef int (*PktlineLineFn)(const char *line, size_t len, void *ctx);
+
+/*
+ * Walks the data packets of a buffered response up to its flush or
+ * response-end, e.g. the "key=value" lines of a bundle-uri reply.
+ *
+ * @param data      Response body.
+ * @param data_len  Byte count of data.
+ * @param fn        Called for each packet's payload.
+ * @param ctx       Passed through to fn.
+ * @return          0 on success, 1 if malformed or fn failed.
+ */
+int pktline_for_each_line(const char *data, size_t data_len, PktlineLineFn fn, void *ctx);
 
 /*
  * Parses a refs discovery response and extracts the HEAD commit SHA.
@@ -32,37 +242,170 @@
  */
 int pktline_parse_head(const char *data, size_t data_len, char *sha_out);
 
+/*
+ * Checks whether the server advertised a capability.
+ *
+ * Capabilities are listed after the NUL on the first ref line:
+ *   00XXsha1 HEAD\0multi_ack ofs-delta side-band-64k ...\n
+ * A capability with a value ("agent=git/2.x") matches by name.
+ *
+ * @param data      Raw response body from http_get_refs().
+ * @param data_len  Byte count of data.
+ * @param name      Capability name, e.g. "ofs-delta".
+ * @return          1 if advertised, 0 otherwise.
+ */
+int pktline_has_capability(const char *data, size_t data_len, const char *name);
+
+/*
+ * Receives one advertised ref: its object and its name (not
+ * NUL-terminated). Returning non-zero stops the walk.
+ */
+typedef int (*PktlineRefFn)(const ObjectId *oid, const char *name, size_t name_len, void *ctx);
+
+/*
+ * Walks every ref of a v0 refs discovery response, the capabilities
+ * stripped from the first.
+ *
+ * @param data      Raw response body from http_get_refs().
+ * @param data_len  Byte count of data.
+ * @param fn        Called for each ref.
+ * @param ctx       Passed through to fn.
+ * @return          0 on success, 1 if malformed or fn failed.
+ */
+int pktline_for_each_ref(const char *data, size_t data_len, PktlineRefFn fn, void *ctx);
+
 /*
  * Builds a "want" request body for git-upload-pack.
  *
  * Produces the pkt-line encoded request:
- *   0032want <40-char SHA>\n
- *   00000009done\n
+ *   XXXXwant <40-char SHA>[ <capabilities>]\n
+ *   [XXXXwant <40-char SHA>\n ...]
+ *   [XXXXshallow <40-char SHA>\n ...]
+ *   [XXXXdeepen <depth>\n]
+ *   [XXXXfilter <spec>\n]
+ *   0000
+ *   [XXXXhave <40-char SHA>\n ...]
+ *   0009done\n     (done), or 0000 (a negotiation round)
  *
- * The caller must free() the returned buffer.
+ * Over stateless HTTP every round repeats the wants, and the haves
+ * the server acknowledged as common, before the new haves. Depth and
+ * filter need the "shallow" and "filter" capabilities in the
+ * capability list (as do shallow lines). The caller must free() the returned buffer.
  *
- * @param sha       40-character hex SHA to request.
- * @param out_body  Output: pointer to the allocated request body.
- * @param out_len   Output: byte count of the request body.
- * @return          0 on success, 1 on failure.
+ * @param wants         Objects to request.
+ * @param want_count    Number of wants; at least one.
+ * @param capabilities  Space-separated capabilities to request, or NULL.
+ * @param opts          Depth, filter and haves, or NULL for a full fetch.
+ * @param done          1 for the final request, 0 for a round whose
+ *                      reply is only ACK/NAK lines.
+ * @param out_body      Output: pointer to the allocated request body.
+ * @param out_len       Output: byte count of the request body.
+ * @return              0 on success, 1 on failure.
+ */
+int pktline_build_want(const ObjectId *wants, size_t want_count, const char *capabilities,
+                       const PktlineFetchOptions *opts, int done,
+                       char **out_body, size_t *out_len);
+
+/*
+ * Receives demultiplexed packfile bytes. Returning non-zero aborts.
  */
-int pktline_build_want(const char *sha, char **out_body, size_t *out_len);
+typedef int (*PktlineSink)(const unsigned char *data, size_t len, void *ctx);
 
 /*
- * Extracts the raw packfile from an upload-pack response.
+ * Receives side-band channel 2 (progress) or 3 (fatal error) text,
+ * in whatever pieces it arrives. Returning non-zero aborts.
+ */
+typedef int (*PktlineMessageFn)(int channel, const char *data, size_t len, void *ctx);
+
+/* Text packets longer than this are not passed to the line handler */
+#define PKTLINE_LINE_MAX 256
+
+/*
+ * Incremental demultiplexer for an upload-pack response.
+ *
+ * Fed with arbitrary slices of the response as they arrive, it
+ * walks them with a PktlineIter and forwards packfile bytes to the
+ * sink as views of the caller's buffer, without copying them.
  *
  * Handles two response formats:
- *   1. Side-band framing: pkt-line packets with \x01 channel byte
+ *   1. Side-band framing: pkt-line packets with a channel byte
+ *      (v0 with side-band-64k, and the v2 fetch "packfile" section,
+ *      whose header line and delimiters are skipped). Channel 1 is
+ *      packfile data; channels 2 (progress) and 3 (fatal error) go
+ *      to the optional message handler.
  *   2. Raw: packfile bytes directly after a NAK pkt-line
- * Scans for the "PACK" magic as a fallback if no side-band data is found.
+ * Packets that are not side-band frames (NAK, "shallow <sha>", v2
+ * section headers) go to the optional line handler; an "ERR" line
+ * or a channel-3 message fails the feed. With sideband-all, those
+ * text packets arrive on channel 1 too, up to the "packfile" header.
+ */
+typedef struct {
+    PktlineIter iter;
+    PktlineSink sink;     /* receives channel-1 / raw packfile bytes */
+    void *ctx;            /* passed through to sink */
+    int channel;          /* current packet's channel, -1 until read */
+    int remote_error;     /* 1 once the server reported a fatal error */
+    int sideband_all;     /* v2 "sideband-all": text packets are framed too */
+    int in_pack;          /* 1 once the "packfile" section header was seen */
+    PktlineLineFn on_line; /* text packets, or NULL to skip them */
+    void *line_ctx;       /* passed through to on_line */
+    PktlineMessageFn on_message; /* channels 2 and 3, or NULL */
+    void *message_ctx;    /* passed through to on_message */
+    char line[PKTLINE_LINE_MAX]; /* current text packet, if split */
+    size_t line_len;
+    uint64_t sink_ns;     /* time in sink during the current feed (tracing) */
+} PktlineDemux;
+
+/* Prepares a demultiplexer that forwards packfile bytes to sink. */
+void pktline_demux_init(PktlineDemux *demux, PktlineSink sink, void *ctx);
+
+/*
+ * Routes text packets of the response (e.g. "shallow <sha>") to
+ * on_line (see PktlineLineFn); returning non-zero aborts the feed.
+ */
+void pktline_demux_set_line_handler(PktlineDemux *demux, PktlineLineFn on_line, void *ctx);
+
+/*
+ * Routes side-band progress and error text to on_message (see
+ * PktlineMessageFn). Without a handler, progress is dropped and a
+ * channel-3 error is reported without its text.
+ */
+void pktline_demux_set_message_handler(PktlineDemux *demux, PktlineMessageFn on_message, void *ctx);
+
+/*
+ * Tells the demultiplexer the fetch asked for "sideband-all", which
+ * side-band frames every packet of the response, section headers and
+ * all (git servers require it for packfile-uris).
+ */
+void pktline_demux_set_sideband_all(PktlineDemux *demux);
+
+/*
+ * Consumes the next slice of the response.
  *
- * @param data      Raw response body from http_post_pack().
- * @param data_len  Byte count of data.
- * @param pack_out  Output: heap-allocated raw packfile (caller must free).
- * @param pack_len  Output: byte count of the packfile.
- * @return          0 on success, 1 on failure.
+ * @param demux  Demultiplexer state.
+ * @param data   Response bytes (any length, any alignment).
+ * @param len    Byte count of data.
+ * @return       0 on success, 1 on malformed framing or sink failure.
+ */
+int pktline_demux_feed(PktlineDemux *demux, const unsigned char *data, size_t len);
+
+/*
+ * Checks that the response ended on a packet boundary.
+ *
+ * @return  0 if complete, 1 if the response was truncated mid-packet.
+ */
+int pktline_demux_finish(const PktlineDemux *demux);
+
+/* State for pktline_print_message(): zero-initialize one per response. */
+typedef struct {
+    int mid_line; /* 1 while the last message did not end its line */
+} PktlineMessageLog;
+
+/*
+ * A PktlineMessageFn that copies side-band text to stderr, prefixing
+ * each line with "remote: " (progress) or "remote error: " (channel
+ * 3), the way git shows it. ctx must point at a PktlineMessageLog.
  */
-int pktline_strip_sideband(const char *data, size_t data_len,
-                           unsigned char **pack_out, size_t *pack_len);
+int pktline_print_message(int channel, const char *data, size_t len, void *ctx);
 
 #endif /* PKTLINE_H */
@@ -0,0 +1,689 @@
+/*
+ * commit_graph.c
+ *
+ * Reading: the file is mapped once and every accessor is a fixed
+ * offset into it. Writing: the commits reachable from the tips are
+ * collected (from the previous graph when it has them), their
+ * generations computed with an explicit DFS, and the arrays streamed
+ * through one buffered writer that also computes the checksum.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../pack/packfile.h"
+#include "../refs/refs.h"
+#include "../utils/hash/hash.h"
+#include "../utils/trace/trace.h"
+#include "commit_graph.h"
+#include "loose_store.h"
+#include "object.h"
+
+#define GRAPH_INFO_DIR ".git/objects/info"
+
+#define GRAPH_SIGNATURE "CGPH"
+#define GRAPH_VERSION 1
+#define GRAPH_HASH_VERSION 1           /* SHA-1 */
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNK_ENTRY_SIZE 12      /* 4-byte id + 8-byte offset */
+#define GRAPH_FANOUT_SIZE (256 * 4)
+#define GRAPH_DATA_WIDTH (OID_RAW_SIZE + 16)
+
+#define CHUNK_OIDF 0x4f494446u         /* "OIDF" */
+#define CHUNK_OIDL 0x4f49444cu         /* "OIDL" */
+#define CHUNK_CDAT 0x43444154u         /* "CDAT" */
+#define CHUNK_EDGE 0x45444745u         /* "EDGE" */
+
+#define GRAPH_PARENT_NONE 0x70000000u
+#define GRAPH_EXTRA_EDGES 0x80000000u  /* parent2 is an EDGE index; marks the last edge too */
+#define GRAPH_EDGE_MASK 0x7fffffffu
+#define GRAPH_GENERATION_MAX 0x3fffffffu
+#define GRAPH_DATE_MAX ((1ULL << 34) - 1)
+
+/* Annotated tags pointing at tags deeper than this are not followed */
+#define TAG_PEEL_MAX 8
+#define GRAPH_WRITE_BUFFER (64 * 1024)
+
+struct CommitGraph {
+    const unsigned char *map;
+    size_t len;
+    uint32_t count;
+    const unsigned char *fanout;
+    const unsigned char *oids;
+    const unsigned char *data;
+    const unsigned char *edges;
+    size_t edge_count;
+};
+
+static uint32_t read_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+static uint64_t read_u64(const unsigned char *p) {
+    return ((uint64_t)read_u32(p) << 32) | read_u32(p + 4);
+}
+
+/* Locates the chunks and checks that their sizes agree. Returns 0 if valid. */
+static int parse_graph(CommitGraph *graph) {
+    const unsigned char *map = graph->map;
+    if (graph->len < GRAPH_HEADER_SIZE + GRAPH_CHUNK_ENTRY_SIZE + OID_RAW_SIZE ||
+        memcmp(map, GRAPH_SIGNATURE, 4) != 0 || map[4] != GRAPH_VERSION ||
+        map[5] != GRAPH_HASH_VERSION || map[7] != 0) {
+        return 1;
+    }
+    size_t chunk_count = map[6];
+    size_t end = graph->len - OID_RAW_SIZE;
+    size_t table_end = GRAPH_HEADER_SIZE + (chunk_count + 1) * GRAPH_CHUNK_ENTRY_SIZE;
+    if (table_end > end) return 1;
+
+    size_t oids_size = 0, data_size = 0, edges_size = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        /* A chunk runs up to where the next entry's chunk starts */
+        const unsigned char *entry = map + GRAPH_HEADER_SIZE + i * GRAPH_CHUNK_ENTRY_SIZE;
+        uint64_t offset = read_u64(entry + 4);
+        uint64_t next = read_u64(entry + GRAPH_CHUNK_ENTRY_SIZE + 4);
+        if (offset < table_end || offset > next || next > end) return 1;
+        size_t size = (size_t)(next - offset);
+        switch (read_u32(entry)) {
+        case CHUNK_OIDF:
+            if (size != GRAPH_FANOUT_SIZE) return 1;
+            graph->fanout = map + offset;
+            break;
+        case CHUNK_OIDL:
+            graph->oids = map + offset;
+            oids_size = size;
+            break;
+        case CHUNK_CDAT:
+            graph->data = map + offset;
+            data_size = size;
+            break;
+        case CHUNK_EDGE:
+            graph->edges = map + offset;
+            edges_size = size;
+            break;
+        default:
+            break;  /* optional chunks (generation v2, bloom filters) */
+        }
+    }
+    if (graph->fanout == NULL || graph->oids == NULL || graph->data == NULL) return 1;
+
+    uint32_t previous = 0;
+    for (int i = 0; i < 256; i++) {
+        uint32_t value = read_u32(graph->fanout + i * 4);
+        if (value < previous) return 1;
+        previous = value;
+    }
+    graph->count = previous;
+    if (oids_size != (size_t)graph->count * OID_RAW_SIZE ||
+        data_size != (size_t)graph->count * GRAPH_DATA_WIDTH) {
+        return 1;
+    }
+    graph->edge_count = edges_size / 4;
+    return 0;
+}
+
+CommitGraph *commit_graph_open(void) {
+    int fd = open(GIT_COMMIT_GRAPH_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping stays valid after close */
+    if (map == MAP_FAILED) return NULL;
+
+    CommitGraph *graph = calloc(1, sizeof(CommitGraph));
+    if (graph == NULL) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    graph->map = map;
+    graph->len = (size_t)st.st_size;
+    if (parse_graph(graph) != 0) {
+        GIT_ERR("commit-graph: ignoring invalid %s\n", GIT_COMMIT_GRAPH_FILE);
+        commit_graph_close(graph);
+        return NULL;
+    }
+    return graph;
+}
+
+void commit_graph_close(CommitGraph *graph) {
+    if (graph == NULL) return;
+    munmap((void *)graph->map, graph->len);
+    free(graph);
+}
+
+uint32_t commit_graph_count(const CommitGraph *graph) {
+    return graph->count;
+}
+
+uint32_t commit_graph_find(const CommitGraph *graph, const ObjectId *oid) {
+    unsigned char first = oid->hash[0];
+    uint32_t lo = first == 0 ? 0 : read_u32(graph->fanout + (first - 1) * 4);
+    uint32_t hi = read_u32(graph->fanout + first * 4);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(graph->oids + (size_t)mid * OID_RAW_SIZE, oid->hash, OID_RAW_SIZE);
+        if (cmp == 0) return mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return COMMIT_GRAPH_NONE;
+}
+
+void commit_graph_oid(const CommitGraph *graph, uint32_t pos, ObjectId *oid_out) {
+    memcpy(oid_out->hash, graph->oids + (size_t)pos * OID_RAW_SIZE, OID_RAW_SIZE);
+}
+
+void commit_graph_tree(const CommitGraph *graph, uint32_t pos, ObjectId *tree_out) {
+    memcpy(tree_out->hash, graph->data + (size_t)pos * GRAPH_DATA_WIDTH, OID_RAW_SIZE);
+}
+
+uint64_t commit_graph_date(const CommitGraph *graph, uint32_t pos) {
+    const unsigned char *p = graph->data + (size_t)pos * GRAPH_DATA_WIDTH + OID_RAW_SIZE + 8;
+    return ((uint64_t)(read_u32(p) & 0x3) << 32) | read_u32(p + 4);
+}
+
+uint32_t commit_graph_generation(const CommitGraph *graph, uint32_t pos) {
+    return read_u32(graph->data + (size_t)pos * GRAPH_DATA_WIDTH + OID_RAW_SIZE + 8) >> 2;
+}
+
+uint32_t commit_graph_parent(const CommitGraph *graph, uint32_t pos, size_t n) {
+    const unsigned char *p = graph->data + (size_t)pos * GRAPH_DATA_WIDTH + OID_RAW_SIZE;
+    uint32_t parent = read_u32(p + (n == 0 ? 0 : 4));
+    if (n > 0 && (parent & GRAPH_EXTRA_EDGES)) {
+        /* Octopus: parents 2.. are a run in EDGE, the last one flagged */
+        size_t edge = (parent & GRAPH_EDGE_MASK) + (n - 1);
+        for (size_t i = parent & GRAPH_EDGE_MASK; i < edge; i++) {
+            if (i >= graph->edge_count || (read_u32(graph->edges + i * 4) & GRAPH_EXTRA_EDGES)) {
+                return COMMIT_GRAPH_NONE;
+            }
+        }
+        if (edge >= graph->edge_count) return COMMIT_GRAPH_NONE;
+        parent = read_u32(graph->edges + edge * 4) & GRAPH_EDGE_MASK;
+    } else if (n > 1) {
+        return COMMIT_GRAPH_NONE;
+    }
+    return parent < graph->count ? parent : COMMIT_GRAPH_NONE;
+}
+
+/* ---- Writing ---- */
+
+/* One commit to write. */
+typedef struct {
+    ObjectId oid;
+    ObjectId tree;
+    uint64_t date;
+    size_t first_parent;    /* into GraphBuild.parents */
+    size_t parent_count;
+    uint32_t generation;    /* 0 until computed */
+    uint32_t pos;           /* position in the new file */
+} GraphNode;
+
+/* The commits reachable from the tips, gathered before writing. */
+typedef struct {
+    GraphNode *nodes;
+    size_t count;
+    size_t capacity;
+    size_t *table;          /* open addressing, node index + 1; 0 = empty */
+    size_t table_size;      /* power of two */
+    size_t *parents;        /* node indices, a run per node */
+    size_t parent_total;
+    size_t parent_capacity;
+    size_t *stack;          /* nodes to read, later the generation DFS */
+    size_t stack_len;
+    size_t stack_capacity;
+    const CommitGraph *old; /* current file, or NULL */
+} GraphBuild;
+
+/* Makes room for one more item in a doubling array. Returns 0 on success. */
+static int reserve_one(void **items, size_t count, size_t *capacity, size_t item_size) {
+    if (count < *capacity) return 0;
+    size_t new_capacity = *capacity == 0 ? 256 : *capacity * 2;
+    void *grown = realloc(*items, new_capacity * item_size);
+    if (grown == NULL) {
+        GIT_ERR("commit-graph: malloc failed\n");
+        return 1;
+    }
+    *items = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int push_stack(GraphBuild *build, size_t index) {
+    if (reserve_one((void **)&build->stack, build->stack_len, &build->stack_capacity, sizeof(size_t)) != 0) {
+        return 1;
+    }
+    build->stack[build->stack_len++] = index;
+    return 0;
+}
+
+static size_t build_slot(const GraphBuild *build, const ObjectId *oid) {
+    size_t mask = build->table_size - 1;
+    size_t i = ((size_t)oid->hash[0] << 24 | (size_t)oid->hash[1] << 16 |
+                (size_t)oid->hash[2] << 8 | oid->hash[3]) & mask;
+    while (build->table[i] != 0 && !oid_equal(&build->nodes[build->table[i] - 1].oid, oid)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/*
+ * Index of oid's node. A new node is queued to be read; SIZE_MAX on
+ * allocation failure.
+ */
+static size_t build_node(GraphBuild *build, const ObjectId *oid) {
+    if (build->table_size > 0 && build->table[build_slot(build, oid)] != 0) {
+        return build->table[build_slot(build, oid)] - 1;
+    }
+    if ((build->count + 1) * 2 > build->table_size) {
+        size_t new_size = build->table_size == 0 ? 1024 : build->table_size * 2;
+        size_t *table = calloc(new_size, sizeof(size_t));
+        if (table == NULL) {
+            GIT_ERR("commit-graph: malloc failed\n");
+            return SIZE_MAX;
+        }
+        free(build->table);
+        build->table = table;
+        build->table_size = new_size;
+        for (size_t i = 0; i < build->count; i++) {
+            build->table[build_slot(build, &build->nodes[i].oid)] = i + 1;
+        }
+    }
+    if (reserve_one((void **)&build->nodes, build->count, &build->capacity, sizeof(GraphNode)) != 0) {
+        return SIZE_MAX;
+    }
+    GraphNode *node = &build->nodes[build->count];
+    memset(node, 0, sizeof(*node));
+    node->oid = *oid;
+    build->table[build_slot(build, oid)] = build->count + 1;
+    if (push_stack(build, build->count) != 0) return SIZE_MAX;
+    return build->count++;
+}
+
+/* Appends a parent to the run of the node being read. */
+static int add_parent(GraphBuild *build, const ObjectId *parent) {
+    size_t index = build_node(build, parent);
+    if (index == SIZE_MAX ||
+        reserve_one((void **)&build->parents, build->parent_total, &build->parent_capacity,
+                    sizeof(size_t)) != 0) {
+        return 1;
+    }
+    build->parents[build->parent_total++] = index;
+    return 0;
+}
+
+/* Reads a commit from the object store: tree, parents, committer time. */
+static int read_commit(GraphBuild *build, size_t index) {
+    ObjectId oid = build->nodes[index].oid;
+    char hex[OID_HEX_SIZE + 1];
+    GitObject obj;
+    if (object_read(&oid, &obj) != 0) return 1;
+    int result = 1;
+    ObjectId tree = {0};
+    uint64_t date = 0;
+    int have_tree = 0;
+
+    const char *p = (const char *)obj.body;
+    const char *end = p + obj.body_size;
+    /* Headers end at the first empty line */
+    while (p < end && *p != '\n') {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == NULL) eol = end;
+        ObjectId parent;
+        if (eol - p == 5 + OID_HEX_SIZE && memcmp(p, "tree ", 5) == 0) {
+            have_tree = oid_from_hex(p + 5, &tree) == 0;
+        } else if (eol - p == 7 + OID_HEX_SIZE && memcmp(p, "parent ", 7) == 0 &&
+                   oid_from_hex(p + 7, &parent) == 0) {
+            if (!object_exists(&parent)) {
+                char parent_hex[OID_HEX_SIZE + 1];
+                GIT_ERR("commit-graph: parent %s of %s is missing\n",
+                        oid_to_hex(&parent, parent_hex), oid_to_hex(&oid, hex));
+                goto cleanup;
+            }
+            if (add_parent(build, &parent) != 0) goto cleanup;
+        } else if (eol - p > 10 && memcmp(p, "committer ", 10) == 0) {
+            /* "committer <name> <<email>> <time> <tz>" */
+            const char *gt = p;
+            for (const char *q = p; q < eol; q++) {
+                if (*q == '>') gt = q;
+            }
+            date = strtoull(gt + 1, NULL, 10);
+        }
+        p = eol + 1;
+    }
+    if (!have_tree) {
+        GIT_ERR("commit-graph: malformed commit %s\n", oid_to_hex(&oid, hex));
+        goto cleanup;
+    }
+    build->nodes[index].tree = tree;
+    build->nodes[index].date = date;
+    result = 0;
+
+cleanup:
+    free(obj.raw);
+    return result;
+}
+
+/* Reads a commit, from the previous graph when it has it. */
+static int parse_node(GraphBuild *build, size_t index) {
+    build->nodes[index].first_parent = build->parent_total;
+    uint32_t pos = build->old != NULL ? commit_graph_find(build->old, &build->nodes[index].oid)
+                                      : COMMIT_GRAPH_NONE;
+    if (pos == COMMIT_GRAPH_NONE) {
+        if (read_commit(build, index) != 0) return 1;
+    } else {
+        commit_graph_tree(build->old, pos, &build->nodes[index].tree);
+        build->nodes[index].date = commit_graph_date(build->old, pos);
+        for (size_t n = 0; ; n++) {
+            uint32_t parent = commit_graph_parent(build->old, pos, n);
+            if (parent == COMMIT_GRAPH_NONE) break;
+            ObjectId parent_oid;
+            commit_graph_oid(build->old, parent, &parent_oid);
+            if (add_parent(build, &parent_oid) != 0) return 1;
+        }
+    }
+    build->nodes[index].parent_count = build->parent_total - build->nodes[index].first_parent;
+    return 0;
+}
+
+/* Adds a tip, peeling annotated tags; other objects are skipped. */
+static int add_tip(GraphBuild *build, const ObjectId *tip) {
+    ObjectId oid = *tip;
+    for (int depth = 0; depth < TAG_PEEL_MAX; depth++) {
+        int type;
+        size_t size;
+        /* Never fetch a missing tip from a promisor remote */
+        if (!object_exists(&oid) || object_read_header(&oid, &type, &size) != 0) return 0;
+        if (type == OBJ_COMMIT) return build_node(build, &oid) == SIZE_MAX;
+        if (type != OBJ_TAG) return 0;
+
+        /* A tag starts with "object <sha>\n" */
+        GitObject obj;
+        if (object_read(&oid, &obj) != 0) return 0;
+        int peeled = obj.body_size > 7 + OID_HEX_SIZE && memcmp(obj.body, "object ", 7) == 0 &&
+                     oid_from_hex((const char *)obj.body + 7, &oid) == 0;
+        free(obj.raw);
+        if (!peeled) return 0;
+    }
+    return 0;
+}
+
+/* refs_for_each() callback. */
+static int add_ref(const char *name, const ObjectId *oid, void *ctx) {
+    (void)name;
+    return add_tip(ctx, oid);
+}
+
+/*
+ * Sets every node's generation with a DFS that descends into one
+ * unfinished parent at a time, so a node is finished only after all
+ * its parents. GRAPH_GENERATION_MAX + 1 marks a node on the DFS path;
+ * meeting one again means a cycle, which only a corrupt previous
+ * graph can produce.
+ */
+static int compute_generations(GraphBuild *build) {
+    const uint32_t on_path = GRAPH_GENERATION_MAX + 1;
+    for (size_t root = 0; root < build->count; root++) {
+        if (build->nodes[root].generation != 0) continue;
+        build->stack_len = 0;
+        if (push_stack(build, root) != 0) return 1;
+        build->nodes[root].generation = on_path;
+        while (build->stack_len > 0) {
+            GraphNode *node = &build->nodes[build->stack[build->stack_len - 1]];
+            uint32_t max_parent = 0;
+            size_t pending = SIZE_MAX;
+            for (size_t i = 0; i < node->parent_count; i++) {
+                size_t parent = build->parents[node->first_parent + i];
+                uint32_t generation = build->nodes[parent].generation;
+                if (generation == on_path) {
+                    GIT_ERR("commit-graph: history contains a cycle\n");
+                    return 1;
+                }
+                if (generation == 0) {
+                    pending = parent;
+                    break;
+                }
+                if (generation > max_parent) max_parent = generation;
+            }
+            if (pending != SIZE_MAX) {
+                build->nodes[pending].generation = on_path;
+                if (push_stack(build, pending) != 0) return 1;
+                continue;
+            }
+            node->generation = max_parent < GRAPH_GENERATION_MAX ? max_parent + 1 : GRAPH_GENERATION_MAX;
+            build->stack_len--;
+        }
+    }
+    return 0;
+}
+
+/* Buffered output that also feeds the checksum. */
+typedef struct {
+    int fd;
+    HashCtx *hash;
+    size_t len;
+    int failed;
+    unsigned char buf[GRAPH_WRITE_BUFFER];
+} GraphFile;
+
+static void graph_flush(GraphFile *out) {
+    const unsigned char *p = out->buf;
+    while (!out->failed && out->len > 0) {
+        ssize_t n = write(out->fd, p, out->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            out->failed = 1;
+            break;
+        }
+        p += n;
+        out->len -= (size_t)n;
+    }
+    out->len = 0;
+}
+
+static void graph_put(GraphFile *out, const void *data, size_t len) {
+    hash_update(out->hash, data, len);
+    const unsigned char *p = data;
+    while (len > 0) {
+        if (out->len == sizeof(out->buf)) graph_flush(out);
+        size_t n = sizeof(out->buf) - out->len;
+        if (n > len) n = len;
+        memcpy(out->buf + out->len, p, n);
+        out->len += n;
+        p += n;
+        len -= n;
+    }
+}
+
+static void graph_put_u32(GraphFile *out, uint32_t value) {
+    unsigned char bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    graph_put(out, bytes, 4);
+}
+
+static void graph_put_u64(GraphFile *out, uint64_t value) {
+    graph_put_u32(out, (uint32_t)(value >> 32));
+    graph_put_u32(out, (uint32_t)value);
+}
+
+/* Sort key: a node's ID and its index. */
+typedef struct {
+    ObjectId oid;
+    size_t node;
+} GraphOrder;
+
+static int compare_order(const void *a, const void *b) {
+    return oid_cmp(&((const GraphOrder *)a)->oid, &((const GraphOrder *)b)->oid);
+}
+
+/* Streams the header, chunk table, chunks and checksum. */
+static void write_chunks(GraphFile *out, const GraphBuild *build, const GraphOrder *order) {
+    size_t extra_edges = 0;
+    for (size_t i = 0; i < build->count; i++) {
+        if (build->nodes[i].parent_count > 2) extra_edges += build->nodes[i].parent_count - 1;
+    }
+    unsigned char chunk_count = extra_edges > 0 ? 4 : 3;
+    unsigned char header[GRAPH_HEADER_SIZE] = { 'C', 'G', 'P', 'H', GRAPH_VERSION, GRAPH_HASH_VERSION,
+                                                chunk_count, 0 };
+    graph_put(out, header, sizeof(header));
+
+    const uint32_t ids[4] = { CHUNK_OIDF, CHUNK_OIDL, CHUNK_CDAT, CHUNK_EDGE };
+    const uint64_t sizes[4] = { GRAPH_FANOUT_SIZE, (uint64_t)build->count * OID_RAW_SIZE,
+                                (uint64_t)build->count * GRAPH_DATA_WIDTH, (uint64_t)extra_edges * 4 };
+    uint64_t offset = GRAPH_HEADER_SIZE + (uint64_t)(chunk_count + 1) * GRAPH_CHUNK_ENTRY_SIZE;
+    for (int i = 0; i < chunk_count; i++) {
+        graph_put_u32(out, ids[i]);
+        graph_put_u64(out, offset);
+        offset += sizes[i];
+    }
+    graph_put_u32(out, 0);
+    graph_put_u64(out, offset);
+
+    /* OIDF and OIDL */
+    size_t next = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        while (next < build->count && order[next].oid.hash[0] == byte) next++;
+        graph_put_u32(out, (uint32_t)next);
+    }
+    for (size_t i = 0; i < build->count; i++) graph_put(out, order[i].oid.hash, OID_RAW_SIZE);
+
+    /* CDAT; octopus merges take their EDGE runs in this order */
+    size_t edge = 0;
+    for (size_t i = 0; i < build->count; i++) {
+        const GraphNode *node = &build->nodes[order[i].node];
+        const size_t *parents = build->parents + node->first_parent;
+        graph_put(out, node->tree.hash, OID_RAW_SIZE);
+        graph_put_u32(out, node->parent_count > 0 ? build->nodes[parents[0]].pos : GRAPH_PARENT_NONE);
+        if (node->parent_count > 2) {
+            graph_put_u32(out, GRAPH_EXTRA_EDGES | (uint32_t)edge);
+            edge += node->parent_count - 1;
+        } else {
+            graph_put_u32(out, node->parent_count == 2 ? build->nodes[parents[1]].pos : GRAPH_PARENT_NONE);
+        }
+        uint64_t date = node->date < GRAPH_DATE_MAX ? node->date : GRAPH_DATE_MAX;
+        graph_put_u32(out, node->generation << 2 | (uint32_t)(date >> 32));
+        graph_put_u32(out, (uint32_t)date);
+    }
+    for (size_t i = 0; i < build->count && extra_edges > 0; i++) {
+        const GraphNode *node = &build->nodes[order[i].node];
+        if (node->parent_count <= 2) continue;
+        for (size_t p = 1; p < node->parent_count; p++) {
+            uint32_t value = build->nodes[build->parents[node->first_parent + p]].pos;
+            graph_put_u32(out, p + 1 == node->parent_count ? value | GRAPH_EXTRA_EDGES : value);
+        }
+    }
+
+    unsigned char checksum[OID_RAW_SIZE];
+    hash_final(out->hash, checksum);
+    size_t room = sizeof(out->buf) - out->len;
+    if (room < OID_RAW_SIZE) graph_flush(out);
+    memcpy(out->buf + out->len, checksum, OID_RAW_SIZE);
+    out->len += OID_RAW_SIZE;
+    graph_flush(out);
+}
+
+/* Writes build to a temp file and renames it over the commit-graph. */
+static int write_graph_file(GraphBuild *build) {
+    int result = 1;
+    GraphOrder *order = NULL;
+    GraphFile *out = NULL;
+    char tmp_path[GIT_PATH_MAX] = "";
+
+    order = malloc(build->count * sizeof(GraphOrder));
+    out = malloc(sizeof(GraphFile));
+    if (order == NULL || out == NULL) {
+        GIT_ERR("commit-graph: malloc failed\n");
+        goto cleanup;
+    }
+    for (size_t i = 0; i < build->count; i++) order[i] = (GraphOrder){ build->nodes[i].oid, i };
+    qsort(order, build->count, sizeof(GraphOrder), compare_order);
+    for (size_t i = 0; i < build->count; i++) build->nodes[order[i].node].pos = (uint32_t)i;
+
+    if (mkdir(GRAPH_INFO_DIR, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) {
+        GIT_ERR("commit-graph: cannot create %s: %s\n", GRAPH_INFO_DIR, strerror(errno));
+        goto cleanup;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s/tmp_graph_XXXXXX", GRAPH_INFO_DIR);
+    out->fd = mkstemp(tmp_path);
+    if (out->fd < 0) {
+        GIT_ERR("commit-graph: cannot create temp file: %s\n", strerror(errno));
+        tmp_path[0] = '\0';
+        goto cleanup;
+    }
+    fchmod(out->fd, 0444); /* read-only, as git writes it */
+    out->hash = hash_ctx_new(HASH_SHA1);
+    out->len = 0;
+    out->failed = out->hash == NULL;
+    if (!out->failed) write_chunks(out, build, order);
+    hash_ctx_free(out->hash);
+    if (!out->failed && loose_store_sync_file(out->fd) != 0) out->failed = 1;
+    if (close(out->fd) != 0) out->failed = 1;
+    if (out->failed) {
+        GIT_ERR("commit-graph: error writing %s\n", tmp_path);
+        goto cleanup;
+    }
+    if (rename(tmp_path, GIT_COMMIT_GRAPH_FILE) != 0) {
+        GIT_ERR("commit-graph: cannot rename to %s: %s\n", GIT_COMMIT_GRAPH_FILE, strerror(errno));
+        goto cleanup;
+    }
+    tmp_path[0] = '\0';
+    result = 0;
+
+cleanup:
+    if (tmp_path[0] != '\0') unlink(tmp_path);
+    free(order);
+    free(out);
+    return result;
+}
+
+int commit_graph_write(const ObjectId *tips, size_t tip_count) {
+    /* Beyond a shallow boundary parents are missing: git writes no graph either */
+    if (access(GIT_SHALLOW_FILE, F_OK) == 0) return 0;
+
+    uint64_t start = trace_now();
+    GraphBuild build = {0};
+    CommitGraph *old = commit_graph_open();
+    build.old = old;
+    int result = 1;
+
+    ObjectId head;
+    if (refs_for_each(add_ref, &build) != 0) goto cleanup;
+    if (refs_resolve("HEAD", &head) == 0 && add_tip(&build, &head) != 0) goto cleanup;
+    for (size_t i = 0; i < tip_count; i++) {
+        if (add_tip(&build, &tips[i]) != 0) goto cleanup;
+    }
+    while (build.stack_len > 0) {
+        if (parse_node(&build, build.stack[--build.stack_len]) != 0) goto cleanup;
+    }
+    if (build.count == 0) {
+        result = 0;
+        goto cleanup;
+    }
+    if (build.count >= GRAPH_PARENT_NONE) {
+        GIT_ERR("commit-graph: too many commits\n");
+        goto cleanup;
+    }
+    if (compute_generations(&build) != 0 || write_graph_file(&build) != 0) goto cleanup;
+    result = 0;
+
+cleanup:
+    commit_graph_close(old);
+    free(build.nodes);
+    free(build.table);
+    free(build.parents);
+    free(build.stack);
+    trace_span("commit_graph.write", start);
+    return result;
+}
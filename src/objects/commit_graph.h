@@ -0,0 +1,97 @@
+/*
+ * commit_graph.h
+ *
+ * The commit-graph file, .git/objects/info/commit-graph, in git's
+ * format (version 1, SHA-1): for every commit reachable from the refs,
+ * its ID, tree, parents (as positions in the file), generation number
+ * and committer date, in fixed-width big-endian arrays. History walks
+ * read it through mmap instead of inflating and parsing commits.
+ *
+ * Layout:
+ *   header        "CGPH", version 1, hash version 1, chunk count, 0
+ *   chunk table   (id, 8-byte offset) per chunk, then (0, end offset)
+ *   OIDF          fanout[256] — cumulative commit counts by first byte
+ *   OIDL          oid[N][20] — sorted commit IDs
+ *   CDAT          per commit: tree[20], parent1, parent2, and 8 bytes
+ *                 holding generation (30 bits) and date (34 bits)
+ *   EDGE          parents 2.. of octopus merges (only if there are any)
+ *   checksum      SHA-1 of everything above
+ */
+
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "object_id.h"
+
+#define GIT_COMMIT_GRAPH_FILE ".git/objects/info/commit-graph"
+
+/* Position returned for a commit that is not in the graph */
+#define COMMIT_GRAPH_NONE UINT32_MAX
+
+typedef struct CommitGraph CommitGraph;
+
+/*
+ * Maps the commit-graph file. An invalid file is ignored with a
+ * warning, as if there were none.
+ *
+ * @return  Heap-allocated graph (release with commit_graph_close()),
+ *          or NULL if there is no usable file.
+ */
+CommitGraph *commit_graph_open(void);
+
+/* Unmaps the file. Safe to call with NULL. */
+void commit_graph_close(CommitGraph *graph);
+
+/* @return  Number of commits in the graph. */
+uint32_t commit_graph_count(const CommitGraph *graph);
+
+/*
+ * Finds a commit by binary search within its fanout slice.
+ *
+ * @return  Its position, or COMMIT_GRAPH_NONE if it is not in the graph.
+ */
+uint32_t commit_graph_find(const CommitGraph *graph, const ObjectId *oid);
+
+/* Reads the ID of the commit at pos (< commit_graph_count()). */
+void commit_graph_oid(const CommitGraph *graph, uint32_t pos, ObjectId *oid_out);
+
+/* Reads the root tree of the commit at pos. */
+void commit_graph_tree(const CommitGraph *graph, uint32_t pos, ObjectId *tree_out);
+
+/* @return  Committer time of the commit at pos, in seconds since the epoch. */
+uint64_t commit_graph_date(const CommitGraph *graph, uint32_t pos);
+
+/*
+ * @return  Generation number of the commit at pos: 1 for a root,
+ *          else 1 + the largest generation among its parents.
+ */
+uint32_t commit_graph_generation(const CommitGraph *graph, uint32_t pos);
+
+/*
+ * Reads one parent of the commit at pos.
+ *
+ * @param n  Parent index, 0 for the first parent.
+ * @return   The parent's position, or COMMIT_GRAPH_NONE when the commit
+ *           has no n-th parent.
+ */
+uint32_t commit_graph_parent(const CommitGraph *graph, uint32_t pos, size_t n);
+
+/*
+ * Writes the commit-graph for every commit reachable from the refs,
+ * HEAD and tips. Commits already in the current graph are taken from
+ * it; only new ones are read from the object store. The file is
+ * written to a temp file and renamed into place.
+ *
+ * Shallow repositories get no graph (their commits lack parents), and
+ * neither do repositories without commits.
+ *
+ * @param tips       More commits to include (may be NULL).
+ * @param tip_count  Number of tips.
+ * @return           0 on success or when skipped, 1 on failure.
+ */
+int commit_graph_write(const ObjectId *tips, size_t tip_count);
+
+#endif /* COMMIT_GRAPH_H */
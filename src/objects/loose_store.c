@@ -0,0 +1,316 @@
+/*
+ * loose_store.c
+ *
+ * Directory handles are opened lazily and never closed. A fan-out fd
+ * is published with a compare-and-swap (the loser of a race closes
+ * its copy), so lookups take no lock. The object store handle is opened
+ * on the first call that finds .git/objects/ (clone creates it after
+ * the process starts) and stays valid across a later chdir.
+ *
+ * A batch directory is created by the first batch-mode install and
+ * removed by the flush that empties it; it holds each pending object
+ * under its full 40-hex name.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE  /* syncfs(), sync_file_range() */
+#endif
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../constants.h"
+#include "../utils/config/config.h"
+#include "../utils/file/file.h"
+#include "../utils/trace/trace.h"
+#include "loose_store.h"
+
+/* Attempts at a fresh temp or batch directory name before giving up */
+#define TEMP_NAME_ATTEMPTS 16
+
+typedef enum {
+    FSYNC_NONE,
+    FSYNC_EACH,   /* core.fsyncMethod=fsync */
+    FSYNC_BATCH,  /* core.fsyncMethod=batch */
+} FsyncMethod;
+
+static struct {
+    _Atomic int objects_fd;        /* .git/objects/, or -1 until found */
+    FsyncMethod method;            /* read with objects_fd, before it is published */
+    _Atomic int fanout_fds[256];   /* fd + 1 of .git/objects/xx/; 0 while not open */
+    atomic_uint next_temp;
+    _Atomic int batch_fd;          /* batch directory, or -1 when nothing is pending */
+    char batch_name[LOOSE_TEMP_NAME_MAX];  /* set before batch_fd is published */
+} store = { .objects_fd = -1, .batch_fd = -1 };
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FsyncMethod read_fsync_method(void) {
+    char value[32];
+    if (config_get("core.fsyncMethod", value, sizeof(value)) != 0) return FSYNC_NONE;
+    if (strcasecmp(value, "fsync") == 0) return FSYNC_EACH;
+    if (strcasecmp(value, "batch") == 0) return FSYNC_BATCH;
+    GIT_ERR("warning: ignoring unknown core.fsyncMethod '%s'\n", value);
+    return FSYNC_NONE;
+}
+
+/* The .git/objects/ handle, or -1 if there is no object store (yet). */
+static int objects_dir(void) {
+    int fd = atomic_load(&store.objects_fd);
+    if (fd >= 0) return fd;
+
+    pthread_mutex_lock(&store_lock);
+    fd = atomic_load(&store.objects_fd);
+    if (fd < 0) {
+        fd = open(GIT_OBJECTS_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            store.method = read_fsync_method();
+            atomic_store(&store.objects_fd, fd);
+        }
+    }
+    pthread_mutex_unlock(&store_lock);
+    return fd;
+}
+
+/*
+ * The handle of fan-out directory byte ("%02x"), or -1. With create,
+ * a missing directory is made first; without, its absence is not
+ * remembered, since a writer may create it later.
+ */
+static int fanout_dir(unsigned char byte, int create) {
+    int fd = atomic_load(&store.fanout_fds[byte]) - 1;
+    if (fd >= 0) return fd;
+    int objects_fd = objects_dir();
+    if (objects_fd < 0) return -1;
+
+    char name[3];
+    snprintf(name, sizeof(name), "%02x", byte);
+    if (create && mkdirat(objects_fd, name, DIRECTORY_PERMISSION) != 0 && errno != EEXIST) return -1;
+    fd = openat(objects_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int published = 0;
+    if (!atomic_compare_exchange_strong(&store.fanout_fds[byte], &published, fd + 1)) {
+        close(fd);  /* another thread opened it first */
+        fd = published - 1;
+    }
+    return fd;
+}
+
+/*
+ * The batch directory handle, created on first use under a fresh
+ * name: one left by a crashed run may hold unsynced files, which
+ * must never be moved into place. Returns -1 on failure.
+ */
+static int batch_dir(void) {
+    int fd = atomic_load(&store.batch_fd);
+    if (fd >= 0) return fd;
+
+    pthread_mutex_lock(&store_lock);
+    fd = atomic_load(&store.batch_fd);
+    int objects_fd = atomic_load(&store.objects_fd);
+    for (int attempt = 0; fd < 0 && attempt < TEMP_NAME_ATTEMPTS; attempt++) {
+        snprintf(store.batch_name, sizeof(store.batch_name), "tmp_objdir_%ld_%u",
+                 (long)getpid(), atomic_fetch_add(&store.next_temp, 1));
+        if (mkdirat(objects_fd, store.batch_name, DIRECTORY_PERMISSION) != 0) {
+            if (errno == EEXIST) continue;
+            break;
+        }
+        fd = openat(objects_fd, store.batch_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            unlinkat(objects_fd, store.batch_name, AT_REMOVEDIR);
+            break;
+        }
+        atomic_store(&store.batch_fd, fd);
+    }
+    pthread_mutex_unlock(&store_lock);
+    return fd;
+}
+
+int loose_store_create_temp(char *name, size_t name_size) {
+    name[0] = '\0';
+    int objects_fd = objects_dir();
+    if (objects_fd < 0) {
+        GIT_ERR("Error opening %s: %s\n", GIT_OBJECTS_DIR, strerror(errno));
+        return -1;
+    }
+    for (int attempt = 0; attempt < TEMP_NAME_ATTEMPTS; attempt++) {
+        /* pid + counter is unique unless a crashed run with this pid left one */
+        snprintf(name, name_size, "tmp_obj_%ld_%u", (long)getpid(), atomic_fetch_add(&store.next_temp, 1));
+        /* Objects are immutable, as in git; the mode does not restrict this fd */
+        int fd = openat(objects_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+        if (fd >= 0) return fd;
+        if (errno != EEXIST) break;
+    }
+    GIT_ERR("Error creating temporary object file: %s\n", strerror(errno));
+    name[0] = '\0';
+    return -1;
+}
+
+/* Applies core.fsyncMethod to a finished temp file. */
+static int sync_temp(int fd) {
+    switch (store.method) {
+    case FSYNC_EACH:
+        return fsync(fd);
+    case FSYNC_BATCH:
+#ifdef __linux__
+        /* Start writeback now, so the barrier finds little left to do */
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+int loose_store_install(int fd, const char *temp_name, const ObjectId *oid) {
+    char hex[OID_HEX_SIZE + 1];
+    oid_to_hex(oid, hex);
+
+    int failed = sync_temp(fd) != 0;
+    if (close(fd) != 0) failed = 1;
+    if (failed) {
+        GIT_ERR("Error writing object %s: %s\n", hex, strerror(errno));
+        goto fail;
+    }
+
+    /* Batch: not under its final name until the barrier has run */
+    int dir_fd = store.method == FSYNC_BATCH ? batch_dir() : fanout_dir(oid->hash[0], 1);
+    if (dir_fd < 0) {
+        GIT_ERR("Error creating a directory for object %s: %s\n", hex, strerror(errno));
+        goto fail;
+    }
+    const char *name = store.method == FSYNC_BATCH ? hex : hex + 2;
+    if (renameat(atomic_load(&store.objects_fd), temp_name, dir_fd, name) != 0) {
+        GIT_ERR("Error moving object into place %s/%.2s/%s: %s\n",
+                GIT_OBJECTS_DIR, hex, hex + 2, strerror(errno));
+        goto fail;
+    }
+    trace_count(TRACE_OBJECTS_WRITTEN, 1);
+    return 0;
+
+fail:
+    loose_store_discard(temp_name);
+    return 1;
+}
+
+void loose_store_discard(const char *temp_name) {
+    int objects_fd = atomic_load(&store.objects_fd);
+    if (temp_name[0] != '\0' && objects_fd >= 0) unlinkat(objects_fd, temp_name, 0);
+}
+
+/* 1 if oid is waiting in the batch directory for the next barrier. */
+static int pending(const char *hex) {
+    int fd = atomic_load(&store.batch_fd);
+    struct stat st;
+    return fd >= 0 && fstatat(fd, hex, &st, 0) == 0;
+}
+
+int loose_store_exists(const ObjectId *oid) {
+    char hex[OID_HEX_SIZE + 1];
+    oid_to_hex(oid, hex);
+    struct stat st;
+
+    int dir_fd = fanout_dir(oid->hash[0], 0);
+    if (dir_fd >= 0 && fstatat(dir_fd, hex + 2, &st, 0) == 0) return 1;
+    return pending(hex);
+}
+
+int loose_store_path(const ObjectId *oid, char *path, size_t path_size) {
+    char hex[OID_HEX_SIZE + 1];
+    oid_to_hex(oid, hex);
+    struct stat st;
+
+    int dir_fd = fanout_dir(oid->hash[0], 0);
+    if ((dir_fd < 0 || fstatat(dir_fd, hex + 2, &st, 0) != 0) && pending(hex)) {
+        return (size_t)snprintf(path, path_size, "%s/%s/%s", GIT_OBJECTS_DIR,
+                                store.batch_name, hex) >= path_size;
+    }
+    return object_path(oid, NULL, 0, path, path_size);
+}
+
+int loose_store_sync_file(int fd) {
+    objects_dir();
+    return store.method != FSYNC_NONE && fsync(fd) != 0;
+}
+
+/* One readdir() pass of install_batch(); sets *moved to the files moved. */
+static int install_pass(int dir_fd, size_t *moved) {
+    *moved = 0;
+    int copy = dup(dir_fd);
+    DIR *dir = copy >= 0 ? fdopendir(copy) : NULL;
+    if (dir == NULL) {
+        if (copy >= 0) close(copy);
+        GIT_ERR("Error reading %s/%s: %s\n", GIT_OBJECTS_DIR, store.batch_name, strerror(errno));
+        return 1;
+    }
+    rewinddir(dir);  /* the dup shares the offset of earlier passes */
+    int failed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        ObjectId oid;
+        if (strlen(entry->d_name) != OID_HEX_SIZE || oid_from_hex(entry->d_name, &oid) != 0) continue;
+        int fanout_fd = fanout_dir(oid.hash[0], 1);
+        if (fanout_fd < 0 || renameat(dir_fd, entry->d_name, fanout_fd, entry->d_name + 2) != 0) {
+            GIT_ERR("Error moving object into place %s/%.2s/%s: %s\n",
+                    GIT_OBJECTS_DIR, entry->d_name, entry->d_name + 2, strerror(errno));
+            failed = 1;
+            continue;
+        }
+        (*moved)++;
+    }
+    closedir(dir);
+    return failed;
+}
+
+/*
+ * Moves every file of the batch directory to its final name, then
+ * removes the directory. readdir() may skip entries of a directory
+ * that changes under it, so passes repeat until one finds nothing.
+ */
+static int install_batch(int objects_fd, int dir_fd) {
+    size_t moved;
+    do {
+        if (install_pass(dir_fd, &moved) != 0) return 1;  /* the rest stays, synced */
+    } while (moved > 0);
+    unlinkat(objects_fd, store.batch_name, AT_REMOVEDIR);
+    return 0;
+}
+
+int loose_store_flush(void) {
+    int dir_fd = atomic_exchange(&store.batch_fd, -1);
+    if (dir_fd < 0) return 0;
+    uint64_t start = trace_now();
+    int objects_fd = atomic_load(&store.objects_fd);
+#ifdef __linux__
+    int failed = syncfs(objects_fd) != 0;
+#else
+    sync();
+    int failed = 0;
+#endif
+    if (failed) {
+        GIT_ERR("Error syncing %s: %s\n", GIT_OBJECTS_DIR, strerror(errno));
+    } else {
+        failed = install_batch(objects_fd, dir_fd);
+    }
+    close(dir_fd);
+    trace_span("loose_store.flush", start);
+    return failed;
+}
+
+void loose_store_reopen(void) {
+    loose_store_flush();
+    for (int i = 0; i < 256; i++) {
+        int fd = atomic_exchange(&store.fanout_fds[i], 0) - 1;
+        if (fd >= 0) close(fd);
+    }
+    int fd = atomic_exchange(&store.objects_fd, -1);
+    if (fd >= 0) close(fd);
+}
@@ -0,0 +1,115 @@
+/*
+ * loose_store.h
+ *
+ * The file system side of loose object writes: handles to
+ * .git/objects/ and its 256 fan-out directories, kept open for the
+ * whole command so each object is created, renamed and looked up
+ * relative to a directory fd instead of through a rebuilt path.
+ *
+ * Durability follows core.fsyncMethod in .git/config:
+ *     (unset)  no syncing — the OS writes objects back in its own time
+ *     fsync    each object is fsynced before it is renamed into place
+ *     batch    each object only starts its writeback and is parked in
+ *              a batch directory; at the end of the command one barrier
+ *              (loose_store_flush) makes all of them durable, and only
+ *              then are they renamed into place, as git's
+ *              core.fsyncMethod=batch does with its temporary objdir
+ *
+ * So an object under its final name is always complete on disk, which
+ * is what lets writers skip objects that already exist. Packs, their
+ * indexes and the commit-graph are synced through
+ * loose_store_sync_file() under the same setting.
+ */
+
+#ifndef LOOSE_STORE_H
+#define LOOSE_STORE_H
+
+#include <stddef.h>
+
+#include "object_id.h"
+
+/* Longest temp object name, NUL included */
+#define LOOSE_TEMP_NAME_MAX 64
+
+/*
+ * Creates a new temp file in .git/objects/ for an object whose ID is
+ * not known yet. The handles are opened (and the setting read) on the
+ * first call that finds .git/objects/. Thread-safe.
+ *
+ * @param name       Output: the temp file's name, relative to .git/objects/.
+ * @param name_size  Size of name (LOOSE_TEMP_NAME_MAX is enough).
+ * @return           Open write-only fd, or -1 on failure (name is "").
+ */
+int loose_store_create_temp(char *name, size_t name_size);
+
+/*
+ * Makes a finished temp file the loose object oid: syncs it as
+ * core.fsyncMethod asks, closes fd and renames the file into its
+ * fan-out directory (created on first use) — or, with batch, into the
+ * batch directory until loose_store_flush(). rename() is atomic, so
+ * readers see either no object or the complete one.
+ *
+ * fd is closed in every case; on failure the temp file is removed.
+ *
+ * @param fd         The temp file's fd, from loose_store_create_temp().
+ * @param temp_name  Its name.
+ * @param oid        ID of the object it holds.
+ * @return           0 on success, 1 on failure.
+ */
+int loose_store_install(int fd, const char *temp_name, const ObjectId *oid);
+
+/*
+ * Removes a temp file that will not be installed.
+ *
+ * @param temp_name  Name from loose_store_create_temp(); "" is ignored.
+ */
+void loose_store_discard(const char *temp_name);
+
+/*
+ * @return  1 if a loose file exists for oid, pending in the batch
+ *          directory included; 0 otherwise.
+ */
+int loose_store_exists(const ObjectId *oid);
+
+/*
+ * Builds the path to read the loose object oid from: its final name,
+ * or its place in the batch directory while it waits for the barrier.
+ *
+ * @param oid        Object to locate.
+ * @param path       Output buffer.
+ * @param path_size  Size of path.
+ * @return           0 on success, 1 if path is too small.
+ */
+int loose_store_path(const ObjectId *oid, char *path, size_t path_size);
+
+/*
+ * Syncs a finished pack, pack index or commit-graph before it is
+ * renamed into place: an fsync() with any core.fsyncMethod, batch
+ * included (batching only pays off for many small loose objects), and
+ * nothing when the setting is unset.
+ *
+ * @param fd  The file, still open.
+ * @return    0 on success, 1 if the sync failed (errno is set).
+ */
+int loose_store_sync_file(int fd);
+
+/*
+ * Sync barrier for core.fsyncMethod=batch: returns once every object
+ * installed so far is on stable storage — one syncfs() of the object
+ * store's file system on Linux, sync() elsewhere — then renames them
+ * into place. Does nothing when no object is pending. Called once, at
+ * the end of every command, when no writer is running.
+ *
+ * @return  0 on success, 1 if the barrier or a rename failed.
+ */
+int loose_store_flush(void);
+
+/*
+ * Runs the barrier for pending writes, then closes every handle, so
+ * the next call opens the object store of the current directory.
+ * For processes that move between repositories (the benchmarks);
+ * must not run concurrently with any other loose_store call.
+ */
+void loose_store_reopen(void);
+
+#endif /* LOOSE_STORE_H */
@@ -2,76 +2,178 @@
  * object.c
  *
  * Git object store: read and write pipelines.
- * Read side:  file → decompress → parse header → GitObject
+ * Read side:  pack index lookup (mmap'd) → inflate → GitObject, or
+ *             loose file → inflate header → allocate exact size →
+ *             inflate once → GitObject
  * Write side: format → SHA-1 → compress → write to .git/objects/
+ * Blobs:      file → fixed-size chunks → incremental SHA-1 + deflate →
+ *             temp file → rename to .git/objects/xx/ (bounded memory)
+ * Temp files, renames and loose lookups go through the directory
+ * handles of loose_store.c, which also applies core.fsyncMethod.
+ * Both sides stop right after hashing when the object already exists.
  */
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <openssl/sha.h>
 
 #include "../constants.h"
 #include "../utils/file/file.h"
 #include "../utils/compression/compression.h"
-#include "../utils/string/string.h"
+#include "../utils/hash/hash.h"
+#include "../utils/trace/trace.h"
+#include "../pack/packfile.h"
+#include "../pack/packstore.h"
+#include "loose_store.h"
+#include "promisor.h"
 #include "object.h"
 
-int object_read(const char *sha1, GitObject *out) {
+/* A loose header ("commit 1234567\0") always fits in this much output */
+#define LOOSE_HEADER_MAX 32
+
+/*
+ * Parses "<type> <size>\0" at the start of an inflated loose object.
+ * Sets *type (OBJ_* code), *size and *header_len (bytes before the NUL).
+ * Returns 0 on success, 1 if malformed.
+ */
+static int parse_loose_header(const unsigned char *data, size_t len,
+                              int *type, size_t *size, size_t *header_len) {
+    const unsigned char *nul = memchr(data, '\0', len);
+    const unsigned char *space = nul != NULL ? memchr(data, ' ', (size_t)(nul - data)) : NULL;
+    if (space == NULL || space + 1 == nul) return 1;
+
+    *type = packfile_type_code((const char *)data, (size_t)(space - data));
+    if (*type < 0) return 1;
+
+    size_t value = 0;
+    for (const unsigned char *p = space + 1; p < nul; p++) {
+        if (*p < '0' || *p > '9' || value > (SIZE_MAX - 9) / 10) return 1;
+        value = value * 10 + (size_t)(*p - '0');
+    }
+    *size = value;
+    *header_len = (size_t)(nul - data);
+    return 0;
+}
+
+/*
+ * After a pack miss: in a partial clone, an object that is not loose
+ * either is fetched from the promisor remote (into a new pack).
+ * Returns 1 if it was fetched and the packs should be searched again.
+ */
+static int fetch_promised(const ObjectId *oid) {
+    return promisor_enabled() && !loose_store_exists(oid) && promisor_fetch(oid, 1) == 0;
+}
+
+int object_read(const ObjectId *oid, GitObject *out) {
+    char hex[OID_HEX_SIZE + 1];
+
+    /* Packs first — after a clone nearly every object lives there */
+    int found = packstore_read(oid, out);
+    if (found > 0 && fetch_promised(oid)) found = packstore_read(oid, out);
+    if (found == 0) return 0;
+    if (found < 0) {
+        GIT_ERR("Error reading packed object %s\n", oid_to_hex(oid, hex));
+        return 1;
+    }
+
+    char abs_file[GIT_PATH_MAX];
     long compressed_size;
-    char *compressed = read_git_blob_file(sha1, &compressed_size);
+    char *compressed = loose_store_path(oid, abs_file, sizeof(abs_file)) == 0
+        ? read_file(abs_file, &compressed_size) : NULL;
     if (compressed == NULL) {
-        GIT_ERR("Error reading object %s\n", sha1);
+        GIT_ERR("Error reading object %s\n", oid_to_hex(oid, hex));
         return 1;
     }
 
-    unsigned long raw_size;
-    unsigned char *raw = decompress_data((unsigned char *)compressed, compressed_size, &raw_size);
-    free(compressed);
-    if (raw == NULL) {
-        GIT_ERR("Error decompressing object %s\n", sha1);
+    /* Inflate just the header to learn the size, then the rest exactly once */
+    unsigned char header[LOOSE_HEADER_MAX];
+    size_t header_bytes = decompress_prefix((unsigned char *)compressed, (size_t)compressed_size,
+                                            header, sizeof(header));
+    int type;
+    size_t body_size, header_len;
+    if (parse_loose_header(header, header_bytes, &type, &body_size, &header_len) != 0) {
+        GIT_ERR("Malformed git object header in %s\n", oid_to_hex(oid, hex));
+        free(compressed);
         return 1;
     }
 
-    /* Git objects: "<type> <size>\0<content>" — find the null separator */
-    unsigned char *header_end = memchr(raw, '\0', raw_size);
-    if (header_end == NULL) {
-        GIT_ERR("Malformed git object header in %s\n", sha1);
+    size_t raw_size = header_len + 1 + body_size;
+    unsigned char *raw = malloc(raw_size + 1);
+    if (raw == NULL) {
+        GIT_ERR("Error allocating %zu bytes for object %s\n", raw_size, oid_to_hex(oid, hex));
+        free(compressed);
+        return 1;
+    }
+    int failed = decompress_into((unsigned char *)compressed, (size_t)compressed_size,
+                                 raw, raw_size, NULL);
+    free(compressed);
+    if (failed) {
+        GIT_ERR("Error decompressing object %s\n", oid_to_hex(oid, hex));
         free(raw);
         return 1;
     }
+    raw[raw_size] = '\0';
 
     out->raw = raw;
-    out->body = header_end + 1;
-    out->body_size = (size_t)(raw_size - (unsigned long)(out->body - raw));
+    out->body = raw + header_len + 1;
+    out->body_size = body_size;
     return 0;
 }
 
-char *object_write(const char *object_data, size_t object_size) {
-    char *str_hash = NULL;
-    unsigned char *compressed = NULL;
+int object_read_header(const ObjectId *oid, int *type, size_t *size) {
+    char hex[OID_HEX_SIZE + 1];
 
-    unsigned char raw_hash[SHA_DIGEST_LENGTH];
-    SHA1((unsigned char *)object_data, object_size, raw_hash);
-    str_hash = hex_to_string(raw_hash, SHA_DIGEST_LENGTH);
-    if (str_hash == NULL) {
-        GIT_ERR("Error converting hash to string\n");
-        goto fail;
+    int found = packstore_read_header(oid, type, size);
+    if (found > 0 && fetch_promised(oid)) found = packstore_read_header(oid, type, size);
+    if (found == 0) return 0;
+    if (found < 0) {
+        GIT_ERR("Error reading packed object %s\n", oid_to_hex(oid, hex));
+        return 1;
     }
 
-    char abs_dir[GIT_PATH_MAX];
+    /* Loose: the first compressed block is enough for the header */
     char abs_file[GIT_PATH_MAX];
-    if (object_path(str_hash, abs_dir, sizeof(abs_dir), abs_file, sizeof(abs_file)) != 0) {
-        goto fail;
+    if (loose_store_path(oid, abs_file, sizeof(abs_file)) != 0) return 1;
+    FILE *f = fopen(abs_file, "rb");
+    if (f == NULL) {
+        GIT_ERR("Error reading object %s\n", oid_to_hex(oid, hex));
+        return 1;
     }
+    unsigned char compressed[FILE_BUFFER_SIZE];
+    size_t compressed_size = fread(compressed, 1, sizeof(compressed), f);
+    fclose(f);
 
-    if (mkdir(abs_dir, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) {
-        GIT_ERR("Error creating directory %s\n", abs_dir);
-        goto fail;
+    unsigned char header[LOOSE_HEADER_MAX];
+    size_t header_bytes = decompress_prefix(compressed, compressed_size, header, sizeof(header));
+    size_t header_len;
+    if (parse_loose_header(header, header_bytes, type, size, &header_len) != 0) {
+        GIT_ERR("Malformed git object header in %s\n", oid_to_hex(oid, hex));
+        return 1;
     }
+    return 0;
+}
+
+/* Read size for streaming blobs; memory use is bounded by this */
+#define BLOB_CHUNK (FILE_BUFFER_SIZE * 16)
+
+int object_exists(const ObjectId *oid) {
+    return loose_store_exists(oid) || packstore_contains(oid);
+}
+
+int object_write(const char *object_data, size_t object_size, ObjectId *oid_out) {
+    unsigned char *compressed = NULL;
+    char tmp_name[LOOSE_TEMP_NAME_MAX] = "";
+    char hex[OID_HEX_SIZE + 1];
+
+    HashPart whole = { object_data, object_size };
+    if (hash_parts(HASH_SHA1, &whole, 1, oid_out->hash) != 0) return 1;
+    if (object_exists(oid_out)) return 0;
 
     unsigned long compressed_size;
     compressed = compress_data((unsigned char *)object_data, object_size, &compressed_size);
@@ -80,52 +182,172 @@ char *object_write(const char *object_data, size_t object_size) {
         goto fail;
     }
 
-    if (write_file(abs_file, (const char *)compressed, compressed_size, "wb") == 1) {
-        GIT_ERR("Error writing object %s\n", str_hash);
+    int fd = loose_store_create_temp(tmp_name, sizeof(tmp_name));
+    if (fd < 0) goto fail;
+    if (write_all(fd, compressed, compressed_size) != 0) {
+        GIT_ERR("Error writing object %s: %s\n", oid_to_hex(oid_out, hex), strerror(errno));
+        close(fd);
         goto fail;
     }
+    /* The temp file is gone after this, installed or not */
+    int failed = loose_store_install(fd, tmp_name, oid_out);
+    tmp_name[0] = '\0';
+    if (failed) goto fail;
 
     free(compressed);
-    return str_hash;
+    return 0;
 
 fail:
-    free(str_hash);
+    loose_store_discard(tmp_name);
     free(compressed);
-    return NULL;
+    return 1;
+}
+
+/* The "<type> <size>\0" header and the body, as two hash/deflate pieces */
+static void object_parts(const char *type, const unsigned char *body, size_t body_size,
+                         char *header, size_t header_size, HashPart parts[2]) {
+    int header_len = snprintf(header, header_size, "%s %zu", type, body_size);
+    parts[0] = (HashPart){ header, (size_t)header_len + 1 };
+    parts[1] = (HashPart){ body, body_size };
+}
+
+int object_hash(const char *type, const unsigned char *body, size_t body_size,
+                ObjectId *oid_out) {
+    char header[LOOSE_HEADER_MAX];
+    HashPart parts[2];
+    object_parts(type, body, body_size, header, sizeof(header), parts);
+    return hash_parts(HASH_SHA1, parts, 2, oid_out->hash);
+}
+
+int object_write_body(const char *type, const unsigned char *body, size_t body_size,
+                      ObjectId *oid_out) {
+    char header[LOOSE_HEADER_MAX];
+    HashPart parts[2];
+    object_parts(type, body, body_size, header, sizeof(header), parts);
+    if (hash_parts(HASH_SHA1, parts, 2, oid_out->hash) != 0) return 1;
+    if (object_exists(oid_out)) return 0;
+
+    int result = 1;
+    CompressStream *cs = NULL;
+    char tmp_name[LOOSE_TEMP_NAME_MAX] = "";
+    int fd = loose_store_create_temp(tmp_name, sizeof(tmp_name));
+    if (fd < 0) goto cleanup;
+    cs = compress_stream_new(fd);
+    if (cs == NULL) goto cleanup;
+    for (size_t i = 0; i < 2; i++) {
+        if (compress_stream_write(cs, parts[i].data, parts[i].len) != 0) goto cleanup;
+    }
+    if (compress_stream_finish(cs) != 0) goto cleanup;
+
+    /* install closes fd and removes the temp file if it fails */
+    result = loose_store_install(fd, tmp_name, oid_out);
+    fd = -1;
+    tmp_name[0] = '\0';
+
+cleanup:
+    if (fd >= 0) close(fd);
+    loose_store_discard(tmp_name);
+    compress_stream_free(cs);
+    return result;
+}
+
+/*
+ * Feeds size bytes of fd through the blob hash and, when cs is not
+ * NULL, through deflate. Returns 0 on success, 1 on a short read or
+ * compression failure.
+ */
+static int stream_blob(int fd, const char *path, unsigned long long size,
+                       unsigned char *chunk, HashCtx *hash, CompressStream *cs) {
+    while (size > 0) {
+        ssize_t n = read(fd, chunk, size < BLOB_CHUNK ? (size_t)size : BLOB_CHUNK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            /* Shrank while we were reading — the header would lie */
+            GIT_ERR("Error reading file %s\n", path);
+            return 1;
+        }
+        hash_update(hash, chunk, (size_t)n);
+        if (cs != NULL && compress_stream_write(cs, chunk, (size_t)n) != 0) return 1;
+        size -= (unsigned long long)n;
+    }
+    return 0;
 }
 
-char *create_blob(const char *path) {
-    long file_size;
-    char *file_content = read_file(path, &file_size);
-    if (file_content == NULL) {
+/*
+ * Hashes the blob for fd: header first, then the content. When cs is
+ * given, the same bytes are deflated into it. Writes the digest to
+ * raw_hash. Returns 0 on success, 1 on failure.
+ */
+static int hash_blob(int fd, const char *path, unsigned long long size, unsigned char *chunk,
+                     CompressStream *cs, unsigned char *raw_hash) {
+    /* Git blob format: "blob <size>\0<content>" — the size comes from stat */
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "blob %llu", size);
+
+    HashCtx *hash = hash_ctx_new(HASH_SHA1);
+    if (hash == NULL) return 1;
+
+    /* The header and its NUL are hashed and compressed like content */
+    hash_update(hash, header, (size_t)header_len + 1);
+    int failed = (cs != NULL &&
+                  compress_stream_write(cs, (const unsigned char *)header, (size_t)header_len + 1) != 0) ||
+                 stream_blob(fd, path, size, chunk, hash, cs) != 0 ||
+                 (cs != NULL && compress_stream_finish(cs) != 0);
+    hash_final(hash, raw_hash);
+    hash_ctx_free(hash);
+    return failed;
+}
+
+int create_blob(const char *path, ObjectId *oid_out) {
+    int result = 1;
+    CompressStream *cs = NULL;
+    unsigned char *chunk = NULL;
+    char tmp_name[LOOSE_TEMP_NAME_MAX] = "";
+    int tmp_fd = -1;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
         GIT_ERR("Error reading file %s\n", path);
-        return NULL;
-    }
-
-    /* snprintf(NULL, 0, ...) safely calculates the header length
-     * before allocating, avoiding any fixed-size buffer guesses. */
-    int header_len_int = snprintf(NULL, 0, "blob %ld", file_size);
-    if (header_len_int < 0) {
-        GIT_ERR("Error formatting blob header\n");
-        free(file_content);
-        return NULL;
-    }
-    size_t header_len = (size_t)header_len_int;
-    size_t total_size = header_len + 1 + file_size;
-    char *blob_data = malloc(total_size);
-    if (blob_data == NULL) {
-        GIT_ERR("Error allocating memory for blob data\n");
-        free(file_content);
-        return NULL;
-    }
-
-    /* Git blob format: "blob <size>\0<content>" */
-    snprintf(blob_data, header_len + 1, "blob %ld", file_size);
-    blob_data[header_len] = '\0';
-    memcpy(blob_data + header_len + 1, file_content, file_size);
-    free(file_content);
-
-    char *sha_hex = object_write(blob_data, total_size);
-    free(blob_data);
-    return sha_hex;
+        goto cleanup;
+    }
+    unsigned long long size = (unsigned long long)st.st_size;
+
+    chunk = malloc(BLOB_CHUNK);
+    if (chunk == NULL) {
+        GIT_ERR("Error allocating blob stream\n");
+        goto cleanup;
+    }
+
+    /* Pass 1: hash only — an unchanged file costs no deflate or write */
+    if (hash_blob(fd, path, size, chunk, NULL, oid_out->hash) != 0) goto cleanup;
+    if (object_exists(oid_out)) {
+        result = 0;
+        goto cleanup;
+    }
+
+    /* Pass 2: new object — re-read, deflate to a temp file, rename */
+    tmp_fd = loose_store_create_temp(tmp_name, sizeof(tmp_name));
+    if (tmp_fd < 0 || lseek(fd, 0, SEEK_SET) != 0) goto cleanup;
+    cs = compress_stream_new(tmp_fd);
+    if (cs == NULL) goto cleanup;
+
+    ObjectId check;
+    if (hash_blob(fd, path, size, chunk, cs, check.hash) != 0) goto cleanup;
+    if (!oid_equal(&check, oid_out)) {
+        GIT_ERR("Error: %s changed while it was being hashed\n", path);
+        goto cleanup;
+    }
+    /* install closes tmp_fd and removes the temp file if it fails */
+    result = loose_store_install(tmp_fd, tmp_name, oid_out);
+    tmp_fd = -1;
+    tmp_name[0] = '\0';
+
+cleanup:
+    if (fd >= 0) close(fd);
+    if (tmp_fd >= 0) close(tmp_fd);
+    loose_store_discard(tmp_name);
+    compress_stream_free(cs);
+    free(chunk);
+    return result;
 }
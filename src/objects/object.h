@@ -11,6 +11,8 @@
 
 #include <stddef.h>
 
+#include "object_id.h"
+
 /* Parsed git object — body points into raw, so only raw needs freeing. */
 typedef struct {
     unsigned char *body;       /* object content (past the header + \0) */
@@ -19,39 +21,107 @@ typedef struct {
 } GitObject;
 
 /*
- * Reads, decompresses, and parses a git object by SHA-1 hash.
+ * Reads, decompresses, and parses a git object by ID.
+ *
+ * Looks in the local packs first (see packstore.h), then falls back
+ * to the loose object file, whose header is inflated first so the
+ * body can be allocated at its exact size and inflated in one pass.
+ * In a partial clone, an object found in neither is first fetched
+ * from the promisor remote (see promisor.h).
  *
  * On success, populates *out: body points to the content after the
  * "type size\0" header, body_size is the content length, and raw
  * holds the full decompressed buffer. Caller must free(out->raw).
  *
- * @param sha1  40-character hex SHA-1 identifying the object.
- * @param out   Output struct populated on success.
+ * @param oid  Object to read.
+ * @param out  Output struct populated on success.
+ * @return     0 on success, 1 on failure.
+ */
+int object_read(const ObjectId *oid, GitObject *out);
+
+/*
+ * Reads only an object's type and size.
+ *
+ * Packed objects are answered from the pack entry headers (a delta
+ * inflates only its first bytes); loose objects inflate just the
+ * "type size" header. No body is allocated.
+ *
+ * @param oid   Object to look up.
+ * @param type  Output: type code (OBJ_COMMIT..OBJ_TAG, see packfile.h).
+ * @param size  Output: body size in bytes.
  * @return      0 on success, 1 on failure.
  */
-int object_read(const char *sha1, GitObject *out);
+int object_read_header(const ObjectId *oid, int *type, size_t *size);
+
+/*
+ * Checks whether an object is already stored, loose or packed.
+ * Writers call this right after hashing: an existing object is
+ * immutable, so there is nothing to compress or write.
+ *
+ * @return  1 if present, 0 otherwise (never fetches).
+ */
+int object_exists(const ObjectId *oid);
 
 /*
  * Writes a complete git object to .git/objects/.
  *
  * Takes already-formatted object data (e.g. "blob 12\0..." or "tree 95\0..."),
  * computes SHA-1, compresses with zlib, and writes to the object store.
+ * If the object already exists (loose or packed) it returns right after
+ * hashing, without compressing or writing. New objects are written to a
+ * temp file and renamed into place, so a crash never leaves a torn one.
  *
  * @param object_data  Formatted git object (header + \0 + content).
  * @param object_size  Total byte count of object_data.
- * @return             Heap-allocated 40-char hex hash (caller must free), or NULL.
+ * @param oid_out      Output: the object's ID.
+ * @return             0 on success, 1 on failure.
+ */
+int object_write(const char *object_data, size_t object_size, ObjectId *oid_out);
+
+/*
+ * Writes an object given as its type and body.
+ *
+ * Same result as object_write() of "<type> <size>\0<body>", but the
+ * header and body are hashed and compressed as separate pieces, so
+ * callers holding a bare body (e.g. a pack entry) never copy it into
+ * a formatted buffer.
+ *
+ * @param type       Object type string ("blob", "tree", "commit", "tag").
+ * @param body       Object content.
+ * @param body_size  Byte count of body.
+ * @param oid_out    Output: the object's ID.
+ * @return           0 on success, 1 on failure.
+ */
+int object_write_body(const char *type, const unsigned char *body, size_t body_size,
+                      ObjectId *oid_out);
+
+/*
+ * Computes an object's ID without storing it.
+ *
+ * @param type       Object type string ("blob", "tree", "commit", "tag").
+ * @param body       Object content.
+ * @param body_size  Byte count of body.
+ * @param oid_out    Output: the object's ID.
+ * @return           0 on success, 1 on failure.
  */
-char *object_write(const char *object_data, size_t object_size);
+int object_hash(const char *type, const unsigned char *body, size_t body_size,
+                ObjectId *oid_out);
 
 /*
  * Creates a blob object for a file and writes it to the object store.
  *
- * Reads the file, wraps it in "blob <size>\0<content>" format,
- * and calls object_write. Used by both hash-object and write-tree.
+ * Streams the file in fixed-size chunks through SHA-1 and deflate
+ * into a temp file under .git/objects/, then renames it into place,
+ * so memory use stays constant however large the file is. The stored
+ * object is identical to object_write() of "blob <size>\0<content>".
+ * The file is hashed first; only if the blob is new is it read again
+ * and compressed, so re-hashing unchanged files costs no writes.
+ * Used by both hash-object and write-tree.
  *
- * @param path  Path to the file.
- * @return      Heap-allocated 40-char hex hash (caller must free), or NULL.
+ * @param path     Path to the file.
+ * @param oid_out  Output: the blob's ID.
+ * @return         0 on success, 1 on failure.
  */
-char *create_blob(const char *path);
+int create_blob(const char *path, ObjectId *oid_out);
 
 #endif /* OBJECT_H */
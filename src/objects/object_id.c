@@ -0,0 +1,28 @@
+/*
+ * object_id.c
+ *
+ * Conversions between ObjectId and its hex spelling.
+ */
+
+#include <string.h>
+
+#include "../constants.h"
+#include "../utils/string/string.h"
+#include "object_id.h"
+
+int oid_from_hex(const char *hex, ObjectId *oid) {
+    return hex_decode(hex, OID_RAW_SIZE, oid->hash);
+}
+
+int oid_parse(const char *arg, ObjectId *oid) {
+    if (strlen(arg) != OID_HEX_SIZE || oid_from_hex(arg, oid) != 0) {
+        GIT_ERR("Not a valid object name: %s\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+char *oid_to_hex(const ObjectId *oid, char *hex) {
+    hex_encode(oid->hash, OID_RAW_SIZE, hex);
+    return hex;
+}
@@ -0,0 +1,54 @@
+/*
+ * object_id.h
+ *
+ * Fixed-size binary object name. Object IDs are passed around as
+ * 20 raw bytes by value or pointer; hex only appears at the edges
+ * (command-line arguments, printed output, loose object paths and
+ * the wire protocol).
+ */
+
+#ifndef OBJECT_ID_H
+#define OBJECT_ID_H
+
+#include <string.h>
+
+#define OID_RAW_SIZE 20
+#define OID_HEX_SIZE 40
+
+typedef struct ObjectId {
+    unsigned char hash[OID_RAW_SIZE];
+} ObjectId;
+
+/*
+ * Parses the first OID_HEX_SIZE characters of hex into *oid.
+ * The input need not be NUL-terminated (e.g. "tree <sha>\n").
+ *
+ * @return  0 on success, 1 if any of the characters is not hex.
+ */
+int oid_from_hex(const char *hex, ObjectId *oid);
+
+/*
+ * Parses a command-line object name: exactly OID_HEX_SIZE hex
+ * characters. Reports malformed input on stderr.
+ *
+ * @return  0 on success, 1 on malformed input.
+ */
+int oid_parse(const char *arg, ObjectId *oid);
+
+/*
+ * Formats *oid as lowercase hex.
+ *
+ * @param hex  Output buffer of at least OID_HEX_SIZE + 1 bytes.
+ * @return     hex, for use directly in printf-style calls.
+ */
+char *oid_to_hex(const ObjectId *oid, char *hex);
+
+static inline int oid_cmp(const ObjectId *a, const ObjectId *b) {
+    return memcmp(a->hash, b->hash, OID_RAW_SIZE);
+}
+
+static inline int oid_equal(const ObjectId *a, const ObjectId *b) {
+    return oid_cmp(a, b) == 0;
+}
+
+#endif /* OBJECT_ID_H */
@@ -0,0 +1,154 @@
+/*
+ * object_writer.c
+ *
+ * Each submission becomes one thread pool task running the ordinary
+ * synchronous object_write(). Completion is published under a single
+ * writer-wide mutex; waiters sleep on one condition variable and
+ * re-check their own handle, which keeps handles small (no per-object
+ * locks) at the cost of spurious wakeups that are cheap next to a
+ * deflate. The same condition variable throttles submitters once
+ * MAX_QUEUED_BYTES of object data is waiting for a worker.
+ */
+
+#include <pthread.h>
+
+#include <stdlib.h>
+
+#include "../constants.h"
+#include "../utils/thread/thread_pool.h"
+#include "object.h"
+#include "object_writer.h"
+
+/* Object data queued but not yet written, before submitters block */
+#define MAX_QUEUED_BYTES (64u << 20)
+
+struct ObjectWriteHandle {
+    ObjectWriter *writer;
+    char *data;                 /* freed by the worker */
+    size_t size;
+    ObjectId oid;               /* result, valid unless failed */
+    int failed;
+    int done;
+    struct ObjectWriteHandle *next;
+};
+
+struct ObjectWriter {
+    ThreadPool *pool;
+    pthread_mutex_t lock;
+    pthread_cond_t completed;
+    ObjectWriteHandle *handles; /* every handle, for object_writer_free() */
+    size_t queued_bytes;        /* data of submitted writes not yet done */
+    int failed;                 /* any write (or submission) failed */
+};
+
+static void write_task(void *arg) {
+    ObjectWriteHandle *h = arg;
+    ObjectId oid;
+    int failed = object_write(h->data, h->size, &oid);
+    free(h->data);
+    h->data = NULL;
+
+    ObjectWriter *w = h->writer;
+    pthread_mutex_lock(&w->lock);
+    h->oid = oid;
+    h->failed = failed;
+    h->done = 1;
+    w->queued_bytes -= h->size;
+    if (failed) w->failed = 1;
+    pthread_cond_broadcast(&w->completed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+ObjectWriter *object_writer_new(int threads) {
+    ObjectWriter *w = calloc(1, sizeof(ObjectWriter));
+    if (w == NULL) {
+        GIT_ERR("object_writer: malloc failed\n");
+        return NULL;
+    }
+    w->pool = thread_pool_new(threads);
+    if (w->pool == NULL) {
+        free(w);
+        return NULL;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->completed, NULL);
+    return w;
+}
+
+ObjectWriteHandle *object_writer_submit(ObjectWriter *writer, char *object_data,
+                                        size_t object_size) {
+    ObjectWriteHandle *h = calloc(1, sizeof(ObjectWriteHandle));
+    if (h == NULL) {
+        GIT_ERR("object_writer: malloc failed for handle\n");
+        goto fail;
+    }
+    h->writer = writer;
+    h->data = object_data;
+    h->size = object_size;
+
+    pthread_mutex_lock(&writer->lock);
+    /* A single object larger than the limit still goes through, alone */
+    while (writer->queued_bytes > 0 && writer->queued_bytes + object_size > MAX_QUEUED_BYTES) {
+        pthread_cond_wait(&writer->completed, &writer->lock);
+    }
+    writer->queued_bytes += object_size;
+    h->next = writer->handles;
+    writer->handles = h;
+    pthread_mutex_unlock(&writer->lock);
+
+    if (thread_pool_submit(writer->pool, write_task, h) != 0) {
+        /* The handle stays listed (and is freed with the writer) */
+        free(object_data);
+        h->data = NULL;
+        pthread_mutex_lock(&writer->lock);
+        writer->queued_bytes -= object_size;
+        h->failed = 1;
+        h->done = 1;
+        writer->failed = 1;
+        pthread_mutex_unlock(&writer->lock);
+        return NULL;
+    }
+    return h;
+
+fail:
+    free(object_data);
+    pthread_mutex_lock(&writer->lock);
+    writer->failed = 1;
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+int object_writer_wait(ObjectWriteHandle *handle, ObjectId *oid_out) {
+    ObjectWriter *w = handle->writer;
+    pthread_mutex_lock(&w->lock);
+    while (!handle->done) pthread_cond_wait(&w->completed, &w->lock);
+    int failed = handle->failed;
+    if (!failed) *oid_out = handle->oid;
+    pthread_mutex_unlock(&w->lock);
+    return failed;
+}
+
+int object_writer_flush(ObjectWriter *writer) {
+    thread_pool_wait(writer->pool);
+
+    pthread_mutex_lock(&writer->lock);
+    int failed = writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+    return failed;
+}
+
+void object_writer_free(ObjectWriter *writer) {
+    if (writer == NULL) return;
+
+    thread_pool_free(writer->pool); /* waits for queued writes */
+    ObjectWriteHandle *h = writer->handles;
+    while (h != NULL) {
+        ObjectWriteHandle *next = h->next;
+        free(h->data);
+        free(h);
+        h = next;
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->completed);
+    free(writer);
+}
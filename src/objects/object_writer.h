@@ -0,0 +1,84 @@
+/*
+ * object_writer.h
+ *
+ * Asynchronous counterpart to object_write(): formatted objects are
+ * queued and a pool of workers hashes, compresses and writes them to
+ * .git/objects/ in parallel. Each submission returns a handle that
+ * resolves to the object's ID once its worker is done.
+ *
+ * Typical use:
+ *   ObjectWriter *w = object_writer_new(0);
+ *   ObjectWriteHandle *h = object_writer_submit(w, data, size);
+ *   ...submit more...
+ *   ObjectId oid;
+ *   object_writer_wait(h, &oid);           // blocks for this object only
+ *   if (object_writer_flush(w) != 0) ...   // every write landed?
+ *   object_writer_free(w);
+ */
+
+#ifndef OBJECT_WRITER_H
+#define OBJECT_WRITER_H
+
+#include <stddef.h>
+
+#include "object_id.h"
+
+typedef struct ObjectWriter ObjectWriter;
+
+/* Future for one queued write; owned by its ObjectWriter. */
+typedef struct ObjectWriteHandle ObjectWriteHandle;
+
+/*
+ * Starts a writer.
+ *
+ * @param threads  Worker count; 0 uses every online CPU. With 1 every
+ *                 object is written inline by object_writer_submit().
+ * @return         Heap-allocated writer (release with object_writer_free()),
+ *                 or NULL on failure.
+ */
+ObjectWriter *object_writer_new(int threads);
+
+/*
+ * Queues a complete git object for writing.
+ *
+ * Takes the same formatted data as object_write() ("blob 12\0...").
+ * Ownership of object_data passes to the writer, which frees it once
+ * the object is on disk — also when submission fails. Blocks while
+ * the workers are too far behind (64 MiB of data queued), so a fast
+ * producer cannot buffer a whole pack in memory.
+ *
+ * @param writer       Writer from object_writer_new().
+ * @param object_data  Heap-allocated formatted object.
+ * @param object_size  Total byte count of object_data.
+ * @return             Handle for the result, or NULL on allocation failure.
+ */
+ObjectWriteHandle *object_writer_submit(ObjectWriter *writer, char *object_data,
+                                        size_t object_size);
+
+/*
+ * Blocks until the handle's object has been written.
+ *
+ * May be called more than once; the handle itself stays valid until
+ * object_writer_free().
+ *
+ * @param handle   Handle from object_writer_submit().
+ * @param oid_out  Output: the object's ID, set on success.
+ * @return         0 on success, 1 if the write failed.
+ */
+int object_writer_wait(ObjectWriteHandle *handle, ObjectId *oid_out);
+
+/*
+ * Waits for every object submitted so far.
+ *
+ * @param writer  Writer from object_writer_new().
+ * @return        0 if all writes succeeded, 1 if any failed.
+ */
+int object_writer_flush(ObjectWriter *writer);
+
+/*
+ * Waits for outstanding writes, then frees the writer and all of its
+ * handles. Accepts NULL.
+ */
+void object_writer_free(ObjectWriter *writer);
+
+#endif /* OBJECT_WRITER_H */
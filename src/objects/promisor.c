@@ -0,0 +1,158 @@
+/*
+ * promisor.c
+ *
+ * Missing objects are requested with a protocol v2 fetch: one want
+ * per object, no filter, at most PROMISOR_BATCH wants per request.
+ * The response goes through the same stream as clone's pack —
+ * side-band demux → pack parser → pack + .idx — so fetched objects
+ * are never written loose.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../net/http.h"
+#include "../net/pktline.h"
+#include "../pack/packfile.h"
+#include "../pack/packstore.h"
+#include "../utils/config/config.h"
+#include "../utils/file/file.h"
+#include "../utils/string/string.h"
+#include "object.h"
+#include "promisor.h"
+
+/* Wants per fetch request; keeps each request body around 200 KiB */
+#define PROMISOR_BATCH 4096
+
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static char promisor_url[GIT_PATH_MAX];
+static int promisor_configured;
+
+/* Serializes fetches, so concurrent misses do not double-fetch */
+static pthread_mutex_t fetch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void load_config(void) {
+    promisor_configured = config_get_bool("remote." PROMISOR_REMOTE ".promisor") &&
+                          config_get("remote." PROMISOR_REMOTE ".url", promisor_url,
+                                     sizeof(promisor_url)) == 0;
+}
+
+int promisor_enabled(void) {
+    pthread_once(&config_once, load_config);
+    return promisor_configured;
+}
+
+int promisor_mark_pack(const unsigned char *checksum) {
+    char hex[OID_HEX_SIZE + 1];
+    hex_encode(checksum, OID_RAW_SIZE, hex);
+    char path[GIT_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/pack-%s.promisor", GIT_PACK_DIR, hex);
+    return write_file(path, "", 0, "wb");
+}
+
+/* HTTP sink: feeds response bytes into the side-band demultiplexer. */
+static int demux_sink(const unsigned char *data, size_t len, void *ctx) {
+    return pktline_demux_feed((PktlineDemux *)ctx, data, len);
+}
+
+/* Demux sink: feeds raw packfile bytes into the pack parser. */
+static int pack_sink(const unsigned char *data, size_t len, void *ctx) {
+    return packfile_stream_feed((PackStream *)ctx, data, len);
+}
+
+/* One v2 fetch for a batch of wants; installs and marks the pack. */
+static int fetch_batch(HttpSession *http, const ObjectId *wants, size_t count) {
+    char *request = NULL;
+    size_t request_len;
+    PackStream *pack = NULL;
+    int result = 1;
+
+    const char *args[] = { "ofs-delta", "no-progress" };
+    size_t arg_count = isatty(STDERR_FILENO) ? 1 : 2;
+    if (pktline_build_fetch(wants, count, args, arg_count, NULL, &request, &request_len) != 0)
+        goto cleanup;
+
+    pack = packfile_stream_new(PACK_MODE_INDEX);
+    if (pack == NULL) goto cleanup;
+    PktlineDemux demux;
+    pktline_demux_init(&demux, pack_sink, pack);
+    PktlineMessageLog messages = {0};
+    pktline_demux_set_message_handler(&demux, pktline_print_message, &messages);
+
+    if (http_post_pack(http, request, request_len, demux_sink, &demux) != 0) goto cleanup;
+    if (pktline_demux_finish(&demux) != 0) goto cleanup;
+    if (packfile_stream_finish(pack) != 0) goto cleanup;
+    if (promisor_mark_pack(packfile_stream_checksum(pack)) != 0) goto cleanup;
+    result = 0;
+
+cleanup:
+    free(request);
+    packfile_stream_free(pack);
+    return result;
+}
+
+/* Opens a v2 session to the promisor remote. */
+static HttpSession *open_remote(void) {
+    HttpSession *http = http_session_new(promisor_url);
+    if (http == NULL) return NULL;
+    http_session_set_protocol(http, 2);
+
+    HttpResponse caps;
+    if (http_get_refs(http, &caps) != 0) goto fail;
+    int usable = pktline_is_v2(caps.data, caps.size) &&
+                 pktline_v2_has_capability(caps.data, caps.size, "fetch");
+    http_response_free(&caps);
+    if (!usable) {
+        GIT_ERR("promisor: %s does not offer a protocol v2 fetch\n", promisor_url);
+        goto fail;
+    }
+    return http;
+
+fail:
+    http_session_free(http);
+    return NULL;
+}
+
+int promisor_fetch(const ObjectId *oids, size_t count) {
+    if (!promisor_enabled()) return 1;
+
+    pthread_mutex_lock(&fetch_lock);
+    int result = 1;
+    HttpSession *http = NULL;
+    ObjectId *missing = malloc((count > 0 ? count : 1) * sizeof(ObjectId));
+    if (missing == NULL) {
+        GIT_ERR("promisor: malloc failed\n");
+        goto cleanup;
+    }
+
+    /* Another thread may have fetched some of these while we waited */
+    size_t missing_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!object_exists(&oids[i])) missing[missing_count++] = oids[i];
+    }
+    if (missing_count == 0) {
+        result = 0;
+        goto cleanup;
+    }
+
+    http = open_remote();
+    if (http == NULL) goto cleanup;
+    for (size_t done = 0; done < missing_count; done += PROMISOR_BATCH) {
+        size_t batch = missing_count - done < PROMISOR_BATCH ? missing_count - done : PROMISOR_BATCH;
+        if (fetch_batch(http, missing + done, batch) != 0) goto cleanup;
+        packstore_reprepare();
+    }
+    result = 0;
+
+cleanup:
+    if (result != 0) GIT_ERR("promisor: could not fetch missing objects\n");
+    http_session_free(http);
+    free(missing);
+    pthread_mutex_unlock(&fetch_lock);
+    return result;
+}
@@ -0,0 +1,53 @@
+/*
+ * promisor.h
+ *
+ * Lazy object fetching for partial clones.
+ *
+ * A clone made with --filter leaves objects (usually blobs) out and
+ * records its remote as a promisor in .git/config:
+ *     [remote "origin"]  url = ..., promisor = true
+ * The packs received from it carry a pack-<checksum>.promisor marker,
+ * as git expects. When an object is missing locally, it is fetched
+ * from the promisor remote on demand and stored as one more pack.
+ */
+
+#ifndef PROMISOR_H
+#define PROMISOR_H
+
+#include <stddef.h>
+
+#include "object_id.h"
+
+/* Name of the remote a partial clone fetches missing objects from */
+#define PROMISOR_REMOTE "origin"
+
+/*
+ * Checks whether this repository has a promisor remote. Read from
+ * .git/config on the first call.
+ *
+ * @return  1 if missing objects can be fetched, 0 otherwise.
+ */
+int promisor_enabled(void);
+
+/*
+ * Fetches every object in oids that is not present locally, in as
+ * few requests as possible, and makes the new packs visible to
+ * object_read(). Thread-safe; concurrent callers are serialized.
+ *
+ * @param oids   Objects that are needed (present ones are skipped).
+ * @param count  Number of oids.
+ * @return       0 if all missing objects were fetched (or none were
+ *               missing), 1 on failure.
+ */
+int promisor_fetch(const ObjectId *oids, size_t count);
+
+/*
+ * Marks an installed pack as coming from the promisor remote, by
+ * creating .git/objects/pack/pack-<checksum>.promisor.
+ *
+ * @param checksum  The pack's 20-byte trailing checksum.
+ * @return          0 on success, 1 on failure.
+ */
+int promisor_mark_pack(const unsigned char *checksum);
+
+#endif /* PROMISOR_H */
@@ -0,0 +1,106 @@
+/*
+ * bundle.c
+ *
+ * Unbundling: the header is checked line by line, and the pack that
+ * follows it goes through the same indexer as a fetched pack, so a
+ * bundle ends up as one more pack-<checksum>.pack / .idx pair.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../objects/object.h"
+#include "bundle.h"
+#include "packfile.h"
+
+/*
+ * Returns the next header line (without its LF) and advances *pos,
+ * or NULL if data ends before the line does.
+ */
+static const char *next_line(const unsigned char *data, size_t len, size_t *pos, size_t *line_len) {
+    const unsigned char *start = data + *pos;
+    const unsigned char *lf = memchr(start, '\n', len - *pos);
+    if (lf == NULL) return NULL;
+    *line_len = (size_t)(lf - start);
+    *pos += *line_len + 1;
+    return (const char *)start;
+}
+
+/* Parses the 40-hex object ID a header line starts with. */
+static int line_oid(const char *line, size_t line_len, ObjectId *oid) {
+    if (line_len < OID_HEX_SIZE || (line_len > OID_HEX_SIZE && line[OID_HEX_SIZE] != ' ')) return 1;
+    return oid_from_hex(line, oid);
+}
+
+/* v3 capabilities: only the default object format is understood. */
+static int check_capability(const char *line, size_t line_len) {
+    if (line_len == 18 && memcmp(line, "object-format=sha1", 18) == 0) return 0;
+    GIT_ERR("bundle: unsupported capability @%.*s\n", (int)line_len, line);
+    return 1;
+}
+
+int bundle_unbundle(const unsigned char *data, size_t len, int threads,
+                    ObjectId **tips, size_t *tip_count) {
+    *tips = NULL;
+    *tip_count = 0;
+    size_t pos = 0, line_len;
+    const char *line = next_line(data, len, &pos, &line_len);
+    int v3 = line != NULL && line_len == 15 && memcmp(line, "# v3 git bundle", 15) == 0;
+    if (line == NULL || (!v3 && (line_len != 15 || memcmp(line, "# v2 git bundle", 15) != 0))) {
+        GIT_ERR("bundle: not a v2 or v3 git bundle\n");
+        return 1;
+    }
+
+    ObjectId *list = NULL;
+    size_t count = 0, capacity = 0;
+    int result = 1;
+    while ((line = next_line(data, len, &pos, &line_len)) != NULL && line_len > 0) {
+        if (v3 && line[0] == '@') {
+            if (check_capability(line + 1, line_len - 1) != 0) goto cleanup;
+            continue;
+        }
+
+        ObjectId oid;
+        int prerequisite = line[0] == '-';
+        if (line_oid(line + prerequisite, line_len - (size_t)prerequisite, &oid) != 0) {
+            GIT_ERR("bundle: malformed header line '%.*s'\n", (int)line_len, line);
+            goto cleanup;
+        }
+        if (prerequisite) {
+            if (!object_exists(&oid)) {
+                result = -1;
+                goto cleanup;
+            }
+            continue;
+        }
+
+        if (count == capacity) {
+            size_t new_capacity = capacity == 0 ? 16 : capacity * 2;
+            ObjectId *grown = realloc(list, new_capacity * sizeof(ObjectId));
+            if (grown == NULL) {
+                GIT_ERR("bundle: malloc failed\n");
+                goto cleanup;
+            }
+            list = grown;
+            capacity = new_capacity;
+        }
+        list[count++] = oid;
+    }
+    if (line == NULL) {
+        GIT_ERR("bundle: header is not terminated\n");
+        goto cleanup;
+    }
+
+    unsigned char checksum[OID_RAW_SIZE];
+    if (packfile_index_buffer(data + pos, len - pos, threads, checksum) != 0) goto cleanup;
+    *tips = list;
+    *tip_count = count;
+    list = NULL;
+    result = 0;
+
+cleanup:
+    free(list);
+    return result;
+}
@@ -0,0 +1,38 @@
+/*
+ * bundle.h
+ *
+ * Reader for git bundle files (v2 and v3): a text header naming the
+ * commits the bundle needs ("prerequisites") and the refs it carries,
+ * a blank line, then a packfile.
+ *
+ *   # v2 git bundle
+ *   -<sha> <comment>        ← prerequisite (optional, any number)
+ *   <sha> refs/heads/main   ← ref tip (any number)
+ *   <blank line>
+ *   PACK...
+ */
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+
+#include "../objects/object_id.h"
+
+/*
+ * Installs a bundle's pack in .git/objects/pack/ (with its .idx), after
+ * checking that every prerequisite is already in the object store.
+ *
+ * @param data       The whole bundle file, typically mmap'd.
+ * @param len        Byte count of data.
+ * @param threads    Delta resolution workers; 0 = every online CPU.
+ * @param tips       Output: heap-allocated ref tips (caller frees), or
+ *                   NULL if the bundle carries none.
+ * @param tip_count  Output: number of tips.
+ * @return           0 on success, 1 on failure, -1 if a prerequisite
+ *                   is missing (nothing was installed).
+ */
+int bundle_unbundle(const unsigned char *data, size_t len, int threads,
+                    ObjectId **tips, size_t *tip_count);
+
+#endif /* BUNDLE_H */
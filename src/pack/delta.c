@@ -0,0 +1,337 @@
+/*
+ * delta.c
+ *
+ * Git's delta encoding: a compact instruction stream that rebuilds a
+ * target object from a base object using COPY and INSERT commands.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "delta.h"
+
+size_t read_var_int(const unsigned char *data, size_t len, size_t *pos) {
+    size_t value = 0;
+    int shift = 0;
+    while (*pos < len) {
+        unsigned char byte = data[(*pos)++];
+        value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+        shift += 7;
+    }
+    return value;
+}
+
+/*
+ * Reads the source/target sizes at the start of a delta, checking the
+ * source size against the base. Leaves *pos at the first instruction.
+ * Returns 0 on success, 1 on a mismatch.
+ */
+static int read_sizes(const unsigned char *delta, size_t delta_len, size_t base_len,
+                      size_t *pos, size_t *tgt_size) {
+    *pos = 0;
+    size_t src_size = read_var_int(delta, delta_len, pos);
+    *tgt_size = read_var_int(delta, delta_len, pos);
+    if (src_size != base_len) {
+        GIT_ERR("delta: base is %zu bytes, delta expects %zu\n", base_len, src_size);
+        return 1;
+    }
+    return 0;
+}
+
+/* Runs the instructions from pos on into result (tgt_size bytes). */
+static int run_instructions(const unsigned char *base, size_t base_len,
+                            const unsigned char *delta, size_t delta_len, size_t pos,
+                            unsigned char *result, size_t tgt_size) {
+    size_t rpos = 0; /* write position in result */
+
+    while (pos < delta_len) {
+        unsigned char cmd = delta[pos++];
+
+        if (cmd & 0x80) {
+            /* COPY instruction: copy a slice from the base object.
+             *
+             * The lower 4 bits of cmd tell us which offset bytes follow:
+             *   bit 0 → offset byte 0 (bits 0-7)
+             *   bit 1 → offset byte 1 (bits 8-15)
+             *   bit 2 → offset byte 2 (bits 16-23)
+             *   bit 3 → offset byte 3 (bits 24-31)
+             *
+             * Bits 4-6 tell us which size bytes follow:
+             *   bit 4 → size byte 0 (bits 0-7)
+             *   bit 5 → size byte 1 (bits 8-15)
+             *   bit 6 → size byte 2 (bits 16-23)
+             *
+             * Missing bytes default to 0. Size of 0 means 0x10000. */
+            size_t offset = 0, size = 0;
+            if (cmd & 0x01) { if (pos >= delta_len) goto corrupt; offset  = delta[pos++]; }
+            if (cmd & 0x02) { if (pos >= delta_len) goto corrupt; offset |= (size_t)delta[pos++] << 8; }
+            if (cmd & 0x04) { if (pos >= delta_len) goto corrupt; offset |= (size_t)delta[pos++] << 16; }
+            if (cmd & 0x08) { if (pos >= delta_len) goto corrupt; offset |= (size_t)delta[pos++] << 24; }
+            if (cmd & 0x10) { if (pos >= delta_len) goto corrupt; size  = delta[pos++]; }
+            if (cmd & 0x20) { if (pos >= delta_len) goto corrupt; size |= (size_t)delta[pos++] << 8; }
+            if (cmd & 0x40) { if (pos >= delta_len) goto corrupt; size |= (size_t)delta[pos++] << 16; }
+            if (size == 0) size = 0x10000;
+
+            if (offset + size > base_len || rpos + size > tgt_size) goto corrupt;
+            memcpy(result + rpos, base + offset, size);
+            rpos += size;
+        } else if (cmd > 0) {
+            /* INSERT instruction: copy literal bytes from delta stream */
+            if (pos + cmd > delta_len || rpos + cmd > tgt_size) goto corrupt;
+            memcpy(result + rpos, delta + pos, cmd);
+            pos += cmd;
+            rpos += cmd;
+        }
+        /* cmd == 0 is reserved — skip */
+    }
+
+    if (rpos != tgt_size) goto corrupt;
+    return 0;
+
+corrupt:
+    GIT_ERR("delta: corrupt delta instruction stream\n");
+    return 1;
+}
+
+unsigned char *apply_delta(const unsigned char *base, size_t base_len,
+                           const unsigned char *delta, size_t delta_len,
+                           size_t *out_len) {
+    size_t pos, tgt_size;
+    if (read_sizes(delta, delta_len, base_len, &pos, &tgt_size) != 0) return NULL;
+
+    unsigned char *result = malloc(tgt_size > 0 ? tgt_size : 1);
+    if (result == NULL) {
+        GIT_ERR("delta: malloc failed for delta result\n");
+        return NULL;
+    }
+    if (run_instructions(base, base_len, delta, delta_len, pos, result, tgt_size) != 0) {
+        free(result);
+        return NULL;
+    }
+    *out_len = tgt_size;
+    return result;
+}
+
+int apply_delta_into(const unsigned char *base, size_t base_len,
+                     const unsigned char *delta, size_t delta_len,
+                     ScratchBuf *out, size_t *out_len) {
+    size_t pos, tgt_size;
+    if (read_sizes(delta, delta_len, base_len, &pos, &tgt_size) != 0) return 1;
+    unsigned char *result = scratch_reserve(out, tgt_size);
+    if (result == NULL) return 1;
+    if (run_instructions(base, base_len, delta, delta_len, pos, result, tgt_size) != 0) return 1;
+    *out_len = tgt_size;
+    return 0;
+}
+
+/* Bytes per indexed block of the base; also the shortest COPY emitted */
+#define DELTA_BLOCK 16
+
+/* Blocks kept per hash bucket; the rest of a repetitive base is skipped */
+#define DELTA_BUCKET_MAX 64
+
+/* Longest COPY emitted, as git does for the benefit of old readers */
+#define DELTA_COPY_MAX 0x10000
+
+/* Longest INSERT the instruction format allows */
+#define DELTA_INSERT_MAX 127
+
+/* Multiplier of the rolling hash (the FNV prime) */
+#define DELTA_HASH_MUL 0x01000193u
+
+struct DeltaIndex {
+    const unsigned char *base;
+    size_t base_len;
+    uint32_t mask;         /* bucket count - 1 */
+    uint32_t out_factor;   /* DELTA_HASH_MUL^(DELTA_BLOCK-1), to roll a byte out */
+    uint32_t *heads;       /* bucket -> first entry + 1 (0 = empty) */
+    uint32_t *next;        /* entry -> next entry in its bucket + 1 */
+    uint32_t *offsets;     /* entry -> offset of its block in the base */
+    uint32_t *hashes;      /* entry -> full hash of its block */
+};
+
+/* Hash of the DELTA_BLOCK bytes at data. */
+static uint32_t block_hash(const unsigned char *data) {
+    uint32_t h = 0;
+    for (int i = 0; i < DELTA_BLOCK; i++) h = h * DELTA_HASH_MUL + data[i];
+    return h;
+}
+
+DeltaIndex *delta_index_new(const unsigned char *base, size_t base_len) {
+    /* COPY offsets are 32-bit */
+    if (base_len < DELTA_BLOCK || base_len > UINT32_MAX) return NULL;
+
+    uint32_t blocks = (uint32_t)(base_len / DELTA_BLOCK);
+    uint32_t buckets = 16;
+    while (buckets < blocks) buckets <<= 1;
+
+    DeltaIndex *index = calloc(1, sizeof(DeltaIndex));
+    uint16_t *fill = calloc(buckets, sizeof(uint16_t));
+    if (index != NULL) {
+        index->heads = calloc(buckets, sizeof(uint32_t));
+        index->next = malloc((size_t)blocks * sizeof(uint32_t));
+        index->offsets = malloc((size_t)blocks * sizeof(uint32_t));
+        index->hashes = malloc((size_t)blocks * sizeof(uint32_t));
+    }
+    if (index == NULL || fill == NULL || index->heads == NULL || index->next == NULL ||
+        index->offsets == NULL || index->hashes == NULL) {
+        GIT_ERR("delta: malloc failed for delta index\n");
+        free(fill);
+        delta_index_free(index);
+        return NULL;
+    }
+    index->base = base;
+    index->base_len = base_len;
+    index->mask = buckets - 1;
+    index->out_factor = 1;
+    for (int i = 1; i < DELTA_BLOCK; i++) index->out_factor *= DELTA_HASH_MUL;
+
+    /* Walk backwards so each bucket lists its blocks in base order */
+    uint32_t entries = 0;
+    for (uint32_t b = blocks; b-- > 0;) {
+        uint32_t h = block_hash(base + (size_t)b * DELTA_BLOCK);
+        uint32_t bucket = h & index->mask;
+        if (fill[bucket] == DELTA_BUCKET_MAX) continue;
+        fill[bucket]++;
+        index->offsets[entries] = b * DELTA_BLOCK;
+        index->hashes[entries] = h;
+        index->next[entries] = index->heads[bucket];
+        index->heads[bucket] = ++entries;
+    }
+    free(fill);
+    return index;
+}
+
+void delta_index_free(DeltaIndex *index) {
+    if (index == NULL) return;
+    free(index->heads);
+    free(index->next);
+    free(index->offsets);
+    free(index->hashes);
+    free(index);
+}
+
+/* Appends a variable-length integer (the inverse of read_var_int()). */
+static size_t put_var_int(unsigned char *out, size_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+/* Appends INSERT instructions for len literal bytes. */
+static size_t put_inserts(unsigned char *out, const unsigned char *data, size_t len) {
+    size_t n = 0;
+    while (len > 0) {
+        size_t chunk = len < DELTA_INSERT_MAX ? len : DELTA_INSERT_MAX;
+        out[n++] = (unsigned char)chunk;
+        memcpy(out + n, data, chunk);
+        n += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+/* Appends one COPY instruction, sending only the non-zero bytes. */
+static size_t put_copy(unsigned char *out, uint32_t offset, uint32_t size) {
+    size_t n = 1;
+    unsigned char cmd = 0x80;
+    for (int i = 0; i < 4; i++) {
+        unsigned char byte = (unsigned char)(offset >> (8 * i));
+        if (byte != 0) { cmd |= (unsigned char)(0x01 << i); out[n++] = byte; }
+    }
+    for (int i = 0; i < 3; i++) {
+        unsigned char byte = (unsigned char)(size >> (8 * i));
+        if (byte != 0) { cmd |= (unsigned char)(0x10 << i); out[n++] = byte; }
+    }
+    out[0] = cmd;
+    return n;
+}
+
+/* Finds the longest match for target[pos..] among the blocks hashing to h. */
+static size_t longest_match(const DeltaIndex *index, uint32_t h,
+                            const unsigned char *target, size_t target_len, size_t pos,
+                            size_t *match_off) {
+    size_t best = 0;
+    for (uint32_t e = index->heads[h & index->mask]; e != 0; e = index->next[e - 1]) {
+        if (index->hashes[e - 1] != h) continue;
+        size_t off = index->offsets[e - 1];
+        size_t limit = index->base_len - off;
+        if (limit > target_len - pos) limit = target_len - pos;
+        size_t n = 0;
+        while (n < limit && index->base[off + n] == target[pos + n]) n++;
+        if (n > best) {
+            best = n;
+            *match_off = off;
+            if (n == limit) break;
+        }
+    }
+    return best;
+}
+
+/* Room for the widest single step: a block's worth of INSERTs or one COPY */
+#define DELTA_STEP_MAX (DELTA_INSERT_MAX + 1 + 8)
+
+unsigned char *create_delta(const DeltaIndex *index,
+                            const unsigned char *target, size_t target_len,
+                            size_t max_len, size_t *delta_len) {
+    unsigned char *out = malloc(max_len + DELTA_STEP_MAX + 32);
+    if (out == NULL) {
+        GIT_ERR("delta: malloc failed for delta\n");
+        return NULL;
+    }
+    size_t n = put_var_int(out, index->base_len);
+    n += put_var_int(out + n, target_len);
+
+    size_t pos = 0, pending = 0;  /* target[pending..pos) awaits an INSERT */
+    uint32_t h = target_len >= DELTA_BLOCK ? block_hash(target) : 0;
+    while (pos + DELTA_BLOCK <= target_len && n <= max_len) {
+        size_t off = 0;
+        size_t len = longest_match(index, h, target, target_len, pos, &off);
+        if (len < DELTA_BLOCK) {
+            if (pos + DELTA_BLOCK < target_len) {
+                h = (h - target[pos] * index->out_factor) * DELTA_HASH_MUL + target[pos + DELTA_BLOCK];
+            }
+            pos++;
+            /* Flush long literal runs as they go, so out never overflows */
+            if (pos - pending == DELTA_INSERT_MAX) {
+                n += put_inserts(out + n, target + pending, pos - pending);
+                pending = pos;
+            }
+            continue;
+        }
+
+        /* Grow the match backwards over literals the base also has */
+        while (off > 0 && pos > pending && index->base[off - 1] == target[pos - 1]) {
+            off--;
+            pos--;
+            len++;
+        }
+        n += put_inserts(out + n, target + pending, pos - pending);
+        while (len > 0 && n <= max_len) {
+            size_t chunk = len < DELTA_COPY_MAX ? len : DELTA_COPY_MAX;
+            n += put_copy(out + n, (uint32_t)off, (uint32_t)chunk);
+            off += chunk;
+            pos += chunk;
+            len -= chunk;
+        }
+        pending = pos;
+        if (pos + DELTA_BLOCK <= target_len) h = block_hash(target + pos);
+    }
+    if (n <= max_len) n += put_inserts(out + n, target + pending, target_len - pending);
+
+    if (n > max_len) {
+        free(out);
+        return NULL;
+    }
+    *delta_len = n;
+    return out;
+}
@@ -0,0 +1,106 @@
+/*
+ * delta.h
+ *
+ * Git delta instruction streams, as used by OFS_DELTA / REF_DELTA
+ * pack entries to describe an object relative to a base object.
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+
+#include "../utils/scratch/scratch.h"
+
+/*
+ * Reads a variable-length integer from delta instructions.
+ *
+ * Each byte contributes 7 bits of value. The MSB (bit 7) is a
+ * continuation flag: 1 = more bytes follow, 0 = last byte.
+ * Bits accumulate from least significant to most significant.
+ *
+ * Used for reading source/target sizes at the start of delta data.
+ *
+ * @param data  Delta stream.
+ * @param len   Byte count of data.
+ * @param pos   In/out: read position, advanced past the integer.
+ * @return      Decoded value.
+ */
+size_t read_var_int(const unsigned char *data, size_t len, size_t *pos);
+
+/*
+ * Applies a delta instruction stream to a base object.
+ *
+ * Delta format:
+ *   1. Source (base) size — variable-length integer
+ *   2. Target (result) size — variable-length integer
+ *   3. Instructions:
+ *      - COPY  (MSB=1): copy a range from the base object
+ *        Lower 4 bits select which offset bytes follow (0-4 bytes).
+ *        Next 3 bits select which size bytes follow (0-3 bytes).
+ *        If size=0, it means 0x10000 (64KB).
+ *      - INSERT (MSB=0): literal bytes from the delta stream
+ *        Lower 7 bits = count of bytes to copy from delta data.
+ *
+ * @param base       Base object body.
+ * @param base_len   Byte count of base.
+ * @param delta      Decompressed delta instruction stream.
+ * @param delta_len  Byte count of delta.
+ * @param out_len    Output: byte count of the result.
+ * @return           Heap-allocated result, or NULL on error.
+ */
+unsigned char *apply_delta(const unsigned char *base, size_t base_len,
+                           const unsigned char *delta, size_t delta_len,
+                           size_t *out_len);
+
+/*
+ * Like apply_delta(), but builds the result in a reusable scratch
+ * buffer instead of a fresh allocation. out must not hold the base.
+ *
+ * @param out      Scratch buffer receiving the result in out->data.
+ * @param out_len  Output: byte count of the result.
+ * @return         0 on success, 1 on error.
+ */
+int apply_delta_into(const unsigned char *base, size_t base_len,
+                     const unsigned char *delta, size_t delta_len,
+                     ScratchBuf *out, size_t *out_len);
+
+/* Block index over a base object, for creating deltas against it (opaque). */
+typedef struct DeltaIndex DeltaIndex;
+
+/*
+ * Indexes a base object for create_delta(): a rolling hash of every
+ * 16-byte block of the base goes into a hash table, so that matches
+ * in a target can be found in one pass over it.
+ *
+ * The index borrows base, which must outlive it.
+ *
+ * @param base      Base object body.
+ * @param base_len  Byte count of base.
+ * @return          Heap-allocated index (free with delta_index_free), or
+ *                  NULL if the base is too small or too large to index.
+ */
+DeltaIndex *delta_index_new(const unsigned char *base, size_t base_len);
+
+/*
+ * Creates a delta that rebuilds target from the indexed base — the
+ * encoder counterpart of apply_delta(). Matches of at least one block
+ * become COPY instructions (extended in both directions byte by byte);
+ * everything else becomes INSERTs.
+ *
+ * @param index      Index of the base.
+ * @param target     Target object body.
+ * @param target_len Byte count of target.
+ * @param max_len    Largest acceptable delta; a longer one is abandoned.
+ * @param delta_len  Output: byte count of the delta.
+ * @return           Heap-allocated delta, or NULL if none fits in max_len
+ *                   (or allocation failed).
+ */
+unsigned char *create_delta(const DeltaIndex *index,
+                            const unsigned char *target, size_t target_len,
+                            size_t max_len, size_t *delta_len);
+
+/* Frees an index. Safe to call with NULL. */
+void delta_index_free(DeltaIndex *index);
+
+#endif /* DELTA_H */
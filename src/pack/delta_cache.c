@@ -0,0 +1,199 @@
+/*
+ * delta_cache.c
+ *
+ * LRU object body cache: a chained hash table for lookup plus a
+ * doubly-linked recency list for eviction. SHA-1 output is already
+ * uniformly distributed, so its first bytes serve as the hash.
+ *
+ * Each thread gets its own cache (thread-local state), so lookups
+ * need no locking and a borrowed pointer cannot be evicted by another
+ * thread. A thread-exit hook frees a worker's cache when the worker
+ * exits.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../utils/thread/thread_exit.h"
+#include "../utils/trace/trace.h"
+#include "delta_cache.h"
+
+typedef struct CacheEntry {
+    unsigned char sha[20];
+    int type;
+    unsigned char *data;
+    size_t size;
+    struct CacheEntry *hash_next;           /* bucket chain */
+    struct CacheEntry *lru_prev, *lru_next; /* prev = more recently used */
+} CacheEntry;
+
+static _Thread_local struct {
+    int initialized;
+    CacheEntry **buckets;
+    size_t bucket_count;                    /* power of two */
+    CacheEntry *lru_head, *lru_tail;        /* head = most recently used */
+    DeltaCacheStats stats;
+} cache;
+
+/* Parses "<n>[k|m|g]" — returns fallback if unset or malformed. */
+static size_t parse_limit(const char *value, size_t fallback) {
+    if (value == NULL || *value == '\0') return fallback;
+    char *end;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (end == value) return fallback;
+    switch (*end) {
+        case 'k': case 'K': n <<= 10; end++; break;
+        case 'm': case 'M': n <<= 20; end++; break;
+        case 'g': case 'G': n <<= 30; end++; break;
+        default: break;
+    }
+    return *end == '\0' ? (size_t)n : fallback;
+}
+
+static void release_thread_cache(void) {
+    delta_cache_clear();
+    free(cache.buckets);
+    cache.buckets = NULL;
+    cache.bucket_count = 0;
+}
+
+static void ensure_init(void) {
+    if (cache.initialized) return;
+    cache.initialized = 1;
+    cache.stats.limit = parse_limit(getenv("GIT_DELTA_BASE_CACHE_LIMIT"),
+                                    DELTA_CACHE_DEFAULT_LIMIT);
+    thread_at_exit(release_thread_cache);
+}
+
+static size_t bucket_of(const unsigned char *sha, size_t bucket_count) {
+    uint32_t h = ((uint32_t)sha[0] << 24) | ((uint32_t)sha[1] << 16) |
+                 ((uint32_t)sha[2] << 8)  |  (uint32_t)sha[3];
+    return h & (bucket_count - 1);
+}
+
+static void lru_unlink(CacheEntry *e) {
+    if (e->lru_prev != NULL) e->lru_prev->lru_next = e->lru_next;
+    else cache.lru_head = e->lru_next;
+    if (e->lru_next != NULL) e->lru_next->lru_prev = e->lru_prev;
+    else cache.lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(CacheEntry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache.lru_head;
+    if (cache.lru_head != NULL) cache.lru_head->lru_prev = e;
+    cache.lru_head = e;
+    if (cache.lru_tail == NULL) cache.lru_tail = e;
+}
+
+static CacheEntry **find_slot(const unsigned char *sha) {
+    if (cache.bucket_count == 0) return NULL;
+    CacheEntry **slot = &cache.buckets[bucket_of(sha, cache.bucket_count)];
+    while (*slot != NULL && memcmp((*slot)->sha, sha, 20) != 0) slot = &(*slot)->hash_next;
+    return slot;
+}
+
+static void remove_entry(CacheEntry *e) {
+    CacheEntry **slot = find_slot(e->sha);
+    if (slot != NULL && *slot == e) *slot = e->hash_next;
+    lru_unlink(e);
+    cache.stats.bytes -= e->size;
+    cache.stats.entries--;
+    free(e->data);
+    free(e);
+}
+
+/* Drops least recently used entries until `incoming` more bytes fit. */
+static void evict_for(size_t incoming) {
+    while (cache.lru_tail != NULL && cache.stats.bytes + incoming > cache.stats.limit) {
+        remove_entry(cache.lru_tail);
+        cache.stats.evictions++;
+    }
+}
+
+/* Doubles the bucket array once chains would average above one entry. */
+static int grow_buckets(void) {
+    size_t new_count = cache.bucket_count == 0 ? 256 : cache.bucket_count * 2;
+    CacheEntry **fresh = calloc(new_count, sizeof(CacheEntry *));
+    if (fresh == NULL) return 1;
+
+    for (size_t i = 0; i < cache.bucket_count; i++) {
+        CacheEntry *e = cache.buckets[i];
+        while (e != NULL) {
+            CacheEntry *next = e->hash_next;
+            size_t b = bucket_of(e->sha, new_count);
+            e->hash_next = fresh[b];
+            fresh[b] = e;
+            e = next;
+        }
+    }
+    free(cache.buckets);
+    cache.buckets = fresh;
+    cache.bucket_count = new_count;
+    return 0;
+}
+
+const unsigned char *delta_cache_get(const unsigned char *sha, int *type, size_t *size) {
+    ensure_init();
+    CacheEntry **slot = find_slot(sha);
+    if (slot == NULL || *slot == NULL) {
+        cache.stats.misses++;
+        trace_count(TRACE_CACHE_MISSES, 1);
+        return NULL;
+    }
+
+    CacheEntry *e = *slot;
+    lru_unlink(e);
+    lru_push_front(e);
+    cache.stats.hits++;
+    trace_count(TRACE_CACHE_HITS, 1);
+    *type = e->type;
+    *size = e->size;
+    return e->data;
+}
+
+int delta_cache_put(const unsigned char *sha, int type, unsigned char *data, size_t size) {
+    ensure_init();
+    if (size > cache.stats.limit) return 0;
+
+    CacheEntry **slot = find_slot(sha);
+    if (slot != NULL && *slot != NULL) return 0;
+
+    if (cache.stats.entries >= cache.bucket_count && grow_buckets() != 0) return 0;
+
+    CacheEntry *e = calloc(1, sizeof(CacheEntry));
+    if (e == NULL) return 0;
+
+    evict_for(size);
+    memcpy(e->sha, sha, 20);
+    e->type = type;
+    e->data = data;
+    e->size = size;
+
+    size_t b = bucket_of(sha, cache.bucket_count);
+    e->hash_next = cache.buckets[b];
+    cache.buckets[b] = e;
+    lru_push_front(e);
+    cache.stats.entries++;
+    cache.stats.bytes += size;
+    return 1;
+}
+
+void delta_cache_set_limit(size_t limit) {
+    ensure_init();
+    cache.stats.limit = limit;
+    evict_for(0);
+}
+
+void delta_cache_stats(DeltaCacheStats *out) {
+    ensure_init();
+    *out = cache.stats;
+}
+
+void delta_cache_clear(void) {
+    while (cache.lru_tail != NULL) remove_entry(cache.lru_tail);
+}
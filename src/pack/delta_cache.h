@@ -0,0 +1,71 @@
+/*
+ * delta_cache.h
+ *
+ * Per-thread, size-bounded LRU cache of object bodies, keyed by
+ * binary SHA. Delta resolution checks it before re-reading and
+ * re-inflating a base, so long chains against a hot base hit memory.
+ *
+ * Every thread sees its own cache: the limit, the stats and the
+ * contents below all refer to the calling thread's cache.
+ */
+
+#ifndef DELTA_CACHE_H
+#define DELTA_CACHE_H
+
+#include <stddef.h>
+
+/* Default memory budget (same as git's core.deltaBaseCacheLimit) */
+#define DELTA_CACHE_DEFAULT_LIMIT (96UL * 1024 * 1024)
+
+/* Counters for tuning and tracing. */
+typedef struct {
+    size_t hits;       /* lookups served from memory */
+    size_t misses;     /* lookups that fell through to the object store */
+    size_t evictions;  /* entries dropped to stay within the budget */
+    size_t entries;    /* entries currently held */
+    size_t bytes;      /* body bytes currently held */
+    size_t limit;      /* current memory budget */
+} DeltaCacheStats;
+
+/*
+ * Looks up an object body.
+ *
+ * The returned pointer is borrowed: it stays valid only until the
+ * next delta_cache_put() or delta_cache_set_limit() call.
+ *
+ * @param sha   20-byte binary object name.
+ * @param type  Output: pack type code (OBJ_COMMIT..OBJ_TAG).
+ * @param size  Output: body size.
+ * @return      Cached body, or NULL on a miss.
+ */
+const unsigned char *delta_cache_get(const unsigned char *sha, int *type, size_t *size);
+
+/*
+ * Offers an object body to the cache, evicting least recently used
+ * entries until the budget is met.
+ *
+ * @param sha   20-byte binary object name.
+ * @param type  Pack type code.
+ * @param data  Heap-allocated body.
+ * @param size  Body size.
+ * @return      1 if the cache took ownership of data, 0 if it declined
+ *              (already cached, or larger than the whole budget) and
+ *              the caller must still free it.
+ */
+int delta_cache_put(const unsigned char *sha, int type, unsigned char *data, size_t size);
+
+/*
+ * Sets the memory budget in bytes, evicting as needed. 0 disables
+ * caching. Without a call, the budget comes from the
+ * GIT_DELTA_BASE_CACHE_LIMIT environment variable (bytes, with an
+ * optional k/m/g suffix) or DELTA_CACHE_DEFAULT_LIMIT.
+ */
+void delta_cache_set_limit(size_t limit);
+
+/* Copies the current counters into *out. */
+void delta_cache_stats(DeltaCacheStats *out);
+
+/* Drops every entry (counters are kept). */
+void delta_cache_clear(void);
+
+#endif /* DELTA_CACHE_H */
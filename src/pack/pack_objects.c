@@ -0,0 +1,367 @@
+/*
+ * pack_objects.c
+ *
+ * Objects are written in one pass over the sorted list. A sliding
+ * window keeps the last few objects (their bodies and delta indexes);
+ * each new object is diffed against those of the same type, and the
+ * winner, if any, is written as an OFS_DELTA — the base is always
+ * earlier in the pack, so its offset is already known. The pack is
+ * written to a temporary file while its checksum is computed, then
+ * the .idx is generated and both are moved into place.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../objects/loose_store.h"
+#include "../objects/object.h"
+#include "../utils/compression/compression.h"
+#include "../utils/compression/zlib_backend.h"
+#include "../utils/hash/hash.h"
+#include "../utils/string/string.h"
+#include "../utils/trace/trace.h"
+#include "delta.h"
+#include "pack_objects.h"
+#include "packfile.h"
+#include "packindex.h"
+#include "packstore.h"
+
+/* Objects smaller than this are never deltified: the delta can't win */
+#define PACK_MIN_DELTA_SIZE 32
+
+/* Write buffer of the pack file */
+#define PACK_WRITE_BUFFER (64 * 1024)
+
+uint32_t pack_name_hash(const char *name) {
+    uint32_t hash = 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        if (isspace(*p)) continue;
+        hash = (hash >> 2) + ((uint32_t)*p << 24);
+    }
+    return hash;
+}
+
+/* The pack being written, with its running checksum. */
+typedef struct {
+    char tmp_path[GIT_PATH_MAX];
+    int fd;
+    HashCtx *hash;
+    uint64_t offset;            /* bytes written so far */
+    uint32_t crc;               /* CRC32 of the current object's bytes */
+    unsigned char buf[PACK_WRITE_BUFFER];
+    size_t buffered;
+} PackWriter;
+
+static int flush_writer(PackWriter *w) {
+    size_t done = 0;
+    while (done < w->buffered) {
+        ssize_t n = write(w->fd, w->buf + done, w->buffered - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            GIT_ERR("pack-objects: error writing %s: %s\n", w->tmp_path, strerror(errno));
+            return 1;
+        }
+        done += (size_t)n;
+    }
+    w->buffered = 0;
+    return 0;
+}
+
+/* Appends bytes to the pack, folding them into the checksum and CRC. */
+static int put(PackWriter *w, const unsigned char *data, size_t len) {
+    hash_update(w->hash, data, len);
+    w->crc = (uint32_t)crc32(w->crc, data, (uInt)len);
+    w->offset += len;
+    while (len > 0) {
+        if (w->buffered == sizeof(w->buf) && flush_writer(w) != 0) return 1;
+        size_t chunk = sizeof(w->buf) - w->buffered;
+        if (chunk > len) chunk = len;
+        memcpy(w->buf + w->buffered, data, chunk);
+        w->buffered += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* Encodes a pack object header (type + variable-length size); returns its length. */
+static size_t encode_object_header(int type, size_t size, unsigned char *out) {
+    size_t n = 0;
+    unsigned char byte = (unsigned char)((type << 4) | (size & 0x0F));
+    size >>= 4;
+    while (size > 0) {
+        out[n++] = byte | 0x80;
+        byte = size & 0x7F;
+        size >>= 7;
+    }
+    out[n++] = byte;
+    return n;
+}
+
+/*
+ * Encodes an OFS_DELTA's distance back to its base: big-endian 7-bit
+ * groups, each continuation adding one (so no value has two spellings).
+ */
+static size_t encode_base_offset(uint64_t distance, unsigned char *out) {
+    unsigned char tmp[16];
+    size_t pos = sizeof(tmp) - 1;
+    tmp[pos] = distance & 0x7F;
+    while (distance >>= 7) tmp[--pos] = 0x80 | (--distance & 0x7F);
+    size_t n = sizeof(tmp) - pos;
+    memcpy(out, tmp + pos, n);
+    return n;
+}
+
+/*
+ * Writes one entry: an object header for size bytes of the given type,
+ * the base distance of an OFS_DELTA, and the deflated data.
+ */
+static int put_entry(PackWriter *w, int type, size_t size, uint64_t base_distance,
+                     const unsigned char *data, size_t data_len) {
+    unsigned char header[32];
+    size_t header_len = encode_object_header(type, size, header);
+    if (type == OBJ_OFS_DELTA) header_len += encode_base_offset(base_distance, header + header_len);
+
+    unsigned long compressed_len = 0;
+    unsigned char *compressed = NULL;
+    const unsigned char *body;
+    if (data_len == 0) {
+        /* compress_data() refuses empty input; this is zlib's empty stream */
+        static const unsigned char empty[] = { 0x78, 0x9c, 0x03, 0x00, 0x00, 0x00, 0x00, 0x01 };
+        body = empty;
+        compressed_len = sizeof(empty);
+    } else {
+        compressed = compress_data(data, data_len, &compressed_len);
+        if (compressed == NULL) return 1;
+        body = compressed;
+    }
+    int result = put(w, header, header_len) || put(w, body, compressed_len);
+    free(compressed);
+    return result;
+}
+
+/* A recent object kept as a delta base candidate. */
+typedef struct {
+    int type;
+    unsigned char *raw;        /* object_read() buffer; NULL = empty slot */
+    const unsigned char *body;
+    size_t size;
+    DeltaIndex *index;         /* NULL if the body is too small to index */
+    int depth;                 /* delta chain length of this object */
+    uint64_t offset;           /* its entry's offset in the pack */
+} WindowSlot;
+
+static void slot_clear(WindowSlot *slot) {
+    delta_index_free(slot->index);
+    free(slot->raw);
+    memset(slot, 0, sizeof(*slot));
+}
+
+/* Type, then name hash, then largest first: bases come before their deltas */
+static int compare_pack_order(const void *a, const void *b) {
+    const PackObject *x = a, *y = b;
+    if (x->type != y->type) return x->type < y->type ? -1 : 1;
+    if (x->name_hash != y->name_hash) return x->name_hash < y->name_hash ? -1 : 1;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return oid_cmp(&x->oid, &y->oid);
+}
+
+/*
+ * Searches the window for the base giving the smallest delta of body.
+ * Returns the delta (heap-allocated) and sets *best, or NULL if none
+ * is smaller than the limit a delta must beat.
+ */
+static unsigned char *find_delta(const WindowSlot *window, int window_size, int type,
+                                 const unsigned char *body, size_t size, int max_depth,
+                                 const WindowSlot **best, size_t *best_len) {
+    unsigned char *delta = NULL;
+    /* A delta must at least halve the object to be worth a chain link */
+    if (size < PACK_MIN_DELTA_SIZE || size / 2 <= OID_RAW_SIZE) return NULL;
+    size_t limit = size / 2 - OID_RAW_SIZE;
+
+    for (int i = 0; i < window_size; i++) {
+        const WindowSlot *slot = &window[i];
+        if (slot->raw == NULL || slot->type != type || slot->index == NULL) continue;
+        if (slot->depth >= max_depth) continue;
+        /* Bases far smaller or larger than the target rarely pay off */
+        if (slot->size < size / 32 || size < slot->size / 32) continue;
+
+        size_t len;
+        unsigned char *candidate = create_delta(slot->index, body, size, limit, &len);
+        if (candidate == NULL) continue;
+        free(delta);
+        delta = candidate;
+        *best = slot;
+        *best_len = len;
+        limit = len - 1;
+    }
+    return delta;
+}
+
+/* Writes every object, in order, keeping the window as it goes. */
+static int write_objects(PackWriter *w, const PackObject *objects, size_t count,
+                         const PackObjectsOptions *opts, PackIndexEntry *index) {
+    int window_size = opts->window > 0 ? opts->window : 0;
+    WindowSlot *window = calloc((size_t)window_size + 1, sizeof(WindowSlot));
+    if (window == NULL) {
+        GIT_ERR("pack-objects: malloc failed for delta window\n");
+        return 1;
+    }
+    int result = 1;
+    int next_slot = 0;
+    char hex[OID_HEX_SIZE + 1];
+
+    for (size_t i = 0; i < count; i++) {
+        const PackObject *obj = &objects[i];
+        GitObject read = {0};
+        if (object_read(&obj->oid, &read) != 0) goto cleanup;
+        if (read.body_size != obj->size) {
+            GIT_ERR("pack-objects: object %s changed size\n", oid_to_hex(&obj->oid, hex));
+            free(read.raw);
+            goto cleanup;
+        }
+
+        const WindowSlot *base = NULL;
+        size_t delta_len = 0;
+        unsigned char *delta = find_delta(window, window_size, obj->type, read.body, read.body_size,
+                                          opts->depth, &base, &delta_len);
+
+        memcpy(index[i].sha, obj->oid.hash, OID_RAW_SIZE);
+        index[i].offset = w->offset;
+        w->crc = (uint32_t)crc32(0L, Z_NULL, 0);
+        int failed = delta != NULL
+            ? put_entry(w, OBJ_OFS_DELTA, delta_len, w->offset - base->offset, delta, delta_len)
+            : put_entry(w, obj->type, read.body_size, 0, read.body, read.body_size);
+        int depth = delta != NULL ? base->depth + 1 : 0;
+        trace_count_max(TRACE_DELTA_DEPTH_MAX, (uint64_t)depth);
+        free(delta);
+        index[i].crc32 = w->crc;
+        if (failed) {
+            free(read.raw);
+            goto cleanup;
+        }
+
+        /* Keep the object as a base for the next ones, if it can be one */
+        if (window_size == 0 || depth >= opts->depth) {
+            free(read.raw);
+            continue;
+        }
+        WindowSlot *slot = &window[next_slot];
+        next_slot = (next_slot + 1) % window_size;
+        slot_clear(slot);
+        slot->type = obj->type;
+        slot->raw = read.raw;
+        slot->body = read.body;
+        slot->size = read.body_size;
+        slot->index = read.body_size >= PACK_MIN_DELTA_SIZE
+            ? delta_index_new(read.body, read.body_size) : NULL;
+        slot->depth = depth;
+        slot->offset = index[i].offset;
+    }
+    result = 0;
+
+cleanup:
+    for (int i = 0; i < window_size; i++) slot_clear(&window[i]);
+    free(window);
+    return result;
+}
+
+int pack_objects(PackObject *objects, size_t count, const PackObjectsOptions *opts,
+                 unsigned char *checksum_out) {
+    if (count > UINT32_MAX) {
+        GIT_ERR("pack-objects: too many objects\n");
+        return 1;
+    }
+    if (mkdir(GIT_PACK_DIR, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) {
+        GIT_ERR("pack-objects: cannot create %s: %s\n", GIT_PACK_DIR, strerror(errno));
+        return 1;
+    }
+    qsort(objects, count, sizeof(PackObject), compare_pack_order);
+
+    PackWriter *w = calloc(1, sizeof(PackWriter));
+    PackIndexEntry *index = malloc((count + 1) * sizeof(PackIndexEntry));
+    int result = 1;
+    if (w == NULL || index == NULL) {
+        GIT_ERR("pack-objects: malloc failed\n");
+        goto cleanup;
+    }
+    w->fd = -1;
+    w->hash = hash_ctx_new(HASH_SHA1);
+    if (w->hash == NULL) goto cleanup;
+    snprintf(w->tmp_path, sizeof(w->tmp_path), "%s/tmp_pack_XXXXXX", GIT_PACK_DIR);
+    w->fd = mkstemp(w->tmp_path);
+    if (w->fd < 0) {
+        GIT_ERR("pack-objects: cannot create temporary pack: %s\n", strerror(errno));
+        w->tmp_path[0] = '\0';
+        goto cleanup;
+    }
+
+    unsigned char header[12] = { 'P', 'A', 'C', 'K', 0, 0, 0, 2 };
+    header[8] = (unsigned char)(count >> 24);
+    header[9] = (unsigned char)(count >> 16);
+    header[10] = (unsigned char)(count >> 8);
+    header[11] = (unsigned char)count;
+    if (put(w, header, sizeof(header)) != 0) goto cleanup;
+    uint64_t start = trace_now();
+    if (write_objects(w, objects, count, opts, index) != 0) goto cleanup;
+    trace_span("pack_objects.write", start);
+
+    /* The trailer is the checksum of everything before it */
+    unsigned char sha[OID_RAW_SIZE];
+    hash_final(w->hash, sha);
+    if (w->buffered + OID_RAW_SIZE > sizeof(w->buf) && flush_writer(w) != 0) goto cleanup;
+    memcpy(w->buf + w->buffered, sha, OID_RAW_SIZE);
+    w->buffered += OID_RAW_SIZE;
+    if (flush_writer(w) != 0) goto cleanup;
+    if (loose_store_sync_file(w->fd) != 0) {
+        GIT_ERR("pack-objects: error syncing %s: %s\n", w->tmp_path, strerror(errno));
+        goto cleanup;
+    }
+    if (close(w->fd) != 0) {
+        w->fd = -1;
+        GIT_ERR("pack-objects: error writing %s: %s\n", w->tmp_path, strerror(errno));
+        goto cleanup;
+    }
+    w->fd = -1;
+
+    char hex[OID_HEX_SIZE + 1];
+    hex_encode(sha, OID_RAW_SIZE, hex);
+    char tmp_idx[sizeof(w->tmp_path) + sizeof(".idx")], pack_path[GIT_PATH_MAX], idx_path[GIT_PATH_MAX];
+    if ((size_t)snprintf(tmp_idx, sizeof(tmp_idx), "%s.idx", w->tmp_path) >= sizeof(tmp_idx)) {
+        GIT_ERR("pack-objects: path too long: %s\n", w->tmp_path);
+        goto cleanup;
+    }
+    snprintf(pack_path, sizeof(pack_path), "%s/pack-%s.pack", GIT_PACK_DIR, hex);
+    snprintf(idx_path, sizeof(idx_path), "%s/pack-%s.idx", GIT_PACK_DIR, hex);
+    start = trace_now();
+    if (pack_index_write(tmp_idx, index, count, sha) != 0) goto cleanup;
+    trace_span("pack.write_index", start);
+
+    /* Pack first: a reader must never find an .idx without its pack */
+    if (rename(w->tmp_path, pack_path) != 0 || rename(tmp_idx, idx_path) != 0) {
+        GIT_ERR("pack-objects: cannot install %s: %s\n", pack_path, strerror(errno));
+        unlink(tmp_idx);
+        goto cleanup;
+    }
+    w->tmp_path[0] = '\0';
+    packstore_reprepare();
+    memcpy(checksum_out, sha, OID_RAW_SIZE);
+    result = 0;
+
+cleanup:
+    if (w != NULL) {
+        if (w->fd >= 0) close(w->fd);
+        if (w->tmp_path[0] != '\0') unlink(w->tmp_path);
+        hash_ctx_free(w->hash);
+    }
+    free(w);
+    free(index);
+    return result;
+}
@@ -0,0 +1,64 @@
+/*
+ * pack_objects.h
+ *
+ * Writes a set of objects from the object store into one new pack,
+ * finding deltas between them — the writing side of packfile.c.
+ */
+
+#ifndef PACK_OBJECTS_H
+#define PACK_OBJECTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../objects/object_id.h"
+
+/* Default delta search window and chain depth, as git's */
+#define PACK_WINDOW_DEFAULT 10
+#define PACK_DEPTH_DEFAULT 50
+
+/* One object to pack. */
+typedef struct {
+    ObjectId oid;
+    int type;            /* OBJ_COMMIT .. OBJ_TAG */
+    size_t size;         /* body size */
+    uint32_t name_hash;  /* pack_name_hash() of a path it was seen at; 0 if none */
+} PackObject;
+
+typedef struct {
+    int window;  /* objects tried as delta bases for each object (0 = no deltas) */
+    int depth;   /* longest delta chain */
+} PackObjectsOptions;
+
+/*
+ * Hashes a path so that objects at the same path (and, less strongly,
+ * with the same file name ending) sort next to each other: the last
+ * characters weigh the most. Matches git's pack_name_hash().
+ *
+ * @param name  Path or file name.
+ * @return      Hash; never 0 for a non-empty name of printable bytes.
+ */
+uint32_t pack_name_hash(const char *name);
+
+/*
+ * Writes objects as .git/objects/pack/pack-<checksum>.{pack,idx}.
+ *
+ * Objects are sorted by type, name hash and decreasing size; each is
+ * then tried against the previous opts->window objects of its type
+ * with create_delta(), and stored as an OFS_DELTA against the base
+ * giving the smallest delta (if any beats the full object), as long
+ * as the base's own chain is shorter than opts->depth.
+ *
+ * objects is reordered. Every object must be readable with
+ * object_read(); the pack store is re-scanned afterwards.
+ *
+ * @param objects       Objects to pack (distinct).
+ * @param count         Number of objects.
+ * @param opts          Window and depth.
+ * @param checksum_out  Output: the pack's 20-byte checksum.
+ * @return              0 on success, 1 on failure.
+ */
+int pack_objects(PackObject *objects, size_t count, const PackObjectsOptions *opts,
+                 unsigned char *checksum_out);
+
+#endif /* PACK_OBJECTS_H */
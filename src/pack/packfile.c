@@ -2,39 +2,158 @@
  * packfile.c
  *
  * Parses a git v2 packfile: reads the header, decompresses each object
- * with zlib, resolves REF_DELTA objects, and writes everything to
- * .git/objects/ using the existing object_write() pipeline.
+ * with zlib, resolves REF_DELTA and OFS_DELTA objects, and writes everything to
+ * .git/objects/ using the existing object_write_body() pipeline, or,
+ * with several threads, an object writer pool (object_writer.h).
+ *
+ * The parser is a resumable state machine: bytes can be fed in slices
+ * of any size (e.g. straight from the HTTP callback) and each object is
+ * inflated and written as soon as its bytes arrive. Nothing but the
+ * object currently being inflated is held in memory.
+ *
+ * Two modes share the state machine:
+ *   PACK_MODE_LOOSE  explode every object into .git/objects/xx/. The
+ *                    parse thread inflates, applies deltas and hashes;
+ *                    compressing and writing is left to the pool, so
+ *                    it overlaps the parse. A delta whose base missed
+ *                    the delta base cache waits for the pool to drain
+ *                    before reading the base back.
+ *   PACK_MODE_INDEX  keep the pack verbatim under .git/objects/pack/
+ *                    and write a v2 .idx for it. The first pass (while
+ *                    streaming) hashes non-delta objects and records
+ *                    each object's offset and CRC; once the pack is
+ *                    complete a second pass over the mmap'd file
+ *                    resolves deltas, walking from each base to the
+ *                    deltas that reference it by SHA or by offset.
+ *                    A thin pack (REF_DELTA bases left out because the
+ *                    receiver has them) is completed from the object
+ *                    store: the bases are appended and the pack's
+ *                    count and checksum rewritten, like git's
+ *                    index-pack --fix-thin.
+ *
+ * Both modes keep a table of every object's offset (in pack order, so
+ * it is sorted) — an OFS_DELTA base is found by binary search on it.
+ *
+ * The per-object work allocates nothing in the steady state (but for
+ * the copy each object hands to the writer pool): one zlib
+ * stream is reset (not rebuilt) for every object, and bodies, deltas
+ * and delta results land in scratch buffers that grow to the largest
+ * object seen and are then reused (per stream while streaming, per
+ * thread while resolving).
  *
  * Pack format overview:
  *   12-byte header: "PACK" + 4-byte version + 4-byte object count
  *   N objects, each:
  *     - variable-length header: 3-bit type + variable-length size
  *     - (REF_DELTA only: 20-byte base SHA)
+ *     - (OFS_DELTA only: variable-length negative offset to the base)
  *     - zlib-compressed body
- *   20-byte checksum (ignored here)
+ *   20-byte SHA-1 checksum of everything before it (verified)
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <zlib.h>
 
 #include "../constants.h"
+#include "../objects/loose_store.h"
 #include "../objects/object.h"
+#include "../objects/object_writer.h"
+#include "../utils/compression/compression.h"
+#include "../utils/compression/zlib_backend.h"
+#include "../utils/file/file.h"
+#include "../utils/hash/hash.h"
+#include "../utils/scratch/scratch.h"
 #include "../utils/string/string.h"
+#include "../utils/thread/thread_exit.h"
+#include "../utils/thread/thread_pool.h"
+#include "../utils/trace/trace.h"
+#include "delta.h"
+#include "delta_cache.h"
+#include "packindex.h"
+#include "packstore.h"
 #include "packfile.h"
 
-/* Pack object type codes */
-#define OBJ_COMMIT    1
-#define OBJ_TREE      2
-#define OBJ_BLOB      3
-#define OBJ_TAG       4
-#define OBJ_OFS_DELTA 6
-#define OBJ_REF_DELTA 7
+/* Parser states — each names the next thing expected on the wire */
+enum {
+    PS_HEADER,      /* 12-byte "PACK" + version + count */
+    PS_OBJ_HEADER,  /* variable-length type + size */
+    PS_REF_BASE,    /* 20-byte base SHA of a REF_DELTA */
+    PS_OFS_BASE,    /* variable-length base offset of an OFS_DELTA */
+    PS_BODY,        /* zlib stream of the object body / delta */
+    PS_TRAILER,     /* 20-byte pack checksum */
+    PS_DONE
+};
+
+/* Inflate output chunk used when hashing without keeping the body */
+#define INFLATE_CHUNK 65536
+
+/* Scratch buffers larger than this are freed once their delta tree is done */
+#define PACK_SCRATCH_KEEP (16UL * 1024 * 1024)
+
+/* One object recorded during the scan (the offset → object table). */
+typedef struct {
+    uint64_t offset;            /* start of the object header in the pack */
+    uint64_t data_offset;       /* start of its zlib stream */
+    size_t size;                /* inflated size (of the delta, for deltas) */
+    uint32_t crc32;             /* CRC32 of all the object's raw bytes */
+    int type;                   /* pack type; deltas take the base's type */
+    atomic_int resolved;        /* sha is known (or a worker has claimed it) */
+    ObjectId sha;
+    ObjectId base_sha;          /* REF_DELTA base */
+    uint64_t base_offset;       /* OFS_DELTA base */
+} PackEntry;
+
+struct PackStream {
+    PackMode mode;
+    int state;
+    unsigned char buf[20];  /* pack header / base SHA / trailer accumulator */
+    size_t buf_len;
+    HashCtx *checksum;      /* running SHA-1 of all bytes before the trailer */
 
-/* Type code → git object type string */
-static const char *type_name(int type) {
+    uint32_t obj_count;
+    uint32_t obj_index;
+
+    /* Object currently being parsed */
+    int type;
+    size_t size;
+    int size_shift;
+    ObjectId base_sha;
+    uint64_t base_offset;       /* OFS_DELTA: accumulated, then absolute */
+    int base_offset_bytes;      /* OFS_DELTA offset bytes read so far */
+    z_stream strm;
+    int strm_ready;             /* strm is initialized; reset per object */
+
+    /* PACK_MODE_LOOSE only */
+    ScratchBuf body;            /* the current object, inflated */
+    size_t body_left;           /* body capacity past strm's output window */
+    ScratchBuf result;          /* delta applied to its base */
+    ObjectWriter *writer;       /* NULL until the first object, and with 1 thread */
+
+    uint64_t consumed;          /* pack bytes seen before the current feed */
+    uint64_t obj_offset;        /* offset of the current object's header */
+    PackEntry *entries;         /* one per object, in pack order */
+    int threads;                /* index: delta resolution workers; loose: writers.
+                                   0 = all CPUs */
+
+    /* PACK_MODE_INDEX only */
+    int pack_fd;                /* temp file receiving the raw pack */
+    char tmp_pack[GIT_PATH_MAX];
+    uint64_t data_offset;       /* offset of the current object's zlib stream */
+    uint32_t crc;               /* running CRC32 of the current object */
+    HashCtx *obj_hash;          /* SHA-1 of the current non-delta object */
+    unsigned char *chunk;       /* INFLATE_CHUNK scratch for hashed output */
+};
+
+const char *packfile_type_name(int type) {
     switch (type) {
         case OBJ_COMMIT: return "commit";
         case OBJ_TREE:   return "tree";
@@ -44,6 +163,14 @@ static const char *type_name(int type) {
     }
 }
 
+int packfile_type_code(const char *name, size_t len) {
+    for (int type = OBJ_COMMIT; type <= OBJ_TAG; type++) {
+        const char *candidate = packfile_type_name(type);
+        if (strlen(candidate) == len && memcmp(candidate, name, len) == 0) return type;
+    }
+    return -1;
+}
+
 /* Reads a 4-byte big-endian unsigned integer. */
 static uint32_t read_uint32_be(const unsigned char *p) {
     return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
@@ -51,323 +178,1046 @@ static uint32_t read_uint32_be(const unsigned char *p) {
 }
 
 /*
- * Reads the variable-length type+size header of a pack object.
- *
- * Encoding (first byte):
- *   bit 7     = continuation flag
- *   bits 6-4  = object type (3 bits)
- *   bits 3-0  = size (lowest 4 bits)
- *
- * Subsequent bytes (while continuation flag set):
- *   bit 7     = continuation flag
- *   bits 6-0  = next 7 bits of size, shifted left
- *
- * Example: byte 0x92 = 1001_0010
- *   continuation=1, type=(001)=commit, size_low=0010=2
- *   Next byte needed for more size bits.
+ * Hands an object to the writer pool. Its ID is computed here, since
+ * later deltas may name it as their base; the pool gets its own
+ * formatted copy, as body is a scratch buffer.
  */
-static int read_type_and_size(const unsigned char *data, size_t len, size_t *pos,
-                              int *type, size_t *size) {
-    if (*pos >= len) return 1;
-    unsigned char byte = data[(*pos)++];
-    *type = (byte >> 4) & 0x07;
-    *size = byte & 0x0F;
-    int shift = 4;
-    while (byte & 0x80) {
-        if (*pos >= len) return 1;
-        byte = data[(*pos)++];
-        *size |= (size_t)(byte & 0x7F) << shift;
-        shift += 7;
+static int submit_object(PackStream *ps, const char *type, const unsigned char *body,
+                         size_t size, ObjectId *oid_out) {
+    if (ps->writer == NULL && (ps->writer = object_writer_new(ps->threads)) == NULL) return 1;
+    if (object_hash(type, body, size, oid_out) != 0) return 1;
+
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "%s %zu", type, size);
+    char *data = malloc((size_t)header_len + 1 + size);
+    if (data == NULL) {
+        GIT_ERR("packfile: malloc failed for object\n");
+        return 1;
     }
+    memcpy(data, header, (size_t)header_len + 1);
+    memcpy(data + header_len + 1, body, size);
+    /* Write errors surface from object_writer_flush() */
+    object_writer_submit(ps->writer, data, (size_t)header_len + 1 + size);
     return 0;
 }
 
 /*
- * Decompresses one zlib stream from the packfile.
- *
- * Unlike our decompress_data() utility which uses uncompress(),
- * this uses inflate() directly so we can find out how many
- * compressed bytes were consumed — critical for advancing to the
- * next object in the packfile.
+ * Writes an object in loose mode and offers a copy of its body to the
+ * delta base cache, since later deltas in the pack are likely to build
+ * on it. body stays the caller's (a scratch buffer, reused next time).
+ */
+static int store_object(PackStream *ps, int type, const unsigned char *body, size_t size,
+                        ObjectId *oid_out) {
+    const char *type_name = packfile_type_name(type);
+    /* On one CPU the pool would only add a copy and a second hash */
+    if (ps->threads == 0) ps->threads = thread_pool_default_threads();
+    int failed = ps->threads == 1 ? object_write_body(type_name, body, size, oid_out)
+                                  : submit_object(ps, type_name, body, size, oid_out);
+    if (failed) return 1;
+    /* The cache needs memory of its own, sized to the body */
+    unsigned char *copy = malloc(size > 0 ? size : 1);
+    if (copy == NULL) return 0;
+    memcpy(copy, body, size);
+    if (!delta_cache_put(oid_out->hash, type, copy, size)) free(copy);
+    return 0;
+}
+
+/* Pack type code of a read object, from its "type size\0" header; -1 if malformed. */
+static int object_type_code(const GitObject *obj) {
+    const char *raw = (const char *)obj->raw;
+    const char *space = memchr(raw, ' ', (size_t)((const char *)obj->body - raw));
+    return space == NULL ? -1 : packfile_type_code(raw, (size_t)(space - raw));
+}
+
+/*
+ * Resolves a delta against its base (named by SHA) and writes the result.
  *
- * @param data       Start of compressed data in the packfile.
- * @param avail_in   Maximum bytes available (rest of packfile).
- * @param expected   Expected decompressed size (from pack header).
- * @param consumed   Output: number of compressed bytes consumed.
- * @return           Heap-allocated decompressed data, or NULL on error.
+ * Step 1: Look the base up in the delta base cache
+ * Step 2: On a miss, read it from the object store and parse its type
+ * Step 3: Apply the delta instructions into the result scratch buffer
+ * Step 4: Write the result with the base's type (and cache it)
  */
-static unsigned char *inflate_stream(const unsigned char *data, size_t avail_in,
-                                     size_t expected, size_t *consumed) {
-    unsigned char *out = malloc(expected);
-    if (out == NULL) {
-        GIT_ERR("packfile: malloc failed for inflate (%zu bytes)\n", expected);
-        return NULL;
+static int resolve_delta(PackStream *ps, const ObjectId *base_oid,
+                         const unsigned char *delta, size_t delta_len,
+                         int *type_out, ObjectId *oid_out) {
+    int base_type;
+    size_t base_size;
+    GitObject base_obj = {0};
+    const unsigned char *base = delta_cache_get(base_oid->hash, &base_type, &base_size);
+
+    if (base == NULL) {
+        /* The base may still be queued for writing */
+        if (ps->writer != NULL && object_writer_flush(ps->writer) != 0) return 1;
+        if (object_read(base_oid, &base_obj) != 0) {
+            char hex[OID_HEX_SIZE + 1];
+            GIT_ERR("packfile: cannot read base object %s\n", oid_to_hex(base_oid, hex));
+            return 1;
+        }
+
+        base_type = object_type_code(&base_obj);
+        if (base_type < 0) {
+            GIT_ERR("packfile: malformed base object header\n");
+            free(base_obj.raw);
+            return 1;
+        }
+        base = base_obj.body;
+        base_size = base_obj.body_size;
     }
 
-    z_stream strm = {0};
-    if (inflateInit(&strm) != Z_OK) {
-        GIT_ERR("packfile: inflateInit failed\n");
-        free(out);
-        return NULL;
+    /* The cached base is borrowed: use it before anything else is cached */
+    size_t result_size;
+    int failed = apply_delta_into(base, base_size, delta, delta_len, &ps->result, &result_size);
+    free(base_obj.raw);
+    if (failed) return 1;
+
+    *type_out = base_type;
+    return store_object(ps, base_type, ps->result.data, result_size, oid_out);
+}
+
+/*
+ * Finds the object that starts at offset in the scan table.
+ * Entries are in pack order, so offsets are strictly increasing.
+ */
+static PackEntry *entry_at_offset(PackEntry *entries, uint32_t count, uint64_t offset) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].offset == offset) return &entries[mid];
+        if (entries[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
     }
+    return NULL;
+}
+
+/* Records the object just scanned in index mode. */
+static int record_entry(PackStream *ps) {
+    PackEntry *e = &ps->entries[ps->obj_index];
+    e->data_offset = ps->data_offset;
+    e->size = ps->size;
+    e->crc32 = ps->crc;
 
-    strm.next_in = (Bytef *)data;
-    strm.avail_in = (uInt)avail_in;
-    strm.next_out = out;
-    strm.avail_out = (uInt)expected;
+    if (ps->type == OBJ_REF_DELTA) {
+        e->base_sha = ps->base_sha;
+    } else if (ps->type == OBJ_OFS_DELTA) {
+        e->base_offset = ps->base_offset;
+    } else {
+        hash_final(ps->obj_hash, e->sha.hash);
+        e->resolved = 1;
+    }
+    return 0;
+}
 
-    int ret = inflate(&strm, Z_FINISH);
-    *consumed = strm.total_in;
-    inflateEnd(&strm);
+/*
+ * Handles a fully inflated object. Loose mode writes it directly, or
+ * resolves it first if it is a delta, from ps->body.
+ * Index mode only records where the object lives.
+ */
+static int finish_object(PackStream *ps) {
+    int result = 1;
+    PackEntry *e = &ps->entries[ps->obj_index];
+    memset(e, 0, sizeof(*e));
+    e->offset = ps->obj_offset;
+    e->type = ps->type;
 
-    if (ret != Z_STREAM_END) {
-        GIT_ERR("packfile: inflate failed (ret=%d, expected %zu bytes)\n",
-                ret, expected);
-        free(out);
-        return NULL;
+    if (ps->mode == PACK_MODE_INDEX) {
+        result = record_entry(ps);
+    } else if (ps->type >= OBJ_COMMIT && ps->type <= OBJ_TAG) {
+        result = store_object(ps, ps->type, ps->body.data, ps->size, &e->sha);
+    } else if (ps->type == OBJ_REF_DELTA) {
+        result = resolve_delta(ps, &ps->base_sha, ps->body.data, ps->size, &e->type, &e->sha);
+    } else if (ps->type == OBJ_OFS_DELTA) {
+        /* The base is an earlier object of this same pack */
+        PackEntry *base = entry_at_offset(ps->entries, ps->obj_index, ps->base_offset);
+        if (base == NULL) {
+            GIT_ERR("packfile: OFS_DELTA at offset %llu has no base at offset %llu\n",
+                    (unsigned long long)ps->obj_offset, (unsigned long long)ps->base_offset);
+        } else {
+            result = resolve_delta(ps, &base->sha, ps->body.data, ps->size, &e->type, &e->sha);
+        }
     }
 
-    return out;
+    ps->type = -1;
+    ps->obj_index++;
+    ps->state = ps->obj_index < ps->obj_count ? PS_OBJ_HEADER : PS_TRAILER;
+    return result;
 }
 
 /*
- * Reads a variable-length integer from delta instructions.
- *
- * Each byte contributes 7 bits of value. The MSB (bit 7) is a
- * continuation flag: 1 = more bytes follow, 0 = last byte.
- * Bits accumulate from least significant to most significant.
- *
- * Used for reading source/target sizes at the start of delta data.
+ * Starts a fresh zlib stream for the current object — the previous
+ * object's stream, reset. Loose mode inflates into the body scratch
+ * buffer; index mode inflates through the scratch chunk, hashing
+ * non-delta objects on the fly.
  */
-static size_t read_var_int(const unsigned char *data, size_t len, size_t *pos) {
-    size_t value = 0;
-    int shift = 0;
-    while (*pos < len) {
-        unsigned char byte = data[(*pos)++];
-        value |= (size_t)(byte & 0x7F) << shift;
-        if (!(byte & 0x80)) break;
-        shift += 7;
+static int begin_body(PackStream *ps, uint64_t data_offset) {
+    if (ps->strm_ready) {
+        if (inflateReset(&ps->strm) != Z_OK) {
+            GIT_ERR("packfile: inflateReset failed\n");
+            return 1;
+        }
+    } else {
+        ps->strm = (z_stream){0};
+        if (inflateInit(&ps->strm) != Z_OK) {
+            GIT_ERR("packfile: inflateInit failed\n");
+            return 1;
+        }
+        ps->strm_ready = 1;
+    }
+    ps->state = PS_BODY;
+
+    if (ps->mode == PACK_MODE_INDEX) {
+        ps->data_offset = data_offset;
+        if (ps->type != OBJ_REF_DELTA && ps->type != OBJ_OFS_DELTA) {
+            char header[32];
+            int header_len = snprintf(header, sizeof(header), "%s %zu",
+                                      packfile_type_name(ps->type), ps->size);
+            if (hash_ctx_reset(ps->obj_hash) != 0) return 1;
+            hash_update(ps->obj_hash, header, (size_t)header_len + 1);
+        }
+        return 0;
     }
-    return value;
+
+    /* One spare byte: inflating past the declared size must be seen */
+    if (scratch_reserve(&ps->body, ps->size + 1) == NULL) return 1;
+    ps->strm.next_out = ps->body.data;
+    ps->strm.avail_out = 0;
+    ps->body_left = ps->size + 1;
+    return 0;
 }
 
 /*
- * Applies a delta instruction stream to a base object.
+ * Feeds compressed body bytes to the current object's zlib stream.
  *
- * Delta format:
- *   1. Source (base) size — variable-length integer
- *   2. Target (result) size — variable-length integer
- *   3. Instructions:
- *      - COPY  (MSB=1): copy a range from the base object
- *        Lower 4 bits select which offset bytes follow (0-4 bytes).
- *        Next 3 bits select which size bytes follow (0-3 bytes).
- *        If size=0, it means 0x10000 (64KB).
- *      - INSERT (MSB=0): literal bytes from the delta stream
- *        Lower 7 bits = count of bytes to copy from delta data.
- *
- * @param base       Base object body.
- * @param base_len   Byte count of base.
- * @param delta      Decompressed delta instruction stream.
- * @param delta_len  Byte count of delta.
- * @param out_len    Output: byte count of the result.
- * @return           Heap-allocated result, or NULL on error.
+ * inflate() stops exactly at the end of the zlib stream, so
+ * *consumed tells the caller where the next object begins.
+ * Sets *done once the stream is complete.
  */
-static unsigned char *apply_delta(const unsigned char *base, size_t base_len,
-                                  const unsigned char *delta, size_t delta_len,
-                                  size_t *out_len) {
-    size_t pos = 0;
+static int inflate_some(PackStream *ps, const unsigned char *data, size_t avail,
+                        size_t *consumed, int *done) {
+    /* avail_in is a uInt — large slices are fed over several calls */
+    uInt chunk = avail > UINT32_MAX ? UINT32_MAX : (uInt)avail;
+    ps->strm.next_in = (Bytef *)data;
+    ps->strm.avail_in = chunk;
+    *done = 0;
 
-    /* Read and verify source/target sizes */
-    size_t src_size = read_var_int(delta, delta_len, &pos);
-    size_t tgt_size = read_var_int(delta, delta_len, &pos);
-    (void)src_size; /* validated implicitly — base_len should match */
+    int ret;
+    do {
+        if (ps->mode == PACK_MODE_INDEX) {
+            ps->strm.next_out = ps->chunk;
+            ps->strm.avail_out = INFLATE_CHUNK;
+        } else {
+            zlib_refill_window(&ps->strm.avail_out, &ps->body_left);
+        }
+        ret = inflate(&ps->strm, Z_NO_FLUSH);
+        if (ps->mode == PACK_MODE_INDEX && ps->type != OBJ_REF_DELTA &&
+            ps->type != OBJ_OFS_DELTA) {
+            hash_update(ps->obj_hash, ps->chunk, INFLATE_CHUNK - ps->strm.avail_out);
+        }
+        if (ps->strm.total_out > ps->size) {
+            GIT_ERR("packfile: object %u inflates past its declared %zu bytes\n",
+                    ps->obj_index, ps->size);
+            return 1;
+        }
+    } while (ret == Z_OK && ps->strm.avail_out == 0 && (ps->mode == PACK_MODE_INDEX || ps->body_left > 0));
+    *consumed = chunk - ps->strm.avail_in;
 
-    unsigned char *result = malloc(tgt_size);
-    if (result == NULL) {
-        GIT_ERR("packfile: malloc failed for delta result\n");
-        return NULL;
+    if (ret == Z_STREAM_END) {
+        size_t produced = ps->strm.total_out;
+        if (produced != ps->size) {
+            GIT_ERR("packfile: inflated %zu bytes, expected %zu (object %u)\n",
+                    produced, ps->size, ps->obj_index);
+            return 1;
+        }
+        trace_count(TRACE_BYTES_INFLATED, produced);
+        *done = 1;
+        return 0;
     }
 
-    size_t rpos = 0; /* write position in result */
+    /* Z_BUF_ERROR just means "need more input" when input ran dry */
+    if (ret == Z_OK || (ret == Z_BUF_ERROR && ps->strm.avail_in == 0)) return 0;
 
-    while (pos < delta_len) {
-        unsigned char cmd = delta[pos++];
+    GIT_ERR("packfile: inflate failed (ret=%d, expected %zu bytes)\n",
+            ret, ps->size);
+    return 1;
+}
 
-        if (cmd & 0x80) {
-            /* COPY instruction: copy a slice from the base object.
-             *
-             * The lower 4 bits of cmd tell us which offset bytes follow:
-             *   bit 0 → offset byte 0 (bits 0-7)
-             *   bit 1 → offset byte 1 (bits 8-15)
-             *   bit 2 → offset byte 2 (bits 16-23)
-             *   bit 3 → offset byte 3 (bits 24-31)
-             *
-             * Bits 4-6 tell us which size bytes follow:
-             *   bit 4 → size byte 0 (bits 0-7)
-             *   bit 5 → size byte 1 (bits 8-15)
-             *   bit 6 → size byte 2 (bits 16-23)
-             *
-             * Missing bytes default to 0. Size of 0 means 0x10000. */
-            size_t offset = 0, size = 0;
-            if (cmd & 0x01) { if (pos >= delta_len) goto corrupt; offset  = delta[pos++]; }
-            if (cmd & 0x02) { if (pos >= delta_len) goto corrupt; offset |= (size_t)delta[pos++] << 8; }
-            if (cmd & 0x04) { if (pos >= delta_len) goto corrupt; offset |= (size_t)delta[pos++] << 16; }
-            if (cmd & 0x08) { if (pos >= delta_len) goto corrupt; offset |= (size_t)delta[pos++] << 24; }
-            if (cmd & 0x10) { if (pos >= delta_len) goto corrupt; size  = delta[pos++]; }
-            if (cmd & 0x20) { if (pos >= delta_len) goto corrupt; size |= (size_t)delta[pos++] << 8; }
-            if (cmd & 0x40) { if (pos >= delta_len) goto corrupt; size |= (size_t)delta[pos++] << 16; }
-            if (size == 0) size = 0x10000;
-
-            if (offset + size > base_len || rpos + size > tgt_size) goto corrupt;
-            memcpy(result + rpos, base + offset, size);
-            rpos += size;
-        } else if (cmd > 0) {
-            /* INSERT instruction: copy literal bytes from delta stream */
-            if (pos + cmd > delta_len || rpos + cmd > tgt_size) goto corrupt;
-            memcpy(result + rpos, delta + pos, cmd);
-            pos += cmd;
-            rpos += cmd;
+/* qsort comparator over PackEntry pointers: order deltas by base SHA. */
+static int compare_base_sha(const void *a, const void *b) {
+    return oid_cmp(&(*(PackEntry *const *)a)->base_sha,
+                   &(*(PackEntry *const *)b)->base_sha);
+}
+
+/* qsort comparator over PackEntry pointers: order deltas by base offset. */
+static int compare_base_offset(const void *a, const void *b) {
+    uint64_t x = (*(PackEntry *const *)a)->base_offset;
+    uint64_t y = (*(PackEntry *const *)b)->base_offset;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Shared state for the index-mode delta resolution pass. The tables
+ * are read-only once the workers start; each worker owns the entries
+ * of the delta trees it resolves, and `failed` is the only shared
+ * write.
+ */
+typedef struct {
+    const unsigned char *map;   /* the complete pack, mmap'd */
+    size_t map_len;
+    PackEntry **ref_deltas;     /* REF_DELTA entries sorted by base SHA */
+    size_t ref_count;
+    PackEntry **ofs_deltas;     /* OFS_DELTA entries sorted by base offset */
+    size_t ofs_count;
+    atomic_int failed;          /* set by the first worker that errors */
+} DeltaResolver;
+
+/* One unit of parallel work: a non-delta base and all deltas on top of it. */
+typedef struct {
+    DeltaResolver *resolver;
+    PackEntry *root;
+} DeltaTreeTask;
+
+/* Index of the first REF_DELTA whose base is sha (ref_count if none). */
+static size_t first_ref_child(const DeltaResolver *r, const ObjectId *sha) {
+    size_t lo = 0, hi = r->ref_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (oid_cmp(&r->ref_deltas[mid]->base_sha, sha) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Index of the first OFS_DELTA whose base is at offset (ofs_count if none). */
+static size_t first_ofs_child(const DeltaResolver *r, uint64_t offset) {
+    size_t lo = 0, hi = r->ofs_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (r->ofs_deltas[mid]->base_offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Whether any delta is built directly on this entry. */
+static int has_children(const DeltaResolver *r, const PackEntry *base) {
+    size_t i = first_ref_child(r, &base->sha);
+    if (i < r->ref_count && oid_equal(&r->ref_deltas[i]->base_sha, &base->sha)) return 1;
+    i = first_ofs_child(r, base->offset);
+    return i < r->ofs_count && r->ofs_deltas[i]->base_offset == base->offset;
+}
+
+/*
+ * Per-thread buffers of the resolution pass, kept from tree to tree:
+ * the delta being applied, and one body per depth of the chain being
+ * walked (a body must outlive the resolution of its children).
+ */
+static _Thread_local struct {
+    ScratchBuf delta;
+    ScratchBuf *levels;         /* levels[d]: body at depth d */
+    size_t level_count;
+} resolve_scratch;
+
+static void release_resolve_scratch(void) {
+    scratch_free(&resolve_scratch.delta);
+    for (size_t i = 0; i < resolve_scratch.level_count; i++) scratch_free(&resolve_scratch.levels[i]);
+    free(resolve_scratch.levels);
+    resolve_scratch.levels = NULL;
+    resolve_scratch.level_count = 0;
+}
+
+/* The calling thread's body buffer for chain depth; NULL on failure. */
+static ScratchBuf *resolve_level(size_t depth) {
+    if (depth >= resolve_scratch.level_count) {
+        if (resolve_scratch.level_count == 0) thread_at_exit(release_resolve_scratch);
+        size_t count = resolve_scratch.level_count == 0 ? 16 : resolve_scratch.level_count * 2;
+        while (count <= depth) count *= 2;
+        /* Moves only the ScratchBuf headers; bodies in use stay put */
+        ScratchBuf *grown = realloc(resolve_scratch.levels, count * sizeof(ScratchBuf));
+        if (grown == NULL) {
+            GIT_ERR("packfile: malloc failed for delta chain\n");
+            return NULL;
         }
-        /* cmd == 0 is reserved — skip */
+        memset(grown + resolve_scratch.level_count, 0,
+               (count - resolve_scratch.level_count) * sizeof(ScratchBuf));
+        resolve_scratch.levels = grown;
+        resolve_scratch.level_count = count;
     }
+    return &resolve_scratch.levels[depth];
+}
 
-    *out_len = rpos;
-    return result;
+/* Drops buffers a huge object left behind, once a tree is done. */
+static void trim_resolve_scratch(void) {
+    scratch_trim(&resolve_scratch.delta, PACK_SCRATCH_KEEP);
+    for (size_t i = 0; i < resolve_scratch.level_count; i++) {
+        scratch_trim(&resolve_scratch.levels[i], PACK_SCRATCH_KEEP);
+    }
+}
 
-corrupt:
-    GIT_ERR("packfile: corrupt delta instruction stream\n");
-    free(result);
-    return NULL;
+static int resolve_children(DeltaResolver *r, const PackEntry *base_entry,
+                            const unsigned char *base, size_t base_len, size_t depth);
+
+/* Rebuilds one delta from its base body, names it, and recurses. */
+static int resolve_one(DeltaResolver *r, PackEntry *e, int type,
+                       const unsigned char *base, size_t base_len, size_t depth) {
+    /* A pack may carry the same base twice; resolve each delta once */
+    if (atomic_exchange(&e->resolved, 1)) return 0;
+    if (atomic_load(&r->failed)) return 1;
+    trace_count_max(TRACE_DELTA_DEPTH_MAX, depth + 1);
+
+    /* The delta is spent before any child needs the buffer again */
+    unsigned char *delta = scratch_reserve(&resolve_scratch.delta, e->size);
+    if (delta == NULL ||
+        decompress_into(r->map + e->data_offset, r->map_len - e->data_offset,
+                        delta, e->size, NULL) != 0) return 1;
+
+    ScratchBuf *level = resolve_level(depth);
+    size_t result_size;
+    if (level == NULL || apply_delta_into(base, base_len, delta, e->size, level, &result_size) != 0) {
+        return 1;
+    }
+    if (object_hash(packfile_type_name(type), level->data, result_size, &e->sha) != 0) return 1;
+    e->type = type;
+
+    return resolve_children(r, e, level->data, result_size, depth + 1);
 }
 
 /*
- * Wraps a raw object body in git's "type size\0body" format
- * and writes it to .git/objects/ via object_write().
+ * Resolves every delta built directly on the given base — by SHA or
+ * by offset — then recurses so each result serves as the base for its
+ * own children. Only the current chain's bodies are held in memory.
+ */
+static int resolve_children(DeltaResolver *r, const PackEntry *base_entry,
+                            const unsigned char *base, size_t base_len, size_t depth) {
+    for (size_t i = first_ref_child(r, &base_entry->sha);
+         i < r->ref_count && oid_equal(&r->ref_deltas[i]->base_sha, &base_entry->sha); i++) {
+        if (resolve_one(r, r->ref_deltas[i], base_entry->type, base, base_len, depth) != 0) return 1;
+    }
+    for (size_t i = first_ofs_child(r, base_entry->offset);
+         i < r->ofs_count && r->ofs_deltas[i]->base_offset == base_entry->offset; i++) {
+        if (resolve_one(r, r->ofs_deltas[i], base_entry->type, base, base_len, depth) != 0) return 1;
+    }
+    return 0;
+}
+
+/* Worker body: inflate one root and resolve its whole delta tree. */
+static void resolve_tree_task(void *arg) {
+    DeltaTreeTask *task = arg;
+    DeltaResolver *r = task->resolver;
+    PackEntry *e = task->root;
+    if (atomic_load(&r->failed)) return;
+
+    ScratchBuf *level = resolve_level(0);
+    unsigned char *body = level == NULL ? NULL : scratch_reserve(level, e->size);
+    int failed = body == NULL ||
+                 decompress_into(r->map + e->data_offset, r->map_len - e->data_offset,
+                                 body, e->size, NULL) != 0 ||
+                 resolve_children(r, e, body, e->size, 1) != 0;
+    trim_resolve_scratch();
+    if (failed) atomic_store(&r->failed, 1);
+}
+
+/*
+ * Second pass of index mode: resolve every delta recorded during
+ * streaming (the first pass). The recorded base references form a
+ * forest rooted at non-delta objects; each tree is independent, so the
+ * trees are handed to a worker pool. Every tree is inflated once from
+ * the mapped pack and walked depth-first. Object names do not depend
+ * on the order trees finish in, so the .idx is identical for any
+ * thread count.
  *
- * @return  Heap-allocated 40-char SHA hex (caller frees), or NULL.
+ * Only entries from first_root on are used as roots (a thin pack's
+ * appended bases). *unresolved counts the deltas left without a base.
  */
-static char *write_pack_object(const char *type, const unsigned char *body,
-                               size_t body_size) {
-    int header_len = snprintf(NULL, 0, "%s %zu", type, body_size);
-    size_t total = (size_t)header_len + 1 + body_size;
-    char *obj = malloc(total);
-    if (obj == NULL) return NULL;
-
-    snprintf(obj, (size_t)header_len + 1, "%s %zu", type, body_size);
-    obj[header_len] = '\0';
-    memcpy(obj + header_len + 1, body, body_size);
-
-    char *sha = object_write(obj, total);
-    free(obj);
-    return sha;
-}
-
-int packfile_parse(const unsigned char *data, size_t len) {
-    /* --- Header (12 bytes) --- */
-    if (len < 12 || memcmp(data, "PACK", 4) != 0) {
-        GIT_ERR("packfile: not a valid packfile (bad magic)\n");
+static int resolve_pack_deltas(PackStream *ps, const unsigned char *map, size_t map_len,
+                               uint32_t first_root, size_t *unresolved_out) {
+    DeltaResolver r = { map, map_len, NULL, 0, NULL, 0, 0 };
+    DeltaTreeTask *tasks = NULL;
+    ThreadPool *pool = NULL;
+    int result = 1;
+
+    r.ref_deltas = malloc(((size_t)ps->obj_count + 1) * sizeof(PackEntry *));
+    r.ofs_deltas = malloc(((size_t)ps->obj_count + 1) * sizeof(PackEntry *));
+    if (r.ref_deltas == NULL || r.ofs_deltas == NULL) {
+        GIT_ERR("packfile: malloc failed for delta table\n");
+        goto cleanup;
+    }
+    for (uint32_t i = 0; i < ps->obj_count; i++) {
+        PackEntry *e = &ps->entries[i];
+        if (e->type == OBJ_REF_DELTA) r.ref_deltas[r.ref_count++] = e;
+        else if (e->type == OBJ_OFS_DELTA) r.ofs_deltas[r.ofs_count++] = e;
+    }
+    *unresolved_out = 0;
+    if (r.ref_count + r.ofs_count == 0) {
+        result = 0;
+        goto cleanup;
+    }
+    if (r.ref_count > 1) qsort(r.ref_deltas, r.ref_count, sizeof(PackEntry *), compare_base_sha);
+    if (r.ofs_count > 1) qsort(r.ofs_deltas, r.ofs_count, sizeof(PackEntry *), compare_base_offset);
+
+    /* Roots: non-delta objects that something is built on */
+    size_t task_count = 0;
+    tasks = malloc(((size_t)ps->obj_count + 1) * sizeof(DeltaTreeTask));
+    if (tasks == NULL) {
+        GIT_ERR("packfile: malloc failed for delta table\n");
+        goto cleanup;
+    }
+    for (uint32_t i = first_root; i < ps->obj_count; i++) {
+        PackEntry *e = &ps->entries[i];
+        if (e->type == OBJ_REF_DELTA || e->type == OBJ_OFS_DELTA) continue;
+        if (!has_children(&r, e)) continue;
+        tasks[task_count++] = (DeltaTreeTask){ &r, e };
+    }
+
+    /* Never start more workers than there are trees */
+    int threads = ps->threads > 0 ? ps->threads : thread_pool_default_threads();
+    if ((size_t)threads > task_count) threads = task_count > 0 ? (int)task_count : 1;
+    pool = thread_pool_new(threads);
+    if (pool == NULL) goto cleanup;
+    for (size_t i = 0; i < task_count; i++) {
+        if (thread_pool_submit(pool, resolve_tree_task, &tasks[i]) != 0) {
+            atomic_store(&r.failed, 1);
+            break;
+        }
+    }
+    thread_pool_wait(pool);
+    if (atomic_load(&r.failed)) goto cleanup;
+
+    size_t unresolved = 0;
+    for (size_t i = 0; i < r.ref_count; i++) {
+        if (!r.ref_deltas[i]->resolved) unresolved++;
+    }
+    for (size_t i = 0; i < r.ofs_count; i++) {
+        if (!r.ofs_deltas[i]->resolved) unresolved++;
+    }
+    *unresolved_out = unresolved;
+    result = 0;
+
+cleanup:
+    thread_pool_free(pool);
+    free(tasks);
+    free(r.ref_deltas);
+    free(r.ofs_deltas);
+    return result;
+}
+
+/* Encodes a pack object header (type + variable-length size); returns its length. */
+static size_t encode_object_header(int type, size_t size, unsigned char *out) {
+    size_t n = 0;
+    unsigned char byte = (unsigned char)((type << 4) | (size & 0x0F));
+    size >>= 4;
+    while (size > 0) {
+        out[n++] = byte | 0x80;
+        byte = size & 0x7F;
+        size >>= 7;
+    }
+    out[n++] = byte;
+    return n;
+}
+
+/* qsort comparator over ObjectIds. */
+static int compare_oid(const void *a, const void *b) {
+    return oid_cmp(a, b);
+}
+
+/*
+ * Appends one object from the object store to the end of the pack as
+ * a full (non-delta) entry, recording it as a resolved root.
+ */
+static int append_base(PackStream *ps, const ObjectId *oid, uint64_t *pack_len) {
+    GitObject obj = {0};
+    if (object_read(oid, &obj) != 0) return 1;
+    int result = 1;
+    unsigned char *compressed = NULL;
+    int type = object_type_code(&obj);
+    if (type < 0) {
+        GIT_ERR("packfile: malformed object header\n");
+        goto cleanup;
+    }
+
+    unsigned long compressed_len = 0;
+    const unsigned char *body = compressed;
+    if (obj.body_size == 0) {
+        /* compress_data() refuses empty input; this is zlib's empty stream */
+        static const unsigned char empty[] = { 0x78, 0x9c, 0x03, 0x00, 0x00, 0x00, 0x00, 0x01 };
+        body = empty;
+        compressed_len = sizeof(empty);
+    } else {
+        compressed = compress_data(obj.body, obj.body_size, &compressed_len);
+        if (compressed == NULL) goto cleanup;
+        body = compressed;
+    }
+
+    unsigned char header[16];
+    size_t header_len = encode_object_header(type, obj.body_size, header);
+    if (write_all(ps->pack_fd, header, header_len) != 0 ||
+        write_all(ps->pack_fd, body, compressed_len) != 0) {
+        GIT_ERR("packfile: error writing %s: %s\n", ps->tmp_pack, strerror(errno));
+        goto cleanup;
+    }
+
+    PackEntry *e = &ps->entries[ps->obj_count++];
+    memset(e, 0, sizeof(*e));
+    e->offset = *pack_len;
+    e->data_offset = *pack_len + header_len;
+    e->size = obj.body_size;
+    e->type = type;
+    e->sha = *oid;
+    e->resolved = 1;
+    e->crc32 = (uint32_t)crc32(crc32(0L, Z_NULL, 0), header, (uInt)header_len);
+    e->crc32 = (uint32_t)crc32(e->crc32, body, (uInt)compressed_len);
+    *pack_len += header_len + compressed_len;
+    result = 0;
+
+cleanup:
+    free(compressed);
+    free(obj.raw);
+    return result;
+}
+
+/*
+ * Completes a thin pack: every REF_DELTA base that is missing from the
+ * pack but present locally is appended, the header's object count and
+ * the trailing checksum are rewritten, and the deltas are resolved
+ * against the new entries. *pack_len is updated to the new length.
+ */
+static int complete_thin_pack(PackStream *ps, uint64_t *pack_len) {
+    uint32_t old_count = ps->obj_count;
+    ObjectId *bases = malloc(((size_t)old_count + 1) * sizeof(ObjectId));
+    unsigned char *map = MAP_FAILED;
+    size_t map_len = 0;
+    int result = 1;
+    if (bases == NULL) {
+        GIT_ERR("packfile: malloc failed for thin pack bases\n");
+        return 1;
+    }
+
+    /* Bases of unresolved REF_DELTAs, once each; those that are only
+     * missing because their own base is will follow from the others */
+    size_t base_count = 0;
+    for (uint32_t i = 0; i < old_count; i++) {
+        PackEntry *e = &ps->entries[i];
+        if (e->type == OBJ_REF_DELTA && !e->resolved) bases[base_count++] = e->base_sha;
+    }
+    if (base_count > 1) qsort(bases, base_count, sizeof(ObjectId), compare_oid);
+    size_t unique = 0;
+    for (size_t i = 0; i < base_count; i++) {
+        if (unique > 0 && oid_equal(&bases[unique - 1], &bases[i])) continue;
+        if (object_exists(&bases[i])) bases[unique++] = bases[i];
+    }
+    if (unique == 0) goto missing;
+
+    PackEntry *grown = realloc(ps->entries, ((size_t)old_count + unique + 1) * sizeof(PackEntry));
+    if (grown == NULL) {
+        GIT_ERR("packfile: malloc failed for thin pack bases\n");
+        goto cleanup;
+    }
+    ps->entries = grown;
+
+    /* The old trailer goes; the new objects take its place */
+    *pack_len -= OID_RAW_SIZE;
+    if (ftruncate(ps->pack_fd, (off_t)*pack_len) != 0 ||
+        lseek(ps->pack_fd, (off_t)*pack_len, SEEK_SET) < 0) {
+        GIT_ERR("packfile: cannot rewrite %s: %s\n", ps->tmp_pack, strerror(errno));
+        goto cleanup;
+    }
+    for (size_t i = 0; i < unique; i++) {
+        if (append_base(ps, &bases[i], pack_len) != 0) goto cleanup;
+    }
+    unsigned char count[4] = {
+        (unsigned char)(ps->obj_count >> 24), (unsigned char)(ps->obj_count >> 16),
+        (unsigned char)(ps->obj_count >> 8), (unsigned char)ps->obj_count
+    };
+    if (pwrite(ps->pack_fd, count, sizeof(count), 8) != (ssize_t)sizeof(count)) {
+        GIT_ERR("packfile: cannot rewrite %s: %s\n", ps->tmp_pack, strerror(errno));
+        goto cleanup;
+    }
+
+    map_len = (size_t)*pack_len;
+    map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, ps->pack_fd, 0);
+    if (map == MAP_FAILED) {
+        GIT_ERR("packfile: cannot map %s: %s\n", ps->tmp_pack, strerror(errno));
+        goto cleanup;
+    }
+    HashPart whole = { map, map_len };
+    if (hash_parts(HASH_SHA1, &whole, 1, ps->buf) != 0 ||
+        write_all(ps->pack_fd, ps->buf, OID_RAW_SIZE) != 0) {
+        GIT_ERR("packfile: cannot rewrite %s trailer\n", ps->tmp_pack);
+        goto cleanup;
+    }
+    *pack_len += OID_RAW_SIZE;
+
+    size_t unresolved;
+    if (resolve_pack_deltas(ps, map, map_len, old_count, &unresolved) != 0) goto cleanup;
+    if (unresolved == 0) {
+        result = 0;
+        goto cleanup;
+    }
+
+missing:
+    GIT_ERR("packfile: deltas reference bases missing from the pack and the object store\n");
+
+cleanup:
+    if (map != MAP_FAILED) munmap(map, map_len);
+    free(bases);
+    return result;
+}
+
+/*
+ * Completes index mode once the whole pack has arrived: resolves
+ * deltas (completing a thin pack first if needed), writes the .idx,
+ * and moves both files to their final pack-<checksum> names under
+ * .git/objects/pack/.
+ */
+static int finish_index(PackStream *ps) {
+    const unsigned char *pack_sha = ps->buf;
+    uint64_t pack_len = ps->consumed;
+    int result = 1;
+
+    unsigned char *map = mmap(NULL, (size_t)pack_len, PROT_READ, MAP_PRIVATE, ps->pack_fd, 0);
+    if (map == MAP_FAILED) {
+        GIT_ERR("packfile: cannot map %s: %s\n", ps->tmp_pack, strerror(errno));
         return 1;
     }
+    uint64_t start = trace_now();
+    size_t unresolved;
+    int failed = resolve_pack_deltas(ps, map, (size_t)pack_len, 0, &unresolved);
+    munmap(map, (size_t)pack_len);
+    if (failed) return 1;
+    if (unresolved > 0 && complete_thin_pack(ps, &pack_len) != 0) return 1;
+    trace_span("pack.resolve", start);
 
-    uint32_t version = read_uint32_be(data + 4);
-    if (version != 2) {
-        GIT_ERR("packfile: unsupported version %u (expected 2)\n", version);
+    PackIndexEntry *index = malloc(((size_t)ps->obj_count + 1) * sizeof(PackIndexEntry));
+    if (index == NULL) {
+        GIT_ERR("packfile: malloc failed for index entries\n");
         return 1;
     }
+    for (uint32_t i = 0; i < ps->obj_count; i++) {
+        memcpy(index[i].sha, ps->entries[i].sha.hash, OID_RAW_SIZE);
+        index[i].crc32 = ps->entries[i].crc32;
+        index[i].offset = ps->entries[i].offset;
+    }
+
+    char hex[OID_HEX_SIZE + 1];
+    hex_encode(pack_sha, OID_RAW_SIZE, hex);
+    char tmp_idx[sizeof(ps->tmp_pack) + sizeof(".idx")], pack_path[GIT_PATH_MAX], idx_path[GIT_PATH_MAX];
+    if ((size_t)snprintf(tmp_idx, sizeof(tmp_idx), "%s.idx", ps->tmp_pack) >= sizeof(tmp_idx)) {
+        GIT_ERR("packfile: path too long: %s\n", ps->tmp_pack);
+        goto cleanup;
+    }
+    snprintf(pack_path, sizeof(pack_path), "%s/pack-%s.pack", GIT_PACK_DIR, hex);
+    snprintf(idx_path, sizeof(idx_path), "%s/pack-%s.idx", GIT_PACK_DIR, hex);
 
-    uint32_t obj_count = read_uint32_be(data + 8);
-    size_t pos = 12;
+    start = trace_now();
+    if (pack_index_write(tmp_idx, index, ps->obj_count, pack_sha) != 0) goto cleanup;
+    trace_span("pack.write_index", start);
 
-    /* --- Process each object --- */
-    for (uint32_t i = 0; i < obj_count; i++) {
-        int type;
-        size_t size;
-        if (read_type_and_size(data, len, &pos, &type, &size) != 0) {
-            GIT_ERR("packfile: truncated object header at index %u\n", i);
-            return 1;
+    if (loose_store_sync_file(ps->pack_fd) != 0) {
+        GIT_ERR("packfile: error syncing %s: %s\n", ps->tmp_pack, strerror(errno));
+        unlink(tmp_idx);
+        goto cleanup;
+    }
+    /* Pack first: a reader must never find an .idx without its pack */
+    if (rename(ps->tmp_pack, pack_path) != 0 || rename(tmp_idx, idx_path) != 0) {
+        GIT_ERR("packfile: cannot install %s: %s\n", pack_path, strerror(errno));
+        unlink(tmp_idx);
+        goto cleanup;
+    }
+    ps->tmp_pack[0] = '\0';
+    packstore_reprepare();
+    result = 0;
+
+cleanup:
+    free(index);
+    return result;
+}
+
+void packfile_stream_set_threads(PackStream *ps, int threads) {
+    ps->threads = threads;
+}
+
+PackStream *packfile_stream_new(PackMode mode) {
+    PackStream *ps = calloc(1, sizeof(PackStream));
+    if (ps == NULL) {
+        GIT_ERR("packfile: malloc failed for stream state\n");
+        return NULL;
+    }
+    ps->mode = mode;
+    ps->state = PS_HEADER;
+    ps->pack_fd = -1;
+    ps->checksum = hash_ctx_new(HASH_SHA1);
+    if (ps->checksum == NULL) {
+        GIT_ERR("packfile: failed to initialise pack checksum\n");
+        packfile_stream_free(ps);
+        return NULL;
+    }
+
+    if (mode == PACK_MODE_INDEX) {
+        ps->obj_hash = hash_ctx_new(HASH_SHA1);
+        ps->chunk = malloc(INFLATE_CHUNK);
+        if (ps->obj_hash == NULL || ps->chunk == NULL) {
+            GIT_ERR("packfile: malloc failed for index state\n");
+            packfile_stream_free(ps);
+            return NULL;
+        }
+        if (mkdir(GIT_PACK_DIR, DIRECTORY_PERMISSION) == -1 && errno != EEXIST) {
+            GIT_ERR("packfile: cannot create %s: %s\n", GIT_PACK_DIR, strerror(errno));
+            packfile_stream_free(ps);
+            return NULL;
         }
+        snprintf(ps->tmp_pack, sizeof(ps->tmp_pack), "%s/tmp_pack_XXXXXX", GIT_PACK_DIR);
+        ps->pack_fd = mkstemp(ps->tmp_pack);
+        if (ps->pack_fd < 0) {
+            GIT_ERR("packfile: cannot create temporary pack: %s\n", strerror(errno));
+            ps->tmp_pack[0] = '\0';
+            packfile_stream_free(ps);
+            return NULL;
+        }
+    }
+    return ps;
+}
+
+/* packfile_stream_feed() itself, less the timing. */
+static int stream_feed(PackStream *ps, const unsigned char *data, size_t len) {
+    size_t pos = 0;
+
+    /* Index mode keeps the pack verbatim — every byte goes to disk */
+    if (ps->mode == PACK_MODE_INDEX && write_all(ps->pack_fd, data, len) != 0) {
+        GIT_ERR("packfile: error writing %s: %s\n", ps->tmp_pack, strerror(errno));
+        return 1;
+    }
 
-        /* For REF_DELTA: read the 20-byte binary SHA of the base object */
-        unsigned char base_sha_bin[20];
-        if (type == OBJ_REF_DELTA) {
-            if (pos + 20 > len) {
-                GIT_ERR("packfile: truncated REF_DELTA SHA at index %u\n", i);
+    while (pos < len) {
+        size_t start = pos;
+        int state = ps->state;
+        int object_done = 0;
+
+        switch (state) {
+        case PS_HEADER: {
+            /* --- Header (12 bytes) --- */
+            size_t take = len - pos < 12 - ps->buf_len ? len - pos : 12 - ps->buf_len;
+            memcpy(ps->buf + ps->buf_len, data + pos, take);
+            ps->buf_len += take;
+            pos += take;
+            if (ps->buf_len < 12) break;
+
+            if (memcmp(ps->buf, "PACK", 4) != 0) {
+                GIT_ERR("packfile: not a valid packfile (bad magic)\n");
+                return 1;
+            }
+            uint32_t version = read_uint32_be(ps->buf + 4);
+            if (version != 2) {
+                GIT_ERR("packfile: unsupported version %u (expected 2)\n", version);
                 return 1;
             }
-            memcpy(base_sha_bin, data + pos, 20);
-            pos += 20;
+            ps->obj_count = read_uint32_be(ps->buf + 8);
+            ps->buf_len = 0;
+            ps->entries = malloc(((size_t)ps->obj_count + 1) * sizeof(PackEntry));
+            if (ps->entries == NULL) {
+                GIT_ERR("packfile: malloc failed for %u object entries\n", ps->obj_count);
+                return 1;
+            }
+            ps->state = ps->obj_count > 0 ? PS_OBJ_HEADER : PS_TRAILER;
+            ps->type = -1;
+            break;
         }
 
-        /* Decompress the object body (or delta instructions) */
-        size_t consumed;
-        unsigned char *body = inflate_stream(data + pos, len - pos,
-                                             size, &consumed);
-        if (body == NULL) return 1;
-        pos += consumed;
-
-        if (type >= OBJ_COMMIT && type <= OBJ_TAG) {
-            /* Non-delta object: write directly */
-            char *sha = write_pack_object(type_name(type), body, size);
-            free(body);
-            if (sha == NULL) return 1;
-            free(sha);
-
-        } else if (type == OBJ_REF_DELTA) {
-            /* Delta object: resolve against base, then write.
+        case PS_OBJ_HEADER: {
+            /*
+             * Variable-length type+size header of a pack object.
+             *
+             * Encoding (first byte):
+             *   bit 7     = continuation flag
+             *   bits 6-4  = object type (3 bits)
+             *   bits 3-0  = size (lowest 4 bits)
+             *
+             * Subsequent bytes (while continuation flag set):
+             *   bit 7     = continuation flag
+             *   bits 6-0  = next 7 bits of size, shifted left
              *
-             * Step 1: Convert 20-byte binary SHA → 40-char hex string
-             * Step 2: Read the base object from .git/objects/
-             * Step 3: Extract the base object's type from its raw header
-             * Step 4: Apply the delta instructions to get the result
-             * Step 5: Write the result with the base's type
+             * Example: byte 0x92 = 1001_0010
+             *   continuation=1, type=(001)=commit, size_low=0010=2
+             *   Next byte needed for more size bits.
              */
-            char *base_hex = hex_to_string(base_sha_bin, 20);
-            if (base_hex == NULL) { free(body); return 1; }
-
-            GitObject base_obj;
-            if (object_read(base_hex, &base_obj) != 0) {
-                GIT_ERR("packfile: cannot read base object %s\n", base_hex);
-                free(base_hex);
-                free(body);
+            if (ps->type == -1) {
+                ps->obj_offset = ps->consumed + pos;
+                ps->crc = crc32(0L, Z_NULL, 0);
+            }
+            unsigned char byte = data[pos++];
+            if (ps->type == -1) {
+                ps->type = (byte >> 4) & 0x07;
+                ps->size = byte & 0x0F;
+                ps->size_shift = 4;
+            } else {
+                if (ps->size_shift > 57) {
+                    GIT_ERR("packfile: object size overflow at index %u\n", ps->obj_index);
+                    return 1;
+                }
+                ps->size |= (size_t)(byte & 0x7F) << ps->size_shift;
+                ps->size_shift += 7;
+            }
+            if (byte & 0x80) break;
+
+            if (ps->type == OBJ_REF_DELTA) {
+                ps->buf_len = 0;
+                ps->state = PS_REF_BASE;
+            } else if (ps->type == OBJ_OFS_DELTA) {
+                ps->base_offset = 0;
+                ps->base_offset_bytes = 0;
+                ps->state = PS_OFS_BASE;
+            } else if (ps->type >= OBJ_COMMIT && ps->type <= OBJ_TAG) {
+                if (begin_body(ps, ps->consumed + pos) != 0) return 1;
+            } else {
+                GIT_ERR("packfile: unsupported object type %d at index %u\n",
+                        ps->type, ps->obj_index);
                 return 1;
             }
-            free(base_hex);
-
-            /* Parse type from the raw header: "type size\0..." */
-            const char *space = memchr(base_obj.raw, ' ', 32);
-            if (space == NULL) {
-                GIT_ERR("packfile: malformed base object header\n");
-                free(body);
-                free(base_obj.raw);
+            break;
+        }
+
+        case PS_REF_BASE: {
+            /* For REF_DELTA: the 20-byte binary SHA of the base object */
+            size_t take = len - pos < 20 - ps->buf_len ? len - pos : 20 - ps->buf_len;
+            memcpy(ps->base_sha.hash + ps->buf_len, data + pos, take);
+            ps->buf_len += take;
+            pos += take;
+            if (ps->buf_len < 20) break;
+            ps->buf_len = 0;
+            if (begin_body(ps, ps->consumed + pos) != 0) return 1;
+            break;
+        }
+
+        case PS_OFS_BASE: {
+            /*
+             * OFS_DELTA: distance back from this object's header to the
+             * base's header. Big-endian 7-bit groups with an MSB
+             * continuation flag; each continuation adds one before
+             * shifting so that no two encodings mean the same value.
+             */
+            unsigned char byte = data[pos++];
+            if (ps->base_offset_bytes > 0) {
+                if (ps->base_offset > (UINT64_MAX >> 7) - 1) {
+                    GIT_ERR("packfile: OFS_DELTA offset overflow at index %u\n", ps->obj_index);
+                    return 1;
+                }
+                ps->base_offset = (ps->base_offset + 1) << 7;
+            }
+            ps->base_offset |= byte & 0x7F;
+            ps->base_offset_bytes++;
+            if (byte & 0x80) break;
+
+            if (ps->base_offset == 0 || ps->base_offset > ps->obj_offset) {
+                GIT_ERR("packfile: OFS_DELTA at index %u points outside the pack\n", ps->obj_index);
                 return 1;
             }
-            size_t tlen = (size_t)(space - (const char *)base_obj.raw);
-            char base_type[16];
-            if (tlen >= sizeof(base_type)) tlen = sizeof(base_type) - 1;
-            memcpy(base_type, base_obj.raw, tlen);
-            base_type[tlen] = '\0';
-
-            /* Apply delta */
-            size_t result_size;
-            unsigned char *result = apply_delta(base_obj.body, base_obj.body_size,
-                                                body, size, &result_size);
-            free(body);
-            free(base_obj.raw);
+            ps->base_offset = ps->obj_offset - ps->base_offset;
+            if (begin_body(ps, ps->consumed + pos) != 0) return 1;
+            break;
+        }
 
-            if (result == NULL) return 1;
+        case PS_BODY: {
+            /* Decompress the object body (or delta instructions) */
+            size_t consumed;
+            int done;
+            if (inflate_some(ps, data + pos, len - pos, &consumed, &done) != 0) return 1;
+            pos += consumed;
+            object_done = done;
+            break;
+        }
 
-            char *sha = write_pack_object(base_type, result, result_size);
-            free(result);
-            if (sha == NULL) return 1;
-            free(sha);
+        case PS_TRAILER: {
+            size_t take = len - pos < 20 - ps->buf_len ? len - pos : 20 - ps->buf_len;
+            memcpy(ps->buf + ps->buf_len, data + pos, take);
+            ps->buf_len += take;
+            pos += take;
+            if (ps->buf_len < 20) break;
 
-        } else {
-            GIT_ERR("packfile: unsupported object type %d at index %u\n",
-                    type, i);
-            free(body);
+            unsigned char expected[OID_RAW_SIZE];
+            hash_final(ps->checksum, expected);
+            if (memcmp(expected, ps->buf, OID_RAW_SIZE) != 0) {
+                GIT_ERR("packfile: pack checksum mismatch\n");
+                return 1;
+            }
+            ps->state = PS_DONE;
+            break;
+        }
+
+        case PS_DONE:
+        default:
+            GIT_ERR("packfile: %zu unexpected bytes after pack trailer\n", len - pos);
             return 1;
         }
+
+        /* Everything before the trailer is covered by the pack checksum */
+        if (state != PS_TRAILER) {
+            hash_update(ps->checksum, data + start, pos - start);
+        }
+        /* The .idx stores a CRC32 of each object's raw bytes */
+        if (ps->mode == PACK_MODE_INDEX && state != PS_HEADER && state != PS_TRAILER) {
+            ps->crc = crc32(ps->crc, data + start, (uInt)(pos - start));
+        }
+        if (object_done && finish_object(ps) != 0) return 1;
     }
 
+    ps->consumed += len;
     return 0;
 }
+
+int packfile_stream_feed(PackStream *ps, const unsigned char *data, size_t len) {
+    uint64_t start = trace_now();
+    int result = stream_feed(ps, data, len);
+    trace_count_since(TRACE_PACK_PARSE_NS, start);
+    return result;
+}
+
+int packfile_stream_finish(PackStream *ps) {
+    if (ps->state != PS_DONE) {
+        GIT_ERR("packfile: pack truncated after %u of %u objects\n",
+                ps->obj_index, ps->obj_count);
+        return 1;
+    }
+    if (ps->mode == PACK_MODE_INDEX) return finish_index(ps);
+    return ps->writer != NULL && object_writer_flush(ps->writer) != 0;
+}
+
+const unsigned char *packfile_stream_checksum(const PackStream *ps) {
+    return ps->state == PS_DONE ? ps->buf : NULL;
+}
+
+void packfile_stream_free(PackStream *ps) {
+    if (ps == NULL) return;
+    if (ps->strm_ready) inflateEnd(&ps->strm);
+    object_writer_free(ps->writer);
+    if (ps->pack_fd >= 0) close(ps->pack_fd);
+    /* Still set only if the pack never made it to its final name */
+    if (ps->tmp_pack[0] != '\0') unlink(ps->tmp_pack);
+    hash_ctx_free(ps->checksum);
+    hash_ctx_free(ps->obj_hash);
+    free(ps->entries);
+    free(ps->chunk);
+    scratch_free(&ps->body);
+    scratch_free(&ps->result);
+    free(ps);
+}
+
+int packfile_parse(const unsigned char *data, size_t len, int threads) {
+    PackStream *ps = packfile_stream_new(PACK_MODE_LOOSE);
+    if (ps == NULL) return 1;
+    packfile_stream_set_threads(ps, threads);
+
+    int result = packfile_stream_feed(ps, data, len) != 0 ||
+                 packfile_stream_finish(ps) != 0;
+    packfile_stream_free(ps);
+    return result;
+}
+
+int packfile_index_buffer(const unsigned char *data, size_t len, int threads,
+                          unsigned char *checksum_out) {
+    PackStream *ps = packfile_stream_new(PACK_MODE_INDEX);
+    if (ps == NULL) return 1;
+    packfile_stream_set_threads(ps, threads);
+
+    int result = packfile_stream_feed(ps, data, len) != 0 ||
+                 packfile_stream_finish(ps) != 0;
+    if (result == 0) memcpy(checksum_out, packfile_stream_checksum(ps), OID_RAW_SIZE);
+    packfile_stream_free(ps);
+    return result;
+}
@@ -1,9 +1,10 @@
 /*
  * packfile.h
  *
- * Parses a git packfile and writes all contained objects to
- * .git/objects/. Handles non-delta objects (commit, tree, blob, tag)
- * and REF_DELTA objects that reference a base by SHA.
+ * Parses a git packfile and stores its objects — either exploded into
+ * loose objects under .git/objects/, or kept as a .pack + .idx pair
+ * under .git/objects/pack/. Handles non-delta objects (commit, tree,
+ * blob, tag) and REF_DELTA objects that reference a base by SHA.
  */
 
 #ifndef PACKFILE_H
@@ -11,21 +12,123 @@
 
 #include <stddef.h>
 
+/* Pack object type codes */
+#define OBJ_COMMIT    1
+#define OBJ_TREE      2
+#define OBJ_BLOB      3
+#define OBJ_TAG       4
+#define OBJ_OFS_DELTA 6
+#define OBJ_REF_DELTA 7
+
+/* Maps a non-delta type code to its object type string ("blob", ...),
+ * or NULL for delta and unknown codes. */
+const char *packfile_type_name(int type);
+
+/* Inverse of packfile_type_name(): maps the first len bytes of name
+ * to a type code, or -1 if it is not an object type. */
+int packfile_type_code(const char *name, size_t len);
+
+/* Resumable packfile parser state (opaque). */
+typedef struct PackStream PackStream;
+
+/* How a streamed pack ends up in the object store. */
+typedef enum {
+    PACK_MODE_LOOSE,  /* inflate and write every object to .git/objects/xx/ */
+    PACK_MODE_INDEX   /* keep the pack verbatim and generate its .idx */
+} PackMode;
+
+/*
+ * Creates a streaming packfile parser.
+ *
+ * Bytes are pushed in with packfile_stream_feed() in slices of any
+ * size. In PACK_MODE_LOOSE every object is inflated and written to the
+ * object store as soon as its last byte arrives; delta bases follow
+ * the same rules as packfile_parse().
+ *
+ * In PACK_MODE_INDEX the bytes are written to a temporary file under
+ * .git/objects/pack/ while non-delta objects are hashed on the fly.
+ * packfile_stream_finish() then resolves the deltas (all bases must be
+ * inside the pack) and installs pack-<checksum>.pack and .idx.
+ *
+ * @param mode  Where the objects should end up.
+ * @return      Parser state (free with packfile_stream_free), or NULL.
+ */
+PackStream *packfile_stream_new(PackMode mode);
+
+/*
+ * Sets how many threads the parser uses.
+ *
+ * PACK_MODE_INDEX resolves trees of deltas that share no base in
+ * parallel; the resulting .idx does not depend on the thread count.
+ * PACK_MODE_LOOSE compresses and writes objects on that many writer
+ * threads while the caller's thread keeps parsing.
+ *
+ * @param ps       Parser state.
+ * @param threads  Worker count; 0 (the default) uses every online CPU,
+ *                 1 does all the work on the calling thread.
+ */
+void packfile_stream_set_threads(PackStream *ps, int threads);
+
+/*
+ * Pushes the next slice of packfile bytes into the parser.
+ *
+ * @param ps    Parser state.
+ * @param data  Next bytes of the packfile.
+ * @param len   Byte count of data.
+ * @return      0 on success, 1 on malformed data or write failure.
+ */
+int packfile_stream_feed(PackStream *ps, const unsigned char *data, size_t len);
+
+/*
+ * Checks that the whole pack (including its trailing checksum)
+ * has been consumed. In PACK_MODE_INDEX this also resolves deltas and
+ * writes the .pack + .idx pair; the temporary file is removed on failure.
+ *
+ * @return  0 if complete and verified, 1 if truncated or on error.
+ */
+int packfile_stream_finish(PackStream *ps);
+
+/*
+ * Returns the pack's trailing 20-byte SHA-1 checksum (which also names
+ * the pack-<checksum>.pack file), or NULL if the pack is incomplete.
+ */
+const unsigned char *packfile_stream_checksum(const PackStream *ps);
+
+/* Frees parser state. Safe to call with NULL. */
+void packfile_stream_free(PackStream *ps);
+
 /*
  * Parses a raw packfile and writes every object to the object store.
  *
  * The packfile must start with the "PACK" magic and be version 2.
  * Objects are decompressed with zlib and written in git's standard
- * format ("type size\0body") via object_write().
+ * format ("type size\0body") via object_write_body().
  *
  * Delta objects (REF_DELTA) are resolved by reading their base from
- * .git/objects/ — base objects must already be written (packfiles
- * guarantee bases come before their deltas).
+ * the delta base cache or .git/objects/ — base objects must already be
+ * written (packfiles guarantee bases come before their deltas).
  *
- * @param data  Raw packfile bytes (starting with "PACK").
- * @param len   Byte count of data.
- * @return      0 on success, 1 on failure.
+ * Convenience wrapper over the streaming parser for in-memory packs.
+ *
+ * @param data     Raw packfile bytes (starting with "PACK").
+ * @param len      Byte count of data.
+ * @param threads  Object writer threads; 0 = every online CPU,
+ *                 1 writes each object on the calling thread.
+ * @return         0 on success, 1 on failure.
+ */
+int packfile_parse(const unsigned char *data, size_t len, int threads);
+
+/*
+ * Installs an in-memory (typically mmap'd) packfile as
+ * pack-<checksum>.pack with its .idx, like PACK_MODE_INDEX streaming.
+ *
+ * @param data          Raw packfile bytes (starting with "PACK").
+ * @param len           Byte count of data.
+ * @param threads       Delta resolution workers; 0 = every online CPU.
+ * @param checksum_out  Output: the pack's 20-byte checksum.
+ * @return              0 on success, 1 on failure.
  */
-int packfile_parse(const unsigned char *data, size_t len);
+int packfile_index_buffer(const unsigned char *data, size_t len, int threads,
+                          unsigned char *checksum_out);
 
 #endif /* PACKFILE_H */
@@ -0,0 +1,44 @@
+/*
+ * packindex.h
+ *
+ * Writes version 2 pack index (.idx) files — the lookup table that
+ * lets a reader find an object inside a .pack by SHA-1 without
+ * scanning the pack.
+ */
+
+#ifndef PACKINDEX_H
+#define PACKINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* One object as it appears in the index. */
+typedef struct {
+    unsigned char sha[20];  /* binary object name */
+    uint32_t crc32;         /* CRC32 of the object's raw bytes in the pack */
+    uint64_t offset;        /* byte offset of the object's header in the pack */
+} PackIndexEntry;
+
+/*
+ * Writes a v2 .idx file for a pack.
+ *
+ * Layout:
+ *   "\377tOc" + version 2
+ *   256-entry fanout table (cumulative object counts by first SHA byte)
+ *   N sorted 20-byte SHAs
+ *   N CRC32s, N 4-byte offsets (MSB set → index into the 8-byte table)
+ *   8-byte offsets for objects past 2 GiB
+ *   20-byte pack checksum, 20-byte checksum of the index itself
+ *
+ * Sorts entries in place by SHA.
+ *
+ * @param path      Destination file path.
+ * @param entries   Objects contained in the pack.
+ * @param count     Number of entries.
+ * @param pack_sha  The pack's trailing 20-byte checksum.
+ * @return          0 on success, 1 on failure.
+ */
+int pack_index_write(const char *path, PackIndexEntry *entries, size_t count,
+                     const unsigned char *pack_sha);
+
+#endif /* PACKINDEX_H */
@@ -0,0 +1,66 @@
+/*
+ * packstore.h
+ *
+ * Read access to objects stored in .git/objects/pack/. Every
+ * pack-*.idx and its .pack are mmap'd once per process; lookups
+ * binary-search the index and inflate straight from the mapping.
+ */
+
+#ifndef PACKSTORE_H
+#define PACKSTORE_H
+
+#include <stddef.h>
+
+#include "../objects/object.h"
+
+/*
+ * Looks up an object by ID in the local packs.
+ *
+ * Packs are discovered and mapped on the first call. On success,
+ * *out is populated exactly like object_read() does: raw holds
+ * "type size\0body" and must be freed by the caller.
+ *
+ * @param oid  Object to look up.
+ * @param out  Output struct populated on success.
+ * @return     0 on success, 1 if the object is not in any pack,
+ *             -1 if it was found but could not be unpacked.
+ */
+int packstore_read(const ObjectId *oid, GitObject *out);
+
+/*
+ * Looks up an object's type and size without inflating its body.
+ *
+ * Non-delta entries carry both in the pack entry header. For deltas
+ * only the first bytes of the delta are inflated (for the result
+ * size), and the type is taken from the end of the base chain.
+ *
+ * @param oid   Object to look up.
+ * @param type  Output: pack type code (OBJ_COMMIT..OBJ_TAG).
+ * @param size  Output: body size.
+ * @return      0 on success, 1 if the object is not in any pack,
+ *              -1 if it was found but is corrupt.
+ */
+int packstore_read_header(const ObjectId *oid, int *type, size_t *size);
+
+/*
+ * Checks whether any local pack contains the object.
+ *
+ * @param oid  Object to look up.
+ * @return     1 if present, 0 otherwise.
+ */
+int packstore_contains(const ObjectId *oid);
+
+/*
+ * Rescans .git/objects/pack/ and maps packs that appeared since the
+ * last scan. Called after a new pack is installed in this process.
+ */
+void packstore_reprepare(void);
+
+/*
+ * Unmaps every pack and forgets it; the next lookup scans the current
+ * repository afresh. For a process that switches repositories. No
+ * other thread may be reading objects.
+ */
+void packstore_reset(void);
+
+#endif /* PACKSTORE_H */
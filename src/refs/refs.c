@@ -0,0 +1,174 @@
+/*
+ * refs.c
+ *
+ * Loose refs hold "<sha>\n" or, when symbolic, "ref: <name>\n".
+ * packed-refs holds "<sha> <name>" lines, a "#" header and "^<sha>"
+ * lines with the peeled target of the annotated tag above them.
+ */
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../utils/file/file.h"
+#include "refs.h"
+
+#define GIT_PACKED_REFS_FILE GIT_ROOT_DIR "/packed-refs"
+
+/* Symbolic refs deeper than this are taken to be a loop */
+#define SYMREF_MAX_DEPTH 5
+
+static int resolve_ref(const char *name, ObjectId *oid_out, int depth);
+
+static char *read_if_exists(const char *path, long *size) {
+    if (access(path, F_OK) != 0) return NULL;
+    return read_file(path, size);
+}
+
+/* Reads a loose ref file; 1 if absent, malformed or a dangling symref. */
+static int read_loose(const char *path, ObjectId *oid_out, int depth) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 1;
+    long size;
+    char *content = read_file(path, &size);
+    if (content == NULL) return 1;
+
+    int result = 1;
+    if (size > 5 && strncmp(content, "ref: ", 5) == 0) {
+        content[strcspn(content, "\r\n")] = '\0';
+        result = resolve_ref(content + 5, oid_out, depth + 1);
+    } else if (size >= OID_HEX_SIZE) {
+        result = oid_from_hex(content, oid_out);
+    }
+    free(content);
+    return result;
+}
+
+/*
+ * Calls cb for each "<sha> <name>" line of packed-refs, with the
+ * name NUL-terminated in place. Returns 0, 1 if the file exists but
+ * cannot be read, or cb's non-zero value.
+ */
+static int for_each_packed(RefCallback cb, void *ctx) {
+    long size;
+    char *content = read_if_exists(GIT_PACKED_REFS_FILE, &size);
+    if (content == NULL) return access(GIT_PACKED_REFS_FILE, F_OK) == 0;
+
+    int result = 0;
+    for (char *line = content; result == 0 && line < content + size; ) {
+        char *eol = memchr(line, '\n', (size_t)(content + size - line));
+        if (eol == NULL) eol = content + size;
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r') eol[-1] = '\0';
+        ObjectId oid;
+        if (eol - line > OID_HEX_SIZE + 1 && line[0] != '#' && line[0] != '^' &&
+            line[OID_HEX_SIZE] == ' ' && oid_from_hex(line, &oid) == 0) {
+            result = cb(line + OID_HEX_SIZE + 1, &oid, ctx);
+        }
+        line = eol + 1;
+    }
+    free(content);
+    return result;
+}
+
+typedef struct {
+    const char *name;
+    ObjectId *oid;
+    int found;
+} PackedLookup;
+
+static int match_packed(const char *name, const ObjectId *oid, void *ctx) {
+    PackedLookup *lookup = ctx;
+    if (strcmp(name, lookup->name) != 0) return 0;
+    *lookup->oid = *oid;
+    lookup->found = 1;
+    return 1;
+}
+
+/* Resolves a full ref name ("HEAD", "refs/..."), loose before packed. */
+static int resolve_ref(const char *name, ObjectId *oid_out, int depth) {
+    if (depth > SYMREF_MAX_DEPTH || strstr(name, "..") != NULL) return 1;
+    char path[GIT_PATH_MAX];
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", GIT_ROOT_DIR, name) >= sizeof(path)) return 1;
+    if (read_loose(path, oid_out, depth) == 0) return 0;
+
+    PackedLookup lookup = { name, oid_out, 0 };
+    for_each_packed(match_packed, &lookup);
+    return !lookup.found;
+}
+
+static int for_each_loose(const char *dir, RefCallback cb, void *ctx) {
+    DIR *d = opendir(dir);
+    if (d == NULL) return 0;
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char path[GIT_PATH_MAX];
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= sizeof(path)) continue;
+        struct stat st;
+        if (stat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            result = for_each_loose(path, cb, ctx);
+            continue;
+        }
+
+        long size;
+        char *content = read_file(path, &size);
+        ObjectId oid;
+        if (content != NULL && size >= OID_HEX_SIZE && oid_from_hex(content, &oid) == 0) {
+            /* The name is the path below .git/ */
+            result = cb(path + strlen(GIT_ROOT_DIR) + 1, &oid, ctx);
+        }
+        free(content);
+    }
+    closedir(d);
+    return result;
+}
+
+int refs_for_each(RefCallback cb, void *ctx) {
+    int result = for_each_loose(GIT_REFS_DIR, cb, ctx);
+    return result != 0 ? result : for_each_packed(cb, ctx);
+}
+
+int refs_resolve(const char *name, ObjectId *oid_out) {
+    if (strlen(name) == OID_HEX_SIZE && oid_from_hex(name, oid_out) == 0) return 0;
+    if (name[0] == '\0') return 1;
+
+    static const char *const rules[] = {
+        "%s", "refs/%s", "refs/tags/%s", "refs/heads/%s", "refs/remotes/%s", "refs/remotes/%s/HEAD",
+    };
+    for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+        char full[GIT_PATH_MAX];
+        if ((size_t)snprintf(full, sizeof(full), rules[i], name) >= sizeof(full)) continue;
+        if (resolve_ref(full, oid_out, 0) == 0) return 0;
+    }
+    return 1;
+}
+
+int refs_read_shallow(ObjectId **out, size_t *count) {
+    *out = NULL;
+    *count = 0;
+    if (access(GIT_SHALLOW_FILE, F_OK) != 0) return 0;
+    long size;
+    char *content = read_file(GIT_SHALLOW_FILE, &size);
+    if (content == NULL) return 1;
+
+    size_t max = (size_t)size / (OID_HEX_SIZE + 1) + 1;
+    *out = malloc(max * sizeof(ObjectId));
+    if (*out == NULL) {
+        GIT_ERR("refs: malloc failed\n");
+        free(content);
+        return 1;
+    }
+    for (long pos = 0; pos + OID_HEX_SIZE <= size && *count < max; pos += OID_HEX_SIZE + 1) {
+        if (oid_from_hex(content + pos, &(*out)[*count]) == 0) (*count)++;
+    }
+    free(content);
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * refs.h
+ *
+ * Read access to refs: loose files under .git/refs/, the
+ * .git/packed-refs file git writes on clone and gc, and HEAD; and to
+ * .git/shallow, which cuts history the way refs start it.
+ */
+
+#ifndef REFS_H
+#define REFS_H
+
+#include <stddef.h>
+
+#include "../objects/object_id.h"
+
+/*
+ * Called once per ref.
+ *
+ * @param name  Full ref name, e.g. "refs/heads/main".
+ * @param oid   The object it points to (tags are not peeled).
+ * @param ctx   Caller's context.
+ * @return      0 to go on, non-zero to stop (returned by refs_for_each).
+ */
+typedef int (*RefCallback)(const char *name, const ObjectId *oid, void *ctx);
+
+/*
+ * Calls cb for every loose ref under .git/refs/ (recursively), then
+ * for every entry of .git/packed-refs. A ref that is both loose and
+ * packed is reported twice; symbolic refs and unreadable files are
+ * skipped.
+ *
+ * @param cb   Callback.
+ * @param ctx  Passed to cb.
+ * @return     0 on success, 1 if packed-refs is unreadable, or the
+ *             first non-zero value cb returned.
+ */
+int refs_for_each(RefCallback cb, void *ctx);
+
+/*
+ * Resolves a revision name the way git looks it up: 40 hex digits,
+ * "HEAD", then <name>, refs/<name>, refs/tags/<name>, refs/heads/<name>,
+ * refs/remotes/<name> and refs/remotes/<name>/HEAD — each loose first,
+ * then packed. Symbolic refs are followed.
+ *
+ * @param name     Revision name.
+ * @param oid_out  Output: the object named.
+ * @return         0 on success, 1 if nothing by that name exists.
+ */
+int refs_resolve(const char *name, ObjectId *oid_out);
+
+/*
+ * Reads .git/shallow, the boundary commits of a shallow clone: their
+ * parents are not in the object store.
+ *
+ * @param out    Output: heap array of commit IDs (caller must free),
+ *               NULL when the repository is not shallow.
+ * @param count  Output: number of IDs.
+ * @return       0 on success (shallow or not), 1 on failure.
+ */
+int refs_read_shallow(ObjectId **out, size_t *count);
+
+#endif /* REFS_H */
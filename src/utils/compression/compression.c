@@ -3,57 +3,193 @@
  *
  * Zlib compression/decompression wrappers with automatic buffer management.
  * Git objects are always zlib-compressed on disk.
+ *
+ * The backend is picked at build time (see zlib_backend.h). With
+ * libdeflate, the whole-buffer paths — exact-size inflate and
+ * compress_data() — use it; partial and streaming work stays on the
+ * zlib API, which libdeflate does not offer.
+ *
+ * Setting up a zlib stream allocates its window and tables, which
+ * costs more than inflating a small object. Each thread therefore
+ * keeps one inflate stream (reset, not rebuilt, per call) and the last
+ * freed CompressStream, which the next compress_stream_new() resets;
+ * with libdeflate, likewise one decompressor and one compressor.
  */
 
+#include <pthread.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <zlib.h>
+
+#ifdef GIT_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 #include "../../constants.h"
+#include "../thread/thread_exit.h"
+#include "../trace/trace.h"
+#include "compression.h"
+#include "zlib_backend.h"
 
-unsigned char *decompress_data(const unsigned char *compressed_data, const unsigned long compressed_data_size,
-                               unsigned long *decompressed_data_size) {
-    if (compressed_data == NULL || compressed_data_size == 0 || decompressed_data_size == NULL) {
-        return NULL;
-    }
+static int loose_level = Z_DEFAULT_COMPRESSION;
+static pthread_once_t loose_level_once = PTHREAD_ONCE_INIT;
 
-    /* Start with 8x the compressed size as an initial estimate.
-     * If the data was highly compressed (common for text), the buffer
-     * may be too small — uncompress returns Z_BUF_ERROR in that case.
-     * We retry with doubled buffer size up to a 256 MB cap to prevent
-     * OOM exhaustion from malformed or malicious compressed input. */
-    const uLongf max_size = 256UL * 1024 * 1024;
-    uLongf dest_size = compressed_data_size * 8;
-    if (dest_size / 8 != compressed_data_size || dest_size > max_size) {
-        dest_size = max_size;
+/* Reads GIT_COMPRESSION_LEVEL once; anything but -1..9 keeps the default. */
+static void load_loose_level(void) {
+    const char *value = getenv(COMPRESSION_LEVEL_ENV);
+    if (value == NULL || *value == '\0') return;
+    char *end;
+    long level = strtol(value, &end, 10);
+    if (*end != '\0' || level < -1 || level > 9) {
+        GIT_ERR("ignoring invalid %s=%s (expected -1..9)\n", COMPRESSION_LEVEL_ENV, value);
+        return;
     }
+    loose_level = (int)level;
+}
 
-    while (dest_size <= max_size) {
-        unsigned char *decompressed_data = malloc(dest_size);
-        if (decompressed_data == NULL) {
-            GIT_ERR("malloc failed\n");
-            return NULL;
-        }
+int compression_level(void) {
+    pthread_once(&loose_level_once, load_loose_level);
+    return loose_level;
+}
 
-        uLongf out_size = dest_size;
-        int result = uncompress(decompressed_data, &out_size, compressed_data, compressed_data_size);
-        if (result == Z_OK) {
-            *decompressed_data_size = out_size;
-            return decompressed_data;
-        }
+/* Per-thread reusable (de)compression state */
+static _Thread_local struct {
+    int inflate_ready;          /* inflater holds an initialized stream */
+    z_stream inflater;
+    CompressStream *spare;      /* a freed stream, kept for reuse */
+#ifdef GIT_USE_LIBDEFLATE
+    struct libdeflate_decompressor *decompressor;
+    struct libdeflate_compressor *compressor;
+    int compressor_level;       /* level compressor was allocated for */
+#endif
+} scratch;
 
-        free(decompressed_data);
+static void release_spare(void);
 
-        if (result != Z_BUF_ERROR) {
-            GIT_ERR("uncompress failed: %d\n", result);
-            return NULL;
+static void release_scratch(void) {
+    if (scratch.inflate_ready) inflateEnd(&scratch.inflater);
+    scratch.inflate_ready = 0;
+    release_spare();
+#ifdef GIT_USE_LIBDEFLATE
+    libdeflate_free_decompressor(scratch.decompressor);
+    scratch.decompressor = NULL;
+    libdeflate_free_compressor(scratch.compressor);
+    scratch.compressor = NULL;
+#endif
+}
+
+/* The calling thread's inflate stream, freshly reset; NULL on failure. */
+static z_stream *thread_inflater(void) {
+    if (scratch.inflate_ready) {
+        if (inflateReset(&scratch.inflater) == Z_OK) return &scratch.inflater;
+        inflateEnd(&scratch.inflater);
+        scratch.inflate_ready = 0;
+    }
+    scratch.inflater = (z_stream){0};
+    if (inflateInit(&scratch.inflater) != Z_OK) {
+        GIT_ERR("inflateInit failed\n");
+        return NULL;
+    }
+    scratch.inflate_ready = 1;
+    thread_at_exit(release_scratch);
+    return &scratch.inflater;
+}
+
+int decompress_into(const unsigned char *data, size_t avail_in,
+                    unsigned char *out, size_t expected_size, size_t *consumed) {
+#ifdef GIT_USE_LIBDEFLATE
+    /* Known output size: a single libdeflate call, no stream state */
+    if (scratch.decompressor == NULL) {
+        scratch.decompressor = libdeflate_alloc_decompressor();
+        if (scratch.decompressor == NULL) {
+            GIT_ERR("libdeflate_alloc_decompressor failed\n");
+            return 1;
         }
+        thread_at_exit(release_scratch);
+    }
+    size_t in_used = 0, produced = 0;
+    enum libdeflate_result res = libdeflate_zlib_decompress_ex(scratch.decompressor, data, avail_in,
+                                                               out, expected_size, &in_used, &produced);
+    if (consumed != NULL) *consumed = in_used;
+    if (res != LIBDEFLATE_SUCCESS || produced != expected_size) {
+        GIT_ERR("inflate failed (libdeflate=%d, got %zu of %zu bytes)\n",
+                (int)res, produced, expected_size);
+        return 1;
+    }
+    trace_count(TRACE_BYTES_INFLATED, produced);
+    return 0;
+#else
+    z_stream *strm = thread_inflater();
+    if (strm == NULL) return 1;
+
+    /* Checking for one byte beyond the expected size would need slack
+     * in the caller's buffer, so instead treat "output full but stream
+     * not finished" as the overrun signal. */
+    size_t in_left = avail_in, out_left = expected_size;
+    strm->next_in = (Bytef *)data;
+    strm->avail_in = 0;
+    strm->next_out = out;
+    strm->avail_out = 0;
+
+    int ret;
+    do {
+        zlib_refill_window(&strm->avail_in, &in_left);
+        zlib_refill_window(&strm->avail_out, &out_left);
+        ret = inflate(strm, in_left == 0 && out_left == 0 ? Z_FINISH : Z_NO_FLUSH);
+    } while ((ret == Z_OK || ret == Z_BUF_ERROR) &&
+             ((strm->avail_in == 0 && in_left > 0) || (strm->avail_out == 0 && out_left > 0)));
+    size_t produced = strm->total_out;
+    if (consumed != NULL) *consumed = strm->total_in;
 
-        dest_size *= 2;
+    if (ret != Z_STREAM_END || produced != expected_size) {
+        GIT_ERR("inflate failed (ret=%d, got %zu of %zu bytes)\n",
+                ret, produced, expected_size);
+        return 1;
     }
+    trace_count(TRACE_BYTES_INFLATED, produced);
+    return 0;
+#endif
+}
+
+size_t decompress_prefix(const unsigned char *data, size_t avail_in,
+                         unsigned char *out, size_t out_size) {
+    z_stream *strm = thread_inflater();
+    if (strm == NULL) return 0;
 
-    GIT_ERR("decompress_data: exceeded maximum output size (%lu bytes)\n", max_size);
-    return NULL;
+    size_t in_left = avail_in, out_left = out_size;
+    strm->next_in = (Bytef *)data;
+    strm->avail_in = 0;
+    strm->next_out = out;
+    strm->avail_out = 0;
+
+    /* Stops as soon as out is full; errors just leave less output */
+    int ret;
+    do {
+        zlib_refill_window(&strm->avail_in, &in_left);
+        zlib_refill_window(&strm->avail_out, &out_left);
+        ret = inflate(strm, Z_SYNC_FLUSH);
+    } while (ret == Z_OK &&
+             ((strm->avail_in == 0 && in_left > 0) || (strm->avail_out == 0 && out_left > 0)));
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) return 0;
+    trace_count(TRACE_BYTES_INFLATED, strm->total_out);
+    return strm->total_out;
+}
+
+unsigned char *decompress_exact(const unsigned char *data, size_t avail_in,
+                                size_t expected_size, size_t *consumed) {
+    unsigned char *out = malloc(expected_size > 0 ? expected_size : 1);
+    if (out == NULL) {
+        GIT_ERR("malloc failed for inflate (%zu bytes)\n", expected_size);
+        return NULL;
+    }
+    if (decompress_into(data, avail_in, out, expected_size, consumed) != 0) {
+        free(out);
+        return NULL;
+    }
+    return out;
 }
 
 unsigned char *compress_data(const unsigned char *file_data, unsigned long file_data_size,
@@ -61,7 +197,37 @@ unsigned char *compress_data(const unsigned char *file_data, unsigned long file_
     if (!file_data || file_data_size == 0 || !compressed_data_size) {
         return NULL;
     }
+    trace_count(TRACE_BYTES_DEFLATED, file_data_size);
 
+    int level = compression_level();
+#ifdef GIT_USE_LIBDEFLATE
+    /* libdeflate has no "default" level; 6 is zlib's default */
+    if (level < 0) level = 6;
+    if (scratch.compressor != NULL && scratch.compressor_level != level) {
+        libdeflate_free_compressor(scratch.compressor);
+        scratch.compressor = NULL;
+    }
+    if (scratch.compressor == NULL) {
+        scratch.compressor = libdeflate_alloc_compressor(level);
+        if (scratch.compressor == NULL) {
+            GIT_ERR("libdeflate_alloc_compressor failed\n");
+            return NULL;
+        }
+        scratch.compressor_level = level;
+        thread_at_exit(release_scratch);
+    }
+    size_t bound = libdeflate_zlib_compress_bound(scratch.compressor, file_data_size);
+    unsigned char *compressed_data = malloc(bound);
+    size_t written = compressed_data != NULL
+        ? libdeflate_zlib_compress(scratch.compressor, file_data, file_data_size, compressed_data, bound) : 0;
+    if (written == 0) {
+        GIT_ERR("compress failed\n");
+        free(compressed_data);
+        return NULL;
+    }
+    *compressed_data_size = written;
+    return compressed_data;
+#else
     uLongf max_compressed_data_size = compressBound(file_data_size);
     unsigned char *compressed_data = malloc(max_compressed_data_size);
     if (!compressed_data) {
@@ -69,7 +235,7 @@ unsigned char *compress_data(const unsigned char *file_data, unsigned long file_
         return NULL;
     }
 
-    int result = compress(compressed_data, &max_compressed_data_size, file_data, file_data_size);
+    int result = compress2(compressed_data, &max_compressed_data_size, file_data, file_data_size, level);
     if (result != Z_OK) {
         GIT_ERR("compress failed: %d\n", result);
         free(compressed_data);
@@ -79,4 +245,111 @@ unsigned char *compress_data(const unsigned char *file_data, unsigned long file_
     *compressed_data_size = max_compressed_data_size;
 
     return compressed_data;
+#endif
+}
+
+/* Output staging buffer for streaming deflate */
+#define DEFLATE_CHUNK (64 * 1024)
+
+struct CompressStream {
+    z_stream strm;
+    int fd;
+    unsigned char out[DEFLATE_CHUNK];
+};
+
+CompressStream *compress_stream_new(int fd) {
+    CompressStream *cs = scratch.spare;
+    if (cs != NULL) {
+        scratch.spare = NULL;
+        if (deflateReset(&cs->strm) == Z_OK) {
+            cs->fd = fd;
+            return cs;
+        }
+        deflateEnd(&cs->strm);
+        free(cs);
+    }
+
+    cs = calloc(1, sizeof(CompressStream));
+    if (cs == NULL) {
+        GIT_ERR("malloc failed\n");
+        return NULL;
+    }
+    if (deflateInit(&cs->strm, compression_level()) != Z_OK) {
+        GIT_ERR("deflateInit failed\n");
+        free(cs);
+        return NULL;
+    }
+    cs->fd = fd;
+    return cs;
+}
+
+/* Runs deflate over the pending input, writing out every full buffer. */
+static int deflate_pending(CompressStream *cs, int flush) {
+    int ret;
+    do {
+        cs->strm.next_out = cs->out;
+        cs->strm.avail_out = DEFLATE_CHUNK;
+        ret = deflate(&cs->strm, flush);
+        if (ret == Z_STREAM_ERROR) {
+            GIT_ERR("deflate failed: %d\n", ret);
+            return 1;
+        }
+
+        size_t have = DEFLATE_CHUNK - cs->strm.avail_out;
+        const unsigned char *p = cs->out;
+        while (have > 0) {
+            ssize_t n = write(cs->fd, p, have);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                GIT_ERR("write failed while compressing\n");
+                return 1;
+            }
+            p += n;
+            have -= (size_t)n;
+        }
+    } while (cs->strm.avail_out == 0);
+
+    if (flush == Z_FINISH && ret != Z_STREAM_END) {
+        GIT_ERR("deflate did not finish: %d\n", ret);
+        return 1;
+    }
+    return 0;
+}
+
+int compress_stream_write(CompressStream *cs, const unsigned char *data, size_t len) {
+    trace_count(TRACE_BYTES_DEFLATED, len);
+    while (len > 0) {
+        uInt take = len > UINT_MAX ? UINT_MAX : (uInt)len;
+        cs->strm.next_in = (unsigned char *)data;
+        cs->strm.avail_in = take;
+        if (deflate_pending(cs, Z_NO_FLUSH) != 0) return 1;
+        data += take;
+        len -= take;
+    }
+    return 0;
+}
+
+int compress_stream_finish(CompressStream *cs) {
+    cs->strm.next_in = NULL;
+    cs->strm.avail_in = 0;
+    return deflate_pending(cs, Z_FINISH);
+}
+
+void compress_stream_free(CompressStream *cs) {
+    if (cs == NULL) return;
+    /* Keep one stream per thread for the next compress_stream_new() */
+    if (scratch.spare == NULL) {
+        scratch.spare = cs;
+        thread_at_exit(release_scratch);
+        return;
+    }
+    deflateEnd(&cs->strm);
+    free(cs);
+}
+
+static void release_spare(void) {
+    if (scratch.spare == NULL) return;
+    deflateEnd(&scratch.spare->strm);
+    free(scratch.spare);
+    scratch.spare = NULL;
 }
@@ -9,22 +9,59 @@
 #ifndef COMPRESSION_H
 #define COMPRESSION_H
 
+#include <stddef.h>
+
+/* Environment variable overriding the loose object compression level */
+#define COMPRESSION_LEVEL_ENV "GIT_COMPRESSION_LEVEL"
+
 /*
- * Decompresses zlib-compressed data with automatic buffer sizing.
- * Uses a retry loop that doubles the output buffer on Z_BUF_ERROR,
- * so it handles any compression ratio without a known output size.
+ * zlib level (-1 = default, 0 = store, 1 = fastest .. 9 = smallest)
+ * used by compress_data() and compress_stream_new(), i.e. for loose
+ * objects. Read once from GIT_COMPRESSION_LEVEL; any level produces
+ * an ordinary zlib stream.
+ */
+int compression_level(void);
+
+/*
+ * Decompresses one zlib stream whose output size is known up front.
+ *
+ * The output buffer is allocated once at the exact size, and the
+ * input may continue past the end of the stream (e.g. the next object
+ * in a pack). The stream must inflate to exactly expected_size bytes.
  *
- * @param compressed_data      Input compressed bytes.
- * @param compressed_data_size Size of input in bytes.
- * @param decompressed_data_size Output: set to actual decompressed size.
+ * @param data           Start of the compressed stream.
+ * @param avail_in       Maximum bytes readable from data.
+ * @param expected_size  Exact decompressed size.
+ * @param consumed       Output: compressed bytes used (may be NULL).
  * @return Heap-allocated decompressed data (caller must free), or NULL.
  */
-unsigned char *decompress_data(const unsigned char *compressed_data,
-                               unsigned long compressed_data_size,
-                               unsigned long *decompressed_data_size);
+unsigned char *decompress_exact(const unsigned char *data, size_t avail_in,
+                                size_t expected_size, size_t *consumed);
+
+/*
+ * Like decompress_exact(), but inflates into a caller-provided buffer
+ * of exactly expected_size bytes.
+ *
+ * @return 0 on success, 1 on error or size mismatch.
+ */
+int decompress_into(const unsigned char *data, size_t avail_in,
+                    unsigned char *out, size_t expected_size, size_t *consumed);
+
+/*
+ * Inflates only the start of a zlib stream — at most out_size bytes —
+ * for peeking at headers without paying for the whole body.
+ *
+ * @param data      Start of the compressed stream.
+ * @param avail_in  Maximum bytes readable from data.
+ * @param out       Output buffer.
+ * @param out_size  Capacity of out.
+ * @return          Bytes written to out (0 if the stream is unreadable).
+ */
+size_t decompress_prefix(const unsigned char *data, size_t avail_in,
+                         unsigned char *out, size_t out_size);
 
 /*
- * Compresses data using zlib default compression level.
+ * Compresses data at compression_level().
  *
  * @param file_data           Input bytes to compress.
  * @param file_data_size      Size of input in bytes.
@@ -35,4 +72,34 @@ unsigned char *compress_data(const unsigned char *file_data,
                              unsigned long file_data_size,
                              unsigned long *compressed_data_size);
 
+/* Incremental deflate that writes its output to a file descriptor (opaque). */
+typedef struct CompressStream CompressStream;
+
+/*
+ * Starts a zlib stream at compression_level(). Output is written to fd
+ * as it is produced, so memory use is independent of the input size.
+ *
+ * @param fd  Open, writable file descriptor (not closed by the stream).
+ * @return    Heap-allocated stream (free with compress_stream_free), or NULL.
+ */
+CompressStream *compress_stream_new(int fd);
+
+/*
+ * Compresses the next slice of input.
+ * @return 0 on success, 1 on zlib or write failure.
+ */
+int compress_stream_write(CompressStream *cs, const unsigned char *data, size_t len);
+
+/*
+ * Flushes the end of the zlib stream to the file descriptor.
+ * @return 0 on success, 1 on zlib or write failure.
+ */
+int compress_stream_finish(CompressStream *cs);
+
+/*
+ * Releases the stream. Accepts NULL. The calling thread keeps the
+ * last one freed, so the next compress_stream_new() skips zlib setup.
+ */
+void compress_stream_free(CompressStream *cs);
+
 #endif /* COMPRESSION_H */
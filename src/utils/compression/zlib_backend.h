@@ -0,0 +1,66 @@
+/*
+ * zlib_backend.h
+ *
+ * The zlib-compatible API used for streaming (de)compression, chosen
+ * at build time by GIT_COMPRESSION_BACKEND in CMakeLists.txt:
+ *
+ *   zlib        stock zlib (default)
+ *   zlib-ng     zlib-ng's native API, mapped onto the zlib names below
+ *               (GIT_USE_ZLIB_NG)
+ *   libdeflate  stock zlib for streams; whole-buffer calls in
+ *               compression.c go through libdeflate (GIT_USE_LIBDEFLATE)
+ *
+ * Every backend reads and writes ordinary zlib streams, so objects
+ * and packs stay interchangeable with git. Include this instead of
+ * <zlib.h>.
+ */
+
+#ifndef ZLIB_BACKEND_H
+#define ZLIB_BACKEND_H
+
+#ifdef GIT_USE_ZLIB_NG
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib-ng.h>
+
+/* zlib-ng's native API differs only in names and integer widths */
+typedef zng_stream z_stream;
+typedef uint32_t uInt;
+typedef uint8_t Bytef;
+typedef size_t uLongf;
+
+#define inflateInit(strm)                   zng_inflateInit(strm)
+#define inflate(strm, flush)                zng_inflate((strm), (flush))
+#define inflateEnd(strm)                    zng_inflateEnd(strm)
+#define inflateReset(strm)                  zng_inflateReset(strm)
+#define deflateInit(strm, level)            zng_deflateInit((strm), (level))
+#define deflate(strm, flush)                zng_deflate((strm), (flush))
+#define deflateEnd(strm)                    zng_deflateEnd(strm)
+#define deflateReset(strm)                  zng_deflateReset(strm)
+#define compressBound(len)                  zng_compressBound(len)
+#define compress2(dst, dst_len, src, len, level) \
+    zng_compress2((dst), (dst_len), (src), (len), (level))
+#define uncompress(dst, dst_len, src, len)  zng_uncompress((dst), (dst_len), (src), (len))
+#define crc32(crc, buf, len)                zng_crc32((crc), (buf), (len))
+
+#else
+
+#include <stddef.h>
+#include <zlib.h>
+
+#endif /* GIT_USE_ZLIB_NG */
+
+/*
+ * Refills a stream's avail_in or avail_out once it has run dry, from
+ * the *left bytes that follow it: avail_* is a uInt, so buffers of
+ * 4 GiB and more are fed in windows. The windows are contiguous, so
+ * next_in / next_out need no adjustment.
+ */
+static inline void zlib_refill_window(uInt *avail, size_t *left) {
+    if (*avail != 0 || *left == 0) return;
+    *avail = *left > (uInt)-1 ? (uInt)-1 : (uInt)*left;
+    *left -= *avail;
+}
+
+#endif /* ZLIB_BACKEND_H */
@@ -0,0 +1,93 @@
+/*
+ * config.c
+ *
+ * Minimal .git/config reader: "[section]" and "[section \"sub\"]"
+ * headers, "key = value" lines, '#' and ';' comments.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../../constants.h"
+#include "config.h"
+
+/* Strips leading and trailing whitespace in place. */
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) s[--len] = '\0';
+    return s;
+}
+
+/* Turns a header line into "section" or "section.sub" (section lowercased). */
+static int parse_header(char *line, char *out, size_t out_size) {
+    char *end = strchr(line, ']');
+    if (end == NULL) return 1;
+    *end = '\0';
+    char *name = line + 1;
+    char *sub = strchr(name, '"');
+    if (sub != NULL) {
+        *sub++ = '\0';
+        char *sub_end = strchr(sub, '"');
+        if (sub_end == NULL) return 1;
+        *sub_end = '\0';
+    }
+    name = trim(name);
+    for (char *p = name; *p != '\0'; p++) *p = (char)tolower((unsigned char)*p);
+    int len = sub != NULL ? snprintf(out, out_size, "%s.%s", name, sub)
+                          : snprintf(out, out_size, "%s", name);
+    return len < 0 || (size_t)len >= out_size;
+}
+
+int config_get(const char *key, char *value, size_t value_size) {
+    /* Split "section[.sub].name" at the last dot */
+    const char *dot = strrchr(key, '.');
+    if (dot == NULL) return 1;
+    size_t section_len = (size_t)(dot - key);
+    const char *name = dot + 1;
+
+    FILE *f = fopen(GIT_CONFIG_FILE, "r");
+    if (f == NULL) return 1;
+
+    char line[FILE_BUFFER_SIZE];
+    char section[FILE_BUFFER_SIZE] = "";
+    int found = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *p = trim(line);
+        if (*p == '\0' || *p == '#' || *p == ';') continue;
+        if (*p == '[') {
+            if (parse_header(p, section, sizeof(section)) != 0) section[0] = '\0';
+            continue;
+        }
+        /* Section names compare case-insensitively, subsections exactly */
+        const char *sub_dot = memchr(key, '.', section_len);
+        size_t base_len = sub_dot != NULL ? (size_t)(sub_dot - key) : section_len;
+        if (strlen(section) != section_len || strncasecmp(section, key, base_len) != 0 ||
+            memcmp(section + base_len, key + base_len, section_len - base_len) != 0) {
+            continue;
+        }
+
+        char *eq = strchr(p, '=');
+        if (eq != NULL) *eq = '\0';
+        if (strcasecmp(trim(p), name) != 0) continue;
+        /* A bare key is boolean true */
+        const char *v = eq != NULL ? trim(eq + 1) : "true";
+        if (strlen(v) >= value_size) {
+            found = 0;
+            break;
+        }
+        strcpy(value, v);
+        found = 1;
+    }
+    fclose(f);
+    return found ? 0 : 1;
+}
+
+int config_get_bool(const char *key) {
+    char value[16];
+    if (config_get(key, value, sizeof(value)) != 0) return 0;
+    return strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0 ||
+           strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0;
+}
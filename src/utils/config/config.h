@@ -0,0 +1,37 @@
+/*
+ * config.h
+ *
+ * Read-only access to .git/config, for the few settings this
+ * implementation keeps there (the promisor remote of a partial clone).
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+/*
+ * Looks up a setting by its dotted name, e.g. "remote.origin.url"
+ * for
+ *     [remote "origin"]
+ *         url = https://example.com/repo
+ *
+ * Section and key names match case-insensitively, subsections
+ * exactly. Values are taken verbatim after trimming; quoting and
+ * escapes are not interpreted. The last occurrence wins, as in git.
+ *
+ * @param key         Dotted setting name.
+ * @param value       Output buffer for the value.
+ * @param value_size  Size of value.
+ * @return            0 if found, 1 if absent, unreadable or too long.
+ */
+int config_get(const char *key, char *value, size_t value_size);
+
+/*
+ * Looks up a boolean setting ("true"/"yes"/"on"/"1", or a bare key).
+ *
+ * @return  1 if set to true, 0 if false or absent.
+ */
+int config_get_bool(const char *key);
+
+#endif /* CONFIG_H */
@@ -4,24 +4,31 @@
  * File I/O utilities for reading, writing, and git object path resolution.
  */
 
+#include <unistd.h>
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../../constants.h"
+#include "file.h"
 
-int object_path(const char *sha_hex, char *abs_dir, size_t dir_size,
+int object_path(const ObjectId *oid, char *abs_dir, size_t dir_size,
                 char *abs_file, size_t file_size) {
-    if (sha_hex == NULL || abs_file == NULL) return 1;
-    if (strlen(sha_hex) != 40) {
-        GIT_ERR("Invalid SHA-1 length: expected 40, got %zu\n", strlen(sha_hex));
+    if (oid == NULL || abs_file == NULL) return 1;
+
+    char sha_hex[OID_HEX_SIZE + 1];
+    oid_to_hex(oid, sha_hex);
+
+    if (abs_dir != NULL &&
+        (size_t)snprintf(abs_dir, dir_size, "%s/%.2s", GIT_OBJECTS_DIR, sha_hex) >= dir_size) {
         return 1;
     }
-
-    if (abs_dir != NULL) {
-        snprintf(abs_dir, dir_size, "%s/%.2s", GIT_OBJECTS_DIR, sha_hex);
+    if ((size_t)snprintf(abs_file, file_size, "%s/%.2s/%s",
+                         GIT_OBJECTS_DIR, sha_hex, sha_hex + 2) >= file_size) {
+        return 1;
     }
-    snprintf(abs_file, file_size, "%s/%.2s/%s", GIT_OBJECTS_DIR, sha_hex, sha_hex + 2);
 
     return 0;
 }
@@ -75,23 +82,6 @@ char *read_file(const char *file_absolute_path, long *file_size) {
     return file_content;
 }
 
-char *read_git_blob_file(const char *sha1_string, long *compressed_size) {
-    char abs_file[GIT_PATH_MAX];
-    if (object_path(sha1_string, NULL, 0, abs_file, sizeof(abs_file)) != 0) {
-        return NULL;
-    }
-
-    long file_size = 0;
-    char *file_content = read_file(abs_file, &file_size);
-    if (file_content == NULL) {
-        GIT_ERR("Error reading file %s\n", abs_file);
-        return NULL;
-    }
-
-    *compressed_size = file_size;
-    return file_content;
-}
-
 int write_file(const char *file_absolute_path, const char *data, size_t byte_count, const char *mode) {
     FILE *target_file = fopen(file_absolute_path, mode);
     if (target_file == NULL) {
@@ -113,3 +103,17 @@ int write_file(const char *file_absolute_path, const char *data, size_t byte_cou
 
     return 0;
 }
+
+int write_all(int fd, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
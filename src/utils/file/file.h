@@ -11,24 +11,26 @@
 
 #include <stddef.h>
 
+#include "../../objects/object_id.h"
+
 /*
- * Resolves a SHA-1 hex hash to absolute object store paths.
+ * Resolves an object ID to absolute object store paths.
  *
- * Converts e.g. "abcdef..." into:
+ * Converts e.g. the ID spelled "abcdef..." into:
  *   abs_dir  = ".git/objects/ab"
  *   abs_file = ".git/objects/ab/cdef..."
  *
  * Zero heap allocations — caller provides stack buffers.
  * abs_dir may be NULL if the caller only needs the file path.
  *
- * @param sha_hex   40-character hex hash string.
+ * @param oid       Object to locate.
  * @param abs_dir   Output buffer for directory path, or NULL.
  * @param dir_size  Size of abs_dir buffer.
  * @param abs_file  Output buffer for full file path.
  * @param file_size Size of abs_file buffer.
- * @return          0 on success, 1 on invalid SHA.
+ * @return          0 on success, 1 if a buffer is too small.
  */
-int object_path(const char *sha_hex, char *abs_dir, size_t dir_size,
+int object_path(const ObjectId *oid, char *abs_dir, size_t dir_size,
                 char *abs_file, size_t file_size);
 
 /*
@@ -42,6 +44,16 @@ int object_path(const char *sha_hex, char *abs_dir, size_t dir_size,
  */
 int write_file(const char *path, const char *data, size_t byte_count, const char *mode);
 
+/*
+ * Writes all bytes to fd, retrying on short writes and EINTR.
+ *
+ * @param fd    Open file descriptor.
+ * @param data  Buffer to write.
+ * @param len   Number of bytes to write.
+ * @return      0 on success, 1 on failure (errno is set).
+ */
+int write_all(int fd, const void *data, size_t len);
+
 /*
  * Reads an entire file into a heap-allocated buffer.
  *
@@ -52,14 +64,4 @@ int write_file(const char *path, const char *data, size_t byte_count, const char
  */
 char *read_file(const char *path, long *file_size);
 
-/*
- * Reads a compressed git blob object by its SHA-1 hash.
- * Resolves the hash to .git/objects/<xx>/<rest> and reads the raw bytes.
- *
- * @param sha1_hex        40-character hex hash string.
- * @param compressed_size Output: set to the size of the compressed data.
- * @return                Heap-allocated compressed data (caller must free), or NULL.
- */
-char *read_git_blob_file(const char *sha1_hex, long *compressed_size);
-
 #endif /* GIT_FILE_H */
@@ -0,0 +1,113 @@
+/*
+ * hash.c
+ *
+ * HashCtx over OpenSSL's EVP digests. Each algorithm's EVP_MD is
+ * fetched once: with OpenSSL 3, passing EVP_sha1() to every init
+ * repeats a provider lookup that costs about as much as hashing a
+ * small object.
+ */
+
+#include <pthread.h>
+
+#include <stdlib.h>
+#include <openssl/evp.h>
+
+#include "../../constants.h"
+#include "../thread/thread_exit.h"
+#include "hash.h"
+
+struct HashCtx {
+    EVP_MD_CTX *md;
+    const EVP_MD *type;
+};
+
+typedef struct {
+    const char *name;       /* OpenSSL digest name */
+    size_t raw_size;
+} HashAlgoInfo;
+
+static const HashAlgoInfo algos[HASH_ALGO_COUNT] = {
+    [HASH_SHA1] = { "SHA1", 20 },
+};
+
+static const EVP_MD *digests[HASH_ALGO_COUNT];
+static pthread_once_t digests_once = PTHREAD_ONCE_INIT;
+
+static void fetch_digests(void) {
+    for (int i = 0; i < HASH_ALGO_COUNT; i++) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        digests[i] = EVP_MD_fetch(NULL, algos[i].name, NULL);
+#else
+        digests[i] = EVP_get_digestbyname(algos[i].name);
+#endif
+    }
+}
+
+static const EVP_MD *digest_of(HashAlgo algo) {
+    pthread_once(&digests_once, fetch_digests);
+    return digests[algo];
+}
+
+size_t hash_raw_size(HashAlgo algo) {
+    return algos[algo].raw_size;
+}
+
+HashCtx *hash_ctx_new(HashAlgo algo) {
+    HashCtx *ctx = malloc(sizeof(HashCtx));
+    if (ctx == NULL) {
+        GIT_ERR("hash: malloc failed\n");
+        return NULL;
+    }
+    ctx->type = digest_of(algo);
+    ctx->md = EVP_MD_CTX_new();
+    if (ctx->type == NULL || ctx->md == NULL || hash_ctx_reset(ctx) != 0) {
+        GIT_ERR("hash: cannot initialize %s\n", algos[algo].name);
+        hash_ctx_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+int hash_ctx_reset(HashCtx *ctx) {
+    return EVP_DigestInit_ex(ctx->md, ctx->type, NULL) == 1 ? 0 : 1;
+}
+
+void hash_update(HashCtx *ctx, const void *data, size_t len) {
+    EVP_DigestUpdate(ctx->md, data, len);
+}
+
+void hash_final(HashCtx *ctx, unsigned char *out) {
+    EVP_DigestFinal_ex(ctx->md, out, NULL);
+}
+
+void hash_ctx_free(HashCtx *ctx) {
+    if (ctx == NULL) return;
+    EVP_MD_CTX_free(ctx->md);
+    free(ctx);
+}
+
+/* Per-thread contexts for hash_parts(), one per algorithm */
+static _Thread_local HashCtx *scratch[HASH_ALGO_COUNT];
+
+static void release_scratch(void) {
+    for (int i = 0; i < HASH_ALGO_COUNT; i++) {
+        hash_ctx_free(scratch[i]);
+        scratch[i] = NULL;
+    }
+}
+
+int hash_parts(HashAlgo algo, const HashPart *parts, size_t count, unsigned char *out) {
+    HashCtx *ctx = scratch[algo];
+    if (ctx == NULL) {
+        ctx = hash_ctx_new(algo);
+        if (ctx == NULL) return 1;
+        scratch[algo] = ctx;
+        thread_at_exit(release_scratch);
+    } else if (hash_ctx_reset(ctx) != 0) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) hash_update(ctx, parts[i].data, parts[i].len);
+    hash_final(ctx, out);
+    return 0;
+}
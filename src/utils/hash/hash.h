@@ -0,0 +1,88 @@
+/*
+ * hash.h
+ *
+ * Incremental hashing behind one small interface, so object naming
+ * does not depend on a particular library call or algorithm.
+ *
+ * OpenSSL does the work and picks the fastest implementation for the
+ * running CPU (SHA-NI on x86-64, the ARMv8 crypto extensions on
+ * aarch64, plain C elsewhere). The algorithm descriptor is fetched
+ * once per process rather than on every init.
+ *
+ * Only SHA-1 objects exist today; a SHA-256 object format would add
+ * a HashAlgo value and a row in hash.c.
+ */
+
+#ifndef GIT_HASH_H
+#define GIT_HASH_H
+
+#include <stddef.h>
+
+typedef enum {
+    HASH_SHA1,
+    HASH_ALGO_COUNT
+} HashAlgo;
+
+/* Largest digest any HashAlgo produces */
+#define HASH_MAX_RAW_SIZE 32
+
+/* Running hash state (opaque); reusable across messages. */
+typedef struct HashCtx HashCtx;
+
+/* One contiguous piece of a message hashed with hash_parts(). */
+typedef struct {
+    const void *data;
+    size_t len;
+} HashPart;
+
+/*
+ * Digest length of an algorithm in bytes.
+ */
+size_t hash_raw_size(HashAlgo algo);
+
+/*
+ * Creates a context, ready for hash_update().
+ *
+ * @param algo  Algorithm to compute.
+ * @return      Heap-allocated context (release with hash_ctx_free()),
+ *              or NULL on failure.
+ */
+HashCtx *hash_ctx_new(HashAlgo algo);
+
+/*
+ * Starts a new message on an existing context, keeping its allocation.
+ * Needed after hash_final() before the context is used again.
+ *
+ * @return  0 on success, 1 on failure.
+ */
+int hash_ctx_reset(HashCtx *ctx);
+
+/* Feeds len bytes of data into the running hash. */
+void hash_update(HashCtx *ctx, const void *data, size_t len);
+
+/*
+ * Finishes the message and writes its digest.
+ *
+ * @param out  Output buffer of hash_raw_size() bytes.
+ */
+void hash_final(HashCtx *ctx, unsigned char *out);
+
+/* Frees a context. Safe to call with NULL. */
+void hash_ctx_free(HashCtx *ctx);
+
+/*
+ * Hashes a message given as several pieces, as if they had been
+ * concatenated — e.g. an object header and its body.
+ *
+ * Uses a context kept per thread, so repeated calls (one per object
+ * while a pack is indexed) allocate nothing.
+ *
+ * @param algo   Algorithm to compute.
+ * @param parts  Pieces of the message, in order.
+ * @param count  Number of pieces.
+ * @param out    Output buffer of hash_raw_size() bytes.
+ * @return       0 on success, 1 on failure.
+ */
+int hash_parts(HashAlgo algo, const HashPart *parts, size_t count, unsigned char *out);
+
+#endif /* GIT_HASH_H */
@@ -0,0 +1,48 @@
+/*
+ * scratch.c
+ *
+ * Grows geometrically, so a run of slowly growing sizes costs a
+ * logarithmic number of allocations.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../constants.h"
+#include "scratch.h"
+
+unsigned char *scratch_reserve(ScratchBuf *buf, size_t size) {
+    if (size == 0) size = 1;
+    if (size <= buf->capacity) return buf->data;
+
+    size_t capacity = buf->capacity < 4096 ? 4096 : buf->capacity;
+    while (capacity < size) capacity = capacity > SIZE_MAX / 2 ? size : capacity * 2;
+    /* No realloc: the old contents are not wanted, so do not copy them */
+    free(buf->data);
+    buf->data = malloc(capacity);
+    if (buf->data == NULL) {
+        GIT_ERR("scratch: malloc failed (%zu bytes)\n", capacity);
+        buf->capacity = 0;
+        return NULL;
+    }
+    buf->capacity = capacity;
+    return buf->data;
+}
+
+unsigned char *scratch_detach(ScratchBuf *buf) {
+    unsigned char *data = buf->data;
+    buf->data = NULL;
+    buf->capacity = 0;
+    return data;
+}
+
+void scratch_trim(ScratchBuf *buf, size_t keep) {
+    if (buf->capacity > keep) scratch_free(buf);
+}
+
+void scratch_free(ScratchBuf *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->capacity = 0;
+}
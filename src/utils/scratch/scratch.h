@@ -0,0 +1,46 @@
+/*
+ * scratch.h
+ *
+ * Growable scratch buffers for hot loops that need a differently
+ * sized buffer per item (an inflated object, a delta result): the
+ * buffer grows to the largest size seen and is then reused, so the
+ * allocator is only visited when an item is bigger than any before.
+ */
+
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stddef.h>
+
+/* Zero-initialize; release with scratch_free(). */
+typedef struct {
+    unsigned char *data;
+    size_t capacity;
+} ScratchBuf;
+
+/*
+ * Makes room for size bytes (at least one). Contents are not kept
+ * when the buffer grows.
+ *
+ * @param buf   Scratch buffer.
+ * @param size  Bytes needed.
+ * @return      buf->data, or NULL on allocation failure.
+ */
+unsigned char *scratch_reserve(ScratchBuf *buf, size_t size);
+
+/*
+ * Hands the buffer's memory to the caller (who frees it), leaving
+ * the scratch buffer empty — for when a result must outlive it.
+ */
+unsigned char *scratch_detach(ScratchBuf *buf);
+
+/*
+ * Frees the memory if it has grown past keep bytes, so one huge item
+ * does not pin its buffer for the rest of the run.
+ */
+void scratch_trim(ScratchBuf *buf, size_t keep);
+
+/* Frees the memory. Accepts an empty buffer. */
+void scratch_free(ScratchBuf *buf);
+
+#endif /* SCRATCH_H */
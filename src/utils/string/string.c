@@ -4,58 +4,35 @@
  * Hex conversion utilities for SHA-1 hashes.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include "string.h"
 
-#include "../../constants.h"
+static const char hex_digits[16] = "0123456789abcdef";
 
-char *hex_to_string(const unsigned char *buffer, size_t buffer_size) {
-    if (buffer == NULL || buffer_size == 0) return NULL;
-
-    char *str = malloc(buffer_size * 2 + 1);
-    if (str == NULL) {
-        GIT_ERR("Failed to allocate memory for hex string\n");
-        return NULL;
-    }
+/* Digit value + 1, so the zero-filled rest of the table marks non-hex */
+static const unsigned char hex_values[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+    ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
 
+void hex_encode(const unsigned char *buffer, size_t buffer_size, char *out) {
     for (size_t i = 0; i < buffer_size; i++) {
-        snprintf(str + (i * 2), 3, "%02x", buffer[i]);
+        *out++ = hex_digits[buffer[i] >> 4];
+        *out++ = hex_digits[buffer[i] & 0x0f];
     }
-
-    str[buffer_size * 2] = '\0';
-    return str;
+    *out = '\0';
 }
 
-unsigned char *hex_string_to_bytes(const char *hex_str, size_t *out_len) {
-    if (hex_str == NULL || out_len == NULL) return NULL;
-
-    size_t hex_len = strlen(hex_str);
-
-    /* Odd-length hex strings would silently lose the last nibble */
-    if (hex_len % 2 != 0) {
-        GIT_ERR("Odd-length hex string (%zu chars)\n", hex_len);
-        return NULL;
+int hex_decode(const char *hex_str, size_t byte_count, unsigned char *out) {
+    const unsigned char *in = (const unsigned char *)hex_str;
+    for (size_t i = 0; i < byte_count; i++) {
+        unsigned int hi = hex_values[in[2 * i]];
+        /* A NUL in the high digit is caught here, before reading past it */
+        if (hi == 0) return 1;
+        unsigned int lo = hex_values[in[2 * i + 1]];
+        if (lo == 0) return 1;
+        out[i] = (unsigned char)(((hi - 1) << 4) | (lo - 1));
     }
-
-    size_t byte_len = hex_len / 2;
-    unsigned char *bytes = malloc(byte_len);
-    if (bytes == NULL) {
-        GIT_ERR("Failed to allocate memory for hex-to-bytes conversion\n");
-        return NULL;
-    }
-
-    /* Parse two hex characters at a time into one byte.
-     * sscanf with %2hhx reads exactly 2 hex digits into an unsigned char.
-     * Check return value to catch non-hex characters. */
-    for (size_t i = 0; i < byte_len; i++) {
-        if (sscanf(hex_str + (i * 2), "%2hhx", &bytes[i]) != 1) {
-            GIT_ERR("Invalid hex character at position %zu\n", i * 2);
-            free(bytes);
-            return NULL;
-        }
-    }
-
-    *out_len = byte_len;
-    return bytes;
+    return 0;
 }
@@ -2,6 +2,8 @@
  * string.h
  *
  * Hex conversion utilities for SHA-1 hashes.
+ * Both directions are table lookups into caller-provided buffers —
+ * no formatting calls and no heap allocations.
  */
 
 #ifndef GIT_STRING_H
@@ -10,25 +12,28 @@
 #include <stddef.h>
 
 /*
- * Converts a binary byte buffer to a hex string.
+ * Converts a binary byte buffer to lowercase hex.
  *
  * @param buffer      Raw bytes (e.g., SHA-1 digest).
  * @param buffer_size Number of bytes in buffer.
- * @return            Heap-allocated hex string of length buffer_size*2 + 1
- *                    (caller must free), or NULL on allocation failure.
+ * @param out         Output buffer of at least buffer_size*2 + 1 bytes;
+ *                    receives the hex digits and a terminating NUL.
  */
-char *hex_to_string(const unsigned char *buffer, size_t buffer_size);
+void hex_encode(const unsigned char *buffer, size_t buffer_size, char *out);
 
 /*
- * Converts a hex string to raw binary bytes (inverse of hex_to_string).
+ * Converts hex to raw binary bytes (inverse of hex_encode).
  *
  * Tree entries store SHA-1 as 20 raw bytes, not 40-char hex.
- * This function converts e.g. "a3f2" → {0xa3, 0xf2}.
+ * This function converts e.g. "a3f2" → {0xa3, 0xf2}. Exactly
+ * byte_count*2 characters are read; the input need not be
+ * NUL-terminated. Upper- and lowercase digits are accepted.
  *
- * @param hex_str    Hex string (must have even length).
- * @param out_len    Output: set to number of bytes written.
- * @return           Heap-allocated byte buffer (caller must free), or NULL.
+ * @param hex_str     Hex characters to convert.
+ * @param byte_count  Number of bytes to produce.
+ * @param out         Output buffer of at least byte_count bytes.
+ * @return            0 on success, 1 on a non-hex character.
  */
-unsigned char *hex_string_to_bytes(const char *hex_str, size_t *out_len);
+int hex_decode(const char *hex_str, size_t byte_count, unsigned char *out);
 
 #endif /* GIT_STRING_H */
@@ -0,0 +1,41 @@
+/*
+ * thread_exit.c
+ *
+ * One pthread key serves every module: its destructor, armed by any
+ * non-NULL value, runs the thread's hooks, newest first.
+ */
+
+#include <pthread.h>
+
+#include <stddef.h>
+
+#include "thread_exit.h"
+
+static _Thread_local struct {
+    ThreadExitHook hooks[THREAD_EXIT_MAX];
+    int count;
+} registered;
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static void run_hooks(void *unused) {
+    (void)unused;
+    while (registered.count > 0) registered.hooks[--registered.count]();
+}
+
+static void create_exit_key(void) {
+    pthread_key_create(&exit_key, run_hooks);
+}
+
+void thread_at_exit(ThreadExitHook hook) {
+    for (int i = 0; i < registered.count; i++) {
+        if (registered.hooks[i] == hook) return;
+    }
+    if (registered.count == THREAD_EXIT_MAX) return;
+    if (registered.count == 0) {
+        pthread_once(&exit_key_once, create_exit_key);
+        pthread_setspecific(exit_key, &registered);
+    }
+    registered.hooks[registered.count++] = hook;
+}
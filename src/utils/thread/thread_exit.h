@@ -0,0 +1,28 @@
+/*
+ * thread_exit.h
+ *
+ * Cleanup of per-thread state: modules that keep _Thread_local caches
+ * (hash contexts, zlib streams, scratch buffers) register a hook that
+ * frees them when the thread exits, so pool workers do not leak them.
+ */
+
+#ifndef THREAD_EXIT_H
+#define THREAD_EXIT_H
+
+/* Hooks one thread can hold: one per module with thread-local state */
+#define THREAD_EXIT_MAX 8
+
+/* Frees the calling module's state for the exiting thread. */
+typedef void (*ThreadExitHook)(void);
+
+/*
+ * Runs hook when the calling thread exits (through pthread_exit() or by
+ * returning from its start routine — not at process exit). The hook
+ * runs on the exiting thread, whose thread-local state is still live.
+ * Registering the same hook again on a thread is a no-op; if the
+ * thread already has THREAD_EXIT_MAX hooks, the state is not freed.
+ *
+ * @param hook  Cleanup function.
+ */
+void thread_at_exit(ThreadExitHook hook);
+#endif /* THREAD_EXIT_H */
@@ -0,0 +1,156 @@
+/*
+ * thread_pool.c
+ *
+ * Workers sleep on a condition variable until a task is queued or the
+ * pool shuts down. `pending` counts queued plus running tasks so that
+ * thread_pool_wait() can block on a second condition variable until
+ * the pool drains.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+
+#include "../../constants.h"
+#include "thread_pool.h"
+
+typedef struct TaskNode {
+    ThreadTask fn;
+    void *arg;
+    struct TaskNode *next;
+} TaskNode;
+
+struct ThreadPool {
+    int size;
+    pthread_t *workers;             /* NULL for an inline pool */
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;      /* signalled on submit / shutdown */
+    pthread_cond_t drained;         /* signalled when pending hits 0 */
+    TaskNode *head, *tail;
+    size_t pending;
+    int stopping;
+};
+
+int thread_pool_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void *worker_main(void *arg) {
+    ThreadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->head == NULL && !pool->stopping) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->head == NULL) break; /* stopping and drained */
+
+        TaskNode *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_broadcast(&pool->drained);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool *thread_pool_new(int threads) {
+    if (threads <= 0) threads = thread_pool_default_threads();
+
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        GIT_ERR("thread_pool: malloc failed\n");
+        return NULL;
+    }
+    pool->size = threads;
+    if (threads == 1) return pool;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->drained, NULL);
+
+    pool->workers = malloc((size_t)threads * sizeof(pthread_t));
+    if (pool->workers == NULL) {
+        GIT_ERR("thread_pool: malloc failed\n");
+        goto fail;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            GIT_ERR("thread_pool: failed to start worker %d\n", i);
+            pool->size = i; /* join only the ones that started */
+            thread_pool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+
+fail:
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->drained);
+    free(pool);
+    return NULL;
+}
+
+int thread_pool_size(const ThreadPool *pool) {
+    return pool->size;
+}
+
+int thread_pool_submit(ThreadPool *pool, ThreadTask fn, void *arg) {
+    if (pool->workers == NULL) {
+        fn(arg);
+        return 0;
+    }
+
+    TaskNode *task = malloc(sizeof(TaskNode));
+    if (task == NULL) {
+        GIT_ERR("thread_pool: malloc failed for task\n");
+        return 1;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) pool->tail->next = task;
+    else pool->head = task;
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void thread_pool_wait(ThreadPool *pool) {
+    if (pool->workers == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) pthread_cond_wait(&pool->drained, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_free(ThreadPool *pool) {
+    if (pool == NULL) return;
+
+    if (pool->workers != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = 1;
+        pthread_cond_broadcast(&pool->work_ready);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->size; i++) pthread_join(pool->workers[i], NULL);
+        free(pool->workers);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work_ready);
+        pthread_cond_destroy(&pool->drained);
+    }
+    free(pool);
+}
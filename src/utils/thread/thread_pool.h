@@ -0,0 +1,58 @@
+/*
+ * thread_pool.h
+ *
+ * Fixed-size pthread worker pool with a FIFO task queue.
+ *
+ * Tasks are plain function + argument pairs; results travel through
+ * the argument. A pool of one thread runs every task inline on the
+ * caller's thread at submit time, so single-threaded runs take exactly
+ * the serial code path.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+typedef struct ThreadPool ThreadPool;
+
+typedef void (*ThreadTask)(void *arg);
+
+/*
+ * Number of online CPUs, used when the caller asks for 0 threads.
+ *
+ * @return  At least 1.
+ */
+int thread_pool_default_threads(void);
+
+/*
+ * Starts a pool.
+ *
+ * @param threads  Worker count; 0 means thread_pool_default_threads().
+ * @return         Heap-allocated pool (release with thread_pool_free()),
+ *                 or NULL on failure.
+ */
+ThreadPool *thread_pool_new(int threads);
+
+/*
+ * Number of workers the pool runs (1 for an inline pool).
+ */
+int thread_pool_size(const ThreadPool *pool);
+
+/*
+ * Queues fn(arg) for execution on some worker.
+ *
+ * @return  0 on success, 1 on allocation failure (fn was not run).
+ */
+int thread_pool_submit(ThreadPool *pool, ThreadTask fn, void *arg);
+
+/*
+ * Blocks until every task submitted so far has finished.
+ */
+void thread_pool_wait(ThreadPool *pool);
+
+/*
+ * Waits for outstanding tasks, stops the workers and frees the pool.
+ * Accepts NULL.
+ */
+void thread_pool_free(ThreadPool *pool);
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,169 @@
+/*
+ * trace.c
+ *
+ * The trace file is opened once, on the first call from any thread;
+ * counters are process-wide atomics (relaxed — they are only read at
+ * exit). Syscall counts come from /proc/self/io where it exists.
+ */
+
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../constants.h"
+#include "trace.h"
+
+/* Longest line emitted */
+#define TRACE_LINE_MAX 2048
+
+static struct {
+    int fd;                 /* trace file, or -1 when tracing is off */
+    uint64_t base_ns;       /* clock at startup; trace_now() counts from it */
+    long pid;
+} trace = { -1, 0, 0 };
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static _Atomic uint64_t counters[TRACE_COUNTER_COUNT];
+static atomic_uint next_thread = 1;
+static _Thread_local unsigned thread_id;
+
+/* How each counter is reported; _NS counters are reported in µs */
+static const struct {
+    const char *name;
+    uint64_t divisor;
+} counter_info[TRACE_COUNTER_COUNT] = {
+    [TRACE_BYTES_RECEIVED]  = { "bytes_received", 1 },
+    [TRACE_BYTES_INFLATED]  = { "bytes_inflated", 1 },
+    [TRACE_BYTES_DEFLATED]  = { "bytes_deflated", 1 },
+    [TRACE_OBJECTS_WRITTEN] = { "objects_written", 1 },
+    [TRACE_DELTA_DEPTH_MAX] = { "delta_depth_max", 1 },
+    [TRACE_CACHE_HITS]      = { "cache_hits", 1 },
+    [TRACE_CACHE_MISSES]    = { "cache_misses", 1 },
+    [TRACE_SIDEBAND_NS]     = { "sideband_us", 1000 },
+    [TRACE_PACK_PARSE_NS]   = { "pack_parse_us", 1000 },
+};
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void open_trace(void) {
+    const char *path = getenv(TRACE_PERF_ENV);
+    if (path == NULL || path[0] == '\0' || strcmp(path, "0") == 0) return;
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        GIT_ERR("trace: cannot open %s: %s\n", path, strerror(errno));
+        return;
+    }
+    trace.base_ns = clock_ns();
+    trace.pid = (long)getpid();
+    trace.fd = fd;
+}
+
+int trace_enabled(void) {
+    pthread_once(&trace_once, open_trace);
+    return trace.fd >= 0;
+}
+
+uint64_t trace_now(void) {
+    if (!trace_enabled()) return 0;
+    /* 0 means "not timed", so the very first instant reads as 1 */
+    uint64_t t = clock_ns() - trace.base_ns;
+    return t > 0 ? t : 1;
+}
+
+/* Appends one line with a single write(), so lines never interleave. */
+static void emit(const char *line, int len) {
+    if (len <= 0) return;
+    if (len >= TRACE_LINE_MAX) len = TRACE_LINE_MAX - 1;
+    while (write(trace.fd, line, (size_t)len) < 0 && errno == EINTR) {}
+}
+
+static unsigned current_thread(void) {
+    if (thread_id == 0) thread_id = atomic_fetch_add(&next_thread, 1);
+    return thread_id;
+}
+
+void trace_span(const char *name, uint64_t start) {
+    if (start == 0 || !trace_enabled()) return;
+    uint64_t end = trace_now();
+    char line[TRACE_LINE_MAX];
+    int len = snprintf(line, sizeof(line),
+                       "{\"event\":\"span\",\"name\":\"%s\",\"pid\":%ld,\"thread\":%u,"
+                       "\"start_us\":%llu,\"dur_us\":%llu}\n",
+                       name, trace.pid, current_thread(),
+                       (unsigned long long)(start / 1000), (unsigned long long)((end - start) / 1000));
+    emit(line, len);
+}
+
+void trace_count(TraceCounter counter, uint64_t n) {
+    if (!trace_enabled()) return;
+    atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+void trace_count_max(TraceCounter counter, uint64_t value) {
+    if (!trace_enabled()) return;
+    uint64_t seen = atomic_load_explicit(&counters[counter], memory_order_relaxed);
+    while (seen < value && !atomic_compare_exchange_weak_explicit(&counters[counter], &seen, value,
+                                                                  memory_order_relaxed,
+                                                                  memory_order_relaxed)) {}
+}
+
+void trace_count_since(TraceCounter counter, uint64_t start) {
+    if (start == 0) return;
+    trace_count(counter, trace_now() - start);
+}
+
+/* Reads "syscr" and "syscw" (read and write syscalls) from /proc/self/io. */
+static int read_syscalls(unsigned long long *reads, unsigned long long *writes) {
+    FILE *f = fopen("/proc/self/io", "r");
+    if (f == NULL) return 1;
+    char key[64];
+    unsigned long long value;
+    int found = 0;
+    while (fscanf(f, "%63[^:]: %llu\n", key, &value) == 2) {
+        if (strcmp(key, "syscr") == 0) { *reads = value; found |= 1; }
+        if (strcmp(key, "syscw") == 0) { *writes = value; found |= 2; }
+    }
+    fclose(f);
+    return found == 3 ? 0 : 1;
+}
+
+void trace_finish(const char *command, int status) {
+    if (!trace_enabled()) return;
+    char line[TRACE_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "{\"event\":\"counters\",\"command\":\"%s\",\"pid\":%ld,"
+                       "\"status\":%d,\"dur_us\":%llu",
+                       command, trace.pid, status, (unsigned long long)(trace_now() / 1000));
+    for (int i = 0; i < TRACE_COUNTER_COUNT && len < (int)sizeof(line); i++) {
+        uint64_t value = atomic_load_explicit(&counters[i], memory_order_relaxed);
+        len += snprintf(line + len, sizeof(line) - (size_t)len, ",\"%s\":%llu",
+                        counter_info[i].name, (unsigned long long)(value / counter_info[i].divisor));
+    }
+
+    struct rusage usage;
+    if (len < (int)sizeof(line) && getrusage(RUSAGE_SELF, &usage) == 0) {
+        len += snprintf(line + len, sizeof(line) - (size_t)len,
+                        ",\"user_us\":%lld,\"sys_us\":%lld,\"max_rss_kb\":%ld",
+                        (long long)usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec,
+                        (long long)usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec,
+                        usage.ru_maxrss);
+    }
+    unsigned long long reads = 0, writes = 0;
+    if (len < (int)sizeof(line) && read_syscalls(&reads, &writes) == 0) {
+        len += snprintf(line + len, sizeof(line) - (size_t)len,
+                        ",\"syscalls_read\":%llu,\"syscalls_write\":%llu", reads, writes);
+    }
+    if (len < (int)sizeof(line)) len += snprintf(line + len, sizeof(line) - (size_t)len, "}\n");
+    emit(line, len);
+}
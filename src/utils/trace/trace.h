@@ -0,0 +1,76 @@
+/*
+ * trace.h
+ *
+ * Opt-in performance tracing. With GIT_TRACE_PERF set to a file name,
+ * timed spans and, at exit, the process's counters are appended to
+ * that file as JSON lines:
+ *
+ *   {"event":"span","name":"clone.fetch","pid":1,"thread":1,"start_us":5,"dur_us":92}
+ *   {"event":"counters","command":"clone","status":0,"bytes_received":...}
+ *
+ * Each line is one write() to an O_APPEND file, so lines from threads
+ * and from nested processes never interleave. When tracing is off
+ * every call returns at once, and trace_now() returns 0 so that code
+ * timing itself does no clock calls either.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Environment variable naming the trace file */
+#define TRACE_PERF_ENV "GIT_TRACE_PERF"
+
+/* Process-wide counters, reported by trace_finish(). */
+typedef enum {
+    TRACE_BYTES_RECEIVED,    /* HTTP response bytes */
+    TRACE_BYTES_INFLATED,    /* zlib output */
+    TRACE_BYTES_DEFLATED,    /* zlib input */
+    TRACE_OBJECTS_WRITTEN,   /* loose objects plus objects of new packs */
+    TRACE_DELTA_DEPTH_MAX,   /* longest delta chain resolved or written */
+    TRACE_CACHE_HITS,        /* delta base cache */
+    TRACE_CACHE_MISSES,
+    TRACE_SIDEBAND_NS,       /* demultiplexing side-band frames (not the pack parse) */
+    TRACE_PACK_PARSE_NS,     /* parsing pack bytes as they arrive */
+    TRACE_COUNTER_COUNT
+} TraceCounter;
+
+/* @return  1 if GIT_TRACE_PERF names a trace file that could be opened. */
+int trace_enabled(void);
+
+/*
+ * Reads the monotonic clock for timing a span or a counter.
+ *
+ * @return  Nanoseconds since tracing started, or 0 when tracing is off.
+ */
+uint64_t trace_now(void);
+
+/*
+ * Emits a span from start (a trace_now() value) until now. Does
+ * nothing for start 0 or when tracing is off.
+ *
+ * @param name   Span name, e.g. "clone.checkout" (not escaped: no quotes).
+ * @param start  trace_now() when the span began.
+ */
+void trace_span(const char *name, uint64_t start);
+
+/* Adds n to a counter. */
+void trace_count(TraceCounter counter, uint64_t n);
+
+/* Raises a counter to value if it is lower (for maxima). */
+void trace_count_max(TraceCounter counter, uint64_t value);
+
+/* Adds the time since start (a trace_now() value) to a _NS counter. */
+void trace_count_since(TraceCounter counter, uint64_t start);
+
+/*
+ * Emits the counters, resource usage and syscall counts as one
+ * "counters" line. Called once, as the command returns.
+ *
+ * @param command  Command name.
+ * @param status   Its exit status.
+ */
+void trace_finish(const char *command, int status);
+
+#endif /* TRACE_H */